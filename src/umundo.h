@@ -22,12 +22,14 @@
 #define CORE_H_BPUC93BU
 
 #include "umundo/Common.h"
+#include "umundo/BufferPool.h"
 #include "umundo/Debug.h"
 #include "umundo/EndPoint.h"
 #include "umundo/Factory.h"
 #include "umundo/Host.h"
 #include "umundo/Implementation.h"
 #include "umundo/Message.h"
+#include "umundo/Statistics.h"
 #include "umundo/UUID.h"
 #include "umundo/portability.h"
 #include "umundo/ResultSet.h"
@@ -36,5 +38,6 @@
 #include "umundo/connection/Subscriber.h"
 #include "umundo/discovery/Discovery.h"
 #include "umundo/thread/Thread.h"
+#include "umundo/thread/SPSCQueue.h"
 
 #endif /* end of include guard: CORE_H_BPUC93BU */
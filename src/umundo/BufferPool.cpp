@@ -0,0 +1,397 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/BufferPool.h"
+#include "umundo/thread/Thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WITHOUT_CXX11
+#include <atomic>
+#endif
+
+#define UMUNDO_BUFFER_HEADER_SIZE 16 // keeps the buffers as aligned as malloc's
+#define UMUNDO_BUFFER_THREAD_CACHE 16 // buffers per size class cached by every thread
+#define UMUNDO_BUFFER_THREAD_CACHE_MAX (64 * 1024) // larger buffers only go to the depot
+#define UMUNDO_BUFFER_DEPOT 256 // buffers per size class in the shared depot
+#define UMUNDO_BUFFER_DEPOT_BYTES (4 * 1024 * 1024) // but no more bytes per size class
+
+namespace umundo {
+
+/// precedes every buffer we hand out
+struct BufferHeader {
+	size_t sizeClass; ///< UMUNDO_BUFFER_POOL_CLASSES for buffers we do not pool
+	size_t capacity;
+};
+
+/// free buffers are chained through their first bytes
+struct FreeList {
+	char* head;
+	size_t count;
+
+	void push(char* buffer) {
+		*(char**)buffer = head;
+		head = buffer;
+		count++;
+	}
+	char* pop() {
+		char* buffer = head;
+		if (buffer != NULL) {
+			head = *(char**)buffer;
+			count--;
+		}
+		return buffer;
+	}
+};
+
+struct Depot {
+	Depot() {
+		memset(lists, 0, sizeof(lists));
+	}
+	tthread::mutex mutex;
+	FreeList lists[UMUNDO_BUFFER_POOL_CLASSES];
+};
+
+static Depot& depot() {
+	// never destroyed, threads may still release buffers while we exit
+	static Depot* depot = new Depot();
+	return *depot;
+}
+
+/**
+ * Counters of one thread.
+ *
+ * Only their thread writes them, without atomic read-modify-write or locks,
+ * getStats sums them all up. Buffers in use may wrap around in a thread that
+ * releases more than it allocates, the sum over all threads is still right.
+ */
+struct ThreadStats {
+	ThreadStats();
+	~ThreadStats();
+
+#ifndef WITHOUT_CXX11
+	typedef std::atomic<size_t> Counter;
+	static inline void add(Counter& counter, size_t value) {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+	static inline size_t get(const Counter& counter) {
+		return counter.load(std::memory_order_relaxed);
+	}
+#else
+	typedef size_t Counter;
+	static inline void add(Counter& counter, size_t value) {
+		counter += value;
+	}
+	static inline size_t get(const Counter& counter) {
+		return counter;
+	}
+#endif
+
+	Counter allocs;
+	Counter hits;
+	Counter buffersInUse;
+	Counter bytesInUse;
+	ThreadStats* next;
+};
+
+/// every thread's counters and those of threads gone
+struct StatsRegistry {
+	StatsRegistry() : threads(NULL), allocs(0), hits(0), buffersInUse(0), bytesInUse(0), highWaterBuffers(0), highWaterBytes(0) {}
+	tthread::mutex mutex;
+	ThreadStats* threads;
+	size_t allocs;
+	size_t hits;
+	size_t buffersInUse;
+	size_t bytesInUse;
+	size_t highWaterBuffers;
+	size_t highWaterBytes;
+};
+
+static StatsRegistry& statsRegistry() {
+	// never destroyed, as with the depot
+	static StatsRegistry* registry = new StatsRegistry();
+	return *registry;
+}
+
+ThreadStats::ThreadStats() : allocs(0), hits(0), buffersInUse(0), bytesInUse(0) {
+	StatsRegistry& r = statsRegistry();
+	ScopeLock lock(r.mutex);
+	next = r.threads;
+	r.threads = this;
+}
+
+ThreadStats::~ThreadStats() {
+	StatsRegistry& r = statsRegistry();
+	ScopeLock lock(r.mutex);
+	r.allocs += get(allocs);
+	r.hits += get(hits);
+	r.buffersInUse += get(buffersInUse);
+	r.bytesInUse += get(bytesInUse);
+	ThreadStats** curr = &r.threads;
+	while (*curr != this)
+		curr = &(*curr)->next;
+	*curr = next;
+}
+
+#ifndef WITHOUT_CXX11
+static thread_local ThreadStats threadStats;
+
+static inline ThreadStats& stats() {
+	return threadStats;
+}
+#else
+// without thread locals, all threads share one set of counters behind a mutex
+static tthread::mutex statsMutex;
+
+static inline ThreadStats& stats() {
+	static ThreadStats* shared = new ThreadStats();
+	return *shared;
+}
+#endif
+
+static size_t nrBytesCached; ///< depot has to be locked
+
+static inline BufferHeader* headerOf(const char* buffer) {
+	return (BufferHeader*)(buffer - UMUNDO_BUFFER_HEADER_SIZE);
+}
+
+static inline size_t classCapacity(size_t sizeClass) {
+	return (size_t)1 << (UMUNDO_BUFFER_POOL_MIN_SHIFT + sizeClass);
+}
+
+static inline size_t sizeClassFor(size_t size) {
+	size_t sizeClass = 0;
+	while (sizeClass < UMUNDO_BUFFER_POOL_CLASSES && classCapacity(sizeClass) < size)
+		sizeClass++;
+	return sizeClass;
+}
+
+static inline size_t depotLimit(size_t sizeClass) {
+	size_t limit = UMUNDO_BUFFER_DEPOT_BYTES / classCapacity(sizeClass);
+	return (limit > UMUNDO_BUFFER_DEPOT ? UMUNDO_BUFFER_DEPOT : (limit < 2 ? 2 : limit));
+}
+
+static void freeBuffer(char* buffer) {
+	free(buffer - UMUNDO_BUFFER_HEADER_SIZE);
+}
+
+/// depot has to be locked
+static void depotPush(Depot& depot, size_t sizeClass, char* buffer) {
+	if (depot.lists[sizeClass].count >= depotLimit(sizeClass)) {
+		freeBuffer(buffer);
+		return;
+	}
+	depot.lists[sizeClass].push(buffer);
+	nrBytesCached += classCapacity(sizeClass);
+}
+
+/// depot has to be locked
+static char* depotPop(Depot& depot, size_t sizeClass) {
+	char* buffer = depot.lists[sizeClass].pop();
+	if (buffer != NULL)
+		nrBytesCached -= classCapacity(sizeClass);
+	return buffer;
+}
+
+#ifndef WITHOUT_CXX11
+struct ThreadCache {
+	ThreadCache() {
+		memset(lists, 0, sizeof(lists));
+	}
+	~ThreadCache() {
+		Depot& d = depot();
+		ScopeLock lock(d.mutex);
+		for (size_t i = 0; i < UMUNDO_BUFFER_POOL_CLASSES; i++) {
+			char* buffer;
+			while((buffer = lists[i].pop()) != NULL)
+				depotPush(d, i, buffer);
+		}
+	}
+	FreeList lists[UMUNDO_BUFFER_POOL_CLASSES];
+};
+
+static thread_local ThreadCache threadCache;
+
+static inline bool isThreadCached(size_t sizeClass) {
+	return classCapacity(sizeClass) <= UMUNDO_BUFFER_THREAD_CACHE_MAX;
+}
+#endif
+
+static char* popCached(size_t sizeClass) {
+#ifndef WITHOUT_CXX11
+	if (isThreadCached(sizeClass)) {
+		FreeList& list = threadCache.lists[sizeClass];
+		if (list.count == 0) {
+			// refill half the thread cache in one go
+			Depot& d = depot();
+			ScopeLock lock(d.mutex);
+			char* buffer;
+			while(list.count < UMUNDO_BUFFER_THREAD_CACHE / 2 && (buffer = depotPop(d, sizeClass)) != NULL)
+				list.push(buffer);
+		}
+		return list.pop();
+	}
+#endif
+	Depot& d = depot();
+	ScopeLock lock(d.mutex);
+	return depotPop(d, sizeClass);
+}
+
+static void pushCached(size_t sizeClass, char* buffer) {
+#ifndef WITHOUT_CXX11
+	if (isThreadCached(sizeClass)) {
+		FreeList& list = threadCache.lists[sizeClass];
+		if (list.count >= UMUNDO_BUFFER_THREAD_CACHE) {
+			// spill half the thread cache in one go
+			Depot& d = depot();
+			ScopeLock lock(d.mutex);
+			while(list.count > UMUNDO_BUFFER_THREAD_CACHE / 2)
+				depotPush(d, sizeClass, list.pop());
+		}
+		list.push(buffer);
+		return;
+	}
+#endif
+	Depot& d = depot();
+	ScopeLock lock(d.mutex);
+	depotPush(d, sizeClass, buffer);
+}
+
+char* BufferPool::alloc(size_t size) {
+	size_t sizeClass = sizeClassFor(size);
+	size_t capacity = (sizeClass < UMUNDO_BUFFER_POOL_CLASSES ? classCapacity(sizeClass) : size);
+
+	char* buffer = NULL;
+	if (sizeClass < UMUNDO_BUFFER_POOL_CLASSES)
+		buffer = popCached(sizeClass);
+
+#ifdef WITHOUT_CXX11
+	ScopeLock lock(statsMutex);
+#endif
+	ThreadStats& counters = stats();
+	if (buffer != NULL) {
+		ThreadStats::add(counters.hits, 1);
+	} else {
+		char* raw = (char*)malloc(UMUNDO_BUFFER_HEADER_SIZE + capacity);
+		if (raw == NULL)
+			return NULL;
+		BufferHeader* header = (BufferHeader*)raw;
+		header->sizeClass = sizeClass;
+		header->capacity = capacity;
+		buffer = raw + UMUNDO_BUFFER_HEADER_SIZE;
+	}
+
+	ThreadStats::add(counters.allocs, 1);
+	ThreadStats::add(counters.buffersInUse, 1);
+	ThreadStats::add(counters.bytesInUse, capacity);
+	return buffer;
+}
+
+char* BufferPool::resize(char* buffer, size_t size) {
+	if (buffer == NULL)
+		return alloc(size);
+	if (capacity(buffer) >= size)
+		return buffer;
+
+	char* resized = alloc(size);
+	if (resized == NULL)
+		return NULL;
+	memcpy(resized, buffer, capacity(buffer));
+	release(buffer);
+	return resized;
+}
+
+void BufferPool::release(char* buffer) {
+	if (buffer == NULL)
+		return;
+
+	BufferHeader* header = headerOf(buffer);
+	{
+#ifdef WITHOUT_CXX11
+		ScopeLock lock(statsMutex);
+#endif
+		ThreadStats& counters = stats();
+		ThreadStats::add(counters.buffersInUse, (size_t)-1);
+		ThreadStats::add(counters.bytesInUse, (size_t)0 - header->capacity);
+	}
+
+	if (header->sizeClass >= UMUNDO_BUFFER_POOL_CLASSES) {
+		freeBuffer(buffer);
+		return;
+	}
+	pushCached(header->sizeClass, buffer);
+}
+
+size_t BufferPool::capacity(const char* buffer) {
+	return headerOf(buffer)->capacity;
+}
+
+void BufferPool::releaseCallback(void* data, void* hint) {
+	release((char*)(hint != NULL ? hint : data));
+}
+
+BufferPool::Stats BufferPool::getStats() {
+	Stats stats;
+	{
+		Depot& d = depot();
+		ScopeLock lock(d.mutex);
+		stats.bytesCached = nrBytesCached;
+	}
+
+#ifdef WITHOUT_CXX11
+	ScopeLock statsLock(statsMutex);
+#endif
+	StatsRegistry& r = statsRegistry();
+	ScopeLock lock(r.mutex);
+	stats.allocs = r.allocs;
+	stats.hits = r.hits;
+	stats.buffersInUse = r.buffersInUse;
+	stats.bytesInUse = r.bytesInUse;
+	for (ThreadStats* thread = r.threads; thread != NULL; thread = thread->next) {
+		stats.allocs += ThreadStats::get(thread->allocs);
+		stats.hits += ThreadStats::get(thread->hits);
+		stats.buffersInUse += ThreadStats::get(thread->buffersInUse);
+		stats.bytesInUse += ThreadStats::get(thread->bytesInUse);
+	}
+
+	// threads counting while we sum may leave us off for a moment, never below zero
+	if (stats.buffersInUse > stats.allocs)
+		stats.buffersInUse = stats.bytesInUse = 0;
+
+	if (stats.buffersInUse > r.highWaterBuffers)
+		r.highWaterBuffers = stats.buffersInUse;
+	if (stats.bytesInUse > r.highWaterBytes)
+		r.highWaterBytes = stats.bytesInUse;
+	stats.highWaterBuffers = r.highWaterBuffers;
+	stats.highWaterBytes = r.highWaterBytes;
+	return stats;
+}
+
+void BufferPool::trim() {
+	Depot& d = depot();
+	ScopeLock lock(d.mutex);
+	for (size_t i = 0; i < UMUNDO_BUFFER_POOL_CLASSES; i++) {
+		char* buffer;
+		while((buffer = depotPop(d, i)) != NULL)
+			freeBuffer(buffer);
+	}
+}
+
+}
@@ -0,0 +1,79 @@
+/**
+ *  @file
+ *  @brief      Size-classed pool for message payloads and wire buffers.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef BUFFERPOOL_H_R4WQ2D7K
+#define BUFFERPOOL_H_R4WQ2D7K
+
+#include "umundo/Common.h"
+
+#define UMUNDO_BUFFER_POOL_MIN_SHIFT 6 // smallest size class is 64 bytes
+#define UMUNDO_BUFFER_POOL_CLASSES 15 // powers of two up to 1MB, larger buffers are not pooled
+
+namespace umundo {
+
+/**
+ * Recycles buffers by power of two size classes.
+ *
+ * Every thread keeps a few buffers per size class and exchanges them with a
+ * shared depot, so buffers allocated in one thread and released in another,
+ * as with 0MQ's I/O threads, still find their way back.
+ */
+class UMUNDO_API BufferPool {
+public:
+	struct Stats {
+		size_t allocs; ///< buffers handed out
+		size_t hits; ///< buffers handed out from a cache
+		size_t buffersInUse;
+		size_t bytesInUse;
+		size_t highWaterBuffers; ///< most buffers in use whenever stats were taken
+		size_t highWaterBytes; ///< most bytes in use whenever stats were taken
+		size_t bytesCached; ///< bytes in the shared depot
+
+		double hitRate() const {
+			return (allocs > 0 ? (double)hits / (double)allocs : 0);
+		}
+	};
+
+	static char* alloc(size_t size);
+	/// grow a buffer from alloc, keeping its contents as realloc would
+	static char* resize(char* buffer, size_t size);
+	static void release(char* buffer);
+	/// usable size of a buffer from alloc, at least the size requested
+	static size_t capacity(const char* buffer);
+
+	/// release callback as with 0MQ and Message::setData, releases the hint if given
+	static void releaseCallback(void* data, void* hint);
+
+	static Stats getStats();
+	/// return the buffers in the shared depot to the system
+	static void trim();
+
+	/// deleter to keep pooled buffers in a SharedPtr
+	class Deleter {
+	public:
+		void operator()(char* p) {
+			BufferPool::release(p);
+		}
+	};
+};
+
+}
+
+#endif /* end of include guard: BUFFERPOOL_H_R4WQ2D7K */
@@ -41,6 +41,7 @@
 #if (defined DISC_AVAHI || defined DISC_BONJOUR)
 #include "umundo/discovery/MDNSDiscovery.h"
 #endif
+#include "umundo/discovery/StaticDiscovery.h"
 
 #ifdef NET_RTP
 #include "umundo/connection/rtp/RTPPublisher.h"
@@ -97,6 +98,7 @@ Factory::Factory() {
 #ifdef DISC_BROADCAST
 	_prototypes["discovery.broadcast"] = new BroadcastDiscovery();
 #endif
+	_prototypes["discovery.static"] = new StaticDiscovery();
 #ifdef NET_RTP
 	_prototypes["pub.rtp"] = new RTPPublisher();
 	_prototypes["sub.rtp"] = new RTPSubscriber();
@@ -18,6 +18,7 @@
  */
 
 #include "umundo/Message.h"
+#include "umundo/UUID.h"
 #include "umundo/config.h"
 
 #ifdef BUILD_WITH_COMPRESSION_MINIZ
@@ -28,6 +29,11 @@
 #endif
 #if defined(BUILD_WITH_COMPRESSION_LZ4)
 #include "lz4.h"
+#include "lz4hc.h"
+#endif
+#if defined(BUILD_WITH_COMPRESSION_ZSTD)
+#include <zstd.h>
+#include <zstd_errors.h>
 #endif
 
 #if 0
@@ -204,8 +210,12 @@ const char* Message::read(const char* from, std::string& value, size_t maxLength
 	return from + readSize + 1; // we consumed \0
 }
 
-char* Message::writeHeaders(char* to, size_t size) {
-    std::map<std::string, std::string>::const_iterator metaIter;
+char* Message::writeHeaders(char* to, size_t size, uint8_t version) {
+    parseRawHeaders();
+    if (version == UM_MSG_VERSION_02)
+        return writeCompactHeaders(to, size, _meta);
+
+    MetaFields::const_iterator metaIter;
     for (metaIter = _meta.begin(); metaIter != _meta.end(); metaIter++) {
         if (metaIter->first.size() == 0) // we do not accept empty keys!
             continue;
@@ -226,7 +236,13 @@ char* Message::writeHeaders(char* to, size_t size) {
     return to;
 }
 
-const char* Message::readHeaders(const char* from, size_t size) {
+const char* Message::readHeaders(const char* from, size_t size, uint8_t version) {
+    if (version == UM_MSG_VERSION_02) {
+        parseRawHeaders();
+        _isMetaMapValid = false;
+        return readCompactHeaders(from, size, _meta);
+    }
+
     const char* readPtr = from;
     while(readPtr - from < size) {
         std::string key;
@@ -238,6 +254,38 @@ const char* Message::readHeaders(const char* from, size_t size) {
     return readPtr;
 }
 
+void Message::setRawHeaders(const char* data, size_t length, uint8_t version, void(*release)(void *data, void *hint), void* hint) {
+    // we only keep a single set of raw headers
+    parseRawHeaders();
+
+    if (release != NULL) {
+        _rawHeaderOwner = SharedPtr<char>(const_cast<char*>(data), Message::ReleaseDeleter(release, hint));
+    } else {
+        _rawHeaderOwner = _data;
+    }
+    _rawHeaders = data;
+    _rawHeaderSize = length;
+    _rawHeaderVersion = version;
+}
+
+/**
+ * Compression codecs by their name and the type in the header flags of
+ * compressed messages. The contexts are opaque to the message.
+ */
+struct CompressionCodec {
+    const char* name;
+    uint8_t type;
+    void* (*create)();
+    void (*destroy)(void* ctx);
+    void (*reset)(void* ctx);
+    size_t (*bounds)(size_t size);
+    /// returns the compressed size or 0 on failure
+    int (*compress)(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize, int level);
+    /// returns the uncompressed size, 0 if the buffer was too small or < 0 for broken input
+    int (*uncompress)(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize);
+};
+
+#if defined(BUILD_WITH_COMPRESSION_LZ4)
 struct comprCtxLZ4 {
     LZ4_stream_t* comprHeadStream;
     LZ4_streamDecode_t* deComprHeadStream;
@@ -247,49 +295,405 @@ struct comprCtxLZ4 {
     size_t dataDictSize;
     char* headDict;
     size_t headDictSize;
+    size_t decompressPasses; ///< calls into LZ4 when uncompressing, for tests
+    LZ4_streamHC_t* comprHeadStreamHC; ///< only with lz4hc
+    LZ4_streamHC_t* comprDataStreamHC;
 };
 
+static void* createLZ4() {
+    struct comprCtxLZ4* c = (struct comprCtxLZ4*)malloc(sizeof(comprCtxLZ4));
     
-size_t Message::compress(const std::string& name, void* ctx, char* data, size_t size, Compression type, int level) {
-    // TODO: fall back to standard compression for NULL ctx
+    c->comprDataStream = LZ4_createStream();
+    c->comprHeadStream = LZ4_createStream();
+    c->deComprDataStream = LZ4_createStreamDecode();
+    c->deComprHeadStream = LZ4_createStreamDecode();
+    
+    c->dataDictSize = 0;
+    c->dataDict = (char*)malloc((1 << 16));
+    memset(c->dataDict, 0, (1 << 16));
+    
+    c->headDictSize = 0;
+    c->headDict = (char*)malloc((1 << 16));
+    memset(c->headDict, 0, (1 << 16));
+
+    c->decompressPasses = 0;
+
+    c->comprHeadStreamHC = NULL;
+    c->comprDataStreamHC = NULL;
+
+    return c;
+}
+
+static void* createLZ4HC() {
+    struct comprCtxLZ4* c = (struct comprCtxLZ4*)createLZ4();
+    c->comprHeadStreamHC = LZ4_createStreamHC();
+    c->comprDataStreamHC = LZ4_createStreamHC();
+    return c;
+}
+
+static void resetLZ4(void* ctx) {
+    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
+
+    LZ4_resetStream(c->comprDataStream);
+    LZ4_resetStream(c->comprHeadStream);
+    memset(c->deComprDataStream, 0, sizeof(LZ4_streamDecode_t));
+    memset(c->deComprHeadStream, 0, sizeof(LZ4_streamDecode_t));
+
+    memset(c->dataDict, 0, c->dataDictSize);
+    memset(c->headDict, 0, c->headDictSize);
+    c->dataDictSize = 0;
+    c->headDictSize = 0;
+}
+
+static void freeLZ4(void* ctx) {
+    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
+
+    // make sure all lingering data is reset
+    resetLZ4(ctx);
+    
+    LZ4_freeStream(c->comprDataStream);
+    LZ4_freeStream(c->comprHeadStream);
+    LZ4_freeStreamDecode(c->deComprDataStream);
+    LZ4_freeStreamDecode(c->deComprHeadStream);
+    if (c->comprDataStreamHC != NULL)
+        LZ4_freeStreamHC(c->comprDataStreamHC);
+    if (c->comprHeadStreamHC != NULL)
+        LZ4_freeStreamHC(c->comprHeadStreamHC);
+    
+    free(c->dataDict);
+    free(c->headDict);
+    free(c);
+}
+
+static size_t boundsLZ4(size_t size) {
+    return LZ4_compressBound(size);
+}
+
+static int compressLZ4(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize, int level) {
+    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
+    
+    if (c == NULL) {
+        // compression without a context
+        return LZ4_compress_fast(from, to, fromSize, toSize, level);
+    }
+
+    // compression with a context
+    LZ4_stream_t* stream = (type == Message::HEADER ? c->comprHeadStream : c->comprDataStream);
+    char* dict           = (type == Message::HEADER ? c->headDict : c->dataDict);
+    size_t* dictSize     = (type == Message::HEADER ? &c->headDictSize : &c->dataDictSize);
+    
+    int compressedSize = LZ4_compress_fast_continue(stream, from, to, fromSize, toSize, level);
+    if (compressedSize <= 0)
+        return 0;
+    
+    *dictSize = fromSize < (1 << 16) ? fromSize : (1 << 16);
+    LZ4_saveDict(stream, dict, *dictSize);
+    return compressedSize;
+}
+
+static int compressLZ4HC(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize, int level) {
     struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
+    
+    if (c == NULL) {
+        return LZ4_compress_HC(from, to, fromSize, toSize, level);
+    }
+    
+    LZ4_streamHC_t* stream = (type == Message::HEADER ? c->comprHeadStreamHC : c->comprDataStreamHC);
+    char* dict             = (type == Message::HEADER ? c->headDict : c->dataDict);
+    size_t* dictSize       = (type == Message::HEADER ? &c->headDictSize : &c->dataDictSize);
+
+    // the level can only be set on a fresh stream
+    if (*dictSize == 0)
+        LZ4_resetStreamHC(stream, level);
+
+    int compressedSize = LZ4_compress_HC_continue(stream, from, to, fromSize, toSize);
+    if (compressedSize <= 0)
+        return 0;
+    
+    *dictSize = fromSize < (1 << 16) ? fromSize : (1 << 16);
+    LZ4_saveDictHC(stream, dict, *dictSize);
+    return compressedSize;
+}
+
+/// lz4hc produces regular lz4 blocks
+static int uncompressLZ4(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize) {
+    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
+    int decBytes = 0;
+    
+    if (c == NULL) {
+        // uncompress without context
+        decBytes = LZ4_decompress_safe(from, to, fromSize, toSize);
+    } else {
+        // uncompress with given context
+        LZ4_streamDecode_t* stream = (type == Message::HEADER ? c->deComprHeadStream : c->deComprDataStream);
+        char* dict                 = (type == Message::HEADER ? c->headDict : c->dataDict);
+        size_t* dictSize           = (type == Message::HEADER ? &c->headDictSize : &c->dataDictSize);
+
+        // set the dictionary anew, a failed pass leaves the stream undefined
+        LZ4_setStreamDecode(stream, dict, *dictSize);
+        decBytes = LZ4_decompress_safe_continue(stream, from, to, fromSize, toSize);
+        c->decompressPasses++;
+
+        if (decBytes > 0) {
+            // save dictionary
+            *dictSize = decBytes < (1 << 16) ? decBytes : (1 << 16);
+            memcpy(dict, &to[decBytes - *dictSize], *dictSize);
+        }
+    }
+    
+    if (decBytes > 0)
+        return decBytes;
+    
+    // lz4 reports the input position where it failed, at the end we only ran out of buffer
+    if (decBytes < 0 && decBytes * -1 >= (int)fromSize)
+        return -1;
+    return 0;
+}
+#endif
+
+#if defined(BUILD_WITH_COMPRESSION_MINIZ)
+/// deflate streams are self-contained, the context only counts
+struct comprCtxMiniz {
+    size_t decompressPasses;
+};
+
+static void* createMiniz() {
+    struct comprCtxMiniz* c = (struct comprCtxMiniz*)malloc(sizeof(comprCtxMiniz));
+    c->decompressPasses = 0;
+    return c;
+}
+
+static void freeMiniz(void* ctx) {
+    free(ctx);
+}
+
+static void resetMiniz(void* ctx) {
+}
+
+static size_t boundsMiniz(size_t size) {
+    return mz_compressBound(size);
+}
+
+static int compressMiniz(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize, int level) {
+    mz_ulong compressedSize = toSize;
+    if (level < 0)
+        level = BUILD_WITH_COMPRESSION_LEVEL_MINIZ;
+    
+    if (mz_compress2((unsigned char*)to, &compressedSize, (const unsigned char*)from, fromSize, level) != MZ_OK)
+        return 0;
+    return compressedSize;
+}
+
+static int uncompressMiniz(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize) {
+    struct comprCtxMiniz* c = (struct comprCtxMiniz*)ctx;
+    if (c != NULL)
+        c->decompressPasses++;
+
+    // mz_uncompress reports a data error when the output buffer is too small
+    mz_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.next_in = (const unsigned char*)from;
+    stream.avail_in = fromSize;
+    stream.next_out = (unsigned char*)to;
+    stream.avail_out = toSize;
+
+    if (mz_inflateInit(&stream) != MZ_OK)
+        return -1;
+
+    int err = mz_inflate(&stream, MZ_FINISH);
+    int decBytes = stream.total_out;
+    bool isFull = (stream.avail_out == 0);
+    mz_inflateEnd(&stream);
+
+    if (err == MZ_STREAM_END)
+        return decBytes;
+    if (err == MZ_BUF_ERROR && isFull)
+        return 0;
+    return -1;
+}
+#endif
+
+#if defined(BUILD_WITH_COMPRESSION_ZSTD)
+/// shared pre-trained dictionary, see Message::setCompressionDictionary
+static std::string zstdDictionary;
+/// digested dictionaries are immutable and shared by all contexts
+static ZSTD_CDict* zstdCDict = NULL;
+static ZSTD_DDict* zstdDDict = NULL;
+
+struct comprCtxZSTD {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+    ZSTD_CDict* cdict; ///< digested dictionary for levels other than the default
+    int cdictLevel;
+    size_t decompressPasses;
+};
+
+static void* createZSTD() {
+    struct comprCtxZSTD* c = (struct comprCtxZSTD*)malloc(sizeof(comprCtxZSTD));
+    c->cctx = ZSTD_createCCtx();
+    c->dctx = ZSTD_createDCtx();
+    c->cdict = NULL;
+    c->cdictLevel = 0;
+    c->decompressPasses = 0;
+    return c;
+}
+
+static void freeZSTD(void* ctx) {
+    struct comprCtxZSTD* c = (struct comprCtxZSTD*)ctx;
+    ZSTD_freeCCtx(c->cctx);
+    ZSTD_freeDCtx(c->dctx);
+    ZSTD_freeCDict(c->cdict);
+    free(c);
+}
+
+static void resetZSTD(void* ctx) {
+    // every message is a frame of its own
+}
+
+static size_t boundsZSTD(size_t size) {
+    return ZSTD_compressBound(size);
+}
+
+static int compressZSTD(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize, int level) {
+    if (ctx == NULL) {
+        ctx = createZSTD();
+        int compressedSize = compressZSTD(ctx, type, from, fromSize, to, toSize, level);
+        freeZSTD(ctx);
+        return compressedSize;
+    }
+    
+    struct comprCtxZSTD* c = (struct comprCtxZSTD*)ctx;
+    if (level < 0)
+        level = ZSTD_CLEVEL_DEFAULT;
+    
     size_t compressedSize = 0;
-    size_t dataSize       = (type == HEADER ? getHeaderDataSize() : _size);
+    if (zstdCDict != NULL) {
+        ZSTD_CDict* cdict = zstdCDict;
+        if (level != ZSTD_CLEVEL_DEFAULT) {
+            if (c->cdict == NULL || c->cdictLevel != level) {
+                ZSTD_freeCDict(c->cdict);
+                c->cdict = ZSTD_createCDict(zstdDictionary.data(), zstdDictionary.size(), level);
+                c->cdictLevel = level;
+            }
+            cdict = c->cdict;
+        }
+        compressedSize = ZSTD_compress_usingCDict(c->cctx, to, toSize, from, fromSize, cdict);
+    } else {
+        compressedSize = ZSTD_compressCCtx(c->cctx, to, toSize, from, fromSize, level);
+    }
+    
+    if (ZSTD_isError(compressedSize))
+        return 0;
+    return compressedSize;
+}
+
+static int uncompressZSTD(void* ctx, Message::Compression type, const char* from, size_t fromSize, char* to, size_t toSize) {
+    if (ctx == NULL) {
+        ctx = createZSTD();
+        int decBytes = uncompressZSTD(ctx, type, from, fromSize, to, toSize);
+        freeZSTD(ctx);
+        return decBytes;
+    }
+
+    struct comprCtxZSTD* c = (struct comprCtxZSTD*)ctx;
+    size_t decBytes = 0;
+    if (zstdDDict != NULL) {
+        decBytes = ZSTD_decompress_usingDDict(c->dctx, to, toSize, from, fromSize, zstdDDict);
+    } else {
+        decBytes = ZSTD_decompressDCtx(c->dctx, to, toSize, from, fromSize);
+    }
+    c->decompressPasses++;
+    
+    if (!ZSTD_isError(decBytes))
+        return decBytes;
+    if (ZSTD_getErrorCode(decBytes) == ZSTD_error_dstSize_tooSmall)
+        return 0;
+    return -1;
+}
+#endif
+
+static const CompressionCodec compressionCodecs[] = {
+#if defined(BUILD_WITH_COMPRESSION_LZ4)
+    { "lz4",   Message::UM_COMPR_LZ4,   createLZ4,   freeLZ4,   resetLZ4,   boundsLZ4,   compressLZ4,   uncompressLZ4 },
+    { "lz4hc", Message::UM_COMPR_LZ4HC, createLZ4HC, freeLZ4,   resetLZ4,   boundsLZ4,   compressLZ4HC, uncompressLZ4 },
+#endif
+#if defined(BUILD_WITH_COMPRESSION_MINIZ)
+    { "miniz", Message::UM_COMPR_MINIZ, createMiniz, freeMiniz, resetMiniz, boundsMiniz, compressMiniz, uncompressMiniz },
+#endif
+#if defined(BUILD_WITH_COMPRESSION_ZSTD)
+    { "zstd",  Message::UM_COMPR_ZSTD,  createZSTD,  freeZSTD,  resetZSTD,  boundsZSTD,  compressZSTD,  uncompressZSTD },
+#endif
+    { NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+static const CompressionCodec* findCodec(const std::string& name) {
+    for (const CompressionCodec* codec = compressionCodecs; codec->name != NULL; codec++) {
+        if (name == codec->name)
+            return codec;
+    }
+    return NULL;
+}
+
+uint8_t Message::getCompressionType(const std::string& name) {
+    const CompressionCodec* codec = findCodec(name);
+    return (codec != NULL ? codec->type : 0);
+}
+
+std::string Message::getCompressionName(uint8_t type) {
+    for (const CompressionCodec* codec = compressionCodecs; codec->name != NULL; codec++) {
+        if (codec->type == type)
+            return codec->name;
+    }
+    return "";
+}
 
-    char* dict = NULL;
-    size_t* dictSize = NULL;
-    LZ4_stream_t* stream = NULL;
+std::vector<std::string> Message::getCompressionCodecs() {
+    std::vector<std::string> names;
+    for (const CompressionCodec* codec = compressionCodecs; codec->name != NULL; codec++) {
+        names.push_back(codec->name);
+    }
+    return names;
+}
+
+bool Message::setCompressionDictionary(const std::string& name, const char* data, size_t size) {
+#if defined(BUILD_WITH_COMPRESSION_ZSTD)
+    if (name == "zstd") {
+        ZSTD_freeCDict(zstdCDict);
+        ZSTD_freeDDict(zstdDDict);
+        zstdCDict = NULL;
+        zstdDDict = NULL;
+        
+        zstdDictionary = std::string(data, size);
+        if (size > 0) {
+            zstdCDict = ZSTD_createCDict(zstdDictionary.data(), zstdDictionary.size(), ZSTD_CLEVEL_DEFAULT);
+            zstdDDict = ZSTD_createDDict(zstdDictionary.data(), zstdDictionary.size());
+        }
+        return true;
+    }
+#endif
+    return false;
+}
+
+size_t Message::compress(const std::string& name, void* ctx, char* data, size_t size, Compression type, int level) {
+    const CompressionCodec* codec = findCodec(name);
+    if (codec == NULL)
+        return 0;
     
+    size_t dataSize = (type == HEADER ? getHeaderDataSize() : _size);
+
     char* buffer = _data.get();
     if (type == HEADER) {
-        buffer = (char*)malloc(dataSize);
+        buffer = BufferPool::alloc(dataSize);
         writeHeaders(buffer, dataSize);
     }
-    if (c != NULL) {
-        // compression with a context
-        stream         = (type == HEADER ? c->comprHeadStream : c->comprDataStream);
-        dict           = (type == HEADER ? c->headDict : c->dataDict);
-        dictSize       = (type == HEADER ? &c->headDictSize : &c->dataDictSize);
-        compressedSize = LZ4_compress_fast_continue(stream, buffer, data, dataSize, size, level);
-        if (compressedSize <= 0)
-            return 0;
-        
-        *dictSize = dataSize < (1 << 16) ? dataSize : (1 << 16);
-        LZ4_saveDict(stream, dict, *dictSize);
 
-    } else {
-        // compression without a context
-        compressedSize = LZ4_compress_fast(buffer, data, dataSize, size, level);
-        if (compressedSize <= 0)
-            return 0;
-    }
+    int compressedSize = codec->compress(ctx, type, buffer, dataSize, data, size, level);
     
     if (type == HEADER) {
-        free(buffer);
+        BufferPool::release(buffer);
     }
     
-    return compressedSize;
-
+    return (compressedSize > 0 ? compressedSize : 0);
 }
 
 #define DECPOMPRESS_HEAD_SIZE_FACTOR 2
@@ -305,142 +709,96 @@ size_t Message::uncompress(const std::string& name,
     if (size == 0)
         return 0;
     
-    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
+    const CompressionCodec* codec = findCodec(name);
+    if (codec == NULL)
+        return 0;
+
     int decBytes = 0;
-    
-    LZ4_streamDecode_t* stream = NULL;
-    char* dict                 = NULL;
-    size_t* dictSize           = NULL;
     size_t scaleFactor = (type == HEADER ? DECPOMPRESS_HEAD_SIZE_FACTOR : DECPOMPRESS_DATA_SIZE_FACTOR);
 
     int decBufferSize = (origSize > 0 ? origSize : size * scaleFactor);
-    char* uncompressed = (char*)malloc(decBufferSize);
-
-    if (c != NULL) {
-        stream   = (type == HEADER ? c->deComprHeadStream : c->deComprDataStream);
-        dict     = (type == HEADER ? c->headDict : c->dataDict);
-        dictSize = (type == HEADER ? &c->headDictSize : &c->dataDictSize);
-
-        // set the dictionary
-        if (*dictSize > 0)
-            LZ4_setStreamDecode(stream, dict, *dictSize);
-    }
+    char* uncompressed = BufferPool::alloc(decBufferSize);
 
     while(true) {
-        if (c != NULL) {
-            // uncompress with given context
-            decBytes = LZ4_decompress_safe_continue(stream, data, uncompressed, size, decBufferSize);
-        } else {
-            // uncompress without context
-            decBytes = LZ4_decompress_safe(data, uncompressed, size, decBufferSize);
-        }
+        decBytes = codec->uncompress(ctx, type, data, size, uncompressed, decBufferSize);
         
         if (decBytes > 0) {
             // success
-            if (c != NULL) {
-                // save dictionary and break
-                *dictSize = decBytes < (1 << 16) ? decBytes : (1 << 16);
-                memcpy(dict, &uncompressed[decBytes - *dictSize], *dictSize);
-            }
             break;
         }
         
-        if (decBytes < 0 && decBytes * -1 >= size) {
-            // we failed!
-            free (uncompressed);
+        if (decBytes < 0 || origSize > 0) {
+            // we failed or the original size was given and still did not suffice
+            BufferPool::release(uncompressed);
             return 0;
         }
         
-        // remember old position and increase buffer
+        // increase buffer
         decBufferSize += size * scaleFactor + (1 << 16);
         
         if (decBufferSize > (1 << 30) || decBufferSize < 0) {
             // decompressed data is getting too large
-            free (uncompressed);
+            BufferPool::release(uncompressed);
             return 0;
         }
         
-        uncompressed = (char*)realloc(uncompressed, decBufferSize);
+        uncompressed = BufferPool::resize(uncompressed, decBufferSize);
     }
 
     // safe decompressed byte array as headers or data
     if (type == HEADER) {
-        _meta["um.compressRatio.head"] = toStr(100 * ((double)size / (double)decBytes));
+        putMeta(MetaFields::COMPRESS_RATIO_HEAD, toStr(100 * ((double)size / (double)decBytes)));
         readHeaders(uncompressed, decBytes);
-        free(uncompressed);
+        BufferPool::release(uncompressed);
     } else {
-        uncompressed = (char*)realloc(uncompressed, decBytes);
-        _meta["um.compressRatio.payload"] = toStr(100 * ((double)size / (double)decBytes));
-        _data = SharedPtr<char>(uncompressed);
+        // keep the slack of the size class rather than copying the payload once more
+        putMeta(MetaFields::COMPRESS_RATIO_PAYLOAD, toStr(100 * ((double)size / (double)decBytes)));
+        _data = SharedPtr<char>(uncompressed, BufferPool::Deleter());
         _size = decBytes;
     }
         
     return decBytes;
 }
 
-void* Message::createCompression() {
-    struct comprCtxLZ4* c = (struct comprCtxLZ4*)malloc(sizeof(comprCtxLZ4));
-    
-    c->comprDataStream = LZ4_createStream();
-    c->comprHeadStream = LZ4_createStream();
-    c->deComprDataStream = LZ4_createStreamDecode();
-    c->deComprHeadStream = LZ4_createStreamDecode();
-    
-    c->dataDictSize = 0;
-    c->dataDict = (char*)malloc((1 << 16));
-    memset(c->dataDict, 0, (1 << 16));
-    
-    c->headDictSize = 0;
-    c->headDict = (char*)malloc((1 << 16));
-    memset(c->headDict, 0, (1 << 16));
-
-    return c;
+void* Message::createCompression(const std::string& name) {
+    const CompressionCodec* codec = findCodec(name);
+    return (codec != NULL ? codec->create() : NULL);
 }
 
-void Message::freeCompression(void* ctx) {
-    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
-
-    // make sure all lingering data is reset
-    resetCompression(ctx);
-    
-    LZ4_freeStream(c->comprDataStream);
-    LZ4_freeStream(c->comprHeadStream);
-    LZ4_freeStreamDecode(c->deComprDataStream);
-    LZ4_freeStreamDecode(c->deComprHeadStream);
-    
-    free(c->dataDict);
-    free(c->headDict);
+void Message::freeCompression(void* ctx, const std::string& name) {
+    const CompressionCodec* codec = findCodec(name);
+    if (codec != NULL && ctx != NULL)
+        codec->destroy(ctx);
 }
 
-void Message::resetCompression(void* ctx) {
-    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
-
-    LZ4_resetStream(c->comprDataStream);
-    LZ4_resetStream(c->comprHeadStream);
-    memset(c->deComprDataStream, 0, sizeof(LZ4_streamDecode_t));
-    memset(c->deComprHeadStream, 0, sizeof(LZ4_streamDecode_t));
-
-    memset(c->dataDict, 0, c->dataDictSize);
-    memset(c->headDict, 0, c->headDictSize);
+void Message::resetCompression(void* ctx, const std::string& name) {
+    const CompressionCodec* codec = findCodec(name);
+    if (codec != NULL && ctx != NULL)
+        codec->reset(ctx);
 }
 
 size_t Message::getCompressBounds(const std::string& name, void* ctx, Compression type) {
-    struct comprCtxLZ4* c = (struct comprCtxLZ4*)ctx;
-    (void)c;
+    const CompressionCodec* codec = findCodec(name);
+    if (codec == NULL)
+        return 0;
     
     switch (type) {
         case HEADER:
-            return LZ4_compressBound(getHeaderDataSize());
+            return codec->bounds(getHeaderDataSize());
         case PAYLOAD:
-            return LZ4_compressBound(_size);
+            return codec->bounds(_size);
         default:
             return 0;
     }
 }
 
-size_t Message::getHeaderDataSize() {
+size_t Message::getHeaderDataSize(uint8_t version) {
+    parseRawHeaders();
+    if (version == UM_MSG_VERSION_02)
+        return getCompactHeaderSize(_meta);
+
     size_t headerDataSize = 0;
-    std::map<std::string, std::string>::const_iterator metaIter;
+    MetaFields::const_iterator metaIter;
     for (metaIter = _meta.begin(); metaIter != _meta.end(); metaIter++) {
         if (metaIter->first.size() == 0) // we do not accept empty keys!
             continue;
@@ -450,4 +808,173 @@ size_t Message::getHeaderDataSize() {
     return headerDataSize;
 }
 
+static uint8_t compactMetaField(const std::string& key, const std::string& value) {
+    if (value.size() != 36 || key.compare(0, 3, "um.") != 0)
+        return Message::UM_META_KVP;
+    if (!UUID::isUUID(value))
+        return Message::UM_META_KVP;
+    if (key == "um.pub")
+        return Message::UM_META_PUB;
+    if (key == "um.proc")
+        return Message::UM_META_PROC;
+    if (key == "um.host")
+        return Message::UM_META_HOST;
+    if (key == "um.sub")
+        return Message::UM_META_SUB;
+    return Message::UM_META_KVP;
+}
+
+static uint8_t compactMetaField(const std::pair<const std::string, std::string>& field) {
+    return compactMetaField(field.first, field.second);
+}
+
+static uint8_t compactMetaField(const MetaFields::Field& field) {
+    // the key was recognized when put, the UUID keys match their MetaField
+    if (field.key < MetaFields::PUB || field.key > MetaFields::SUB)
+        return Message::UM_META_KVP;
+    if (field.second.size() != 36 || !UUID::isUUID(field.second))
+        return Message::UM_META_KVP;
+    return field.key;
+}
+
+static void putCompactMeta(std::map<std::string, std::string>& meta, uint8_t field, const std::string& value) {
+    meta[MetaFields::toString((MetaFields::Key)field)] = value;
+}
+
+static void putCompactMeta(MetaFields& meta, uint8_t field, const std::string& value) {
+    meta.put((MetaFields::Key)field, value);
+}
+
+static void putCompactMeta(std::map<std::string, std::string>& meta, const std::string& key, const std::string& value) {
+    meta[key] = value;
+}
+
+static void putCompactMeta(MetaFields& meta, const std::string& key, const std::string& value) {
+    meta.put(key, value);
+}
+
+static size_t compactLengthSize(uint64_t value) {
+    if (value < 254)
+        return 1;
+    if (value < (1 << 16))
+        return 3;
+    return 9;
+}
+
+template <typename Meta>
+static size_t compactHeaderSize(const Meta& meta) {
+    size_t headerDataSize = 0;
+    typename Meta::const_iterator metaIter;
+    for (metaIter = meta.begin(); metaIter != meta.end(); metaIter++) {
+        if (metaIter->first.size() == 0) // we do not accept empty keys!
+            continue;
+        if (compactMetaField(*metaIter) != Message::UM_META_KVP) {
+            headerDataSize += 1 + 16;
+        } else {
+            headerDataSize += 1;
+            headerDataSize += compactLengthSize(metaIter->first.size()) + metaIter->first.size();
+            headerDataSize += compactLengthSize(metaIter->second.size()) + metaIter->second.size();
+        }
+    }
+    return headerDataSize;
+}
+
+template <typename Meta>
+static char* writeCompactMeta(char* to, size_t size, const Meta& meta) {
+    char* end = to + size;
+    typename Meta::const_iterator metaIter;
+    for (metaIter = meta.begin(); metaIter != meta.end(); metaIter++) {
+        if (metaIter->first.size() == 0) // we do not accept empty keys!
+            continue;
+
+        uint8_t field = compactMetaField(*metaIter);
+        if (field != Message::UM_META_KVP) {
+            if (end - to < 1 + 16)
+                return 0;
+            to = Message::write(to, field);
+            to = UUID::writeHexToBin(to, metaIter->second);
+            continue;
+        }
+
+        if (end - to < 1)
+            return 0;
+        to = Message::write(to, field);
+
+        if ((to = Message::writeCompact(to, metaIter->first.size(), end - to)) == 0 || (size_t)(end - to) < metaIter->first.size())
+            return 0;
+        memcpy(to, metaIter->first.data(), metaIter->first.size());
+        to += metaIter->first.size();
+
+        if ((to = Message::writeCompact(to, metaIter->second.size(), end - to)) == 0 || (size_t)(end - to) < metaIter->second.size())
+            return 0;
+        memcpy(to, metaIter->second.data(), metaIter->second.size());
+        to += metaIter->second.size();
+    }
+    return to;
+}
+
+template <typename Meta>
+static const char* readCompactMeta(const char* from, size_t size, Meta& meta) {
+    const char* end = from + size;
+    while(from < end) {
+        uint8_t field;
+        from = Message::read(from, &field);
+
+        switch (field) {
+        case Message::UM_META_PUB:
+        case Message::UM_META_PROC:
+        case Message::UM_META_HOST:
+        case Message::UM_META_SUB: {
+            if (end - from < 16)
+                return 0;
+            std::string uuid;
+            from = UUID::readBinToHex(from, uuid);
+            putCompactMeta(meta, field, uuid);
+            break;
+        }
+        case Message::UM_META_KVP: {
+            uint64_t keySize = 0;
+            uint64_t valueSize = 0;
+            if (from >= end || (from = Message::readCompact(from, &keySize, end - from)) == 0 || keySize > (uint64_t)(end - from))
+                return 0;
+            const char* key = from;
+            from += keySize;
+            if (from >= end || (from = Message::readCompact(from, &valueSize, end - from)) == 0 || valueSize > (uint64_t)(end - from))
+                return 0;
+            putCompactMeta(meta, std::string(key, keySize), std::string(from, valueSize));
+            from += valueSize;
+            break;
+        }
+        default:
+            // unknown field, we cannot know its length
+            return 0;
+        }
+    }
+    return from;
+}
+
+size_t Message::getCompactHeaderSize(const std::map<std::string, std::string>& meta) {
+    return compactHeaderSize(meta);
+}
+
+size_t Message::getCompactHeaderSize(const MetaFields& meta) {
+    return compactHeaderSize(meta);
+}
+
+char* Message::writeCompactHeaders(char* to, size_t size, const std::map<std::string, std::string>& meta) {
+    return writeCompactMeta(to, size, meta);
+}
+
+char* Message::writeCompactHeaders(char* to, size_t size, const MetaFields& meta) {
+    return writeCompactMeta(to, size, meta);
+}
+
+const char* Message::readCompactHeaders(const char* from, size_t size, std::map<std::string, std::string>& meta) {
+    return readCompactMeta(from, size, meta);
+}
+
+const char* Message::readCompactHeaders(const char* from, size_t size, MetaFields& meta) {
+    return readCompactMeta(from, size, meta);
+}
+
 }
@@ -22,6 +22,8 @@
 #define MESSAGE_H_Y7TB6U8
 
 #include "umundo/Common.h"
+#include "umundo/BufferPool.h"
+#include "umundo/MetaFields.h"
 #include <string.h>
 
 namespace umundo {
@@ -40,23 +42,48 @@ public:
         UM_VERSION            = 0xF005, // version 0.5 of the control message format
 		UM_CONNECT_REQ        = 0x0001, // sent to a remote node when it was added
 		UM_CONNECT_REP        = 0x0002, // reply from a remote node
-		UM_NODE_INFO          = 0x0003, // information about a node and its publishers (unused, CONNECT_REP for now)
+		UM_NODE_INFO          = 0x0003, // a node's port and the addresses of its peers for gossip
 		UM_PUB_ADDED          = 0x0004, // sent when a node added a publisher
 		UM_PUB_REMOVED        = 0x0005, // sent when a node removed a publisher
 		UM_SUBSCRIBE          = 0x0006, // sent when subscribing to a publisher
 		UM_UNSUBSCRIBE        = 0x0007, // unsusbscribing from a publisher
 		UM_DEBUG              = 0x0009, // request debug info
+		UM_PUB_DIFF           = 0x000A, // publishers added and removed since a version of a node's publisher set
 		UM_SHUTDOWN           = 0x000C, // node is shutting down
 	};
 
     enum HeaderField {
         UM_MSG_VERSION_01     = 0x01,     // version 0.1 of the data message format
-        UM_MSG_VERSION        = UM_MSG_VERSION_01,
+        UM_MSG_VERSION_02     = 0x02,     // version 0.2 with binary header fields and static headers
+        UM_MSG_VERSION        = UM_MSG_VERSION_02,
         UM_COMPR_MSG          = (1 << 7), // header is compressed
         UM_COMPR_KEYFRAME     = (1 << 6), // compression keyframe
+        UM_STATIC_HEADER      = (1 << 5), // static header of the publisher is included
+        UM_STATIC_REF         = (1 << 4), // static header of the publisher applies
+        UM_PAYLOAD_FRAME      = (1 << 3), // payload follows in a separate zeromq frame
+        UM_BATCH              = (1 << 2), // several messages in one frame (version 0.2 only)
+        UM_SHM_PAYLOAD        = (1 << 1), // payload waits in the publisher's shared memory ring (version 0.2 only)
+        UM_SHM_COPY           = (1 << 0), // payload was also announced via shared memory (version 0.2 only)
+        UM_TRACE              = (1 << 6), // trace block follows the static generation (version 0.2 only)
+        UM_COMPR_SIZES        = (1 << 5), // uncompressed sizes precede the data (compressed version 0.1 only)
         UM_COMPR_LZ4          = 0x01,     // header compressed with LZ4
+        UM_COMPR_LZ4HC        = 0x02,     // header compressed with LZ4 high compression
+        UM_COMPR_MINIZ        = 0x03,     // header compressed with miniz deflate
+        UM_COMPR_ZSTD         = 0x04,     // header compressed with zstd, optionally with a shared dictionary
+        UM_COMPR_TYPE         = 0x07,     // mask for the compression type (compressed version 0.1 only)
     };
     
+	/**
+	 * Well-known header fields in version 0.2 of the data message format
+	 */
+	enum MetaField {
+		UM_META_KVP           = 0x00, // key and value as length-prefixed strings
+		UM_META_PUB           = 0x01, // um.pub as 16 byte binary UUID
+		UM_META_PROC          = 0x02, // um.proc as 16 byte binary UUID
+		UM_META_HOST          = 0x03, // um.host as 16 byte binary UUID
+		UM_META_SUB           = 0x04, // um.sub as 16 byte binary UUID
+	};
+
 	enum Flags {
 		NONE            = 0x0000, ///< Default is to copy data and deallocate
 		ADOPT_DATA      = 0x0001, ///< Do not copy into message but deallocate when done
@@ -78,6 +105,7 @@ public:
 		if (type == UM_SUBSCRIBE)		   return "SUBSCRIBE";
 		if (type == UM_UNSUBSCRIBE)        return "UNSUBSCRIBE";
 		if (type == UM_DEBUG)              return "DEBUG";
+		if (type == UM_PUB_DIFF)           return "PUB_DIFF";
 		if (type == UM_SHUTDOWN)           return "SHUTDOWN";
 		return "UNKNOWN";
 	}
@@ -95,9 +123,19 @@ public:
 	static char* write(char* to, double value);
     static char* writeCompact(char* to, uint64_t value, size_t remaining);
 
-    size_t getHeaderDataSize();
-    char* writeHeaders(char* to, size_t size);
-    const char* readHeaders(const char* from, size_t size);
+    size_t getHeaderDataSize(uint8_t version = UM_MSG_VERSION_01);
+    char* writeHeaders(char* to, size_t size, uint8_t version = UM_MSG_VERSION_01);
+    const char* readHeaders(const char* from, size_t size, uint8_t version = UM_MSG_VERSION_01);
+
+    /** @name Binary header fields of version 0.2 */
+    //@{
+    static size_t getCompactHeaderSize(const std::map<std::string, std::string>& meta);
+    static char* writeCompactHeaders(char* to, size_t size, const std::map<std::string, std::string>& meta);
+    static const char* readCompactHeaders(const char* from, size_t size, std::map<std::string, std::string>& meta);
+    static size_t getCompactHeaderSize(const MetaFields& meta);
+    static char* writeCompactHeaders(char* to, size_t size, const MetaFields& meta);
+    static const char* readCompactHeaders(const char* from, size_t size, MetaFields& meta);
+    //@}
 
 	static const char* read(const char* from, std::string& value, size_t maxLength);
 	static const char* read(const char* from, uint64_t* value);
@@ -118,8 +156,8 @@ private:
 	friend class ZeroMQPublisher;
 
 public:
-	Message() : _size(0), _isQueued(false), _flags(NONE), _hint(NULL), _doneCallback(NULL) {}
-	Message(const char* data, size_t length, Flags flags) : _size(length), _isQueued(false), _flags(flags), _hint(NULL), _doneCallback(NULL) {
+	Message() : _size(0), _isQueued(false), _flags(NONE), _hint(NULL), _doneCallback(NULL), _rawHeaders(NULL), _rawHeaderSize(0), _rawHeaderVersion(UM_MSG_VERSION_01), _isMetaMapValid(false) {}
+	Message(const char* data, size_t length, Flags flags) : _size(length), _isQueued(false), _flags(flags), _hint(NULL), _doneCallback(NULL), _rawHeaders(NULL), _rawHeaderSize(0), _rawHeaderVersion(UM_MSG_VERSION_01), _isMetaMapValid(false) {
 		if (_flags & ADOPT_DATA) {
 			// take ownership of data and delete when done
 			_data = SharedPtr<char>(const_cast<char*>(data));
@@ -128,28 +166,43 @@ public:
 			_data = SharedPtr<char>(const_cast<char*>(data), Message::NilDeleter());
 		} else {
 			// copy into message
-			_data = SharedPtr<char>((char*)malloc(_size));
+			_data = SharedPtr<char>(BufferPool::alloc(_size), BufferPool::Deleter());
 			memcpy(_data.get(), data, _size);
 		}
 	}
 
 	// need this one for SWIG to ignore the other one with flags
-	Message(const char* data, size_t length) : _size(length), _isQueued(false), _flags(NONE), _hint(NULL), _doneCallback(NULL) {
-		_data = SharedPtr<char>((char*)malloc(_size));
+	Message(const char* data, size_t length) : _size(length), _isQueued(false), _flags(NONE), _hint(NULL), _doneCallback(NULL), _rawHeaders(NULL), _rawHeaderSize(0), _rawHeaderVersion(UM_MSG_VERSION_01), _isMetaMapValid(false) {
+		_data = SharedPtr<char>(BufferPool::alloc(_size), BufferPool::Deleter());
 		memcpy(_data.get(), data, _size);
 	}
 
-	Message(const char* data, size_t length, void(*doneCallback)(void *data, void *hint), void* hint) : _size(length), _isQueued(false), _flags(WRAP_DATA) {
+	/**
+	 * Wrap data owned by the caller without copying.
+	 *
+	 * The done callback is invoked with the hint exactly once, when the last copy
+	 * of the message and the transport are done with the data.
+	 */
+	Message(const char* data, size_t length, void(*doneCallback)(void *data, void *hint), void* hint) : _size(length), _isQueued(false), _flags(WRAP_DATA), _rawHeaders(NULL), _rawHeaderSize(0), _rawHeaderVersion(UM_MSG_VERSION_01), _isMetaMapValid(false) {
 		_doneCallback = doneCallback;
 		_hint = hint;
-		_data = SharedPtr<char>(const_cast<char*>(data), Message::NilDeleter());
+		if (doneCallback != NULL) {
+			_flags = ADOPT_DATA;
+			_data = SharedPtr<char>(const_cast<char*>(data), Message::ReleaseDeleter(doneCallback, hint));
+		} else {
+			_data = SharedPtr<char>(const_cast<char*>(data), Message::NilDeleter());
+		}
 	}
 
-	Message(const Message& other) : _size(other.size()), _isQueued(other._isQueued), _flags(other._flags) {
+	Message(const Message& other) : _size(other.size()), _isQueued(other._isQueued), _flags(other._flags), _isMetaMapValid(false) {
 		_data = other._data;
 		_meta = other._meta;
 		_hint = other._hint;
 		_doneCallback = other._doneCallback;
+		_rawHeaders = other._rawHeaders;
+		_rawHeaderSize = other._rawHeaderSize;
+		_rawHeaderVersion = other._rawHeaderVersion;
+		_rawHeaderOwner = other._rawHeaderOwner;
 	}
 
     /**
@@ -160,14 +213,22 @@ public:
             const char* compressedHeaderData,
             size_t compressedHeaderLength,
             const char* compressedPayloadData,
-            size_t compressedPayloadLength) {
+            size_t compressedPayloadLength) : _rawHeaders(NULL), _rawHeaderSize(0), _rawHeaderVersion(UM_MSG_VERSION_01), _isMetaMapValid(false) {
         uncompress(name, ctx, compressedHeaderData, compressedHeaderLength, HEADER);
         uncompress(name, ctx, compressedPayloadData, compressedPayloadLength, PAYLOAD);
     }
     
-    static void* createCompression();
-    static void freeCompression(void* ctx);
-    static void resetCompression(void* ctx);
+    /** @name Compression codecs by name, see getCompressionCodecs */
+    //@{
+    static void* createCompression(const std::string& name = "lz4");
+    static void freeCompression(void* ctx, const std::string& name = "lz4");
+    static void resetCompression(void* ctx, const std::string& name = "lz4");
+    static uint8_t getCompressionType(const std::string& name); ///< value for UM_COMPR_TYPE or 0 if unknown
+    static std::string getCompressionName(uint8_t type);
+    static std::vector<std::string> getCompressionCodecs();
+    /// pre-trained dictionary, set before compressing and the same for publishers and subscribers
+    static bool setCompressionDictionary(const std::string& name, const char* data, size_t size);
+    //@}
     
 	virtual ~Message() {
 	}
@@ -190,6 +251,7 @@ public:
                     size_t size,
                     Compression type,
                     int level = -1);
+    /// origSize is the exact uncompressed size if known, saves growing the buffer on retries
     size_t uncompress(const std::string& name,
                       void* ctx,
                       const char* data,
@@ -199,20 +261,80 @@ public:
     
 	virtual void setData(const char* data, size_t length)               {
 		_size = length;
-		_data = SharedPtr<char>((char*)malloc(_size));
+		_data = SharedPtr<char>(BufferPool::alloc(_size), BufferPool::Deleter());
 		memcpy(_data.get(), data, _size);
 	}
 
+	/**
+	 * Use data owned by someone else as payload without copying.
+	 *
+	 * The release callback is invoked with the hint once the last copy of the
+	 * message referring to the data is gone.
+	 */
+	virtual void setData(const char* data, size_t length, void(*release)(void *data, void *hint), void* hint) {
+		_size = length;
+		_data = SharedPtr<char>(const_cast<char*>(data), Message::ReleaseDeleter(release, hint));
+	}
+
+	/**
+	 * Keep serialized headers and only parse them when meta fields are first accessed.
+	 *
+	 * Without a release callback, the headers have to live in the buffer passed as
+	 * payload via setData and are kept alive with it.
+	 */
+	void setRawHeaders(const char* data, size_t length, uint8_t version, void(*release)(void *data, void *hint) = NULL, void* hint = NULL);
+
 	virtual const void putMeta(const std::string& key, const std::string& value)  {
-		_meta[key] = value;
+		parseRawHeaders();
+		_meta.put(key, value);
+		_isMetaMapValid = false;
+	}
+	void putMeta(MetaFields::Key key, const std::string& value) {
+		parseRawHeaders();
+		_meta.put(key, value);
+		_isMetaMapValid = false;
+	}
+	void putMeta(const MetaFields& fields) {
+		parseRawHeaders();
+		_meta.put(fields);
+		_isMetaMapValid = false;
 	}
+
+	/**
+	 * All meta fields as a map.
+	 *
+	 * The map is assembled on first use after a change, use getMeta with a key,
+	 * hasMeta or getMetaFields where performance matters.
+	 */
 	virtual const std::map<std::string, std::string>& getMeta()                        {
-		return _meta;
+		parseRawHeaders();
+		if (!_isMetaMapValid) {
+			_metaMap = _meta.toMap();
+			_isMetaMapValid = true;
+		}
+		return _metaMap;
 	}
 	virtual const std::string getMeta(const std::string& key)                    {
-		if (_meta.find(key) != _meta.end())
-			return _meta[key];
-		return "";
+		return getMetaRef(key);
+	}
+	/// value of the meta field or the empty string, valid until the message changes
+	const std::string& getMetaRef(const std::string& key) {
+		parseRawHeaders();
+		const std::string* value = _meta.find(key);
+		return (value != NULL ? *value : noMeta());
+	}
+	const std::string& getMeta(MetaFields::Key key) {
+		parseRawHeaders();
+		const std::string* value = _meta.find(key);
+		return (value != NULL ? *value : noMeta());
+	}
+	bool hasMeta(const std::string& key) {
+		parseRawHeaders();
+		return _meta.find(key) != NULL;
+	}
+	const MetaFields& getMetaFields() {
+		parseRawHeaders();
+		return _meta;
 	}
 
 	void setQueued(bool isQueued) {
@@ -239,14 +361,49 @@ private:
 		void operator()(char* p) {}
 	};
 
+	class ReleaseDeleter {
+	public:
+		ReleaseDeleter(void(*release)(void *data, void *hint), void* hint) : _release(release), _hint(hint) {}
+		void operator()(char* p) {
+			_release(p, _hint);
+		}
+	private:
+		void (*_release) (void *data, void *hint);
+		void* _hint;
+	};
+
+	static const std::string& noMeta() {
+		static const std::string empty;
+		return empty;
+	}
+
+	void parseRawHeaders() {
+		if (_rawHeaders == NULL)
+			return;
+		const char* rawHeaders = _rawHeaders;
+		_rawHeaders = NULL; // readHeaders will call putMeta
+		readHeaders(rawHeaders, _rawHeaderSize, _rawHeaderVersion);
+		_rawHeaderSize = 0;
+		_rawHeaderOwner = SharedPtr<char>();
+	}
+
 	SharedPtr<char> _data;
 	size_t _size;
 
 	bool _isQueued;
 	uint32_t _flags;
-	std::map<std::string, std::string> _meta;
+	MetaFields _meta;
 	void* _hint;
 	void (*_doneCallback) (void *data, void *hint);
+
+	const char* _rawHeaders;
+	size_t _rawHeaderSize;
+	uint8_t _rawHeaderVersion;
+	SharedPtr<char> _rawHeaderOwner;
+
+	/// _meta as returned by getMeta()
+	std::map<std::string, std::string> _metaMap;
+	bool _isMetaMapValid;
 };
 }
 
@@ -0,0 +1,142 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/MetaFields.h"
+
+#include <algorithm>
+
+namespace umundo {
+
+static const std::string& keyString(size_t key) {
+	static const std::string keys[MetaFields::NR_KEYS] = {
+		"",
+		"um.pub",
+		"um.proc",
+		"um.host",
+		"um.sub",
+		"um.channel",
+		"um.compressRatio.head",
+		"um.compressRatio.payload",
+	};
+	return keys[key];
+}
+
+MetaFields::Key MetaFields::toKey(const std::string& key) {
+	// all well-known keys start with um.
+	if (key.size() < 6 || key[0] != 'u' || key[1] != 'm' || key[2] != '.')
+		return OTHER;
+	for (size_t i = 1; i < NR_KEYS; i++) {
+		if (keyString(i) == key)
+			return (Key)i;
+	}
+	return OTHER;
+}
+
+const std::string& MetaFields::toString(Key key) {
+	return keyString(key < NR_KEYS ? key : OTHER);
+}
+
+void MetaFields::put(Key key, const std::string& keyString, const std::string& value) {
+	for (size_t i = 0; i < _size; i++) {
+		Field& field = at(i);
+		if (field.key == key && (key != OTHER || field.first == keyString)) {
+			field.second = value;
+			return;
+		}
+	}
+
+	if (_size < UMUNDO_META_INLINE) {
+		Field& field = at(_size++);
+		field.key = key;
+		field.first = keyString;
+		field.second = value;
+		return;
+	}
+
+	// key and value may be our own fields, they move when the overflow grows
+	Field field;
+	field.key = key;
+	field.first = keyString;
+	field.second = value;
+	_overflow.push_back(field);
+	_size++;
+}
+
+void MetaFields::put(const MetaFields& other) {
+	for (size_t i = 0; i < other._size; i++) {
+		const Field& field = other.at(i);
+		put((Key)field.key, field.first, field.second);
+	}
+}
+
+const std::string* MetaFields::find(const std::string& key) const {
+	for (size_t i = 0; i < _size; i++) {
+		const Field& field = at(i);
+		if (field.first == key)
+			return &field.second;
+	}
+	return NULL;
+}
+
+const std::string* MetaFields::find(Key key) const {
+	for (size_t i = 0; i < _size; i++) {
+		const Field& field = at(i);
+		if (field.key == key)
+			return &field.second;
+	}
+	return NULL;
+}
+
+bool MetaFields::erase(const std::string& key) {
+	for (size_t i = 0; i < _size; i++) {
+		if (at(i).first != key)
+			continue;
+
+		// keep the order of the remaining fields
+		for (size_t j = i + 1; j < _size; j++) {
+			Field& prev = at(j - 1);
+			Field& curr = at(j);
+			std::swap(prev.first, curr.first);
+			std::swap(prev.second, curr.second);
+			std::swap(prev.key, curr.key);
+		}
+		_size--;
+		if (_size >= UMUNDO_META_INLINE)
+			_overflow.resize(_size - UMUNDO_META_INLINE);
+		return true;
+	}
+	return false;
+}
+
+void MetaFields::clear() {
+	// inline fields keep their strings for the next use
+	_overflow.clear();
+	_size = 0;
+}
+
+std::map<std::string, std::string> MetaFields::toMap() const {
+	std::map<std::string, std::string> meta;
+	for (size_t i = 0; i < _size; i++) {
+		const Field& field = at(i);
+		meta[field.first] = field.second;
+	}
+	return meta;
+}
+
+}
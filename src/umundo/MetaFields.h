@@ -0,0 +1,138 @@
+/**
+ *  @file
+ *  @brief      Flat storage for the meta fields of a message.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef METAFIELDS_H_H3ZQ8V1N
+#define METAFIELDS_H_H3ZQ8V1N
+
+#include "umundo/Common.h"
+
+#define UMUNDO_META_INLINE 8 // fields kept within the message before we allocate
+
+namespace umundo {
+
+/**
+ * Key/value pairs in insertion order with room for a few fields inline.
+ *
+ * Messages carry a handful of fields, most of them the well-known um.* keys.
+ * A linear scan over these is cheaper than a std::map with a node per field
+ * and well-known keys are recognized once when put and not when encoded.
+ */
+class UMUNDO_API MetaFields {
+public:
+	/// well-known keys, the UUID fields match Message::MetaField
+	enum Key {
+		OTHER                 = 0,
+		PUB                   = 1, ///< um.pub
+		PROC                  = 2, ///< um.proc
+		HOST                  = 3, ///< um.host
+		SUB                   = 4, ///< um.sub
+		CHANNEL               = 5, ///< um.channel
+		COMPRESS_RATIO_HEAD   = 6, ///< um.compressRatio.head
+		COMPRESS_RATIO_PAYLOAD= 7, ///< um.compressRatio.payload
+		NR_KEYS               = 8
+	};
+
+	/// a field, first and second as with std::map
+	struct Field {
+		Field() : key(OTHER) {}
+		std::string first;
+		std::string second;
+		uint8_t key;
+	};
+
+	class const_iterator {
+	public:
+		const_iterator() : _fields(NULL), _index(0) {}
+		const_iterator(const MetaFields* fields, size_t index) : _fields(fields), _index(index) {}
+		const Field& operator*() const {
+			return _fields->at(_index);
+		}
+		const Field* operator->() const {
+			return &_fields->at(_index);
+		}
+		const_iterator& operator++() {
+			_index++;
+			return *this;
+		}
+		const_iterator operator++(int) {
+			const_iterator curr(*this);
+			_index++;
+			return curr;
+		}
+		bool operator==(const const_iterator& other) const {
+			return _index == other._index && _fields == other._fields;
+		}
+		bool operator!=(const const_iterator& other) const {
+			return !(*this == other);
+		}
+	private:
+		const MetaFields* _fields;
+		size_t _index;
+	};
+
+	MetaFields() : _size(0) {}
+
+	static Key toKey(const std::string& key);
+	static const std::string& toString(Key key);
+
+	void put(const std::string& key, const std::string& value) {
+		put(toKey(key), key, value);
+	}
+	void put(Key key, const std::string& value) {
+		put(key, toString(key), value);
+	}
+	/// put all fields of other
+	void put(const MetaFields& other);
+	/// value for key or NULL
+	const std::string* find(const std::string& key) const;
+	const std::string* find(Key key) const;
+	bool erase(const std::string& key);
+	void clear();
+
+	size_t size() const {
+		return _size;
+	}
+	const_iterator begin() const {
+		return const_iterator(this, 0);
+	}
+	const_iterator end() const {
+		return const_iterator(this, _size);
+	}
+
+	std::map<std::string, std::string> toMap() const;
+
+protected:
+	void put(Key key, const std::string& keyString, const std::string& value);
+
+	const Field& at(size_t index) const {
+		return (index < UMUNDO_META_INLINE ? _inline[index] : _overflow[index - UMUNDO_META_INLINE]);
+	}
+	Field& at(size_t index) {
+		return (index < UMUNDO_META_INLINE ? _inline[index] : _overflow[index - UMUNDO_META_INLINE]);
+	}
+
+	Field _inline[UMUNDO_META_INLINE];
+	std::vector<Field> _overflow;
+	size_t _size;
+};
+
+}
+
+#endif /* end of include guard: METAFIELDS_H_H3ZQ8V1N */
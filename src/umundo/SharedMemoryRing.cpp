@@ -0,0 +1,221 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/SharedMemoryRing.h"
+
+#include <string.h>
+
+#ifdef UMUNDO_WITH_SHARED_MEMORY
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define UMUNDO_SHM_MAGIC 0x756d5231 // "umR1"
+#define UMUNDO_SHM_HEADER_SIZE 64 // records start at a cache line of their own
+#define UMUNDO_SHM_RECORD_SIZE(size) ((8 + (uint64_t)(size) + 7) & ~(uint64_t)7) // length and data, 8 byte aligned
+
+namespace umundo {
+
+#ifdef UMUNDO_WITH_SHARED_MEMORY
+
+/**
+ * Records are a 64 bit length followed by the data and never wrap around the
+ * end of the ring. The writer announces how far it is about to write with
+ * reserved before it copies a record and publishes it with head afterwards,
+ * the same scheme as a sequence lock.
+ */
+struct SharedMemoryRing::Header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	std::atomic<uint64_t> reserved; ///< bytes ever written or about to be
+	std::atomic<uint64_t> head; ///< bytes ever written
+};
+
+SharedMemoryRing::SharedMemoryRing() : _isWriter(false), _mapping(NULL), _mappingSize(0), _header(NULL), _data(NULL), _capacity(0) {}
+
+SharedMemoryRing::~SharedMemoryRing() {
+	if (_mapping != NULL)
+		munmap(_mapping, _mappingSize) && UM_LOG_WARN("munmap: %s", strerror(errno));
+
+	// readers keep their mapping until they are done
+	if (_isWriter)
+		shm_unlink(_name.c_str()) && UM_LOG_WARN("shm_unlink %s: %s", _name.c_str(), strerror(errno));
+}
+
+SharedPtr<SharedMemoryRing> SharedMemoryRing::create(const std::string& name, size_t capacity) {
+	capacity = (capacity < 4096 ? 4096 : capacity) & ~(size_t)7;
+
+	// only processes of our own user may read the payloads, as with any other file of ours
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		// left behind by a crashed process
+		shm_unlink(name.c_str());
+		fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	}
+	if (fd < 0) {
+		UM_LOG_WARN("shm_open %s: %s", name.c_str(), strerror(errno));
+		return SharedPtr<SharedMemoryRing>();
+	}
+
+	size_t mappingSize = UMUNDO_SHM_HEADER_SIZE + capacity;
+	void* mapping = MAP_FAILED;
+	if (ftruncate(fd, mappingSize) == 0) {
+		mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		UM_LOG_WARN("mapping %s: %s", name.c_str(), strerror(errno));
+		shm_unlink(name.c_str());
+		return SharedPtr<SharedMemoryRing>();
+	}
+
+	SharedPtr<SharedMemoryRing> ring(new SharedMemoryRing());
+	ring->_name = name;
+	ring->_isWriter = true;
+	ring->_mapping = (char*)mapping;
+	ring->_mappingSize = mappingSize;
+	ring->_header = (Header*)mapping;
+	ring->_data = ring->_mapping + UMUNDO_SHM_HEADER_SIZE;
+	ring->_capacity = capacity;
+
+	ring->_header->capacity = capacity;
+	ring->_header->version = 1;
+	ring->_header->reserved.store(0, std::memory_order_relaxed);
+	ring->_header->head.store(0, std::memory_order_relaxed);
+	ring->_header->magic = UMUNDO_SHM_MAGIC;
+	return ring;
+}
+
+SharedPtr<SharedMemoryRing> SharedMemoryRing::open(const std::string& name) {
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return SharedPtr<SharedMemoryRing>();
+
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > UMUNDO_SHM_HEADER_SIZE) {
+		mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+		return SharedPtr<SharedMemoryRing>();
+
+	SharedPtr<SharedMemoryRing> ring(new SharedMemoryRing());
+	ring->_name = name;
+	ring->_mapping = (char*)mapping;
+	ring->_mappingSize = st.st_size;
+	ring->_header = (Header*)mapping;
+	ring->_data = ring->_mapping + UMUNDO_SHM_HEADER_SIZE;
+	ring->_capacity = ring->_header->capacity;
+
+	if (ring->_header->magic != UMUNDO_SHM_MAGIC || ring->_capacity != (uint64_t)(st.st_size - UMUNDO_SHM_HEADER_SIZE)) {
+		UM_LOG_WARN("%s is no ring we know", name.c_str());
+		return SharedPtr<SharedMemoryRing>();
+	}
+	return ring;
+}
+
+bool SharedMemoryRing::write(const char* data, size_t size, uint64_t* position) {
+	uint64_t recordSize = UMUNDO_SHM_RECORD_SIZE(size);
+	if (!_isWriter || recordSize > _capacity / 2)
+		return false;
+
+	uint64_t pos = _header->head.load(std::memory_order_relaxed);
+	uint64_t offset = pos % _capacity;
+	if (offset + recordSize > _capacity) {
+		// records are contiguous, leave the rest of this lap
+		pos += _capacity - offset;
+		offset = 0;
+	}
+
+	_header->reserved.store(pos + recordSize, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	uint64_t length = size;
+	memcpy(_data + offset, &length, sizeof(length));
+	memcpy(_data + offset + sizeof(length), data, size);
+
+	_header->head.store(pos + recordSize, std::memory_order_release);
+	*position = pos;
+	return true;
+}
+
+bool SharedMemoryRing::read(uint64_t position, char* buffer, size_t size) {
+	uint64_t recordSize = UMUNDO_SHM_RECORD_SIZE(size);
+	uint64_t offset = position % _capacity;
+	if (offset + recordSize > _capacity)
+		return false;
+
+	uint64_t head = _header->head.load(std::memory_order_acquire);
+	if (position + recordSize > head || head - position > _capacity)
+		return false;
+
+	uint64_t length;
+	memcpy(&length, _data + offset, sizeof(length));
+	memcpy(buffer, _data + offset + sizeof(length), size);
+
+	// anything the writer reserved after we started might have been copied
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t reserved = _header->reserved.load(std::memory_order_relaxed);
+	return (length == size && reserved - position <= _capacity);
+}
+
+#else
+
+struct SharedMemoryRing::Header {};
+
+SharedMemoryRing::SharedMemoryRing() : _isWriter(false), _mapping(NULL), _mappingSize(0), _header(NULL), _data(NULL), _capacity(0) {}
+SharedMemoryRing::~SharedMemoryRing() {}
+
+SharedPtr<SharedMemoryRing> SharedMemoryRing::create(const std::string& name, size_t capacity) {
+	return SharedPtr<SharedMemoryRing>();
+}
+
+SharedPtr<SharedMemoryRing> SharedMemoryRing::open(const std::string& name) {
+	return SharedPtr<SharedMemoryRing>();
+}
+
+bool SharedMemoryRing::write(const char* data, size_t size, uint64_t* position) {
+	return false;
+}
+
+bool SharedMemoryRing::read(uint64_t position, char* buffer, size_t size) {
+	return false;
+}
+
+#endif
+
+std::string SharedMemoryRing::nameFor(const std::string& uuid) {
+	// POSIX allows for 31 characters on some systems
+	std::string name("/um.");
+	for (size_t i = 0; i < uuid.size() && name.size() < 28; i++) {
+		if (uuid[i] != '-')
+			name += uuid[i];
+	}
+	return name;
+}
+
+}
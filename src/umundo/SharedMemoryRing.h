@@ -0,0 +1,79 @@
+/**
+ *  @file
+ *  @brief      Ring buffer in shared memory for payloads to processes on the same host.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef SHAREDMEMORYRING_H_K2VQ8TNE
+#define SHAREDMEMORYRING_H_K2VQ8TNE
+
+#include "umundo/Common.h"
+#include "umundo/config.h"
+
+#if defined(UNIX) && !defined(ANDROID) && !defined(IOS) && !defined(WITHOUT_CXX11)
+#define UMUNDO_WITH_SHARED_MEMORY 1
+#endif
+
+#define UMUNDO_SHM_RING_SIZE (32 * 1024 * 1024) // default size of a publisher's ring
+#define UMUNDO_SHM_MIN_PAYLOAD 4096 // smaller payloads are cheaper to just send
+
+namespace umundo {
+
+/**
+ * A single writer broadcasting variable sized records to any number of readers.
+ *
+ * The writer never waits for readers, it overwrites the oldest records once the
+ * ring is full. Readers learn the position of a record by other means, copy it
+ * out and only then check whether the writer got there in the meantime.
+ */
+class UMUNDO_API SharedMemoryRing {
+public:
+	virtual ~SharedMemoryRing();
+
+	/// create a ring to write into, only our own user can read it, empty where shared memory is not supported
+	static SharedPtr<SharedMemoryRing> create(const std::string& name, size_t capacity);
+	/// map an existing ring to read from, empty if there is none on this host or it is not ours
+	static SharedPtr<SharedMemoryRing> open(const std::string& name);
+	/// ring name for an endpoint, short enough for all platforms
+	static std::string nameFor(const std::string& uuid);
+
+	/// copy a record into the ring, false if it is larger than half the ring
+	bool write(const char* data, size_t size, uint64_t* position);
+	/// copy the record written at position, false if it was overwritten already
+	bool read(uint64_t position, char* buffer, size_t size);
+
+	uint64_t getCapacity() {
+		return _capacity;
+	}
+
+protected:
+	SharedMemoryRing();
+
+	struct Header;
+
+	std::string _name;
+	bool _isWriter;
+	char* _mapping;
+	size_t _mappingSize;
+	Header* _header;
+	char* _data;
+	uint64_t _capacity;
+};
+
+}
+
+#endif /* end of include guard: SHAREDMEMORYRING_H_K2VQ8TNE */
@@ -0,0 +1,231 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/Statistics.h"
+#include "umundo/thread/Thread.h"
+
+namespace umundo {
+
+static inline size_t highestBit(uint64_t value) {
+	size_t bit = 0;
+	if (value >= ((uint64_t)1 << 32)) {
+		value >>= 32;
+		bit += 32;
+	}
+	if (value >= ((uint64_t)1 << 16)) {
+		value >>= 16;
+		bit += 16;
+	}
+	if (value >= ((uint64_t)1 << 8)) {
+		value >>= 8;
+		bit += 8;
+	}
+	if (value >= ((uint64_t)1 << 4)) {
+		value >>= 4;
+		bit += 4;
+	}
+	if (value >= ((uint64_t)1 << 2)) {
+		value >>= 2;
+		bit += 2;
+	}
+	if (value >= ((uint64_t)1 << 1)) {
+		bit += 1;
+	}
+	return bit;
+}
+
+Histogram::Histogram() : _count(0), _sum(0), _max(0) {
+	for (size_t i = 0; i < UMUNDO_HISTOGRAM_BUCKETS; i++)
+		_counts[i] = 0;
+}
+
+size_t Histogram::bucketFor(uint64_t value) {
+	if (value < ((uint64_t)1 << UMUNDO_HISTOGRAM_SUB_BITS))
+		return (size_t)value;
+
+	size_t bit = highestBit(value);
+	if (bit > UMUNDO_HISTOGRAM_MAX_BITS)
+		return UMUNDO_HISTOGRAM_BUCKETS - 1;
+
+	// the bits below the highest one select the bucket within the power of two
+	size_t shift = bit - UMUNDO_HISTOGRAM_SUB_BITS;
+	size_t sub = (size_t)(value >> shift) & ((1 << UMUNDO_HISTOGRAM_SUB_BITS) - 1);
+	return ((shift + 1) << UMUNDO_HISTOGRAM_SUB_BITS) + sub;
+}
+
+uint64_t Histogram::bucketMax(size_t bucket) {
+	size_t group = bucket >> UMUNDO_HISTOGRAM_SUB_BITS;
+	if (group == 0)
+		return bucket;
+
+	size_t shift = group - 1;
+	uint64_t sub = bucket & ((1 << UMUNDO_HISTOGRAM_SUB_BITS) - 1);
+	uint64_t lower = (((uint64_t)1 << UMUNDO_HISTOGRAM_SUB_BITS) + sub) << shift;
+	return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+	UMUNDO_STAT_ADD(_counts[bucketFor(value)], 1);
+	UMUNDO_STAT_ADD(_count, 1);
+	UMUNDO_STAT_ADD(_sum, value);
+
+#ifndef WITHOUT_CXX11
+	uint64_t max = _max.load(std::memory_order_relaxed);
+	while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+#else
+	if (value > _max)
+		_max = value;
+#endif
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+	Snapshot snapshot;
+	snapshot.count = UMUNDO_STAT_GET(_count);
+	snapshot.sum = UMUNDO_STAT_GET(_sum);
+	snapshot.max = UMUNDO_STAT_GET(_max);
+	if (snapshot.count == 0)
+		return snapshot;
+
+	snapshot.counts.resize(UMUNDO_HISTOGRAM_BUCKETS);
+	for (size_t i = 0; i < UMUNDO_HISTOGRAM_BUCKETS; i++)
+		snapshot.counts[i] = UMUNDO_STAT_GET(_counts[i]);
+	return snapshot;
+}
+
+uint64_t Histogram::Snapshot::percentile(double percent) const {
+	if (counts.size() == 0)
+		return 0;
+
+	// the buckets are read one after the other, do not trust count
+	uint64_t total = 0;
+	for (size_t i = 0; i < counts.size(); i++)
+		total += counts[i];
+
+	uint64_t threshold = (uint64_t)((percent / 100) * total + 0.5);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < counts.size(); i++) {
+		seen += counts[i];
+		if (seen > 0 && seen >= threshold)
+			return (bucketMax(i) < max ? bucketMax(i) : max);
+	}
+	return max;
+}
+
+Histogram::Snapshot& Histogram::Snapshot::operator-=(const Snapshot& earlier) {
+	count -= earlier.count;
+	sum -= earlier.sum;
+	if (earlier.counts.size() == counts.size()) {
+		for (size_t i = 0; i < counts.size(); i++)
+			counts[i] -= earlier.counts[i];
+	}
+	return *this;
+}
+
+void ChannelStats::countMessage(size_t payloadSize) {
+	UMUNDO_STAT_ADD(_nrMsgs, 1);
+	_sizes.record(payloadSize);
+
+	uint64_t now = Thread::getTimeStampUs();
+#ifndef WITHOUT_CXX11
+	uint64_t last = _lastMsgUs.exchange(now, std::memory_order_relaxed);
+#else
+	uint64_t last = _lastMsgUs;
+	_lastMsgUs = now;
+#endif
+	if (last > 0 && now >= last)
+		_interArrival.record(now - last);
+}
+
+ChannelStats::Snapshot ChannelStats::snapshotCounters() const {
+	Snapshot snapshot;
+	snapshot.timeStamp = Thread::getTimeStampMs();
+	snapshot.nrMsgs = UMUNDO_STAT_GET(_nrMsgs);
+	snapshot.sizeMsgs = UMUNDO_STAT_GET(_sizeMsgs);
+	snapshot.nrCompressed = UMUNDO_STAT_GET(_nrCompressed);
+	snapshot.nrComprSkipped = UMUNDO_STAT_GET(_nrComprSkipped);
+	snapshot.nrQueueDropped = UMUNDO_STAT_GET(_nrQueueDropped);
+	return snapshot;
+}
+
+ChannelStats::Snapshot ChannelStats::snapshot() const {
+	Snapshot snapshot = snapshotCounters();
+	snapshot.sizes = _sizes.snapshot();
+	snapshot.interArrival = _interArrival.snapshot();
+	return snapshot;
+}
+
+ChannelStats::Snapshot& ChannelStats::Snapshot::operator-=(const Snapshot& earlier) {
+	nrMsgs -= earlier.nrMsgs;
+	sizeMsgs -= earlier.sizeMsgs;
+	nrCompressed -= earlier.nrCompressed;
+	nrComprSkipped -= earlier.nrComprSkipped;
+	nrQueueDropped -= earlier.nrQueueDropped;
+	sizes -= earlier.sizes;
+	interArrival -= earlier.interArrival;
+	return *this;
+}
+
+static inline uint64_t elapsed(uint64_t from, uint64_t to) {
+	// clocks of different hosts may disagree
+	return (to > from ? to - from : 0);
+}
+
+void TraceStats::record(const std::string& pubUUID, uint64_t seq, uint64_t sentUs, uint64_t forwardedUs, uint64_t receivedUs) {
+	UMUNDO_STAT_ADD(_nrTraced, 1);
+
+	std::map<std::string, uint64_t>::iterator seqIter = _lastSeq.find(pubUUID);
+	if (seqIter == _lastSeq.end()) {
+		_lastSeq[pubUUID] = seq;
+	} else if (seq > seqIter->second) {
+		if (seq > seqIter->second + 1)
+			UMUNDO_STAT_ADD(_nrLost, seq - seqIter->second - 1);
+		seqIter->second = seq;
+	} else {
+		UMUNDO_STAT_ADD(_nrReordered, 1);
+	}
+
+	_latency.record(elapsed(sentUs, receivedUs));
+	if (forwardedUs > 0) {
+		_toNode.record(elapsed(sentUs, forwardedUs));
+		_fromNode.record(elapsed(forwardedUs, receivedUs));
+	}
+}
+
+TraceStats::Snapshot TraceStats::snapshot() const {
+	Snapshot snapshot;
+	snapshot.nrTraced = UMUNDO_STAT_GET(_nrTraced);
+	snapshot.nrLost = UMUNDO_STAT_GET(_nrLost);
+	snapshot.nrReordered = UMUNDO_STAT_GET(_nrReordered);
+	snapshot.latency = _latency.snapshot();
+	snapshot.toNode = _toNode.snapshot();
+	snapshot.fromNode = _fromNode.snapshot();
+	return snapshot;
+}
+
+TraceStats::Snapshot& TraceStats::Snapshot::operator-=(const Snapshot& earlier) {
+	nrTraced -= earlier.nrTraced;
+	nrLost -= earlier.nrLost;
+	nrReordered -= earlier.nrReordered;
+	latency -= earlier.latency;
+	toNode -= earlier.toNode;
+	fromNode -= earlier.fromNode;
+	return *this;
+}
+
+}
@@ -0,0 +1,185 @@
+/**
+ *  @file
+ *  @brief      Counters and histograms updated without locks.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef STATISTICS_H_C8MN3XUE
+#define STATISTICS_H_C8MN3XUE
+
+#include "umundo/Common.h"
+
+#ifndef WITHOUT_CXX11
+#include <atomic>
+#endif
+
+#define UMUNDO_HISTOGRAM_SUB_BITS 3 // 8 buckets per power of two, values within 12.5%
+#define UMUNDO_HISTOGRAM_MAX_BITS 40 // larger values are counted in the last bucket
+#define UMUNDO_HISTOGRAM_BUCKETS (((UMUNDO_HISTOGRAM_MAX_BITS - UMUNDO_HISTOGRAM_SUB_BITS) + 2) << UMUNDO_HISTOGRAM_SUB_BITS)
+
+namespace umundo {
+
+#ifndef WITHOUT_CXX11
+typedef std::atomic<uint64_t> StatCounter;
+#define UMUNDO_STAT_ADD(counter, value) (counter).fetch_add((value), std::memory_order_relaxed)
+#define UMUNDO_STAT_GET(counter) (counter).load(std::memory_order_relaxed)
+#else
+// without atomics, concurrent updates may get lost, we accept that for statistics
+typedef volatile uint64_t StatCounter;
+#define UMUNDO_STAT_ADD(counter, value) ((counter) += (value))
+#define UMUNDO_STAT_GET(counter) (counter)
+#endif
+
+/**
+ * Distribution of values in buckets of logarithmic size as with HdrHistogram.
+ *
+ * Values below 8 have a bucket each, larger values share a bucket with those
+ * less than 12.5% apart. Recording is safe from any thread.
+ */
+class UMUNDO_API Histogram {
+public:
+	struct UMUNDO_API Snapshot {
+		Snapshot() : count(0), sum(0), max(0) {}
+
+		std::vector<uint64_t> counts; ///< per bucket, empty if nothing was recorded
+		uint64_t count;
+		uint64_t sum;
+		uint64_t max;
+
+		/// smallest value not exceeded by the given percentage of values
+		uint64_t percentile(double percent) const;
+		double mean() const {
+			return (count > 0 ? (double)sum / (double)count : 0);
+		}
+		/// values recorded since an earlier snapshot, max is kept as is
+		Snapshot& operator-=(const Snapshot& earlier);
+	};
+
+	Histogram();
+	void record(uint64_t value);
+	Snapshot snapshot() const;
+
+	static size_t bucketFor(uint64_t value);
+	static uint64_t bucketMax(size_t bucket); ///< largest value counted in bucket
+
+protected:
+	StatCounter _counts[UMUNDO_HISTOGRAM_BUCKETS];
+	StatCounter _count;
+	StatCounter _sum;
+	StatCounter _max;
+};
+
+/**
+ * Traffic on a channel, shared by the node and all its publishers on the channel.
+ *
+ * Counters only ever grow, rates are the difference of two snapshots.
+ */
+class UMUNDO_API ChannelStats {
+public:
+	struct UMUNDO_API Snapshot {
+		Snapshot() : timeStamp(0), nrMsgs(0), sizeMsgs(0), nrCompressed(0), nrComprSkipped(0), nrQueueDropped(0) {}
+
+		uint64_t timeStamp; ///< in ms as with Thread::getTimeStampMs
+		uint64_t nrMsgs;
+		uint64_t sizeMsgs; ///< bytes on the wire
+		uint64_t nrCompressed; ///< messages sent compressed
+		uint64_t nrComprSkipped; ///< messages adaptive compression sent uncompressed
+		uint64_t nrQueueDropped; ///< messages for unknown subscribers dropped from their queue
+		Histogram::Snapshot sizes; ///< payload sizes
+		Histogram::Snapshot interArrival; ///< us between two messages
+
+		Snapshot& operator-=(const Snapshot& earlier);
+	};
+
+	ChannelStats(const std::string& channelName) : _channelName(channelName), _nrMsgs(0), _sizeMsgs(0), _nrCompressed(0), _nrComprSkipped(0), _nrQueueDropped(0), _lastMsgUs(0) {}
+
+	/// a message with the given payload size
+	void countMessage(size_t payloadSize);
+	/// bytes put on the wire
+	void countBytes(size_t size) {
+		UMUNDO_STAT_ADD(_sizeMsgs, size);
+	}
+	void countCompressed() {
+		UMUNDO_STAT_ADD(_nrCompressed, 1);
+	}
+	void countComprSkipped() {
+		UMUNDO_STAT_ADD(_nrComprSkipped, 1);
+	}
+	void countQueueDropped(size_t nrMsgs) {
+		UMUNDO_STAT_ADD(_nrQueueDropped, nrMsgs);
+	}
+
+	/// counters only, without copying the histograms
+	Snapshot snapshotCounters() const;
+	Snapshot snapshot() const;
+
+	const std::string& getChannelName() const {
+		return _channelName;
+	}
+
+protected:
+	std::string _channelName;
+	StatCounter _nrMsgs;
+	StatCounter _sizeMsgs;
+	StatCounter _nrCompressed;
+	StatCounter _nrComprSkipped;
+	StatCounter _nrQueueDropped;
+	StatCounter _lastMsgUs;
+	Histogram _sizes;
+	Histogram _interArrival;
+};
+
+/**
+ * Latencies of traced messages received on a channel, see PublisherConfigTCP::enableTracing.
+ *
+ * Times are from the monotonic clock of every host, only messages of
+ * publishers on our host are recorded. Only the receiving thread records.
+ */
+class UMUNDO_API TraceStats {
+public:
+	struct UMUNDO_API Snapshot {
+		Snapshot() : nrTraced(0), nrLost(0), nrReordered(0) {}
+
+		uint64_t nrTraced;
+		uint64_t nrLost; ///< gaps in the sequence numbers of publishers
+		uint64_t nrReordered; ///< late or duplicate sequence numbers
+		Histogram::Snapshot latency; ///< us from publisher to subscriber
+		Histogram::Snapshot toNode; ///< us from publisher until its node forwarded
+		Histogram::Snapshot fromNode; ///< us from forwarding node to subscriber
+
+		Snapshot& operator-=(const Snapshot& earlier);
+	};
+
+	TraceStats() : _nrTraced(0), _nrLost(0), _nrReordered(0) {}
+
+	/// a traced message, forwardedUs is 0 if no node stamped it
+	void record(const std::string& pubUUID, uint64_t seq, uint64_t sentUs, uint64_t forwardedUs, uint64_t receivedUs);
+	Snapshot snapshot() const;
+
+protected:
+	StatCounter _nrTraced;
+	StatCounter _nrLost;
+	StatCounter _nrReordered;
+	Histogram _latency;
+	Histogram _toNode;
+	Histogram _fromNode;
+	std::map<std::string, uint64_t> _lastSeq; ///< per publisher
+};
+
+}
+
+#endif /* end of include guard: STATISTICS_H_C8MN3XUE */
@@ -0,0 +1,175 @@
+/**
+ *  @file
+ *  @brief      Radix tree from channel names to subscribers or publishers.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef CHANNELINDEX_H_W9DJ4QAS
+#define CHANNELINDEX_H_W9DJ4QAS
+
+#include "umundo/Common.h"
+
+namespace umundo {
+
+/**
+ * Entries by channel name and id, found by prefix as subscribers match publishers.
+ *
+ * Subscribers match all publishers whose channel starts with their own, so a
+ * publisher looks for the entries on the path to its channel and a subscriber
+ * for the entries below its channel. Both take time in the length of the channel
+ * and the number of entries found, not in the number of entries indexed.
+ */
+template<typename T> class ChannelIndex {
+public:
+	ChannelIndex() : _size(0) {}
+
+	/// add or replace the entry with the given id
+	void insert(const std::string& channel, const std::string& id, const T& value) {
+		Node* node = &_root;
+		size_t pos = 0;
+		while (pos < channel.size()) {
+			typename std::map<char, SharedPtr<Node> >::iterator childIter = node->children.find(channel[pos]);
+			if (childIter == node->children.end()) {
+				SharedPtr<Node> leaf(new Node());
+				leaf->label = channel.substr(pos);
+				node->children[channel[pos]] = leaf;
+				node = leaf.get();
+				break;
+			}
+
+			SharedPtr<Node> child = childIter->second;
+			size_t common = 1;
+			while (common < child->label.size() && pos + common < channel.size() && child->label[common] == channel[pos + common])
+				common++;
+
+			if (common < child->label.size()) {
+				// channel ends or differs within the label, split it
+				SharedPtr<Node> split(new Node());
+				split->label = child->label.substr(0, common);
+				child->label = child->label.substr(common);
+				split->children[child->label[0]] = child;
+				childIter->second = split;
+				child = split;
+			}
+			node = child.get();
+			pos += common;
+		}
+
+		if (node->entries.find(id) == node->entries.end())
+			_size++;
+		node->entries[id] = value;
+	}
+
+	/// remove the entry with the given id, false if there was none
+	bool erase(const std::string& channel, const std::string& id) {
+		std::vector<std::pair<Node*, char> > path; // parents and the keys of their children we took
+		Node* node = &_root;
+		size_t pos = 0;
+		while (pos < channel.size()) {
+			typename std::map<char, SharedPtr<Node> >::iterator childIter = node->children.find(channel[pos]);
+			if (childIter == node->children.end() || channel.compare(pos, childIter->second->label.size(), childIter->second->label) != 0)
+				return false;
+			path.push_back(std::make_pair(node, channel[pos]));
+			pos += childIter->second->label.size();
+			node = childIter->second.get();
+		}
+
+		if (node->entries.erase(id) == 0)
+			return false;
+		_size--;
+
+		// drop nodes without entries, merge the ones left with a single child
+		while (!path.empty() && node->entries.empty() && node->children.size() <= 1) {
+			Node* parent = path.back().first;
+			char key = path.back().second;
+			path.pop_back();
+
+			if (node->children.empty()) {
+				parent->children.erase(key);
+				node = parent;
+				continue;
+			}
+			SharedPtr<Node> child = node->children.begin()->second;
+			child->label = node->label + child->label;
+			parent->children[key] = child;
+			break;
+		}
+		return true;
+	}
+
+	/// entries whose channel is a prefix of the given one, as subscribers for a publisher
+	void findPrefixesOf(const std::string& channel, std::vector<T>& found) const {
+		const Node* node = &_root;
+		size_t pos = 0;
+		collect(node, found, false);
+		while (pos < channel.size()) {
+			typename std::map<char, SharedPtr<Node> >::const_iterator childIter = node->children.find(channel[pos]);
+			if (childIter == node->children.end() || channel.compare(pos, childIter->second->label.size(), childIter->second->label) != 0)
+				return;
+			pos += childIter->second->label.size();
+			node = childIter->second.get();
+			collect(node, found, false);
+		}
+	}
+
+	/// entries whose channel starts with the given prefix, as publishers for a subscriber
+	void findStartingWith(const std::string& prefix, std::vector<T>& found) const {
+		const Node* node = &_root;
+		size_t pos = 0;
+		while (pos < prefix.size()) {
+			typename std::map<char, SharedPtr<Node> >::const_iterator childIter = node->children.find(prefix[pos]);
+			if (childIter == node->children.end())
+				return;
+
+			// the prefix may end within the label
+			const std::string& label = childIter->second->label;
+			size_t length = (label.size() < prefix.size() - pos ? label.size() : prefix.size() - pos);
+			if (prefix.compare(pos, length, label, 0, length) != 0)
+				return;
+			pos += length;
+			node = childIter->second.get();
+		}
+		collect(node, found, true);
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+protected:
+	struct Node {
+		std::string label; ///< part of the channel name after the parent's
+		std::map<char, SharedPtr<Node> > children; ///< by the first character of their label
+		std::map<std::string, T> entries; ///< with exactly this channel name by id
+	};
+
+	static void collect(const Node* node, std::vector<T>& found, bool recurse) {
+		for (typename std::map<std::string, T>::const_iterator entryIter = node->entries.begin(); entryIter != node->entries.end(); entryIter++)
+			found.push_back(entryIter->second);
+		if (!recurse)
+			return;
+		for (typename std::map<char, SharedPtr<Node> >::const_iterator childIter = node->children.begin(); childIter != node->children.end(); childIter++)
+			collect(childIter->second.get(), found, true);
+	}
+
+	Node _root;
+	size_t _size;
+};
+
+}
+
+#endif /* end of include guard: CHANNELINDEX_H_W9DJ4QAS */
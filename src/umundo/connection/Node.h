@@ -63,6 +63,93 @@ public:
 	void allowLocalConnections(bool allow) {
 		options["node.allowLocal"] = toStr(allow);
 	}
+
+	/**
+	 * Deliver messages for subscribers added to this node from a pool of threads.
+	 *
+	 * Without, every subscriber with a receiver runs its own thread. Subscribers
+	 * can still opt out with SubscriberConfigTCP::enableDispatcher(false).
+	 * @param nrThreads Worker threads, 0 for one per core.
+	 */
+	void setDispatchThreads(size_t nrThreads) {
+		options["node.dispatch.threads"] = toStr(nrThreads);
+	}
+
+	/**
+	 * Tell connected nodes about our peers and connect to the ones they know.
+	 *
+	 * With only a few seed nodes given to every node, e.g. via DiscoveryConfigStatic,
+	 * all nodes still end up connected to each other. Every new connection exchanges
+	 * the peers known at either side and every intervalMs, a random peer is told
+	 * again while all others only hear that we are alive. Nodes without gossip
+	 * ignore it. A peer learned from gossip is removed again if we cannot connect
+	 * to it or it stops gossiping for four intervals.
+	 */
+	void enableGossip(bool enable = true, uint32_t intervalMs = 5000) {
+		options["node.gossip"] = toStr(enable);
+		options["node.gossip.interval"] = toStr(intervalMs);
+	}
+
+	/**
+	 * Changes to our publishers to remember for reconnecting nodes.
+	 *
+	 * A node reconnecting after a network outage only receives what changed since
+	 * the version of our publishers it last saw, if that is still among the
+	 * remembered changes. Otherwise it receives all of our publishers.
+	 */
+	void setPublisherHistory(size_t nrChanges) {
+		options["node.pubHistory"] = toStr(nrChanges);
+	}
+
+	/**
+	 * @name 0MQ context of the process
+	 *
+	 * There is a single context shared by all nodes, publishers and subscribers
+	 * of a process. These only take effect with the first node created, before
+	 * any publisher or subscriber.
+	 */
+	//@{
+	/// threads doing the network IO, 0 for one per core
+	void setIOThreads(int nrThreads) {
+		options["node.zmq.ioThreads"] = toStr(nrThreads);
+	}
+
+	/// pin the IO threads to the given cores, call for every core
+	void addIOThreadAffinity(int cpu) {
+		if (options["node.zmq.ioThreadAffinity"].size() > 0)
+			options["node.zmq.ioThreadAffinity"] += ",";
+		options["node.zmq.ioThreadAffinity"] += toStr(cpu);
+	}
+
+	/// scheduling of the IO threads as for sched_setscheduler, -1 to keep the default policy
+	void setIOThreadPriority(int priority, int policy = -1) {
+		options["node.zmq.ioThreadPriority"] = toStr(priority);
+		options["node.zmq.ioThreadSchedPolicy"] = toStr(policy);
+	}
+	//@}
+
+	/** @name Sockets of this node to remote nodes */
+	//@{
+	/// messages queued per peer before dropping, 0 for no limit
+	void setHighWaterMarks(int sndHwm, int rcvHwm) {
+		options["node.zmq.sndhwm"] = toStr(sndHwm);
+		options["node.zmq.rcvhwm"] = toStr(rcvHwm);
+	}
+
+	/// kernel socket buffers, 0 for the system default
+	void setSocketBuffers(int sndBuf, int rcvBuf) {
+		options["node.zmq.sndbuf"] = toStr(sndBuf);
+		options["node.zmq.rcvbuf"] = toStr(rcvBuf);
+	}
+
+	/// detect dead connections, times in seconds, -1 for the system default
+	void setTCPKeepAlive(int idle, int interval = -1, int count = -1) {
+		options["node.zmq.keepalive"] = toStr(1);
+		options["node.zmq.keepalive.idle"] = toStr(idle);
+		options["node.zmq.keepalive.intvl"] = toStr(interval);
+		options["node.zmq.keepalive.cnt"] = toStr(count);
+	}
+	//@}
 };
 
 /**
@@ -83,6 +170,11 @@ public:
 	virtual std::map<std::string, NodeStub> connectedFrom() = 0;
 	virtual std::map<std::string, NodeStub> connectedTo() = 0;
 
+	/// port of the node-global publisher, 0 if there is none
+	virtual uint16_t getPubPort() {
+		return 0;
+	}
+
 	virtual std::map<std::string, Subscriber> getSubscribers() {
 		return _subs;
 	}
@@ -27,7 +27,7 @@ namespace umundo {
 
 int PublisherImpl::instances = 0;
 
-PublisherImpl::PublisherImpl() : _greeter(NULL) {
+PublisherImpl::PublisherImpl() : _mandatoryMetaVersion(0), _greeter(NULL) {
 	instances++;
 }
 
@@ -59,12 +59,21 @@ public:
 
 	virtual void send(Message* msg) = 0;
 
+	/** Send several messages at once, implementors may coalesce them on the wire */
+	virtual void sendBatch(const std::vector<Message*>& msgs) {
+		for (std::vector<Message*>::const_iterator msgIter = msgs.begin(); msgIter != msgs.end(); msgIter++) {
+			send(*msgIter);
+		}
+	}
+
 	/** Meta fields to be set on every message published */
 	void putMeta(const std::string& key, const std::string& value) {
 		_mandatoryMeta[key] = value;
+		_mandatoryMetaVersion++;
 	}
 	void clearMeta(const std::string& key) {
 		_mandatoryMeta.erase(key);
+		_mandatoryMetaVersion++;
 	}
 
 	/** @name Optional subscriber awareness */
@@ -97,6 +106,7 @@ protected:
 	//@}
 
 	std::map<std::string, std::string> _mandatoryMeta;
+	uint32_t _mandatoryMetaVersion; ///< changes whenever _mandatoryMeta changes
 	std::map<std::string, SubscriberStub> _subs;
 
 	Greeter* _greeter;
@@ -146,6 +156,9 @@ public:
 		_impl->send(msg);
 	}
 	void send(const char* data, size_t length);
+	void sendBatch(const std::vector<Message*>& msgs) {
+		_impl->sendBatch(msgs);
+	}
 	int waitForSubscribers(int count, int timeoutMs = 0) {
 		return _impl->waitForSubscribers(count, timeoutMs);
 	}
@@ -214,7 +227,35 @@ public:
             options["pub.compression.refreshInterval"] = toStr(refreshInterval);
 
 	}
-    
+
+	/**
+	 * Send payloads uncompressed while compression does not pay off.
+	 *
+	 * The achieved ratio is tracked per payload size and compression is probed
+	 * again periodically, so a single setting suits channels with mixed content.
+	 */
+	void enableAdaptiveCompression(bool enable = true) {
+		options["pub.compression.adaptive"] = toStr(enable);
+	}
+
+	/**
+	 * Limit messages kept for explicitly addressed subscribers not connected yet.
+	 *
+	 * Messages with an um.sub meta field are queued until the subscriber shows up.
+	 * Per subscriber, at most maxMsgs messages with maxBytes of payload are kept
+	 * for at most ttlMs, a limit of 0 disables it.
+	 */
+	void setQueueLimits(size_t maxMsgs, size_t maxBytes, uint64_t ttlMs) {
+		options["pub.queue.maxMsgs"] = toStr(maxMsgs);
+		options["pub.queue.maxBytes"] = toStr(maxBytes);
+		options["pub.queue.ttl"] = toStr(ttlMs);
+	}
+
+	/// drop the newest instead of the oldest messages once a queue is full
+	void setQueueDropNewest(bool dropNewest = true) {
+		options["pub.queue.dropNewest"] = toStr(dropNewest);
+	}
+
 	friend class Publisher;
 };
 
@@ -225,6 +266,62 @@ public:
 		_type = Publisher::ZEROMQ;
 	}
 
+	/**
+	 * Hand the payload to 0MQ without copying it into the wire buffer.
+	 *
+	 * The payload is sent as a frame of its own and its memory is kept alive until
+	 * 0MQ released it. Messages with WRAP_DATA and no done callback are still copied,
+	 * compressed messages are always encoded into a new buffer.
+	 */
+	void enableZeroCopy(bool enable = true) {
+		options["pub.zeroCopy"] = toStr(enable);
+	}
+
+	/**
+	 * Pass large payloads to subscribers on the same host via shared memory.
+	 *
+	 * Enabled by default where available. Subscribers copy payloads out of a ring
+	 * of the given size, the ones falling behind by more than the ring lose them.
+	 * Only processes of the same user can read the ring, subscribers of other
+	 * users get the payloads sent as usual.
+	 */
+	void enableSharedMemory(bool enable = true) {
+		options["pub.shm"] = toStr(enable);
+	}
+
+	void setSharedMemorySize(size_t size) {
+		options["pub.shm.size"] = toStr(size);
+	}
+
+	/**
+	 * Replay the last messages sent on the channel to every new subscriber.
+	 *
+	 * Keeps the last depth messages as they were encoded, or with a key, the last
+	 * message per value of that meta field for up to depth values.
+	 */
+	void enableLastValueCache(size_t depth = 1, const std::string& key = "") {
+		options["pub.lvc.depth"] = toStr(depth);
+		options["pub.lvc.key"] = key;
+	}
+
+	/**
+	 * Stamp messages with a sequence number and the time they were sent.
+	 *
+	 * The node stamps the time it forwarded them, subscribers record latencies
+	 * and lost messages, see Subscriber::getTraceStats. Subscribers need to be
+	 * of a version understanding traced messages. Compressed messages and those
+	 * for explicit subscribers are not traced. Times are from the monotonic
+	 * clock, subscribers on other hosts do not record them.
+	 */
+	void enableTracing(bool enable = true) {
+		options["pub.trace"] = toStr(enable);
+	}
+
+	/// messages the node has yet to forward before we drop more, 0 for no limit
+	void setHighWaterMark(int hwm) {
+		options["pub.zmq.sndhwm"] = toStr(hwm);
+	}
+
 protected:
 	friend class Publisher;
 };
@@ -27,6 +27,7 @@
 #include "umundo/connection/SubscriberStub.h"
 #include "umundo/EndPoint.h"
 #include "umundo/Implementation.h"
+#include "umundo/Statistics.h"
 
 #include <list>
 
@@ -76,6 +77,11 @@ public:
 	virtual Message* getNextMsg() = 0;
 	virtual bool hasNextMsg() = 0;
 
+	/** Latencies of traced messages received, empty if the implementor does not trace */
+	virtual TraceStats::Snapshot getTraceStats() {
+		return TraceStats::Snapshot();
+	}
+
 	virtual bool matches(const PublisherStub& pub) {
 		// are our types equal and is our channel a prefix of the given channel?
 		return (pub.getImpl()->implType == implType &&
@@ -149,6 +155,10 @@ public:
 		return _impl->hasNextMsg();
 	}
 
+	TraceStats::Snapshot getTraceStats() {
+		return _impl->getTraceStats();
+	}
+
 	std::map<std::string, PublisherStub> getPublishers()             {
 		return _impl->getPublishers();
 	}
@@ -207,6 +217,56 @@ public:
 		_type = Subscriber::ZEROMQ;
 	}
 
+	/**
+	 * Deliver messages referring into the received 0MQ frames.
+	 *
+	 * Payloads are not copied and meta fields are only parsed when first accessed.
+	 * A message keeps its frames alive, so do not hold on to many of them.
+	 */
+	void enableZeroCopy(bool enable = true) {
+		options["sub.zeroCopy"] = toStr(enable);
+	}
+
+	/**
+	 * Have a shared pool of threads deliver messages instead of a thread of our own.
+	 *
+	 * Messages are still delivered in order and one at a time. Enabled, we use the
+	 * pool of the node we are added to or a process-wide one with a thread per core,
+	 * disabled we keep our own thread even if the node has a pool.
+	 */
+	void enableDispatcher(bool enable = true) {
+		options["sub.dispatch"] = toStr(enable);
+	}
+
+	/**
+	 * Deliver only the latest message pending when the receiver falls behind.
+	 *
+	 * For channels carrying state, older messages are dropped per publisher or,
+	 * with a key, per publisher and value of that meta field.
+	 */
+	void enableConflation(bool enable = true, const std::string& key = "") {
+		options["sub.conflate"] = toStr(enable);
+		options["sub.conflate.key"] = key;
+	}
+
+	/// messages 0MQ keeps per connected publisher before dropping, 0 for no limit
+	void setHighWaterMark(int hwm) {
+		options["sub.zmq.rcvhwm"] = toStr(hwm);
+	}
+
+	/// kernel receive buffer of the connections to remote nodes
+	void setReceiveBuffer(int size) {
+		options["sub.zmq.rcvbuf"] = toStr(size);
+	}
+
+	/// detect dead connections to remote nodes, times in seconds, -1 for the system default
+	void setTCPKeepAlive(int idle, int interval = -1, int count = -1) {
+		options["sub.zmq.keepalive"] = toStr(1);
+		options["sub.zmq.keepalive.idle"] = toStr(idle);
+		options["sub.zmq.keepalive.intvl"] = toStr(interval);
+		options["sub.zmq.keepalive.cnt"] = toStr(count);
+	}
+
 protected:
 	friend class Subscriber;
 };
@@ -231,6 +291,26 @@ public:
 			setMulticastIP("239.8.4.8");		//default multicast address for umundo rtp
 		setPortbase(port);
 	}
+
+	/**
+	 * Deliver packets ordered by sequence number, holding up to depth of them.
+	 *
+	 * Late packets are dropped, missing ones are skipped when the buffer is full
+	 * or nothing arrived for a while. Meant for a single publisher per subscriber.
+	 */
+	void setJitterBuffer(size_t depth) {
+		options["sub.rtp.jitterBuffer"] = toStr(depth);
+	}
+
+	/// packets pending delivery before we drop new ones
+	void setQueueSize(size_t size) {
+		options["sub.rtp.queueSize"] = toStr(size);
+	}
+
+	/// set the um.* meta fields, or only the fields of RTPMessage when disabled
+	void enableHeaderMeta(bool enable = true) {
+		options["sub.rtp.headerMeta"] = toStr(enable);
+	}
 };
 
 
@@ -0,0 +1,83 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/connection/SubscriberQueue.h"
+#include "umundo/Message.h"
+
+namespace umundo {
+
+SubscriberQueue::~SubscriberQueue() {
+	while(!_msgs.empty())
+		dropFront();
+}
+
+size_t SubscriberQueue::push(Message* msg, uint64_t now, const Limits& limits) {
+	size_t dropped = expire(now, limits);
+
+	bool fits = (limits.maxBytes == 0 || msg->size() <= limits.maxBytes);
+	if (fits && limits.policy == DROP_NEWEST) {
+		fits = (limits.maxMsgs == 0 || _msgs.size() < limits.maxMsgs) &&
+		       (limits.maxBytes == 0 || _bytes + msg->size() <= limits.maxBytes);
+	}
+	if (!fits) {
+		delete msg;
+		_dropped++;
+		return dropped + 1;
+	}
+
+	_msgs.push_back(std::make_pair(now, msg));
+	_bytes += msg->size();
+
+	while((limits.maxMsgs > 0 && _msgs.size() > limits.maxMsgs) ||
+	        (limits.maxBytes > 0 && _bytes > limits.maxBytes)) {
+		dropFront();
+		dropped++;
+	}
+	return dropped;
+}
+
+size_t SubscriberQueue::expire(uint64_t now, const Limits& limits) {
+	if (limits.ttlMs == 0)
+		return 0;
+
+	// queued in order, the oldest are in front
+	size_t dropped = 0;
+	while(!_msgs.empty() && _msgs.front().first + limits.ttlMs <= now) {
+		dropFront();
+		dropped++;
+	}
+	return dropped;
+}
+
+Message* SubscriberQueue::pop() {
+	if (_msgs.empty())
+		return NULL;
+	Message* msg = _msgs.front().second;
+	_bytes -= msg->size();
+	_msgs.pop_front();
+	return msg;
+}
+
+void SubscriberQueue::dropFront() {
+	Message* msg = pop();
+	delete msg;
+	_dropped++;
+}
+
+}
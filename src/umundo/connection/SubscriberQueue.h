@@ -0,0 +1,97 @@
+/**
+ *  @file
+ *  @brief      Bounded queue of messages for a subscriber that is not connected yet.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef SUBSCRIBERQUEUE_H_P5XG2KWB
+#define SUBSCRIBERQUEUE_H_P5XG2KWB
+
+#include "umundo/Common.h"
+
+#include <list>
+
+#define UMUNDO_QUEUE_MAX_MSGS 1024 // default messages kept per subscriber
+#define UMUNDO_QUEUE_MAX_BYTES (4 * 1024 * 1024) // default payload bytes kept per subscriber
+#define UMUNDO_QUEUE_TTL_MS 30000 // default time until queued messages expire
+
+namespace umundo {
+
+class Message;
+
+/**
+ * Messages explicitly addressed to a subscriber we do not know yet.
+ *
+ * The queue owns its messages and drops them once they expire or the limits
+ * are exceeded, so a subscriber that never shows up does not keep them forever.
+ */
+class UMUNDO_API SubscriberQueue {
+public:
+	enum DropPolicy {
+		DROP_OLDEST = 0, ///< make room for new messages
+		DROP_NEWEST = 1  ///< keep the messages we have
+	};
+
+	struct Limits {
+		Limits() : maxMsgs(UMUNDO_QUEUE_MAX_MSGS), maxBytes(UMUNDO_QUEUE_MAX_BYTES), ttlMs(UMUNDO_QUEUE_TTL_MS), policy(DROP_OLDEST) {}
+		size_t maxMsgs; ///< 0 for no limit
+		size_t maxBytes; ///< 0 for no limit
+		uint64_t ttlMs; ///< 0 to never expire
+		DropPolicy policy;
+	};
+
+	SubscriberQueue() : _bytes(0), _dropped(0) {}
+	virtual ~SubscriberQueue();
+
+	/// take ownership of the message, returns how many messages were dropped
+	size_t push(Message* msg, uint64_t now, const Limits& limits);
+	/// drop messages older than the limits allow, returns how many
+	size_t expire(uint64_t now, const Limits& limits);
+	/// oldest message for the caller to delete, NULL if empty
+	Message* pop();
+
+	bool empty() const {
+		return _msgs.empty();
+	}
+	size_t size() const {
+		return _msgs.size();
+	}
+	size_t bytes() const {
+		return _bytes;
+	}
+	/// messages dropped from this queue ever
+	uint64_t dropped() const {
+		return _dropped;
+	}
+
+protected:
+	void dropFront();
+
+	std::list<std::pair<uint64_t, Message*> > _msgs; ///< with the time they were queued
+	size_t _bytes;
+	uint64_t _dropped;
+
+private:
+	SubscriberQueue(const SubscriberQueue& other) {}
+	SubscriberQueue& operator=(const SubscriberQueue& other) {
+		return *this;
+	}
+};
+
+}
+
+#endif /* end of include guard: SUBSCRIBERQUEUE_H_P5XG2KWB */
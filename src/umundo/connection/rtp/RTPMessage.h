@@ -0,0 +1,74 @@
+/**
+ *  @file
+ *  @brief      Messages received via RTP with their header fields.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef RTPMESSAGE_H_B3KQ7XWM
+#define RTPMESSAGE_H_B3KQ7XWM
+
+#include "umundo/Common.h"
+#include "umundo/Message.h"
+
+namespace umundo {
+
+/**
+ * A message from an RTP subscriber, cast to get at the header fields.
+ *
+ * The fields are set on the thread receiving the packet, the um.* meta fields
+ * with their string representation are only written before delivery and not at
+ * all if the subscriber was configured without them.
+ */
+class UMUNDO_API RTPMessage : public Message {
+public:
+	RTPMessage(const char* data, size_t length) : Message(data, length),
+		version(0), padding(false), extension(false), marker(false), payloadType(0),
+		sequenceNumber(0), extendedSequenceNumber(0), timestamp(0), ssrc(0), csrcCount(0) {}
+
+	uint8_t version;
+	bool padding;
+	bool extension;
+	bool marker;
+	uint8_t payloadType;
+	uint16_t sequenceNumber;
+	uint32_t extendedSequenceNumber; ///< sequence number counting wrap arounds in the upper 16 bits
+	uint32_t timestamp;
+	uint32_t ssrc;
+	uint8_t csrcCount;
+	uint32_t csrc[16];
+
+	/// header fields as the um.* meta fields we always had
+	void putHeaderMeta() {
+		putMeta("um.type", "RTP");
+		putMeta("um.version", toStr((uint16_t)version));
+		putMeta("um.extension", toStr(extension));
+		putMeta("um.padding", toStr(padding));
+		putMeta("um.marker", toStr(marker));
+		putMeta("um.ssrc", toStr(ssrc));
+		putMeta("um.timestamp", toStr(timestamp));
+		putMeta("um.payloadType", toStr((uint16_t)payloadType)); // force numeric literal
+		putMeta("um.sequenceNumber", toStr(sequenceNumber));
+		putMeta("um.extendedSequenceNumber", toStr(extendedSequenceNumber));
+		putMeta("um.csrccount", toStr((uint16_t)csrcCount));
+		for (int i = 0; i < csrcCount; i++)
+			putMeta("um.csrc" + toStr(i), toStr(csrc[i]));
+	}
+};
+
+}
+
+#endif /* end of include guard: RTPMESSAGE_H_B3KQ7XWM */
@@ -29,6 +29,11 @@
 #include <winsock2.h>
 #endif // WIN32
 
+#ifdef HAVE_SENDMMSG
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 #include <boost/bind.hpp>
 
 #include "umundo/connection/rtp/RTPPublisher.h"
@@ -54,6 +59,11 @@ struct rtp_sock {
 	struct rtcp_sess *rtcp; /**< RTCP Session          */
 	bool rtcp_mux;          /**< RTP/RTCP multiplexing */
 };
+
+//taken from libre src/rtp/rtcp.h, not part of its public headers but called by rtp_send for every packet.
+//exported by the libre 0.4.x we build, see BuildLibRE.cmake. It is not checked for at configure time
+//as libre is only built as an external project afterwards, update it along with rtp_sock above.
+extern "C" void rtcp_sess_tx_rtp(struct rtcp_sess *sess, uint32_t ts, size_t payload_size);
 }
 
 namespace umundo {
@@ -249,16 +259,25 @@ void RTPPublisher::removed(const SubscriberStub& sub, const NodeStub& node) {
 
 void RTPPublisher::send(Message* msg) {
 	RScopeLock lock(_mutex);
-	int status = 0;
-	uint32_t timestamp = 0;
-	uint8_t payloadType = _payloadType;
-	uint16_t sequenceNumber = strTo<uint16_t>(msg->getMeta("um.sequenceNumber"));		//only for internal use by umundo-bridge
-	bool marker = strTo<bool>(msg->getMeta("um.marker"));
+	std::vector<Message*> msgs(1, msg);
+	sendPackets(msgs);
+}
+
+void RTPPublisher::sendBatch(const std::vector<Message*>& msgs) {
+	RScopeLock lock(_mutex);
+	sendPackets(msgs);
+}
+
+RTPPublisher::RTPHeader RTPPublisher::prepareHeader(Message* msg) {
+	RTPHeader header;
+	header.payloadType = _payloadType;
+	header.sequenceNumber = strTo<uint16_t>(msg->getMeta("um.sequenceNumber"));		//only for internal use by umundo-bridge
+	header.marker = strTo<bool>(msg->getMeta("um.marker"));
 	if (!msg->getMeta("um.sequenceNumber").size())
-		sequenceNumber = _sequenceNumber++;
+		header.sequenceNumber = _sequenceNumber++;
 
 	if (!msg->getMeta("um.marker").size())
-		marker = false;
+		header.marker = false;
 
 	std::string timestampIncrement = msg->getMeta("um.timestampIncrement");
 
@@ -266,36 +285,147 @@ void RTPPublisher::send(Message* msg) {
 		timestampIncrement = _mandatoryMeta["um.timestampIncrement"];
 
 	if (msg->getMeta("um.timestamp").size())	{					//mainly for internal use by umundo-bridge
-		timestamp = strTo<uint32_t>(msg->getMeta("um.timestamp"));
+		header.timestamp = strTo<uint32_t>(msg->getMeta("um.timestamp"));
 	} else {
 		if (timestampIncrement.size()) {
-			timestamp = (_timestamp += strTo<uint32_t>(timestampIncrement));
+			header.timestamp = (_timestamp += strTo<uint32_t>(timestampIncrement));
 		}	else {
-			timestamp = (_timestamp += _timestampIncrement);
+			header.timestamp = (_timestamp += _timestampIncrement);
 		}
 	}
 	if (msg->getMeta("um.payloadType").size())							//mainly for internal use by umundo-bridge
-		payloadType = strTo<uint8_t>(msg->getMeta("um.payloadType"));
-
-	//allocate buffer
-	libre::mbuf *mb = libre::mbuf_alloc(libre::RTP_HEADER_SIZE + msg->size());
-	//make room for rtp header
-	libre::mbuf_set_end(mb, libre::RTP_HEADER_SIZE);
-	libre::mbuf_skip_to_end(mb);
-	//write data
-	libre::mbuf_write_mem(mb, (const uint8_t*)msg->data(), msg->size());
-	//send data
+		header.payloadType = strTo<uint8_t>(msg->getMeta("um.payloadType"));
+	return header;
+}
+
+void RTPPublisher::sendPackets(const std::vector<Message*>& msgs) {
+	if (!_initDone)
+		return;
+
+	std::vector<RTPHeader> headers;
+	headers.reserve(msgs.size());
+	for (size_t i = 0; i < msgs.size(); i++)
+		headers.push_back(prepareHeader(msgs[i]));
+
+	if (_destinations.size() == 0)
+		return;
+
+	if (sendPacketsMulti(msgs, headers))
+		return;
+
+	int status = 0;
+	for (size_t i = 0; i < msgs.size(); i++) {
+		Message* msg = msgs[i];
+		//allocate buffer
+		libre::mbuf *mb = libre::mbuf_alloc(libre::RTP_HEADER_SIZE + msg->size());
+		//make room for rtp header
+		libre::mbuf_set_end(mb, libre::RTP_HEADER_SIZE);
+		libre::mbuf_skip_to_end(mb);
+		//write data
+		libre::mbuf_write_mem(mb, (const uint8_t*)msg->data(), msg->size());
+		//send data
+		typedef std::map<std::string, struct libre::sa>::iterator it_type;
+		for(it_type iterator = _destinations.begin(); iterator !=  _destinations.end(); iterator++) {
+			//reset buffer pos to start of data
+			libre::mbuf_set_pos(mb, libre::RTP_HEADER_SIZE);
+			if (headers[i].sequenceNumber)
+				_rtp_socket->enc.seq = headers[i].sequenceNumber;
+			if ((status = libre::rtp_send(_rtp_socket, &iterator->second, headers[i].marker, headers[i].payloadType, headers[i].timestamp, mb)))
+				UM_LOG_INFO("%s: error in libre::rtp_send() for destination '%s': %s", SHORT_UUID(_uuid).c_str(), iterator->first.c_str(), strerror(status));
+		}
+		//cleanup
+		libre::mem_deref(mb);
+	}
+}
+
+/**
+ * Encode the RTP header of every message once and hand the packets for all
+ * destinations to the kernel with as few calls to sendmmsg as possible.
+ */
+bool RTPPublisher::sendPacketsMulti(const std::vector<Message*>& msgs, const std::vector<RTPHeader>& headers) {
+#ifdef HAVE_SENDMMSG
+	// libre keeps one socket per address family, destinations are sent in one pass per socket
 	typedef std::map<std::string, struct libre::sa>::iterator it_type;
+	std::map<int, std::vector<struct libre::sa*> > sockets;
 	for(it_type iterator = _destinations.begin(); iterator !=  _destinations.end(); iterator++) {
-		//reset buffer pos to start of data
-		libre::mbuf_set_pos(mb, libre::RTP_HEADER_SIZE);
-		if (sequenceNumber)
-			_rtp_socket->enc.seq = sequenceNumber;
-		if ((status = libre::rtp_send(_rtp_socket, &iterator->second, marker, payloadType, timestamp, mb)))
-			UM_LOG_INFO("%s: error in libre::rtp_send() for destination '%s': %s", SHORT_UUID(_uuid).c_str(), iterator->first.c_str(), strerror(status));
+		int fd = libre::udp_sock_fd((libre::udp_sock*)libre::rtp_sock(_rtp_socket), iterator->second.u.sa.sa_family);
+		if (fd < 0)
+			return false;
+		sockets[fd].push_back(&iterator->second);
 	}
-	//cleanup
-	libre::mem_deref(mb);
+
+	// RFC 3550 fixed header without CSRCs as written by libre::rtp_send
+	std::vector<uint8_t> encoded(msgs.size() * libre::RTP_HEADER_SIZE);
+	for (size_t i = 0; i < msgs.size(); i++) {
+		uint8_t* header = &encoded[i * libre::RTP_HEADER_SIZE];
+		uint16_t sequenceNumber = htons(headers[i].sequenceNumber);
+		uint32_t timestamp = htonl(headers[i].timestamp);
+		uint32_t ssrc = htonl(_rtp_socket->enc.ssrc);
+		header[0] = 2 << 6; // version 2, no padding, extension or CSRCs
+		header[1] = (headers[i].marker ? 1 << 7 : 0) | (headers[i].payloadType & 0x7f);
+		memcpy(header + 2, &sequenceNumber, 2);
+		memcpy(header + 4, &timestamp, 4);
+		memcpy(header + 8, &ssrc, 4);
+
+		// as if libre sent it, including the sender statistics of RTCP for every packet
+		if (headers[i].sequenceNumber)
+			_rtp_socket->enc.seq = headers[i].sequenceNumber + 1;
+		if (_rtp_socket->rtcp) {
+			for (size_t j = 0; j < _destinations.size(); j++)
+				libre::rtcp_sess_tx_rtp(_rtp_socket->rtcp, headers[i].timestamp, msgs[i]->size());
+		}
+	}
+
+	std::map<int, std::vector<struct libre::sa*> >::iterator socketIter = sockets.begin();
+	while(socketIter != sockets.end()) {
+		int fd = socketIter->first;
+		std::vector<struct libre::sa*>& dests = socketIter->second;
+
+		size_t nrPackets = msgs.size() * dests.size();
+		std::vector<struct iovec> iovecs(nrPackets * 2);
+		std::vector<struct mmsghdr> packets(nrPackets);
+		memset(&packets[0], 0, nrPackets * sizeof(struct mmsghdr));
+
+		size_t packet = 0;
+		for (size_t i = 0; i < msgs.size(); i++) {
+			for (size_t j = 0; j < dests.size(); j++, packet++) {
+				iovecs[packet * 2].iov_base = &encoded[i * libre::RTP_HEADER_SIZE];
+				iovecs[packet * 2].iov_len = libre::RTP_HEADER_SIZE;
+				iovecs[packet * 2 + 1].iov_base = (void*)msgs[i]->data();
+				iovecs[packet * 2 + 1].iov_len = msgs[i]->size();
+				packets[packet].msg_hdr.msg_name = &dests[j]->u.sa;
+				packets[packet].msg_hdr.msg_namelen = dests[j]->len;
+				packets[packet].msg_hdr.msg_iov = &iovecs[packet * 2];
+				packets[packet].msg_hdr.msg_iovlen = 2;
+			}
+		}
+
+		// the socket does not block, packets it has no room for are lost as with rtp_send
+		packet = 0;
+		size_t nrDropped = 0;
+		int error = 0;
+		while (packet < nrPackets) {
+			unsigned int batchSize = (nrPackets - packet > UIO_MAXIOV ? UIO_MAXIOV : nrPackets - packet);
+			int sent = sendmmsg(fd, &packets[packet], batchSize, 0);
+			if (sent <= 0) {
+				error = errno;
+				if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS) {
+					sent = batchSize; // no room for the others either
+				} else {
+					sent = 1; // skip the packet we failed on
+				}
+				nrDropped += sent;
+			}
+			packet += sent;
+		}
+		if (nrDropped > 0)
+			UM_LOG_WARN("%s: sendmmsg() dropped %lu of %lu packets: %s", SHORT_UUID(_uuid).c_str(), (unsigned long)nrDropped, (unsigned long)nrPackets, strerror(error));
+		socketIter++;
+	}
+	return true;
+#else
+	return false;
+#endif
 }
 
 void RTPPublisher::rtp_recv(const struct libre::sa *src, const struct libre::rtp_header *hdr, struct libre::mbuf *mb, void *arg) {
@@ -44,6 +44,7 @@ public:
 	void resume();
 
 	void send(Message* msg);
+	void sendBatch(const std::vector<Message*>& msgs);
 	int waitForSubscribers(int count, int timeoutMs);
 
 protected:
@@ -56,6 +57,17 @@ protected:
 	void removed(const SubscriberStub& sub, const NodeStub& node);
 
 private:
+	/// fields of the RTP header for a message, see prepareHeader
+	struct RTPHeader {
+		bool marker;
+		uint8_t payloadType;
+		uint16_t sequenceNumber;
+		uint32_t timestamp;
+	};
+	RTPHeader prepareHeader(Message* msg);
+	void sendPackets(const std::vector<Message*>& msgs);
+	bool sendPacketsMulti(const std::vector<Message*>& msgs, const std::vector<RTPHeader>& headers);
+
 	uint8_t _payloadType;
 	uint32_t _timestampIncrement;
 	uint16_t _sequenceNumber;
@@ -31,7 +31,10 @@
 
 namespace umundo {
 
-RTPSubscriber::RTPSubscriber() : _extendedSequenceNumber(0), _lastSequenceNumber(0), _isSuspended(false), _initDone(false) {
+RTPSubscriber::RTPSubscriber() : _extendedSequenceNumber(0), _lastSequenceNumber(0), _hasSequenceNumber(false), _lastSsrc(0), _nrDropped(0),
+	_isSuspended(false), _initDone(false), _headerMeta(true), _isWaiting(false),
+	_jitterDepth(0), _nextSequenceNumber(0), _hasNextSequenceNumber(false), _jitterSsrc(0), _lastArrival(0) {
+	_queue = SharedPtr<SPSCQueue<RTPMessage*> >(new SPSCQueue<RTPMessage*>(UMUNDO_RTP_QUEUE_SIZE));
 #ifdef WIN32
 	WSADATA dat;
 	WSAStartup(MAKEWORD(2,2),&dat);
@@ -45,6 +48,14 @@ void RTPSubscriber::init(const Options* config) {
 	uint16_t max = 65534;		//maximum rtp port
 	uint16_t portbase = strTo<uint16_t>(config->getKVPs()["sub.rtp.portbase"]);
 	std::string multicastIP = config->getKVPs()["sub.rtp.multicast"];
+
+	if (config->getKVPs().count("sub.rtp.queueSize") && strTo<size_t>(config->getKVPs()["sub.rtp.queueSize"]) > 0)
+		_queue = SharedPtr<SPSCQueue<RTPMessage*> >(new SPSCQueue<RTPMessage*>(strTo<size_t>(config->getKVPs()["sub.rtp.queueSize"])));
+	if (config->getKVPs().count("sub.rtp.jitterBuffer"))
+		_jitterDepth = strTo<size_t>(config->getKVPs()["sub.rtp.jitterBuffer"]);
+	if (config->getKVPs().count("sub.rtp.headerMeta"))
+		_headerMeta = strTo<bool>(config->getKVPs()["sub.rtp.headerMeta"]);
+
 	if (config->getKVPs().count("pub.rtp.multicast") && !config->getKVPs().count("pub.rtp.portbase")) {
 		UM_LOG_ERR("%s: error RTPSubscriber.init(): you need to specify a valid multicast portbase (0 < portbase < 65535) when using multicast", SHORT_UUID(_uuid).c_str());
 		return;
@@ -110,6 +121,12 @@ RTPSubscriber::~RTPSubscriber() {
 	if (_initDone) {
 		libre::mem_deref(_rtp_socket);
 	}
+
+	RTPMessage* msg = NULL;
+	while(_queue->pop(msg))
+		delete msg;
+	for (std::map<uint32_t, RTPMessage*>::iterator msgIter = _jitterBuffer.begin(); msgIter != _jitterBuffer.end(); msgIter++)
+		delete msgIter->second;
 #ifdef WIN32
 	WSACleanup();
 #endif // WIN32
@@ -213,12 +230,20 @@ void RTPSubscriber::run() {
 		Message *msg = NULL;
 		{
 			RScopeLock lock(_mutex);
-			if (_queue.empty())
-				_cond.wait(_mutex);
-			if (_queue.empty())
+			msg = dequeue();
+			if (msg == NULL) {
+				// tell the libre thread before looking again, it checks after pushing
+				_isWaiting = true;
+				if (_queue->empty()) {
+					if (_jitterBuffer.empty()) {
+						_cond.wait(_mutex);
+					} else {
+						_cond.wait(_mutex, UMUNDO_RTP_JITTER_FLUSH_MS);
+					}
+				}
+				_isWaiting = false;
 				continue;
-			msg = _queue.front();
-			_queue.pop();
+			}
 		}
 		if (!_receiver) {
 			delete msg;
@@ -257,46 +282,119 @@ void RTPSubscriber::rtp_recv(const struct libre::sa *src, const struct libre::rt
 	};
 #endif
 
-	Message* msg = new Message((char*)mbuf_buf(mb), mbuf_get_left(mb));
-	msg->putMeta("um.type", "RTP");
-	msg->putMeta("um.version", toStr((uint16_t)hdr->ver));
-	msg->putMeta("um.extension", toStr((bool)hdr->ext));
-	msg->putMeta("um.padding", toStr((bool)hdr->pad));
-	msg->putMeta("um.marker", toStr((bool)hdr->m));
-	msg->putMeta("um.ssrc", toStr(hdr->ssrc));
-	msg->putMeta("um.timestamp", toStr(hdr->ts));
-	msg->putMeta("um.payloadType", toStr((uint16_t)hdr->pt)); // force numeric literal
-	msg->putMeta("um.sequenceNumber", toStr(hdr->seq));
-
-	if (hdr->seq < sub->_lastSequenceNumber)		//test for sequence number overflow
-		sub->_extendedSequenceNumber++;
-
-	sub->_lastSequenceNumber = hdr->seq;
-	msg->putMeta("um.extendedSequenceNumber", toStr((sub->_extendedSequenceNumber<<16) + hdr->seq));
-	msg->putMeta("um.csrccount", toStr((uint16_t)hdr->cc));
-	for (int i = 0; i<hdr->cc; i++)
-		msg->putMeta("um.csrc"+toStr(i), toStr(hdr->csrc[i]));
-
-	//push new message into queue
-	{
+	// this is the libre thread, take no locks and leave the string work to the subscriber thread
+	RTPMessage* msg = new RTPMessage((char*)mbuf_buf(mb), mbuf_get_left(mb));
+	msg->version = hdr->ver;
+	msg->extension = hdr->ext;
+	msg->padding = hdr->pad;
+	msg->marker = hdr->m;
+	msg->ssrc = hdr->ssrc;
+	msg->timestamp = hdr->ts;
+	msg->payloadType = hdr->pt;
+	msg->sequenceNumber = hdr->seq;
+	msg->csrcCount = hdr->cc;
+	for (int i = 0; i < hdr->cc; i++)
+		msg->csrc[i] = hdr->csrc[i];
+
+	uint16_t cycles;
+	if (!sub->_hasSequenceNumber || hdr->ssrc != sub->_lastSsrc) {
+		// new stream, start counting anew
+		sub->_extendedSequenceNumber = 0;
+		sub->_lastSequenceNumber = hdr->seq;
+		sub->_hasSequenceNumber = true;
+		sub->_lastSsrc = hdr->ssrc;
+		cycles = 0;
+	} else if ((int16_t)(hdr->seq - sub->_lastSequenceNumber) >= 0) {
+		// moving forward, count a wrap around only here and not for reordered packets
+		if (hdr->seq < sub->_lastSequenceNumber)
+			sub->_extendedSequenceNumber++;
+		sub->_lastSequenceNumber = hdr->seq;
+		cycles = sub->_extendedSequenceNumber;
+	} else if (hdr->seq > sub->_lastSequenceNumber) {
+		// reordered from before the last wrap around
+		cycles = sub->_extendedSequenceNumber - 1;
+	} else {
+		cycles = sub->_extendedSequenceNumber;
+	}
+	msg->extendedSequenceNumber = ((uint32_t)cycles << 16) + hdr->seq;
+
+	if (!sub->_queue->push(msg)) {
+		// we never block the libre thread, the subscriber is too slow
+		delete msg;
+		if (sub->_nrDropped++ % 1000 == 0)
+			UM_LOG_WARN("%s: queue full, dropped %lu packets so far", SHORT_UUID(sub->_uuid).c_str(), (unsigned long)sub->_nrDropped);
+		return;
+	}
+
+	if (sub->_isWaiting) {
 		RScopeLock lock(sub->_mutex);
-		sub->_queue.push(msg);
+		sub->_cond.broadcast();
 	}
-	sub->_cond.broadcast();
 }
 
-Message* RTPSubscriber::getNextMsg() {
-	RScopeLock lock(_mutex);
-	if (_queue.empty())
+RTPMessage* RTPSubscriber::dequeue(bool remove) {
+	// with _mutex held
+	RTPMessage* msg = NULL;
+
+	if (_jitterDepth == 0) {
+		if (!_queue->pop(msg))
+			return NULL;
+		if (_headerMeta)
+			msg->putHeaderMeta();
+		return msg;
+	}
+
+	bool arrived = false;
+	while(_queue->pop(msg)) {
+		arrived = true;
+		if (msg->ssrc != _jitterSsrc) {
+			// a new stream, its sequence numbers start anywhere
+			_jitterSsrc = msg->ssrc;
+			_hasNextSequenceNumber = false;
+		}
+		if (_jitterBuffer.find(msg->extendedSequenceNumber) != _jitterBuffer.end() ||
+		        (_hasNextSequenceNumber && (int32_t)(msg->extendedSequenceNumber - _nextSequenceNumber) < 0)) {
+			// duplicate or too late, we already moved past it
+			delete msg;
+			continue;
+		}
+		_jitterBuffer[msg->extendedSequenceNumber] = msg;
+	}
+	if (arrived)
+		_lastArrival = Thread::getTimeStampMs();
+
+	if (_jitterBuffer.empty())
 		return NULL;
-	Message *msg = _queue.front();
-	_queue.pop();
+
+	// deliver in order, skip missing packets once the buffer is full or nothing came for a while
+	std::map<uint32_t, RTPMessage*>::iterator first = _jitterBuffer.begin();
+	if (!(_hasNextSequenceNumber && first->first == _nextSequenceNumber) &&
+	        _jitterBuffer.size() <= _jitterDepth &&
+	        Thread::getTimeStampMs() - _lastArrival < UMUNDO_RTP_JITTER_FLUSH_MS)
+		return NULL;
+
+	msg = first->second;
+	if (!remove)
+		return msg;
+
+	_jitterBuffer.erase(first);
+	_nextSequenceNumber = msg->extendedSequenceNumber + 1;
+	_hasNextSequenceNumber = true;
+	if (_headerMeta)
+		msg->putHeaderMeta();
 	return msg;
 }
 
+Message* RTPSubscriber::getNextMsg() {
+	RScopeLock lock(_mutex);
+	return dequeue();
+}
+
 bool RTPSubscriber::hasNextMsg() {
 	RScopeLock lock(_mutex);
-	return !_queue.empty();
+	if (_jitterDepth == 0)
+		return !_queue->empty();
+	return dequeue(false) != NULL;
 }
 
 }
\ No newline at end of file
@@ -23,16 +23,19 @@
 
 #include "umundo/Common.h"
 
-#include <queue>
-
 #include "umundo/config.h"
 #include "umundo/thread/Thread.h"
+#include "umundo/thread/SPSCQueue.h"
 #include "umundo/Message.h"
 #include "umundo/connection/Subscriber.h"
 #include "umundo/connection/rtp/RTPThread.h"
+#include "umundo/connection/rtp/RTPMessage.h"
 
 #include "umundo/connection/rtp/libre.h"
 
+#define UMUNDO_RTP_QUEUE_SIZE 8192 // default packets pending between the libre thread and ours
+#define UMUNDO_RTP_JITTER_FLUSH_MS 100 // stop waiting for missing packets after being idle for so long
+
 namespace umundo {
 
 class PublisherStub;
@@ -61,13 +64,35 @@ protected:
 	RTPSubscriber();
 
 private:
-	uint16_t _extendedSequenceNumber;
+	RTPMessage* dequeue(bool remove = true);
+
+	// written by the libre thread only
+	uint16_t _extendedSequenceNumber; ///< wrap arounds of the sequence number
 	uint16_t _lastSequenceNumber;
+	bool _hasSequenceNumber;
+	uint32_t _lastSsrc;
+	uint64_t _nrDropped;
 
 	bool _isSuspended;
 	bool _initDone;
+	bool _headerMeta;
+
+	/// packets from the libre thread, it never waits for us
+	SharedPtr<SPSCQueue<RTPMessage*> > _queue;
+#ifndef WITHOUT_CXX11
+	std::atomic<bool> _isWaiting; ///< the libre thread only signals when we are
+#else
+	volatile bool _isWaiting;
+#endif
+
+	/// packets by extended sequence number to deliver in order, see dequeue
+	std::map<uint32_t, RTPMessage*> _jitterBuffer;
+	size_t _jitterDepth;
+	uint32_t _nextSequenceNumber;
+	bool _hasNextSequenceNumber;
+	uint32_t _jitterSsrc;
+	uint64_t _lastArrival; ///< when we last took packets from the queue
 
-	std::queue<Message*> _queue;
 	std::multimap<std::string, std::string> _domainPubs;
 	RMutex _mutex;
 	Monitor _cond;
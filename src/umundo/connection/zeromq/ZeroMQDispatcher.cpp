@@ -0,0 +1,222 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/connection/zeromq/ZeroMQNode.h"
+#include "umundo/connection/zeromq/ZeroMQSubscriber.h"
+#include "umundo/connection/zeromq/ZeroMQDispatcher.h"
+#include "umundo/UUID.h"
+
+#include <algorithm>
+
+namespace umundo {
+
+ZeroMQDispatcher::ZeroMQDispatcher(size_t nrWorkers) {
+	if (nrWorkers == 0)
+		nrWorkers = tthread::thread::hardware_concurrency();
+	if (nrWorkers == 0)
+		nrWorkers = 1;
+
+	for (size_t i = 0; i < nrWorkers; i++) {
+		Worker* worker = new Worker("inproc://um.dispatch." + UUID::getUUID());
+		worker->start();
+		_workers.push_back(worker);
+	}
+	UM_LOG_INFO("started %lu dispatcher threads", (unsigned long)_workers.size());
+}
+
+ZeroMQDispatcher::~ZeroMQDispatcher() {
+	for (size_t i = 0; i < _workers.size(); i++) {
+		delete _workers[i];
+	}
+}
+
+SharedPtr<ZeroMQDispatcher> ZeroMQDispatcher::getDefault() {
+	static RMutex mutex;
+	static SharedPtr<ZeroMQDispatcher> dispatcher;
+
+	RScopeLock lock(mutex);
+	if (!dispatcher)
+		dispatcher = SharedPtr<ZeroMQDispatcher>(new ZeroMQDispatcher());
+	return dispatcher;
+}
+
+void ZeroMQDispatcher::add(ZeroMQSubscriber* sub) {
+	RScopeLock lock(_mutex);
+	if (_assigned.find(sub) != _assigned.end())
+		return;
+
+	// subscribers stay with their worker to keep their messages in order
+	Worker* worker = _workers[0];
+	size_t fewest = worker->size();
+	for (size_t i = 1; i < _workers.size(); i++) {
+		size_t size = _workers[i]->size();
+		if (size < fewest) {
+			worker = _workers[i];
+			fewest = size;
+		}
+	}
+
+	_assigned[sub] = worker;
+	worker->add(sub);
+}
+
+void ZeroMQDispatcher::remove(ZeroMQSubscriber* sub) {
+	Worker* worker = NULL;
+	{
+		RScopeLock lock(_mutex);
+		std::map<ZeroMQSubscriber*, Worker*>::iterator assignedIter = _assigned.find(sub);
+		if (assignedIter == _assigned.end())
+			return;
+		worker = assignedIter->second;
+		_assigned.erase(assignedIter);
+	}
+	// do not block other subscribers while we wait for the worker
+	worker->remove(sub);
+}
+
+size_t ZeroMQDispatcher::getNumberOfSubscribers() {
+	RScopeLock lock(_mutex);
+	return _assigned.size();
+}
+
+ZeroMQDispatcher::Worker::Worker(const std::string& address) : _address(address), _dirty(true), _generation(0), _threadId(0) {
+	(_readOpSocket  = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
+	(_writeOpSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
+
+	zmq_bind(_readOpSocket, _address.c_str()) && UM_LOG_WARN("zmq_bind: %s", zmq_strerror(errno));
+	zmq_connect(_writeOpSocket, _address.c_str()) && UM_LOG_ERR("zmq_connect %s: %s", _address.c_str(), zmq_strerror(errno));
+}
+
+ZeroMQDispatcher::Worker::~Worker() {
+	stop();
+	{
+		RScopeLock lock(_mutex);
+		wakeUp();
+		_cond.broadcast();
+	}
+	join();
+
+	zmq_disconnect(_writeOpSocket, _address.c_str()) && UM_LOG_ERR("zmq_disconnect %s: %s", _address.c_str(), zmq_strerror(errno));
+	zmq_close(_readOpSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
+	zmq_close(_writeOpSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
+}
+
+void ZeroMQDispatcher::Worker::add(ZeroMQSubscriber* sub) {
+	RScopeLock lock(_mutex);
+	_subs.push_back(sub);
+	_dirty = true;
+	wakeUp();
+}
+
+void ZeroMQDispatcher::Worker::remove(ZeroMQSubscriber* sub) {
+	RScopeLock lock(_mutex);
+	std::vector<ZeroMQSubscriber*>::iterator subIter = std::find(_subs.begin(), _subs.end(), sub);
+	if (subIter == _subs.end())
+		return;
+	_subs.erase(subIter);
+	_dirty = true;
+
+	// called from a receiver, we will not touch the subscriber after it returns
+	if (!isStarted() || Thread::getThreadId() == _threadId)
+		return;
+
+	// wait until we no longer poll its sockets
+	uint64_t generation = _generation;
+	wakeUp();
+	while (_generation == generation && isStarted())
+		_cond.wait(_mutex);
+}
+
+size_t ZeroMQDispatcher::Worker::size() {
+	RScopeLock lock(_mutex);
+	return _subs.size();
+}
+
+void ZeroMQDispatcher::Worker::wakeUp() {
+	// a pending wake up is as good as a new one
+	char tmp[4];
+	zmq_send(_writeOpSocket, tmp, 4, ZMQ_DONTWAIT) == -1 && errno != EAGAIN && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
+}
+
+bool ZeroMQDispatcher::Worker::isDirty() {
+#ifndef WITHOUT_CXX11
+	return _dirty;
+#else
+	RScopeLock lock(_mutex);
+	return _dirty;
+#endif
+}
+
+void ZeroMQDispatcher::Worker::updateSockets() {
+	RScopeLock lock(_mutex);
+	_active = _subs;
+
+	zmq_pollitem_t opItem = { _readOpSocket, 0, ZMQ_POLLIN, 0 };
+	_items.clear();
+	_items.push_back(opItem);
+	for (size_t i = 0; i < _active.size(); i++) {
+		zmq_pollitem_t subItem = { _active[i]->_subSocket, 0, ZMQ_POLLIN, 0 };
+		zmq_pollitem_t subOpItem = { _active[i]->_readOpSocket, 0, ZMQ_POLLIN, 0 };
+		_items.push_back(subItem);
+		_items.push_back(subOpItem);
+	}
+
+	_dirty = false;
+	_generation++;
+	_cond.broadcast();
+}
+
+void ZeroMQDispatcher::Worker::run() {
+	_threadId = Thread::getThreadId();
+
+	while(isStarted()) {
+		if (isDirty())
+			updateSockets();
+
+		int rc = zmq_poll(&_items[0], _items.size(), -1);
+		if (rc < 0) {
+			UM_LOG_ERR("zmq_poll: %s", zmq_strerror(errno));
+		}
+
+		if (!isStarted())
+			break;
+
+		if (_items[0].revents & ZMQ_POLLIN) {
+			char tmp[4];
+			while (zmq_recv(_readOpSocket, tmp, 4, ZMQ_DONTWAIT) >= 0) {}
+		}
+
+		for (size_t i = 0; i < _active.size(); i++) {
+			// a receiver removed a subscriber, it might be gone already
+			if (isDirty())
+				break;
+
+			bool readMsgs = _items[2 * i + 1].revents & ZMQ_POLLIN;
+			bool readOps = _items[2 * i + 2].revents & ZMQ_POLLIN;
+			if (readMsgs || readOps)
+				_active[i]->dispatch(readMsgs, readOps);
+		}
+	}
+
+	// let anyone waiting in remove go
+	RScopeLock lock(_mutex);
+	_cond.broadcast();
+}
+
+}
@@ -0,0 +1,105 @@
+/**
+ *  @file
+ *  @brief      Shared worker threads delivering messages for many subscribers.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+
+#ifndef ZEROMQDISPATCHER_H_R7PX2KLD
+#define ZEROMQDISPATCHER_H_R7PX2KLD
+
+#include <zmq.h>
+
+#include "umundo/Common.h"
+#include "umundo/thread/Thread.h"
+
+#ifndef WITHOUT_CXX11
+#include <atomic>
+#endif
+
+namespace umundo {
+
+class ZeroMQSubscriber;
+
+/**
+ * A fixed number of worker threads polling the sockets of many subscribers.
+ *
+ * Every subscriber is assigned to the worker with the fewest subscribers and
+ * stays there, so its receiver is called from one thread at a time and in the
+ * order messages arrived, just as with a thread per subscriber.
+ */
+class UMUNDO_API ZeroMQDispatcher {
+public:
+	/// nrWorkers of 0 starts a worker per core
+	ZeroMQDispatcher(size_t nrWorkers = 0);
+	virtual ~ZeroMQDispatcher();
+
+	/// the dispatcher for subscribers asking for one, created on first use
+	static SharedPtr<ZeroMQDispatcher> getDefault();
+
+	void add(ZeroMQSubscriber* sub);
+	/// returns when the subscriber will no longer be called
+	void remove(ZeroMQSubscriber* sub);
+
+	size_t getNumberOfWorkers() {
+		return _workers.size();
+	}
+	size_t getNumberOfSubscribers();
+
+protected:
+	class Worker : public Thread {
+	public:
+		Worker(const std::string& address);
+		virtual ~Worker();
+
+		void add(ZeroMQSubscriber* sub);
+		void remove(ZeroMQSubscriber* sub);
+		size_t size();
+
+		void run();
+
+	protected:
+		void wakeUp();
+		void updateSockets();
+		bool isDirty();
+
+		std::string _address;
+		void* _readOpSocket; ///< polled along with the subscribers to notice changes
+		void* _writeOpSocket;
+
+		RMutex _mutex;
+		Monitor _cond;
+		std::vector<ZeroMQSubscriber*> _subs; ///< assigned to us, guarded by _mutex
+		std::vector<ZeroMQSubscriber*> _active; ///< the ones we poll for
+		std::vector<zmq_pollitem_t> _items;
+#ifndef WITHOUT_CXX11
+		std::atomic<bool> _dirty; ///< written with _mutex, read without it while we dispatch
+#else
+		bool _dirty;
+#endif
+		uint64_t _generation; ///< counts updates of _active
+		unsigned long int _threadId;
+	};
+
+	std::vector<Worker*> _workers;
+	std::map<ZeroMQSubscriber*, Worker*> _assigned;
+	RMutex _mutex;
+};
+
+}
+
+#endif /* end of include guard: ZEROMQDISPATCHER_H_R7PX2KLD */
@@ -0,0 +1,140 @@
+/**
+ *  @file
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/connection/zeromq/ZeroMQForwardQueue.h"
+
+namespace umundo {
+
+ZeroMQForwardQueue::ZeroMQForwardQueue(void* doorbell) : _doorbell(doorbell), _size(0), _isSleeping(true) {
+	_tail = new Entry();
+	_head = _tail;
+}
+
+ZeroMQForwardQueue::~ZeroMQForwardQueue() {
+	// messages the node did not get to anymore
+	zmq_msg_t frames[UMUNDO_FORWARD_MAX_FRAMES];
+	size_t nrFrames;
+	while ((nrFrames = pop(frames)) > 0) {
+		for (size_t i = 0; i < nrFrames; i++)
+			zmq_msg_close(&frames[i]) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+	}
+	delete _tail;
+
+	zmq_close(_doorbell) && UM_LOG_WARN("zmq_close: %s", zmq_strerror(errno));
+}
+
+bool ZeroMQForwardQueue::push(zmq_msg_t* frames, size_t nrFrames, size_t hwm) {
+	assert(nrFrames > 0 && nrFrames <= UMUNDO_FORWARD_MAX_FRAMES);
+	if (hwm > 0 && size() >= hwm)
+		return false;
+
+	Entry* entry = new Entry();
+	for (size_t i = 0; i < nrFrames; i++) {
+		zmq_msg_init(&entry->frames[i]) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
+		zmq_msg_move(&entry->frames[i], &frames[i]) && UM_LOG_WARN("zmq_msg_move: %s", zmq_strerror(errno));
+	}
+	entry->nrFrames = nrFrames;
+
+	bool wasSleeping;
+#ifndef WITHOUT_CXX11
+	_size.fetch_add(1, std::memory_order_relaxed);
+	Entry* prev = _head.exchange(entry);
+	// until here, the node sees the queue end before our entry and may go to sleep
+	prev->next.store(entry);
+	wasSleeping = _isSleeping.exchange(false);
+#else
+	{
+		ScopeLock lock(_mutex);
+		_size++;
+		_head->next = entry;
+		_head = entry;
+		wasSleeping = _isSleeping;
+		_isSleeping = false;
+	}
+#endif
+
+	if (wasSleeping)
+		ring();
+	return true;
+}
+
+size_t ZeroMQForwardQueue::pop(zmq_msg_t* frames) {
+#ifndef WITHOUT_CXX11
+	Entry* next = _tail->next.load(std::memory_order_acquire);
+#else
+	ScopeLock lock(_mutex);
+	Entry* next = _tail->next;
+#endif
+	if (next == NULL)
+		return 0;
+
+	size_t nrFrames = next->nrFrames;
+	for (size_t i = 0; i < nrFrames; i++) {
+		zmq_msg_init(&frames[i]) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
+		zmq_msg_move(&frames[i], &next->frames[i]) && UM_LOG_WARN("zmq_msg_move: %s", zmq_strerror(errno));
+	}
+
+	// the entry we just emptied stays as the one popped last
+	delete _tail;
+	_tail = next;
+
+#ifndef WITHOUT_CXX11
+	_size.fetch_sub(1, std::memory_order_relaxed);
+#else
+	_size--;
+#endif
+	return nrFrames;
+}
+
+bool ZeroMQForwardQueue::sleep() {
+#ifndef WITHOUT_CXX11
+	_isSleeping.store(true);
+	if (_tail->next.load() == NULL)
+		return true;
+	// a publisher pushed meanwhile and rings unless we are awake again before it looks
+	return !_isSleeping.exchange(false);
+#else
+	ScopeLock lock(_mutex);
+	if (_tail->next != NULL)
+		return false;
+	_isSleeping = true;
+	return true;
+#endif
+}
+
+size_t ZeroMQForwardQueue::size() {
+#ifndef WITHOUT_CXX11
+	return _size.load(std::memory_order_relaxed);
+#else
+	ScopeLock lock(_mutex);
+	return _size;
+#endif
+}
+
+void ZeroMQForwardQueue::ring() {
+	// the node reads doorbells before it pops, a full socket already woke it
+	ScopeLock lock(_doorbellMutex);
+	zmq_msg_t bell;
+	zmq_msg_init(&bell) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
+	if (zmq_msg_send(&bell, _doorbell, ZMQ_DONTWAIT) < 0 && errno != EAGAIN)
+		UM_LOG_WARN("zmq_msg_send: %s", zmq_strerror(errno));
+	zmq_msg_close(&bell) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+}
+
+}
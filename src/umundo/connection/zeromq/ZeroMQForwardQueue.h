@@ -0,0 +1,112 @@
+/**
+ *  @file
+ *  @brief      Messages handed from publishers to the thread of their node.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+
+#ifndef ZEROMQFORWARDQUEUE_H_W2JQ8TNA
+#define ZEROMQFORWARDQUEUE_H_W2JQ8TNA
+
+#include <zmq.h>
+
+#include "umundo/Common.h"
+#include "umundo/thread/Thread.h"
+
+#ifndef WITHOUT_CXX11
+#include <atomic>
+#endif
+
+#define UMUNDO_FORWARD_MAX_FRAMES 4 // frames of a single message handed to the node
+
+namespace umundo {
+
+/**
+ * Queue of whole messages from any number of publishers to the thread of a node.
+ *
+ * Publishers push without waiting for each other or the node (an intrusive MPSC
+ * queue as by Vyukov), the node pops in its own thread and sends the frames on
+ * its XPUB socket as they are. After the node found the queue empty, the next
+ * publisher to push rings the doorbell, a PUSH socket to a socket the node polls.
+ * Without C++11 atomics, all sides take a mutex.
+ */
+class UMUNDO_API ZeroMQForwardQueue {
+public:
+	/// we close the doorbell socket when we are gone
+	ZeroMQForwardQueue(void* doorbell);
+	virtual ~ZeroMQForwardQueue();
+
+	/**
+	 * From any thread, moves the frames into the queue.
+	 *
+	 * Nothing is taken if there are hwm messages waiting already, 0 for no limit.
+	 * The frames still need to be closed either way.
+	 */
+	bool push(zmq_msg_t* frames, size_t nrFrames, size_t hwm);
+
+	/// from the node thread only, moves the frames of the oldest message, 0 if there is none
+	size_t pop(zmq_msg_t* frames);
+
+	/// from the node thread only after pop found nothing, false if it has to pop again
+	bool sleep();
+
+	/// messages waiting, an estimate while publishers push
+	size_t size();
+
+protected:
+	struct Entry {
+		Entry() : next(NULL), nrFrames(0) {}
+#ifndef WITHOUT_CXX11
+		std::atomic<Entry*> next;
+#else
+		Entry* next;
+#endif
+		zmq_msg_t frames[UMUNDO_FORWARD_MAX_FRAMES];
+		size_t nrFrames;
+	};
+
+	void ring();
+
+	void* _doorbell;
+	Mutex _doorbellMutex;
+
+	Entry* _tail; ///< the entry popped last, its frames are empty, node thread only
+
+#ifndef WITHOUT_CXX11
+	// on cache lines of their own, publishers write the head and the node reads the tail
+	char _padHead[64];
+	std::atomic<Entry*> _head; ///< the entry pushed last
+	std::atomic<size_t> _size;
+	std::atomic<bool> _isSleeping; ///< the node found us empty and needs to be woken
+	char _padEnd[64];
+#else
+	Entry* _head;
+	size_t _size;
+	bool _isSleeping;
+	Mutex _mutex;
+#endif
+
+private:
+	ZeroMQForwardQueue(const ZeroMQForwardQueue& other) {}
+	ZeroMQForwardQueue& operator=(const ZeroMQForwardQueue& other) {
+		return *this;
+	}
+};
+
+}
+
+#endif /* end of include guard: ZEROMQFORWARDQUEUE_H_W2JQ8TNA */
@@ -17,8 +17,12 @@
  *  @endcond
  */
 
-#define UMUNDO_PERF_WINDOW_LENGTH_MS 5000
-#define UMUNDO_PERF_BUCKET_LENGTH_MS 200.0
+#define UMUNDO_PERF_SAMPLE_MS 1000
+#define UMUNDO_PERF_ROLLOFF 0.3
+#define UMUNDO_MAX_FORWARD_MSGS 1024 // messages to forward from publishers before polling again
+#define UMUNDO_MAX_INTERNAL_OPS 1024 // internal operations to process before broadcasting changed publishers
+#define UMUNDO_PUB_HISTORY 4096 // changes to our publishers remembered for reconnecting nodes
+#define UMUNDO_GOSSIP_TIMEOUT 4 // gossip intervals before we give up on a silent peer learned from gossip
 
 #include "umundo/connection/zeromq/ZeroMQNode.h"
 #include "umundo/discovery/Discovery.h"
@@ -45,6 +49,7 @@
 #include "umundo/UUID.h"
 #include "umundo/connection/zeromq/ZeroMQPublisher.h"
 #include "umundo/connection/zeromq/ZeroMQSubscriber.h"
+#include "umundo/connection/zeromq/ZeroMQDispatcher.h"
 
 #include <math.h>       /* round */
 
@@ -112,9 +117,18 @@ sizeof(uint16_t) +                  /* whether this is multicats */ \
 sub.getIP().length() + 1 +          /* IP address */ \
 sizeof(uint16_t)                    /* port of subscriber */
 
-#define NODE_BROADCAST_MSG(msg) \
+#define NODE_BROADCAST_MSG(msg) NODE_BROADCAST_MSG_IF(msg, true)
+
+/**
+ * Send a copy of the message to every node connected to us for which cond holds, nodeIter_ is the node
+ */
+#define NODE_BROADCAST_MSG_IF(msg, cond) \
 std::map<std::string, NodeStub>::iterator nodeIter_ = _connFrom.begin();\
 while (nodeIter_ != _connFrom.end()) {\
+	if (!(cond)) {\
+		nodeIter_++;\
+		continue;\
+	}\
 	zmq_msg_t broadCastMsgCopy_;\
 	zmq_msg_init(&broadCastMsgCopy_) && UM_LOG_ERR("zmq_msg_init: %s", zmq_strerror(errno));\
 	zmq_msg_copy(&broadCastMsgCopy_, &msg) && UM_LOG_ERR("zmq_msg_copy: %s", zmq_strerror(errno));\
@@ -133,6 +147,27 @@ zmq_send(_nodeSocket, msg.c_str(), msg.length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) ==
 
 namespace umundo {
 
+/**
+ * IP address of the node that sent a message to our node socket
+ */
+static std::string peerAddress(zmq_msg_t* msg) {
+	std::string address;
+	int srcFd = zmq_msg_get(msg, ZMQ_SRCFD);
+
+	if (srcFd > 0) {
+		int rc;
+		(void)rc; // surpress unused warning without assert
+		struct sockaddr_storage ss;
+		socklen_t addrlen = sizeof ss;
+		rc = getpeername (srcFd, (struct sockaddr*) &ss, &addrlen);
+
+		char host [NI_MAXHOST];
+		rc = getnameinfo ((struct sockaddr*) &ss, addrlen, host, sizeof host, NULL, 0, NI_NUMERICHOST);
+		address = host;
+	}
+	return address;
+}
+
 void* ZeroMQNode::getZeroMQContext() {
 	if (_zmqContext == NULL) {
 		(_zmqContext = zmq_ctx_new()) || UM_LOG_ERR("zmq_init: %s",zmq_strerror(errno));
@@ -140,8 +175,97 @@ void* ZeroMQNode::getZeroMQContext() {
 	return _zmqContext;
 }
 void* ZeroMQNode::_zmqContext = NULL;
+bool ZeroMQNode::_zmqContextConfigured = false;
 
-ZeroMQNode::ZeroMQNode() {
+void ZeroMQNode::configureZeroMQContext(std::map<std::string, std::string>& options) {
+	if (options.find("node.zmq.ioThreads") == options.end() &&
+	        options.find("node.zmq.ioThreadAffinity") == options.end() &&
+	        options.find("node.zmq.ioThreadPriority") == options.end())
+		return;
+
+	if (_zmqContext != NULL) {
+		// 0MQ starts its IO threads with the first socket
+		if (!_zmqContextConfigured)
+			UM_LOG_WARN("0MQ context already in use, create the node configuring IO threads before any publisher or subscriber");
+		return;
+	}
+	_zmqContextConfigured = true;
+
+	void* context = getZeroMQContext();
+	if (options.find("node.zmq.ioThreads") != options.end()) {
+		int ioThreads = strTo<int>(options["node.zmq.ioThreads"]);
+		if (ioThreads <= 0)
+			ioThreads = tthread::thread::hardware_concurrency();
+		if (ioThreads <= 0)
+			ioThreads = 1;
+		zmq_ctx_set(context, ZMQ_IO_THREADS, ioThreads) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+		UM_LOG_INFO("using %d 0MQ IO threads", ioThreads);
+	}
+
+	if (options.find("node.zmq.ioThreadAffinity") != options.end()) {
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+		std::stringstream cpus(options["node.zmq.ioThreadAffinity"]);
+		std::string cpu;
+		while(std::getline(cpus, cpu, ',')) {
+			zmq_ctx_set(context, ZMQ_THREAD_AFFINITY_CPU_ADD, strTo<int>(cpu)) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+		}
+#else
+		UM_LOG_WARN("0MQ too old to pin IO threads, ignoring affinity");
+#endif
+	}
+
+	if (options.find("node.zmq.ioThreadPriority") != options.end()) {
+#ifdef ZMQ_THREAD_PRIORITY
+		int policy = strTo<int>(options["node.zmq.ioThreadSchedPolicy"]);
+		if (policy >= 0)
+			zmq_ctx_set(context, ZMQ_THREAD_SCHED_POLICY, policy) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+		zmq_ctx_set(context, ZMQ_THREAD_PRIORITY, strTo<int>(options["node.zmq.ioThreadPriority"])) && UM_LOG_ERR("zmq_ctx_set: %s", zmq_strerror(errno));
+#else
+		UM_LOG_WARN("0MQ too old to set the priority of IO threads, ignoring");
+#endif
+	}
+}
+
+void ZeroMQNode::SocketOptions::read(std::map<std::string, std::string>& options, const std::string& prefix) {
+	if (options.find(prefix + "sndhwm") != options.end())
+		sndHwm = strTo<int>(options[prefix + "sndhwm"]);
+	if (options.find(prefix + "rcvhwm") != options.end())
+		rcvHwm = strTo<int>(options[prefix + "rcvhwm"]);
+	if (options.find(prefix + "sndbuf") != options.end())
+		sndBuf = strTo<int>(options[prefix + "sndbuf"]);
+	if (options.find(prefix + "rcvbuf") != options.end())
+		rcvBuf = strTo<int>(options[prefix + "rcvbuf"]);
+	if (options.find(prefix + "keepalive") != options.end()) {
+		keepAlive = strTo<int>(options[prefix + "keepalive"]);
+		keepAliveIdle = strTo<int>(options[prefix + "keepalive.idle"]);
+		keepAliveIntvl = strTo<int>(options[prefix + "keepalive.intvl"]);
+		keepAliveCnt = strTo<int>(options[prefix + "keepalive.cnt"]);
+	}
+}
+
+void ZeroMQNode::SocketOptions::apply(void* socket) const {
+	if (sndHwm >= 0)
+		zmq_setsockopt(socket, ZMQ_SNDHWM, &sndHwm, sizeof(sndHwm)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	if (rcvHwm >= 0)
+		zmq_setsockopt(socket, ZMQ_RCVHWM, &rcvHwm, sizeof(rcvHwm)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	if (sndBuf > 0)
+		zmq_setsockopt(socket, ZMQ_SNDBUF, &sndBuf, sizeof(sndBuf)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	if (rcvBuf > 0)
+		zmq_setsockopt(socket, ZMQ_RCVBUF, &rcvBuf, sizeof(rcvBuf)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	if (keepAlive >= 0) {
+		zmq_setsockopt(socket, ZMQ_TCP_KEEPALIVE, &keepAlive, sizeof(keepAlive)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+		zmq_setsockopt(socket, ZMQ_TCP_KEEPALIVE_IDLE, &keepAliveIdle, sizeof(keepAliveIdle)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+		zmq_setsockopt(socket, ZMQ_TCP_KEEPALIVE_INTVL, &keepAliveIntvl, sizeof(keepAliveIntvl)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+		zmq_setsockopt(socket, ZMQ_TCP_KEEPALIVE_CNT, &keepAliveCnt, sizeof(keepAliveCnt)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	}
+}
+
+ZeroMQNode::ZeroMQNode() : _lastStatsSample(0), _pubSetVersion(0), _pubSetSent(0), _pubLogSize(UMUNDO_PUB_HISTORY),
+	_gossip(false), _gossipInterval(0), _lastGossip(0) {
+	_metaSent.stats = SharedPtr<ChannelStats>(new ChannelStats(""));
+	_metaRcvd.stats = SharedPtr<ChannelStats>(new ChannelStats(""));
+	_metaSent.last = _metaSent.stats->snapshotCounters();
+	_metaRcvd.last = _metaRcvd.stats->snapshotCounters();
 }
 
 ZeroMQNode::~ZeroMQNode() {
@@ -181,6 +305,13 @@ ZeroMQNode::~ZeroMQNode() {
 	while(_connFrom.size() > 0) {
 		_connFrom.erase(_connFrom.begin());
 	}
+	_diffPeers.clear();
+
+	// publishers outliving us must not fill our queue anymore
+	for (std::map<std::string, Publisher>::iterator pubIter = _pubs.begin(); pubIter != _pubs.end(); pubIter++) {
+		if (pubIter->second.getImpl()->implType == Publisher::ZEROMQ)
+			StaticPtrCast<ZeroMQPublisher>(pubIter->second.getImpl())->detachNode(_uuid);
+	}
 
 	if (_sockets != NULL)
 		free(_sockets);
@@ -188,7 +319,7 @@ ZeroMQNode::~ZeroMQNode() {
 	// close sockets
 	zmq_close(_nodeSocket)    && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
 	zmq_close(_pubSocket)     && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
-	zmq_close(_subSocket)     && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
+	zmq_close(_forwardSocket) && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
 	zmq_close(_readOpSocket)  && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
 	zmq_close(_writeOpSocket) && UM_LOG_ERR("zmq_close: %s", zmq_strerror(errno));
 	UM_LOG_INFO("%s: node gone", SHORT_UUID(_uuid).c_str());
@@ -203,6 +334,22 @@ void ZeroMQNode::init(const Options* options) {
 	_pubPort = strTo<uint16_t>(_options["node.port.pub"]);
 	_allowLocalConns = strTo<bool>(_options["node.allowLocal"]);
 
+	if (_options.find("node.gossip") != _options.end()) {
+		_gossip = strTo<bool>(_options["node.gossip"]);
+		_gossipInterval = strTo<uint32_t>(_options["node.gossip.interval"]);
+	}
+
+	if (_options.find("node.pubHistory") != _options.end()) {
+		_pubLogSize = strTo<size_t>(_options["node.pubHistory"]);
+	}
+
+	if (_options.find("node.dispatch.threads") != _options.end()) {
+		_dispatcher = SharedPtr<ZeroMQDispatcher>(new ZeroMQDispatcher(strTo<size_t>(_options["node.dispatch.threads"])));
+	}
+
+	configureZeroMQContext(_options);
+	_socketOptions.read(_options, "node.zmq.");
+
 	_transport = "tcp";
 	_ip = _options["endpoint.ip"];
 	_lastNodeInfoBroadCast = Thread::getTimeStampMs();
@@ -211,11 +358,10 @@ void ZeroMQNode::init(const Options* options) {
 	int routProbe = 0;
 	int vbsSub = 1;
 	int sndhwm = NET_ZEROMQ_SND_HWM;
-	int rcvhwm = NET_ZEROMQ_RCV_HWM;
 
 	(_nodeSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_ROUTER))  || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_pubSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_XPUB))     || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
-	(_subSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_SUB))      || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
+	(_forwardSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PULL)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_readOpSocket  = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_writeOpSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 
@@ -224,6 +370,22 @@ void ZeroMQNode::init(const Options* options) {
 	zmq_bind(_readOpSocket, readOpId.c_str())  && UM_LOG_ERR("zmq_bind: %s", zmq_strerror(errno));
 	zmq_connect(_writeOpSocket, readOpId.c_str()) && UM_LOG_ERR("zmq_connect %s: %s", readOpId.c_str(), zmq_strerror(errno));
 
+	// publishers ring the doorbell of our forward queue when we might be waiting in poll
+	int linger = 0;
+	void* doorbell;
+	(doorbell = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PUSH)) || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
+	zmq_setsockopt(doorbell, ZMQ_LINGER, &linger, sizeof(linger)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	std::string forwardId("inproc://um.node.forward." + _uuid);
+	zmq_bind(_forwardSocket, forwardId.c_str()) && UM_LOG_ERR("zmq_bind: %s", zmq_strerror(errno));
+	zmq_connect(doorbell, forwardId.c_str()) && UM_LOG_ERR("zmq_connect %s: %s", forwardId.c_str(), zmq_strerror(errno));
+	_forwardQueue = SharedPtr<ZeroMQForwardQueue>(new ZeroMQForwardQueue(doorbell));
+	_isForwarding = false;
+
+	// before binding, the configured options override our defaults
+	zmq_setsockopt(_pubSocket, ZMQ_SNDHWM, &sndhwm, sizeof(sndhwm))         && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
+	_socketOptions.apply(_nodeSocket);
+	_socketOptions.apply(_pubSocket);
+
 	// connect node socket
 	if (_port > 0) {
 		std::stringstream ssNodeAddress;
@@ -253,12 +415,8 @@ void ZeroMQNode::init(const Options* options) {
 	zmq_bind(_pubSocket,  std::string("inproc://" + pubId).c_str())  && UM_LOG_ERR("zmq_bind: %s", zmq_strerror(errno));
 	//  zmq_bind(_pubSocket,  std::string("ipc://" + pubId).c_str())     && UM_LOG_WARN("zmq_bind: %s %s", std::string("ipc://" + pubId).c_str(), zmq_strerror(errno));
 
-	zmq_setsockopt(_pubSocket, ZMQ_SNDHWM, &sndhwm, sizeof(sndhwm))         && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 	zmq_setsockopt(_pubSocket, ZMQ_XPUB_VERBOSE, &vbsSub, sizeof(vbsSub))   && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno)); // receive all subscriptions
 
-	zmq_setsockopt(_subSocket, ZMQ_RCVHWM, &rcvhwm, sizeof(rcvhwm)) && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
-	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, "", 0)                && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno)); // subscribe to every internal publisher
-
 	zmq_setsockopt(_nodeSocket, ZMQ_IDENTITY, _uuid.c_str(), _uuid.length())        && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 	zmq_setsockopt(_nodeSocket, ZMQ_ROUTER_MANDATORY, &routMand, sizeof(routMand))  && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 	zmq_setsockopt(_nodeSocket, ZMQ_PROBE_ROUTER, &routProbe, sizeof(routProbe))    && UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
@@ -269,7 +427,7 @@ void ZeroMQNode::init(const Options* options) {
 	_stdSockets[0].socket = _nodeSocket;
 	_stdSockets[1].socket = _pubSocket;
 	_stdSockets[2].socket = _readOpSocket;
-	_stdSockets[3].socket = _subSocket;
+	_stdSockets[3].socket = _forwardSocket;
 	_stdSockets[0].fd = _stdSockets[1].fd = _stdSockets[2].fd = _stdSockets[3].fd = 0;
 	_stdSockets[0].events = _stdSockets[1].events = _stdSockets[2].events = _stdSockets[3].events = ZMQ_POLLIN;
 
@@ -344,30 +502,19 @@ void ZeroMQNode::addSubscriber(Subscriber& sub) {
 	UM_LOG_INFO("%s added subscriber %s on %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(sub.getUUID()).c_str(), sub.getChannelName().c_str());
 
 	_subs[sub.getUUID()] = sub;
-
-	std::map<std::string, SharedPtr<NodeConnection> >::const_iterator nodeIter = _connTo.begin();
-	while (nodeIter != _connTo.end()) {
-		if (!UUID::isUUID(nodeIter->first)) {
-			// nodes are contained twice in _connTo, per address and per uuid
-			nodeIter++;
-			continue;
+	_subsByChannel.insert(sub.getChannelName(), sub.getUUID(), sub);
+
+	if (_dispatcher && sub.getImpl()->implType == Subscriber::ZEROMQ)
+		StaticPtrCast<ZeroMQSubscriber>(sub.getImpl())->setDispatcher(_dispatcher);
+
+	// remote publishers on channels starting with ours
+	std::vector<RemotePublisher> pubs;
+	_remotePubsByChannel.findStartingWith(sub.getChannelName(), pubs);
+	for (std::vector<RemotePublisher>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+		if (sub.matches(pubIter->pub)) {
+			sub.added(pubIter->pub, pubIter->node);
+			sendSubscribeToPublisher(pubIter->node.getUUID(), sub, pubIter->pub);
 		}
-		if (nodeIter->second && nodeIter->second->node) {
-			std::map<std::string, PublisherStub> pubs = nodeIter->second->node.getPublishers();
-			std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin();
-
-			// iterate all remote publishers and add this sub
-			while (pubIter != pubs.end()) {
-				if (sub.matches(pubIter->second)) {
-
-					sub.added(pubIter->second, nodeIter->second->node);
-					sendSubscribeToPublisher(nodeIter->first.c_str(), sub, pubIter->second);
-
-				}
-				pubIter++;
-			}
-		}
-		nodeIter++;
 	}
 }
 
@@ -380,23 +527,15 @@ void ZeroMQNode::removeSubscriber(Subscriber& sub) {
 
 	UM_LOG_INFO("%s removed subscriber %s on %s", SHORT_UUID(_uuid).c_str(), SHORT_UUID(sub.getUUID()).c_str(), sub.getChannelName().c_str());
 
-	std::map<std::string, SharedPtr<NodeConnection> >::const_iterator nodeIter = _connTo.begin();
-	while (nodeIter != _connTo.end()) {
-		if (nodeIter->second->node) {
-			std::map<std::string, PublisherStub> pubs = nodeIter->second->node.getPublishers();
-			std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin();
-
-			// iterate all remote publishers and remove this sub
-			while (pubIter != pubs.end()) {
-				if(sub.matches(pubIter->second)) {
-					sub.removed(pubIter->second, nodeIter->second->node);
-					sendUnsubscribeFromPublisher(nodeIter->first.c_str(), sub, pubIter->second);
-				}
-				pubIter++;
-			}
+	std::vector<RemotePublisher> pubs;
+	_remotePubsByChannel.findStartingWith(sub.getChannelName(), pubs);
+	for (std::vector<RemotePublisher>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+		if (sub.matches(pubIter->pub)) {
+			sub.removed(pubIter->pub, pubIter->node);
+			sendUnsubscribeFromPublisher(pubIter->node.getUUID(), sub, pubIter->pub);
 		}
-		nodeIter++;
 	}
+	_subsByChannel.erase(sub.getChannelName(), sub.getUUID());
 	_subs.erase(sub.getUUID());
 }
 
@@ -420,6 +559,17 @@ void ZeroMQNode::addPublisher(Publisher& pub) {
 
 	zmq_msg_send(&pubAddedMsg, _writeOpSocket, 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
 
+	// publishers on the same channel share their counters
+	StatSlot& slot = _channelStats[pub.getChannelName()];
+	if (!slot.stats) {
+		slot.stats = SharedPtr<ChannelStats>(new ChannelStats(pub.getChannelName()));
+		slot.last = slot.stats->snapshotCounters();
+	}
+	if (pub.getImpl()->implType == Publisher::ZEROMQ) {
+		StaticPtrCast<ZeroMQPublisher>(pub.getImpl())->setStats(slot.stats);
+		StaticPtrCast<ZeroMQPublisher>(pub.getImpl())->attachNode(_uuid, _forwardQueue);
+	}
+
 	_pubs[pub.getUUID()] = pub;
 	zmq_msg_close(&pubAddedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 
@@ -444,14 +594,22 @@ void ZeroMQNode::removePublisher(Publisher& pub) {
 	assert(writePtr - writeBuffer == bufferSize);
 
 	zmq_msg_send(&pubRemovedMsg, _writeOpSocket, 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	if (_buckets.size() > 0) {
-		_buckets.back().nrMetaMsgSent++;
-		_buckets.back().sizeMetaMsgSent += bufferSize;
-	}
+	countMetaSent(bufferSize);
 
 	zmq_msg_close(&pubRemovedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+	if (pub.getImpl()->implType == Publisher::ZEROMQ)
+		StaticPtrCast<ZeroMQPublisher>(pub.getImpl())->detachNode(_uuid);
 	_pubs.erase(pub.getUUID());
 
+	// forget about the channel with its last publisher
+	std::map<std::string, Publisher>::iterator pubIter = _pubs.begin();
+	while(pubIter != _pubs.end()) {
+		if (pubIter->second.getChannelName() == pub.getChannelName())
+			return;
+		pubIter++;
+	}
+	_channelStats.erase(pub.getChannelName());
+
 }
 
 /**
@@ -529,6 +687,8 @@ void ZeroMQNode::removed(ENDPOINT_RS_TYPE endPoint) {
 		return;
 	}
 
+	_gossipPeers.erase(endPoint.getUUID());
+
 	if (_endPoints[zmqAdress].find(endPoint) == _endPoints[zmqAdress].end()) {
 		UM_LOG_INFO("%s: Not removing endpoint %s - not known",
 		            SHORT_UUID(_uuid).c_str(), endPoint.getAddress().c_str());
@@ -587,10 +747,7 @@ void ZeroMQNode::receivedFromNodeSocket() {
 
 	// read first message
 	RECV_MSG(_nodeSocket, header);
-	if (_buckets.size() > 0) {
-		_buckets.back().nrMetaMsgRcvd++;
-		_buckets.back().sizeMetaMsgRcvd += msgSize;
-	}
+	countMetaRcvd(msgSize);
 
 	std::string from(recvBuffer, msgSize);
 	zmq_msg_close(&header) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
@@ -615,10 +772,7 @@ void ZeroMQNode::receivedFromNodeSocket() {
 		RECV_MSG(_nodeSocket, content);
 	}
 
-	if (_buckets.size() > 0) {
-		_buckets.back().nrMetaMsgRcvd++;
-		_buckets.back().sizeMetaMsgRcvd += msgSize;
-	}
+	countMetaRcvd(msgSize);
 
 	// assume the mesage has at least version and type
 	if (REMAINING_BYTES_TOREAD < 4) {
@@ -660,25 +814,44 @@ void ZeroMQNode::receivedFromNodeSocket() {
 			_connFrom[from].updateLastSeen();
 		}
 
-		// reply with our uuid and publishers
-		UM_LOG_INFO("%s: Replying with CONNECT_REP and %d pubs on _nodeSocket to %s", SHORT_UUID(_uuid).c_str(), _pubs.size(), SHORT_UUID(from).c_str());
 		zmq_send(_nodeSocket, from.c_str(), from.length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno)); // return to sender
-		if (_buckets.size() > 0) {
-			_buckets.back().nrMetaMsgSent++;
-			_buckets.back().sizeMetaMsgSent += from.length();
-		}
+		countMetaSent(from.length());
 
 		zmq_msg_t replyNodeInfoMsg;
-		writeNodeInfo(&replyNodeInfoMsg, Message::UM_CONNECT_REP);
+		if (REMAINING_BYTES_TOREAD >= 1 + 8) {
+			// newer nodes send the version of our publishers they know and get what changed since
+			std::string knownUUID;
+			uint64_t knownVersion;
+			readPtr = Message::read(readPtr, knownUUID, REMAINING_BYTES_TOREAD - 8);
+			readPtr = Message::read(readPtr, &knownVersion);
 
-		zmq_sendmsg(_nodeSocket, &replyNodeInfoMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
-		if (_buckets.size() > 0) {
-			_buckets.back().nrMetaMsgSent++;
-			_buckets.back().sizeMetaMsgSent += zmq_msg_size(&replyNodeInfoMsg);
+			if (_connFrom.find(from) != _connFrom.end())
+				_diffPeers.insert(from);
+
+			if (knownUUID != _uuid)
+				knownVersion = 0;
+
+			UM_LOG_INFO("%s: Replying with PUB_DIFF since version %lu of %lu on _nodeSocket to %s",
+			            SHORT_UUID(_uuid).c_str(), (unsigned long)knownVersion, (unsigned long)_pubSetVersion, SHORT_UUID(from).c_str());
+			writePubDiff(&replyNodeInfoMsg, knownVersion);
+
+		} else {
+			// reply with our uuid and publishers
+			UM_LOG_INFO("%s: Replying with CONNECT_REP and %d pubs on _nodeSocket to %s", SHORT_UUID(_uuid).c_str(), _pubs.size(), SHORT_UUID(from).c_str());
+			writeNodeInfo(&replyNodeInfoMsg, Message::UM_CONNECT_REP);
 		}
+
+		zmq_sendmsg(_nodeSocket, &replyNodeInfoMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
+		countMetaSent(zmq_msg_size(&replyNodeInfoMsg));
 		zmq_msg_close(&replyNodeInfoMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 		break;
 	}
+	case Message::UM_NODE_INFO: {
+		// a connected node tells us about its peers
+		if (_gossip)
+			receivedGossip(from, readPtr, REMAINING_BYTES_TOREAD, peerAddress(&content));
+		break;
+	}
 	case Message::UM_SUBSCRIBE:
 	case Message::UM_UNSUBSCRIBE: {
 		// a remote node subscribed or unsubscribed to one of our publishers
@@ -689,28 +862,21 @@ void ZeroMQNode::receivedFromNodeSocket() {
 		readPtr = read(readPtr, subImpl.get(), REMAINING_BYTES_TOREAD);
 		readPtr = read(readPtr, pubImpl.get(), REMAINING_BYTES_TOREAD);
 
+		// subscriptions carry the host of the subscriber, older nodes are remote for us
+		bool isRemote = true;
+		if (type == Message::UM_SUBSCRIBE && REMAINING_BYTES_TOREAD > 0) {
+			std::string subHost;
+			readPtr = Message::read(readPtr, subHost, REMAINING_BYTES_TOREAD);
+			isRemote = (subHost != hostUUID);
+		}
+		subImpl->setRemote(isRemote);
+
 		std::string pubUUID = pubImpl->getUUID();
 		std::string subUUID = subImpl->getUUID();
-		std::string address;
+		std::string address = peerAddress(&content);
 
 		assert(REMAINING_BYTES_TOREAD == 0);
 
-		{
-			int srcFd = zmq_msg_get(&content, ZMQ_SRCFD);
-
-			if (srcFd > 0) {
-				int rc;
-				(void)rc; // surpress unused warning without assert
-				struct sockaddr_storage ss;
-				socklen_t addrlen = sizeof ss;
-				rc = getpeername (srcFd, (struct sockaddr*) &ss, &addrlen);
-
-				char host [NI_MAXHOST];
-				rc = getnameinfo ((struct sockaddr*) &ss, addrlen, host, sizeof host, NULL, 0, NI_NUMERICHOST);
-				address = host;
-			}
-		}
-
 		if (_pubs.find(pubUUID) == _pubs.end())
 			break;
 
@@ -722,6 +888,7 @@ void ZeroMQNode::receivedFromNodeSocket() {
             if (!_subscriptions[subUUID].subStub) {
 				_subscriptions[subUUID].subStub = SubscriberStub(subImpl);
 			}
+			_subscriptions[subUUID].subStub.getImpl()->setRemote(isRemote);
             _subscriptions[subUUID].nodeUUID = from;
 			_subscriptions[subUUID].address = address;
 			_subscriptions[subUUID].pending[pubUUID] = _pubs[pubUUID];
@@ -776,7 +943,22 @@ void ZeroMQNode::receivedFromPubSocket() {
 			subUUID = subChannel.substr(1, zmq_msg_size(&message) - 2);
 		}
 
-		if (subscription) {
+		// a subscriber missed the static header of a publisher, see ZeroMQSubscriber::requestStaticHeader
+		bool headerRequest = (subChannel.size() == 1 + 36 + 36 && subChannel[0] == '~' &&
+		                      UUID::isUUID(subChannel.substr(1, 36)) && UUID::isUUID(subChannel.substr(37, 36)));
+
+		// a subscriber on our host can or cannot read a publisher's ring, see ZeroMQSubscriber::reportSharedMemory
+		bool shmReport = (subChannel.size() == 1 + 36 + 36 + 1 && subChannel[0] == '~' &&
+		                  (subChannel[73] == '+' || subChannel[73] == '-') &&
+		                  UUID::isUUID(subChannel.substr(1, 36)) && UUID::isUUID(subChannel.substr(37, 36)));
+
+		if (headerRequest) {
+			if (subscription)
+				requestedStaticHeader(subChannel.substr(1, 36), subChannel.substr(37, 36));
+		} else if (shmReport) {
+			if (subscription)
+				reportedSharedMemory(subChannel.substr(1, 36), subChannel.substr(37, 36), subChannel[73] == '+');
+		} else if (subscription) {
 			UM_LOG_INFO("%s: Got 0MQ subscription on %s", SHORT_UUID(_uuid).c_str(), subChannel.c_str());
 			if (subUUID.length() > 0) {
 				// every subscriber subscribes to its uuid prefixed with a "~" for late alphabetical order
@@ -823,6 +1005,7 @@ void ZeroMQNode::receivedFromPubSocket() {
  *
  * UM_PUB_REMOVED
  * UM_PUB_ADDED
+ * UM_PUB_DIFF
  * UM_SHUTDOWN
  * UM_CONNECT_REP
  *
@@ -892,6 +1075,10 @@ void ZeroMQNode::receivedFromClientNode(SharedPtr<NodeConnection> client) {
 			// node terminated, it's no longer connected to us
 			_connFrom.erase(from);
 		}
+		_diffPeers.erase(from);
+
+		// it will not come back with the same publishers
+		_remotePubSets.erase(from);
 
 		// if we were connected, remove it, object will be destructed there
 		if (_connTo.find(from) != _connTo.end()) {
@@ -920,6 +1107,11 @@ void ZeroMQNode::receivedFromClientNode(SharedPtr<NodeConnection> client) {
 		remoteNodeConfirm(uuid, client, publishers);
 		break;
 	}
+	case Message::UM_PUB_DIFF: {
+		// remote server answered our connect_req or changed its publishers
+		receivedPubDiff(client, readPtr, REMAINING_BYTES_TOREAD);
+		break;
+	}
 	default:
 		UM_LOG_WARN("%s: Unhandled message type on client socket", SHORT_UUID(_uuid).c_str());
 		break;
@@ -958,22 +1150,16 @@ void ZeroMQNode::receivedInternalOp() {
 		std::string uuid;
 		readPtr = Message::read(readPtr, uuid, 37);
 
+		const char* pubInfo = readPtr;
 		PublisherStubImpl* pubStub = new PublisherStubImpl();
 		readPtr = read(readPtr, pubStub, REMAINING_BYTES_TOREAD);
 		assert(REMAINING_BYTES_TOREAD == 0);
 
-		std::string internalPubId("inproc://um.pub.intern.");
-		internalPubId += pubStub->getUUID();
-
+		changedPubSet(type == Message::UM_PUB_ADDED, pubStub->getUUID(), std::string(pubInfo, readPtr - pubInfo));
 		delete pubStub;
 
-		if (type == Message::UM_PUB_ADDED) {
-			zmq_connect(_subSocket, internalPubId.c_str()) && UM_LOG_ERR("zmq_connect %s: %s", internalPubId.c_str(), zmq_strerror(errno));
-		} else {
-			zmq_disconnect(_subSocket, internalPubId.c_str()) && UM_LOG_ERR("zmq_disconnect %s: %s", internalPubId.c_str(), zmq_strerror(errno));
-		}
-		// tell every other node connected to us that we changed publishers
-		NODE_BROADCAST_MSG(opMsg);
+		// older nodes are told right away, the others with the next diff
+		NODE_BROADCAST_MSG_IF(opMsg, _diffPeers.find(nodeIter_->first) == _diffPeers.end());
 
 		break;
 	}
@@ -1015,6 +1201,7 @@ void ZeroMQNode::remoteNodeConnect(const std::string& address) {
 	SharedPtr<NodeConnection> clientConn = SharedPtr<NodeConnection>(new NodeConnection(address, _uuid));
 
 	clientConn->address = address;
+	clientConn->socketOptions = _socketOptions;
 	int err = clientConn->connect();
 	if (err)
 		return;
@@ -1022,20 +1209,43 @@ void ZeroMQNode::remoteNodeConnect(const std::string& address) {
 	_connTo[address] = clientConn;
 	_dirtySockets = true;
 
-	UM_LOG_INFO("%s: Sending CONNECT_REQ to %s", SHORT_UUID(_uuid).c_str(), address.c_str());
+	sendConnectReq(clientConn);
+}
 
-	// send a CONNECT_REQ message
-	PREPARE_MSG(connReqMsg, 4);
+/**
+ * Send a CONNECT_REQ with the version of the remote publishers we know
+ */
+void ZeroMQNode::sendConnectReq(SharedPtr<NodeConnection> client) {
+	COMMON_VARS
+
+	// the node we last saw at this address, older nodes ignore everything after the type
+	std::string knownUUID;
+	uint64_t knownVersion = 0;
+	if (client->node) {
+		knownUUID = client->node.getUUID();
+	} else if (_addressUUIDs.find(client->address) != _addressUUIDs.end()) {
+		knownUUID = _addressUUIDs[client->address];
+	}
+	if (_remotePubSets.find(knownUUID) != _remotePubSets.end()) {
+		knownVersion = _remotePubSets[knownUUID].version;
+	} else {
+		knownUUID.clear();
+	}
+
+	UM_LOG_INFO("%s: Sending CONNECT_REQ to %s knowing version %lu", SHORT_UUID(_uuid).c_str(), client->address.c_str(), (unsigned long)knownVersion);
+
+	msgSize = 4 + knownUUID.length() + 1 + 8;
+	PREPARE_MSG(connReqMsg, msgSize);
 	writePtr = writeVersionAndType(writePtr, Message::UM_CONNECT_REQ);
 	ASSERT_BYTES_WRITTEN(4);
+	writePtr = Message::write(writePtr, knownUUID);
+	writePtr = Message::write(writePtr, knownVersion);
+	ASSERT_BYTES_WRITTEN(msgSize);
 
-	zmq_sendmsg(clientConn->socket, &connReqMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
+	zmq_sendmsg(client->socket, &connReqMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
 	zmq_msg_close(&connReqMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 
-	if (_buckets.size() > 0) {
-		_buckets.back().nrMetaMsgSent++;
-		_buckets.back().sizeMetaMsgSent += 4;
-	}
+	countMetaSent(msgSize);
 }
 
 /**
@@ -1071,6 +1281,12 @@ void ZeroMQNode::remoteNodeConfirm(const std::string& uuid, SharedPtr<NodeConnec
 		otherNode->node = NodeStub();
 	}
 
+	if (uuid == _uuid && !_allowLocalConns) {
+		// a configured peer address is our own
+		UM_LOG_INFO("%s: %s is ourself - not confirming", SHORT_UUID(_uuid).c_str(), otherNode->address.c_str());
+		return;
+	}
+
 	if (!otherNode->node) {
 		// needs a new or updated node
 
@@ -1097,11 +1313,146 @@ void ZeroMQNode::remoteNodeConfirm(const std::string& uuid, SharedPtr<NodeConnec
 			receivedRemotePubAdded(otherNode, *pubIter);
 			pubIter++;
 		}
+
+		// tell the new peer whom we know
+		if (_gossip)
+			sendGossip(otherNode);
 	}
 
 	otherNode->isConfirmed = true;
 }
 
+/**
+ * Send our port and the addresses of the nodes we are connected to, without
+ * the latter it only tells the peer we are still there.
+ */
+void ZeroMQNode::sendGossip(SharedPtr<NodeConnection> to, bool withPeers) {
+	UM_TRACE("sendGossip");
+	COMMON_VARS;
+
+	std::list<SharedPtr<NodeConnection> > peers;
+	msgSize = 4 + _uuid.length() + 1 + 2 + 2;
+
+	std::map<std::string, SharedPtr<NodeConnection> >::iterator connIter = _connTo.begin();
+	while(withPeers && connIter != _connTo.end()) {
+		// every connection is there with its address and uuid, take the latter
+		if (UUID::isUUID(connIter->first) && connIter->second != to && connIter->second->isConfirmed) {
+			peers.push_back(connIter->second);
+			msgSize += connIter->first.length() + 1 + connIter->second->address.length() + 1;
+		}
+		connIter++;
+	}
+
+	PREPARE_MSG(gossipMsg, msgSize);
+	writePtr = writeVersionAndType(writePtr, Message::UM_NODE_INFO);
+	writePtr = Message::write(writePtr, _uuid);
+	writePtr = Message::write(writePtr, _port);
+	writePtr = Message::write(writePtr, (uint16_t)peers.size());
+
+	std::list<SharedPtr<NodeConnection> >::iterator peerIter = peers.begin();
+	while(peerIter != peers.end()) {
+		writePtr = Message::write(writePtr, (*peerIter)->node.getUUID());
+		writePtr = Message::write(writePtr, (*peerIter)->address);
+		peerIter++;
+	}
+	ASSERT_BYTES_WRITTEN(msgSize);
+
+	UM_LOG_INFO("%s: Gossiping %lu peers to %s", SHORT_UUID(_uuid).c_str(), (unsigned long)peers.size(), to->address.c_str());
+	zmq_sendmsg(to->socket, &gossipMsg, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_sendmsg: %s", zmq_strerror(errno));
+	countMetaSent(msgSize);
+	zmq_msg_close(&gossipMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+}
+
+void ZeroMQNode::receivedGossip(const std::string& from, const char* buffer, size_t available, const std::string& fromIP) {
+	UM_TRACE("receivedGossip");
+	const char* readPtr = buffer;
+	const char* end = buffer + available;
+
+	std::string uuid;
+	uint16_t port;
+	uint16_t nrPeers;
+	readPtr = Message::read(readPtr, uuid, end - readPtr);
+	if (end - readPtr < 4 || uuid != from) {
+		UM_LOG_WARN("%s: Malformed gossip from %s - discarding", SHORT_UUID(_uuid).c_str(), SHORT_UUID(from).c_str());
+		return;
+	}
+	readPtr = Message::read(readPtr, &port);
+	readPtr = Message::read(readPtr, &nrPeers);
+
+	// addresses on the loopback of the sender are on its host
+	std::string ip = (fromIP.length() > 0 ? fromIP : "127.0.0.1");
+	learnedFromGossip(uuid, "tcp://" + ip + ":" + toStr(port));
+
+	std::map<std::string, GossipPeer>::iterator gossipIter = _gossipPeers.find(from);
+	if (gossipIter != _gossipPeers.end())
+		gossipIter->second.lastHeard = Thread::getTimeStampMs();
+
+	for (uint16_t i = 0; i < nrPeers && readPtr < end; i++) {
+		std::string peerUUID;
+		std::string address;
+		readPtr = Message::read(readPtr, peerUUID, end - readPtr);
+		readPtr = Message::read(readPtr, address, end - readPtr);
+
+		size_t hostStart = address.find("://");
+		size_t colonPos = address.find_last_of(":");
+		if (hostStart == std::string::npos || colonPos <= hostStart + 3)
+			continue;
+		std::string host = address.substr(hostStart + 3, colonPos - hostStart - 3);
+		if (host == "localhost" || host.substr(0, 4) == "127.")
+			address = address.substr(0, hostStart + 3) + ip + address.substr(colonPos);
+
+		learnedFromGossip(peerUUID, address);
+	}
+}
+
+void ZeroMQNode::learnedFromGossip(const std::string& uuid, const std::string& address) {
+	if (uuid == _uuid || !UUID::isUUID(uuid))
+		return;
+	if (_connTo.find(uuid) != _connTo.end() || _gossipPeers.find(uuid) != _gossipPeers.end())
+		return; // already known
+
+	EndPoint endPoint(address);
+	if (!endPoint)
+		return;
+	endPoint.getImpl()->setUUID(uuid);
+
+	UM_LOG_INFO("%s: Learned about %s at %s from gossip", SHORT_UUID(_uuid).c_str(), SHORT_UUID(uuid).c_str(), address.c_str());
+	GossipPeer& peer = _gossipPeers[uuid];
+	peer.endPoint = endPoint;
+	peer.learnedAt = Thread::getTimeStampMs();
+	added(endPoint);
+}
+
+/**
+ * Nobody removes the peers we learned from gossip, we do once we could not
+ * connect to them or they stopped gossiping. Peers without gossip are kept.
+ */
+void ZeroMQNode::expireGossipPeers(uint64_t now) {
+	uint64_t timeout = (uint64_t)_gossipInterval * UMUNDO_GOSSIP_TIMEOUT;
+
+	std::list<EndPoint> expired;
+	std::map<std::string, GossipPeer>::iterator peerIter = _gossipPeers.begin();
+	while(peerIter != _gossipPeers.end()) {
+		std::map<std::string, SharedPtr<NodeConnection> >::iterator connIter = _connTo.find(peerIter->first);
+		bool isConfirmed = (connIter != _connTo.end() && connIter->second->isConfirmed);
+
+		if (!isConfirmed && now - peerIter->second.learnedAt > timeout) {
+			UM_LOG_INFO("%s: Could not connect to %s learned from gossip - removing", SHORT_UUID(_uuid).c_str(), SHORT_UUID(peerIter->first).c_str());
+			expired.push_back(peerIter->second.endPoint);
+		} else if (peerIter->second.lastHeard > 0 && now - peerIter->second.lastHeard > timeout) {
+			UM_LOG_INFO("%s: No gossip from %s for %lums - removing", SHORT_UUID(_uuid).c_str(), SHORT_UUID(peerIter->first).c_str(), (unsigned long)(now - peerIter->second.lastHeard));
+			expired.push_back(peerIter->second.endPoint);
+		}
+		peerIter++;
+	}
+
+	// removed() only forgets them if the endpoint is still known at its address
+	for (std::list<EndPoint>::iterator endPointIter = expired.begin(); endPointIter != expired.end(); endPointIter++) {
+		removed(*endPointIter);
+		_gossipPeers.erase(endPointIter->getUUID());
+	}
+}
+
 void ZeroMQNode::remoteNodeDisconnect(const std::string& address) {
 	if (_connTo.find(address) == _connTo.end()) {
 		UM_LOG_ERR("Received internal disconnect request for %s, but adress is no known", address.c_str());
@@ -1113,6 +1464,7 @@ void ZeroMQNode::remoteNodeDisconnect(const std::string& address) {
 		unsubscribeFromRemoteNode(otherNode);
 		_connTo.erase(otherNode->node.getUUID());
 		_connFrom.erase(otherNode->node.getUUID());
+		_diffPeers.erase(otherNode->node.getUUID());
 	}
 
 	otherNode->disconnect();
@@ -1138,7 +1490,7 @@ void ZeroMQNode::updateSockets() {
 	 *  _stdSockets[0].socket = _nodeSocket;
 	 *  _stdSockets[1].socket = _pubSocket;
 	 *  _stdSockets[2].socket = _readOpSocket;
-	 *  _stdSockets[3].socket = _subSocket;
+	 *  _stdSockets[3].socket = _forwardSocket;
 	 *
 	 */
 	memcpy(_sockets, _stdSockets, _nrStdSockets * sizeof(zmq_pollitem_t));
@@ -1166,10 +1518,6 @@ void ZeroMQNode::run() {
 	size_t moreSize = sizeof(more);
 
 	while(isStarted()) {
-		// make sure we have a bucket for performance measuring
-		if (_buckets.size() == 0)
-			_buckets.push_back(StatBucket<size_t>());
-
 		if (_dirtySockets)
 			updateSockets();
 
@@ -1177,18 +1525,30 @@ void ZeroMQNode::run() {
 			_sockets[i].revents = 0;
 		}
 
-		zmq_poll(_sockets, _nrSockets, -1);
+		// do not wait while publishers still have messages for us
+		zmq_poll(_sockets, _nrSockets, (_isForwarding ? 0 : (_gossip && _gossipInterval > 0 ? _gossipInterval : -1)));
 		// We do have a message to read!
 
-		// manage performane status buckets
+		// derive rates from the counters every now and then
 		uint64_t now = Thread::getTimeStampMs();
-		while (_buckets.size() > 0 && _buckets.front().timeStamp < now - UMUNDO_PERF_WINDOW_LENGTH_MS) {
-			// drop oldest bucket
-			_buckets.pop_front();
-		}
-		if (_buckets.back().timeStamp < now - UMUNDO_PERF_BUCKET_LENGTH_MS) {
-			// we need a new bucket
-			_buckets.push_back(StatBucket<size_t>());
+		if (now - _lastStatsSample >= UMUNDO_PERF_SAMPLE_MS)
+			sampleStats(now);
+
+		// repeat what we know to a random peer in case something got lost, the others only hear we are alive
+		if (_gossip && _gossipInterval > 0 && now - _lastGossip >= _gossipInterval) {
+			RScopeLock lock(_mutex);
+			std::vector<SharedPtr<NodeConnection> > peers;
+			std::map<std::string, SharedPtr<NodeConnection> >::iterator connIter = _connTo.begin();
+			while(connIter != _connTo.end()) {
+				if (UUID::isUUID(connIter->first) && connIter->second->isConfirmed)
+					peers.push_back(connIter->second);
+				connIter++;
+			}
+			size_t toldPeer = (peers.size() > 0 ? rand() % peers.size() : 0);
+			for (size_t i = 0; i < peers.size(); i++)
+				sendGossip(peers[i], i == toldPeer);
+			expireGossipPeers(now);
+			_lastGossip = now;
 		}
 
 		// look through node sockets
@@ -1221,35 +1581,29 @@ void ZeroMQNode::run() {
 
 		if (_sockets[2].revents & ZMQ_POLLIN) {
 			RScopeLock lock(_mutex);
-			receivedInternalOp();
-			DRAIN_SOCKET(_readOpSocket);
+			// take all pending operations so changed publishers go out as one diff
+			int events = ZMQ_POLLIN;
+			size_t eventsSize = sizeof(events);
+			size_t ops = 0;
+			while (events & ZMQ_POLLIN && ops++ < UMUNDO_MAX_INTERNAL_OPS) {
+				receivedInternalOp();
+				DRAIN_SOCKET(_readOpSocket);
+				zmq_getsockopt(_readOpSocket, ZMQ_EVENTS, &events, &eventsSize) && UM_LOG_ERR("zmq_getsockopt: %s", zmq_strerror(errno));
+			}
+		}
+
+		if (_pubSetSent != _pubSetVersion) {
+			RScopeLock lock(_mutex);
+			flushPubDiff();
 		}
 
 		// someone is publishing via our external publisher, just pass through
 		if (_sockets[3].revents & ZMQ_POLLIN) {
-			size_t msgSize = 0;
-			zmq_msg_t message;
-			std::string channelName;
-			while (1) {
-				//  Process all parts of the message
-				zmq_msg_init (&message) && UM_LOG_ERR("zmq_msg_init: %s", zmq_strerror(errno));
-				zmq_msg_recv (&message, _subSocket, 0);
-				msgSize = zmq_msg_size(&message);
-
-				if (channelName.size() == 0)
-					channelName = std::string((char*)zmq_msg_data(&message));
-
-				if (_buckets.size() > 0) {
-					_buckets.back().nrChannelMsg[channelName]++;
-					_buckets.back().sizeChannelMsg[channelName] += msgSize;
-				}
-				zmq_getsockopt (_subSocket, ZMQ_RCVMORE, &more, &moreSize) && UM_LOG_ERR("zmq_getsockopt: %s", zmq_strerror(errno));
-				zmq_msg_send(&message, _pubSocket, more ? ZMQ_SNDMORE: 0) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-				zmq_msg_close (&message) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
-				if (!more)
-					break;      //  Last message part
-			}
+			while (zmq_recv(_forwardSocket, NULL, 0, ZMQ_DONTWAIT) >= 0) {}
+			_isForwarding = true;
 		}
+		if (_isForwarding)
+			_isForwarding = forwardQueued();
 
 //			if (now - _lastNodeInfoBroadCast > 5000) {
 //				broadCastNodeInfo(now);
@@ -1262,6 +1616,37 @@ void ZeroMQNode::run() {
 	}
 }
 
+/**
+ * Pass messages of our publishers on to our XPUB socket.
+ *
+ * Publishers hand us whole messages via the forward queue, we send them on
+ * without looking at the frames. Statistics are kept by the publishers and
+ * collected with every new bucket. Traced data frames only get our time at
+ * the offset publishers leave for it. Returns whether to come back before
+ * waiting in poll again.
+ */
+bool ZeroMQNode::forwardQueued() {
+	zmq_msg_t frames[UMUNDO_FORWARD_MAX_FRAMES];
+	size_t nrFrames;
+	size_t forwarded = 0;
+
+	while ((nrFrames = _forwardQueue->pop(frames)) > 0) {
+		if (nrFrames > 1 && zmq_msg_size(&frames[1]) >= UMUNDO_TRACE_OFFSET + UMUNDO_TRACE_SIZE) {
+			char* data = (char*)zmq_msg_data(&frames[1]);
+			if (data[0] == Message::UM_MSG_VERSION_02 && (data[1 + 16] & Message::UM_TRACE))
+				Message::write(data + UMUNDO_TRACE_OFFSET + 16, Thread::getMonotonicTimeStampUs());
+		}
+		for (size_t i = 0; i < nrFrames; i++) {
+			zmq_msg_send(&frames[i], _pubSocket, (i + 1 < nrFrames ? ZMQ_SNDMORE : 0)) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
+			zmq_msg_close(&frames[i]) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+		}
+		// give control messages a chance every now and then
+		if (++forwarded >= UMUNDO_MAX_FORWARD_MSGS)
+			return true;
+	}
+	return !_forwardQueue->sleep();
+}
+
 #if 0
 void ZeroMQNode::broadCastNodeInfo(uint64_t now) {
 	UM_TRACE("broadCastNodeInfo");
@@ -1330,16 +1715,18 @@ void ZeroMQNode::unsubscribeFromRemoteNode(SharedPtr<NodeConnection> connection)
 		std::string nodeUUID = connection->node.getUUID();
 		std::map<std::string, PublisherStub> remotePubs = connection->node.getPublishers();
 		std::map<std::string, PublisherStub>::iterator remotePubIter = remotePubs.begin();
-		std::map<std::string, Subscriber>::iterator localSubIter = _subs.begin();
 
 		// iterate all remote publishers and remove from local subs
 		while (remotePubIter != remotePubs.end()) {
-			while (localSubIter != _subs.end()) {
-				if(localSubIter->second.matches(remotePubIter->second)) {
-					localSubIter->second.removed(remotePubIter->second, connection->node);
-					sendUnsubscribeFromPublisher(connection->node.getUUID().c_str(), localSubIter->second, remotePubIter->second);
+			_remotePubsByChannel.erase(remotePubIter->second.getChannelName(), remotePubIter->first);
+
+			std::vector<Subscriber> localSubs;
+			_subsByChannel.findPrefixesOf(remotePubIter->second.getChannelName(), localSubs);
+			for (std::vector<Subscriber>::iterator localSubIter = localSubs.begin(); localSubIter != localSubs.end(); localSubIter++) {
+				if(localSubIter->matches(remotePubIter->second)) {
+					localSubIter->removed(remotePubIter->second, connection->node);
+					sendUnsubscribeFromPublisher(connection->node.getUUID().c_str(), *localSubIter, remotePubIter->second);
 				}
-				localSubIter++;
 			}
 
 			std::list<ResultSet<PublisherStub>* >::iterator monitorIter = _pubMonitors.begin();
@@ -1371,6 +1758,37 @@ void ZeroMQNode::unsubscribeFromRemoteNode(SharedPtr<NodeConnection> connection)
 	}
 }
 
+/**
+ * Telling a publisher about a subscriber it already has makes it send its static
+ * header to everyone with the next message.
+ */
+void ZeroMQNode::requestedStaticHeader(const std::string& subUUID, const std::string& pubUUID) {
+	UM_TRACE("requestedStaticHeader");
+	if (_subscriptions.find(subUUID) == _subscriptions.end())
+		return;
+
+	Subscription& confSub = _subscriptions[subUUID];
+	if (!confSub.subStub || confSub.confirmed.find(pubUUID) == confSub.confirmed.end())
+		return; // publisher will send it once the subscription is confirmed
+
+	UM_LOG_INFO("%s: Subscriber %s asks publisher %s for its static header", SHORT_UUID(_uuid).c_str(), SHORT_UUID(subUUID).c_str(), SHORT_UUID(pubUUID).c_str());
+	if (_connFrom.find(confSub.nodeUUID) != _connFrom.end()) {
+		confSub.confirmed[pubUUID].added(confSub.subStub, _connFrom[confSub.nodeUUID]);
+	} else if (_connTo.find(confSub.nodeUUID) != _connTo.end()) {
+		confSub.confirmed[pubUUID].added(confSub.subStub, _connTo[confSub.nodeUUID]->node);
+	}
+}
+
+void ZeroMQNode::reportedSharedMemory(const std::string& subUUID, const std::string& pubUUID, bool canRead) {
+	UM_TRACE("reportedSharedMemory");
+	if (_pubs.find(pubUUID) == _pubs.end())
+		return;
+
+	Publisher& pub = _pubs[pubUUID];
+	if (pub.getImpl()->implType == Publisher::ZEROMQ)
+		StaticPtrCast<ZeroMQPublisher>(pub.getImpl())->readsSharedMemory(subUUID, canRead);
+}
+
 void ZeroMQNode::confirmSubscription(const std::string& subUUID) {
 	UM_TRACE("confirmSubscription");
 	if (_subscriptions.find(subUUID) == _subscriptions.end())
@@ -1437,6 +1855,226 @@ void ZeroMQNode::writeNodeInfo(zmq_msg_t* msg, Message::ControlType type) {
 	assert(writePtr - writeBuffer == zmq_msg_size(msg));
 }
 
+/**
+ * One of our publishers was added or removed, called from the node thread
+ */
+void ZeroMQNode::changedPubSet(bool added, const std::string& uuid, const std::string& info) {
+	if (added) {
+		_pubSet[uuid] = info;
+	} else {
+		_pubSet.erase(uuid);
+	}
+
+	PubChange change;
+	change.version = ++_pubSetVersion;
+	change.added = added;
+	change.uuid = uuid;
+	change.info = info;
+	_pubLog.push_back(change);
+}
+
+/**
+ * Our publishers as changes since the given version or all of them if we forgot
+ * some of the changes or there are more changes than publishers.
+ */
+void ZeroMQNode::writePubDiff(zmq_msg_t* msg, uint64_t since) {
+	UM_TRACE("writePubDiff");
+
+	uint8_t flags = 0;
+	if (since > _pubSetVersion || _pubSetVersion - since > _pubLog.size() || _pubSetVersion - since > _pubSet.size())
+		flags |= PUB_DIFF_FULL;
+
+	std::deque<PubChange>::iterator changeIter = _pubLog.end() - (size_t)(flags & PUB_DIFF_FULL ? 0 : _pubSetVersion - since);
+	std::map<std::string, std::string>::iterator pubIter;
+
+	size_t entriesSize = 0;
+	if (flags & PUB_DIFF_FULL) {
+		for (pubIter = _pubSet.begin(); pubIter != _pubSet.end(); pubIter++)
+			entriesSize += 1 + pubIter->second.length();
+	} else {
+		for (std::deque<PubChange>::iterator iter = changeIter; iter != _pubLog.end(); iter++)
+			entriesSize += 1 + iter->info.length();
+	}
+
+	zmq_msg_init(msg) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
+	zmq_msg_init_size (msg, 4 + _uuid.length() + 1 + 8 + 8 + 1 + entriesSize) && UM_LOG_WARN("zmq_msg_init_size: %s",zmq_strerror(errno));
+	char* writeBuffer = (char*)zmq_msg_data(msg);
+	char* writePtr = writeBuffer;
+
+	writePtr = writeVersionAndType(writePtr, Message::UM_PUB_DIFF);
+	writePtr = Message::write(writePtr, _uuid);
+	writePtr = Message::write(writePtr, since);
+	writePtr = Message::write(writePtr, _pubSetVersion);
+	writePtr = Message::write(writePtr, flags);
+	assert((size_t)(writePtr - writeBuffer) == 4 + _uuid.length() + 1 + 8 + 8 + 1);
+
+	// every change is one version, all publishers are added
+	if (flags & PUB_DIFF_FULL) {
+		for (pubIter = _pubSet.begin(); pubIter != _pubSet.end(); pubIter++) {
+			writePtr = Message::write(writePtr, (uint8_t)1);
+			memcpy(writePtr, pubIter->second.data(), pubIter->second.length());
+			writePtr += pubIter->second.length();
+		}
+	} else {
+		for (; changeIter != _pubLog.end(); changeIter++) {
+			writePtr = Message::write(writePtr, (uint8_t)(changeIter->added ? 1 : 0));
+			memcpy(writePtr, changeIter->info.data(), changeIter->info.length());
+			writePtr += changeIter->info.length();
+		}
+	}
+
+	assert((size_t)(writePtr - writeBuffer) == zmq_msg_size(msg));
+}
+
+/**
+ * Send the changes since the last tick to every connected node that understands diffs
+ */
+void ZeroMQNode::flushPubDiff() {
+	UM_TRACE("flushPubDiff");
+
+	if (_diffPeers.size() > 0) {
+		zmq_msg_t diffMsg;
+		writePubDiff(&diffMsg, _pubSetSent);
+
+		UM_LOG_INFO("%s: Broadcasting PUB_DIFF from version %lu to %lu",
+		            SHORT_UUID(_uuid).c_str(), (unsigned long)_pubSetSent, (unsigned long)_pubSetVersion);
+
+		NODE_BROADCAST_MSG_IF(diffMsg, _diffPeers.find(nodeIter_->first) != _diffPeers.end());
+		zmq_msg_close(&diffMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
+	}
+	_pubSetSent = _pubSetVersion;
+
+	while(_pubLog.size() > _pubLogSize)
+		_pubLog.pop_front();
+}
+
+/**
+ * A remote node replied to our CONNECT_REQ or changed its publishers
+ */
+void ZeroMQNode::receivedPubDiff(SharedPtr<NodeConnection> client, const char* buffer, size_t available) {
+	UM_TRACE("receivedPubDiff");
+
+	const char* readPtr = buffer;
+	if (available < 37 + 8 + 8 + 1)
+		return;
+
+	std::string uuid;
+	uint64_t since;
+	uint64_t version;
+	uint8_t flags;
+	readPtr = Message::read(readPtr, uuid, 37);
+	readPtr = Message::read(readPtr, &since);
+	readPtr = Message::read(readPtr, &version);
+	readPtr = Message::read(readPtr, &flags);
+
+	// entries as they are and as publishers
+	std::list<std::pair<bool, std::string> > entries;
+	std::list<SharedPtr<PublisherStubImpl> > entryPubs;
+	while((size_t)(readPtr - buffer) < available) {
+		// added flag, channel name, uuid, type and port of the publisher
+		size_t remaining = available - (readPtr - buffer);
+		const char* channelEnd = (const char*)memchr(readPtr + 1, '\0', remaining - 1);
+		if (channelEnd == NULL || remaining - (channelEnd + 1 - readPtr) < 37 + 2 + 2 || channelEnd[37] != '\0') {
+			UM_LOG_WARN("%s: Ignoring PUB_DIFF from %s with a truncated entry", SHORT_UUID(_uuid).c_str(), SHORT_UUID(uuid).c_str());
+			return;
+		}
+
+		uint8_t added;
+		readPtr = Message::read(readPtr, &added);
+		const char* pubInfo = readPtr;
+		SharedPtr<PublisherStubImpl> pubStub = SharedPtr<PublisherStubImpl>(new PublisherStubImpl());
+		readPtr = read(readPtr, pubStub.get(), available - (readPtr - buffer));
+		entries.push_back(std::make_pair(added != 0, std::string(pubInfo, readPtr - pubInfo)));
+		entryPubs.push_back(pubStub);
+	}
+
+	RemotePubSet& known = _remotePubSets[uuid];
+	bool isConnectReply = (!client->isConfirmed || !client->node || client->node.getUUID() != uuid);
+
+	if (!(flags & PUB_DIFF_FULL) && since > known.version) {
+		// we missed some changes, ask again with what we have
+		UM_LOG_WARN("%s: Changes to publishers of %s since version %lu missing, we know %lu - requesting again",
+		            SHORT_UUID(_uuid).c_str(), SHORT_UUID(uuid).c_str(), (unsigned long)since, (unsigned long)known.version);
+		if (isConnectReply)
+			_remotePubSets.erase(uuid);
+		sendConnectReq(client);
+		return;
+	}
+
+	std::map<std::string, std::string> pubs = (flags & PUB_DIFF_FULL ? std::map<std::string, std::string>() : known.pubs);
+	std::list<std::pair<bool, SharedPtr<PublisherStubImpl> > > changes;
+
+	std::list<std::pair<bool, std::string> >::iterator entryIter = entries.begin();
+	std::list<SharedPtr<PublisherStubImpl> >::iterator entryPubIter = entryPubs.begin();
+	for (uint64_t entryVersion = since + 1; entryIter != entries.end(); entryIter++, entryPubIter++, entryVersion++) {
+		const std::string& pubUUID = (*entryPubIter)->getUUID();
+		if (flags & PUB_DIFF_FULL) {
+			pubs[pubUUID] = entryIter->second;
+			if (known.pubs.find(pubUUID) == known.pubs.end())
+				changes.push_back(std::make_pair(true, *entryPubIter));
+			continue;
+		}
+
+		if (entryVersion <= known.version) // seen with the reply to our connect request
+			continue;
+
+		if (entryIter->first && pubs.find(pubUUID) == pubs.end()) {
+			pubs[pubUUID] = entryIter->second;
+			changes.push_back(std::make_pair(true, *entryPubIter));
+		} else if (!entryIter->first && pubs.find(pubUUID) != pubs.end()) {
+			pubs.erase(pubUUID);
+			changes.push_back(std::make_pair(false, *entryPubIter));
+		}
+	}
+
+	if (flags & PUB_DIFF_FULL) {
+		std::map<std::string, std::string>::iterator knownIter = known.pubs.begin();
+		while(knownIter != known.pubs.end()) {
+			if (pubs.find(knownIter->first) == pubs.end()) {
+				SharedPtr<PublisherStubImpl> pubStub = SharedPtr<PublisherStubImpl>(new PublisherStubImpl());
+				read(knownIter->second.data(), pubStub.get(), knownIter->second.length());
+				changes.push_back(std::make_pair(false, pubStub));
+			}
+			knownIter++;
+		}
+	}
+
+	known.pubs = pubs;
+	if ((flags & PUB_DIFF_FULL) || version > known.version)
+		known.version = version;
+
+	if (isConnectReply) {
+		// all the publishers we know are new to this connection
+		UM_LOG_INFO("%s: %s replied with %d changes, has %d publishers at version %lu",
+		            SHORT_UUID(_uuid).c_str(), SHORT_UUID(uuid).c_str(), entries.size(), pubs.size(), (unsigned long)version);
+		// a node replaced at this address will not come back
+		if (_addressUUIDs.find(client->address) != _addressUUIDs.end() && _addressUUIDs[client->address] != uuid)
+			_remotePubSets.erase(_addressUUIDs[client->address]);
+		_addressUUIDs[client->address] = uuid;
+
+		std::list<SharedPtr<PublisherStubImpl> > publishers;
+		std::map<std::string, std::string>::iterator pubIter = pubs.begin();
+		while(pubIter != pubs.end()) {
+			SharedPtr<PublisherStubImpl> pubStub = SharedPtr<PublisherStubImpl>(new PublisherStubImpl());
+			read(pubIter->second.data(), pubStub.get(), pubIter->second.length());
+			publishers.push_back(pubStub);
+			pubIter++;
+		}
+		remoteNodeConfirm(uuid, client, publishers);
+		return;
+	}
+
+	std::list<std::pair<bool, SharedPtr<PublisherStubImpl> > >::iterator changeIter = changes.begin();
+	while(changeIter != changes.end()) {
+		if (changeIter->first) {
+			receivedRemotePubAdded(client, changeIter->second);
+		} else {
+			receivedRemotePubRemoved(client, changeIter->second);
+		}
+		changeIter++;
+	}
+}
+
 void ZeroMQNode::receivedRemotePubAdded(SharedPtr<NodeConnection> client, SharedPtr<PublisherStubImpl> pub) {
 	UM_TRACE("receivedRemotePubAdded");
 
@@ -1452,6 +2090,7 @@ void ZeroMQNode::receivedRemotePubAdded(SharedPtr<NodeConnection> client, Shared
 	pubStub.getImpl()->setTransport(nodeStub.getTransport());
 
 	nodeStub.getImpl()->addPublisher(pubStub);
+	_remotePubsByChannel.insert(pubStub.getChannelName(), pubStub.getUUID(), RemotePublisher(pubStub, nodeStub));
 
 	std::list<ResultSet<PublisherStub>* >::iterator monitorIter = _pubMonitors.begin();
 	while(monitorIter != _pubMonitors.end()) {
@@ -1460,13 +2099,14 @@ void ZeroMQNode::receivedRemotePubAdded(SharedPtr<NodeConnection> client, Shared
 		monitorIter++;
 	}
 
-	std::map<std::string, Subscriber>::iterator subIter = _subs.begin();
-	while(subIter != _subs.end()) {
-		if (subIter->second.matches(pubStub)) {
-			subIter->second.added(pubStub, nodeStub);
-			sendSubscribeToPublisher(nodeStub.getUUID(), subIter->second, pubStub);
+	// our subscribers on channels the publisher's channel starts with
+	std::vector<Subscriber> subs;
+	_subsByChannel.findPrefixesOf(pubStub.getChannelName(), subs);
+	for (std::vector<Subscriber>::iterator subIter = subs.begin(); subIter != subs.end(); subIter++) {
+		if (subIter->matches(pubStub)) {
+			subIter->added(pubStub, nodeStub);
+			sendSubscribeToPublisher(nodeStub.getUUID(), *subIter, pubStub);
 		}
-		subIter++;
 	}
 }
 
@@ -1487,14 +2127,15 @@ void ZeroMQNode::receivedRemotePubRemoved(SharedPtr<NodeConnection> client, Shar
 		monitorIter++;
 	}
 
-	std::map<std::string, Subscriber>::iterator subIter = _subs.begin();
-	while(subIter != _subs.end()) {
-		if (subIter->second.matches(pubStub)) {
-			subIter->second.removed(pubStub, nodeStub);
-			sendUnsubscribeFromPublisher(nodeStub.getUUID(), subIter->second, pubStub);
+	std::vector<Subscriber> subs;
+	_subsByChannel.findPrefixesOf(pubStub.getChannelName(), subs);
+	for (std::vector<Subscriber>::iterator subIter = subs.begin(); subIter != subs.end(); subIter++) {
+		if (subIter->matches(pubStub)) {
+			subIter->removed(pubStub, nodeStub);
+			sendUnsubscribeFromPublisher(nodeStub.getUUID(), *subIter, pubStub);
 		}
-		subIter++;
 	}
+	_remotePubsByChannel.erase(pubStub.getChannelName(), pubStub.getUUID());
 	nodeStub.removePublisher(pubStub);
 }
 
@@ -1518,19 +2159,17 @@ void ZeroMQNode::sendSubscribeToPublisher(const std::string& nodeUUID, const Sub
 	UM_LOG_INFO("Sending sub added for %s on %s to publisher %s",
 	            sub.getChannelName().c_str(), SHORT_UUID(sub.getUUID()).c_str(), SHORT_UUID(pub.getUUID()).c_str());
 
-	size_t bufferSize = 4 + SUB_INFO_SIZE(sub) + PUB_INFO_SIZE(pub);
+	size_t bufferSize = 4 + SUB_INFO_SIZE(sub) + PUB_INFO_SIZE(pub) + hostUUID.length() + 1;
 	PREPARE_MSG(subAddedMsg, bufferSize);
 
 	writePtr = writeVersionAndType(writePtr, Message::UM_SUBSCRIBE);
 	writePtr = write(writePtr, sub);
 	writePtr = write(writePtr, pub);
+	writePtr = Message::write(writePtr, hostUUID); // lets publishers on our host use shared memory
 	assert(writePtr - writeBuffer == bufferSize);
 
 	zmq_msg_send(&subAddedMsg, clientSocket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	if (_buckets.size() > 0) {
-		_buckets.back().nrMetaMsgSent++;
-		_buckets.back().sizeMetaMsgSent += bufferSize;
-	}
+	countMetaSent(bufferSize);
 	zmq_msg_close(&subAddedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 }
 
@@ -1557,10 +2196,7 @@ void ZeroMQNode::sendUnsubscribeFromPublisher(const std::string& nodeUUID, const
 	assert(writePtr - writeBuffer == bufferSize);
 
 	zmq_msg_send(&subRemovedMsg, clientSocket, ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_msg_send: %s", zmq_strerror(errno));
-	if (_buckets.size() > 0) {
-		_buckets.back().nrMetaMsgSent++;
-		_buckets.back().sizeMetaMsgSent += bufferSize;
-	}
+	countMetaSent(bufferSize);
 	zmq_msg_close(&subRemovedMsg) && UM_LOG_ERR("zmq_msg_close: %s", zmq_strerror(errno));
 
 }
@@ -1665,70 +2301,49 @@ const char* ZeroMQNode::readVersionAndType(const char* buffer, uint16_t& version
 }
 
 
-ZeroMQNode::StatBucket<double> ZeroMQNode::accumulateIntoBucket() {
-	StatBucket<double> statBucket;
-
-	double rollOffFactor = 0.3;
-
-	std::list<StatBucket<size_t> >::iterator buckFrameStart = _buckets.begin();
-	std::list<StatBucket<size_t> >::iterator buckFrameEnd = _buckets.begin();
-	std::map<std::string, size_t>::iterator chanIter;
-
-	while(buckFrameEnd != _buckets.end()) {
-		if (buckFrameEnd->timeStamp - 1000 < buckFrameStart->timeStamp) {
-			// we do not yet have a full second
-			buckFrameEnd++;
-			continue;
-		}
+void ZeroMQNode::sampleRates(StatSlot& slot) {
+	ChannelStats::Snapshot curr = slot.stats->snapshotCounters();
+	ChannelStats::Snapshot delta = curr;
+	delta -= slot.last;
 
-		// accumulate stats for a second
-		StatBucket<size_t> oneSecBucket;
-		std::list<StatBucket<size_t> >::iterator curr = buckFrameStart;
-		while(curr != buckFrameEnd) {
-			oneSecBucket.nrMetaMsgRcvd += curr->nrMetaMsgRcvd;
-			oneSecBucket.nrMetaMsgSent += curr->nrMetaMsgSent;
-			oneSecBucket.sizeMetaMsgRcvd += curr->sizeMetaMsgRcvd;
-			oneSecBucket.sizeMetaMsgSent += curr->sizeMetaMsgSent;
-
-			chanIter = curr->nrChannelMsg.begin();
-			while (chanIter != curr->nrChannelMsg.end()) {
-				oneSecBucket.nrChannelMsg[chanIter->first] += chanIter->second;
-				chanIter++;
-			}
-			chanIter = curr->sizeChannelMsg.begin();
-			while (chanIter != curr->sizeChannelMsg.end()) {
-				oneSecBucket.sizeChannelMsg[chanIter->first] += chanIter->second;
-				chanIter++;
-			}
-			curr++;
-		}
-
-		statBucket.nrMetaMsgSent = (1 - rollOffFactor) * statBucket.nrMetaMsgSent + rollOffFactor * oneSecBucket.nrMetaMsgSent;
-		statBucket.nrMetaMsgRcvd = (1 - rollOffFactor) * statBucket.nrMetaMsgRcvd + rollOffFactor * oneSecBucket.nrMetaMsgRcvd;
-		statBucket.sizeMetaMsgSent = (1 - rollOffFactor) * statBucket.sizeMetaMsgSent + rollOffFactor * oneSecBucket.sizeMetaMsgSent;
-		statBucket.sizeMetaMsgRcvd = (1 - rollOffFactor) * statBucket.sizeMetaMsgRcvd + rollOffFactor * oneSecBucket.sizeMetaMsgRcvd;
+	double secs = (double)(curr.timeStamp - slot.last.timeStamp) / 1000;
+	if (secs <= 0)
+		return;
 
-		chanIter = oneSecBucket.sizeChannelMsg.begin();
-		while (chanIter != oneSecBucket.sizeChannelMsg.end()) {
-			statBucket.sizeChannelMsg[chanIter->first] = (1 - rollOffFactor) * statBucket.sizeChannelMsg[chanIter->first] + rollOffFactor * chanIter->second;;
-			chanIter++;
-		}
+	// exponentially weighted to smooth bursts
+	double rollOffFactor = UMUNDO_PERF_ROLLOFF;
+	slot.msgsPerSec = (1 - rollOffFactor) * slot.msgsPerSec + rollOffFactor * (delta.nrMsgs / secs);
+	slot.bytesPerSec = (1 - rollOffFactor) * slot.bytesPerSec + rollOffFactor * (delta.sizeMsgs / secs);
+	slot.compressedPerSec = (1 - rollOffFactor) * slot.compressedPerSec + rollOffFactor * (delta.nrCompressed / secs);
+	slot.comprSkippedPerSec = (1 - rollOffFactor) * slot.comprSkippedPerSec + rollOffFactor * (delta.nrComprSkipped / secs);
+	slot.last = curr;
+}
 
-		chanIter = oneSecBucket.nrChannelMsg.begin();
-		while (chanIter != oneSecBucket.nrChannelMsg.end()) {
-			statBucket.nrChannelMsg[chanIter->first] = (1 - rollOffFactor) * statBucket.nrChannelMsg[chanIter->first] + rollOffFactor * chanIter->second;;
-			chanIter++;
-		}
+void ZeroMQNode::sampleStats(uint64_t now) {
+	RScopeLock lock(_mutex);
+	_lastStatsSample = now;
 
-		buckFrameStart++;
+	sampleRates(_metaSent);
+	sampleRates(_metaRcvd);
+	std::map<std::string, StatSlot>::iterator slotIter = _channelStats.begin();
+	while(slotIter != _channelStats.end()) {
+		sampleRates(slotIter->second);
+		slotIter++;
 	}
+}
 
-	return statBucket;
+std::map<std::string, ChannelStats::Snapshot> ZeroMQNode::getChannelStats() {
+	RScopeLock lock(_mutex);
+	std::map<std::string, ChannelStats::Snapshot> stats;
+	std::map<std::string, StatSlot>::iterator slotIter = _channelStats.begin();
+	while(slotIter != _channelStats.end()) {
+		stats[slotIter->first] = slotIter->second.stats->snapshot();
+		slotIter++;
+	}
+	return stats;
 }
 
 void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
-	StatBucket<double> statBucket = accumulateIntoBucket();
-
 	// return to sender
 	zmq_send(_nodeSocket, uuid.c_str(), uuid.length(), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
 	zmq_send(_nodeSocket, "", 0, ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno));
@@ -1756,10 +2371,15 @@ void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
 	SEND_DEBUG_ENVELOPE(std::string("proc:" + procUUID));
 
 	// calculate performance
-	SEND_DEBUG_ENVELOPE(std::string("sent:msgs:" + toStr(ceil(statBucket.nrMetaMsgSent))));
-	SEND_DEBUG_ENVELOPE(std::string("sent:bytes:" + toStr(ceil(statBucket.sizeMetaMsgSent))));
-	SEND_DEBUG_ENVELOPE(std::string("rcvd:msgs:" + toStr(ceil(statBucket.nrMetaMsgRcvd))));
-	SEND_DEBUG_ENVELOPE(std::string("rcvd:bytes:" + toStr(ceil(statBucket.sizeMetaMsgRcvd))));
+	SEND_DEBUG_ENVELOPE(std::string("sent:msgs:" + toStr(ceil(_metaSent.msgsPerSec))));
+	SEND_DEBUG_ENVELOPE(std::string("sent:bytes:" + toStr(ceil(_metaSent.bytesPerSec))));
+	SEND_DEBUG_ENVELOPE(std::string("rcvd:msgs:" + toStr(ceil(_metaRcvd.msgsPerSec))));
+	SEND_DEBUG_ENVELOPE(std::string("rcvd:bytes:" + toStr(ceil(_metaRcvd.bytesPerSec))));
+
+	BufferPool::Stats poolStats = BufferPool::getStats();
+	SEND_DEBUG_ENVELOPE(std::string("pool:hitRate:" + toStr(poolStats.hitRate())));
+	SEND_DEBUG_ENVELOPE(std::string("pool:highWater:bytes:" + toStr(poolStats.highWaterBytes)));
+	SEND_DEBUG_ENVELOPE(std::string("pool:highWater:buffers:" + toStr(poolStats.highWaterBuffers)));
 
 	// send our publishers
 	std::map<std::string, Publisher>::iterator pubIter = _pubs.begin();
@@ -1768,8 +2388,20 @@ void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
 		SEND_DEBUG_ENVELOPE(std::string("pub:uuid:" + pubIter->first));
 		SEND_DEBUG_ENVELOPE(std::string("pub:channelName:" + pubIter->second.getChannelName()));
 		SEND_DEBUG_ENVELOPE(std::string("pub:type:" + toStr(pubIter->second.getImpl()->implType)));
-		SEND_DEBUG_ENVELOPE(std::string("pub:sent:msgs:" + toStr(ceil(statBucket.nrChannelMsg[pubIter->second.getChannelName()]))));
-		SEND_DEBUG_ENVELOPE(std::string("pub:sent:bytes:" + toStr(ceil(statBucket.sizeChannelMsg[pubIter->second.getChannelName()]))));
+
+		std::map<std::string, StatSlot>::iterator slotIter = _channelStats.find(pubIter->second.getChannelName());
+		if (slotIter != _channelStats.end()) {
+			StatSlot& slot = slotIter->second;
+			ChannelStats::Snapshot stats = slot.stats->snapshot();
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:msgs:" + toStr(ceil(slot.msgsPerSec))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:bytes:" + toStr(ceil(slot.bytesPerSec))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:compressed:" + toStr(ceil(slot.compressedPerSec))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:comprSkipped:" + toStr(ceil(slot.comprSkippedPerSec))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:size:p50:" + toStr(stats.sizes.percentile(50))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:size:p99:" + toStr(stats.sizes.percentile(99))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:interval:p50:" + toStr(stats.interArrival.percentile(50))));
+			SEND_DEBUG_ENVELOPE(std::string("pub:sent:interval:p99:" + toStr(stats.interArrival.percentile(99))));
+		}
 
 		std::map<std::string, SubscriberStub> subs = pubIter->second.getSubscribers();
 		std::map<std::string, SubscriberStub>::iterator subIter = subs.begin();
@@ -1793,6 +2425,18 @@ void ZeroMQNode::replyWithDebugInfo(const std::string uuid) {
 		SEND_DEBUG_ENVELOPE(std::string("sub:channelName:" + subIter->second.getChannelName()));
 		SEND_DEBUG_ENVELOPE(std::string("sub:type:" + toStr(subIter->second.getImpl()->implType)));
 
+		TraceStats::Snapshot trace = subIter->second.getTraceStats();
+		if (trace.nrTraced > 0) {
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:msgs:" + toStr(trace.nrTraced)));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:lost:" + toStr(trace.nrLost)));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:reordered:" + toStr(trace.nrReordered)));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:latency:p50:" + toStr(trace.latency.percentile(50))));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:latency:p99:" + toStr(trace.latency.percentile(99))));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:latency:max:" + toStr(trace.latency.max)));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:toNode:p99:" + toStr(trace.toNode.percentile(99))));
+			SEND_DEBUG_ENVELOPE(std::string("sub:trace:fromNode:p99:" + toStr(trace.fromNode.percentile(99))));
+		}
+
 		std::map<std::string, PublisherStub> pubs = subIter->second.getPublishers();
 		std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin();
 		// send all remote publishers we think this node has
@@ -1894,6 +2538,7 @@ int ZeroMQNode::NodeConnection::connect() {
 		UM_LOG_ERR("zmq_setsockopt: %s", zmq_strerror(errno));
 		return err;
 	}
+	socketOptions.apply(socket);
 
 	err = zmq_connect(socket, address.c_str());
 	if (err) {
@@ -22,12 +22,21 @@
 #define ZEROMQDISPATCHER_H_XFMTSVLV
 
 #include <zmq.h>
+#include <deque>
 
 #include "umundo/Common.h"
+#include "umundo/config.h"
 #include "umundo/thread/Thread.h"
 #include "umundo/ResultSet.h"
 #include "umundo/connection/Node.h"
+#include "umundo/connection/ChannelIndex.h"
 #include "umundo/Message.h"
+#include "umundo/Statistics.h"
+#include "umundo/connection/zeromq/ZeroMQForwardQueue.h"
+
+/// Traced data frames have a block with sequence number, sent and forwarded time after these bytes
+#define UMUNDO_TRACE_OFFSET (1 + 16 + 1 + 4)
+#define UMUNDO_TRACE_SIZE (8 + 8 + 8)
 
 /// Send uuid as first message in envelope
 #define ZMQ_SEND_IDENTITY(msg, uuid, socket) \
@@ -68,6 +77,7 @@ zmq_msg_close(&endPointOp) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno
 namespace umundo {
 
 class PublisherStub;
+class ZeroMQDispatcher;
 class ZeroMQPublisher;
 class ZeroMQSubscriber;
 class NodeQuery;
@@ -96,8 +106,14 @@ public:
 	void removePublisher(Publisher&);
 	std::map<std::string, NodeStub> connectedFrom();
 	std::map<std::string, NodeStub> connectedTo();
+	uint16_t getPubPort() {
+		return _pubPort;
+	}
 	//@}
 
+	/// traffic per channel of our publishers since they were added
+	std::map<std::string, ChannelStats::Snapshot> getChannelStats();
+
 	/** @name Callbacks from Discovery */
 	//@{
 	void added(ENDPOINT_RS_TYPE);    ///< A node was added, connect to its router socket and list our publishers.
@@ -108,6 +124,24 @@ public:
 
 	static uint16_t bindToFreePort(void* socket, const std::string& transport, const std::string& address);
 	static void* getZeroMQContext();
+	static void configureZeroMQContext(std::map<std::string, std::string>& options); ///< IO threads as in NodeConfig, before the first socket
+
+	/// options of 0MQ sockets read from <prefix>sndhwm, <prefix>rcvbuf, <prefix>keepalive.idle, ...
+	struct SocketOptions {
+		SocketOptions() : sndHwm(-1), rcvHwm(-1), sndBuf(0), rcvBuf(0),
+			keepAlive(-1), keepAliveIdle(-1), keepAliveIntvl(-1), keepAliveCnt(-1) {}
+		void read(std::map<std::string, std::string>& options, const std::string& prefix);
+		void apply(void* socket) const;
+
+		int sndHwm; ///< -1 to keep what the socket has
+		int rcvHwm;
+		int sndBuf; ///< 0 for the system default
+		int rcvBuf;
+		int keepAlive; ///< -1 for the system default
+		int keepAliveIdle;
+		int keepAliveIntvl;
+		int keepAliveCnt;
+	};
 
 protected:
 
@@ -130,6 +164,7 @@ protected:
 		uint64_t startedAt; ///< when connect to, a timestamp when we initially tried to connect
 		NodeStub node; /// a representation about the remote node
 		bool isConfirmed; ///< Whether we connected our subscribers to the remote nodes publishers
+		SocketOptions socketOptions; ///< applied to the socket in connect
 
 		int connect();
 		int disconnect();
@@ -148,26 +183,32 @@ protected:
 		uint64_t startedAt; ///< Timestamp when we noticed this subscription attempt
 	};
 
-	template<class T>
-	class StatBucket {
-	public:
-		StatBucket() :
-			timeStamp(Thread::getTimeStampMs()),
-			nrMetaMsgRcvd(0),
-			sizeMetaMsgRcvd(0),
-			nrMetaMsgSent(0),
-			sizeMetaMsgSent(0) {
-		};
-		uint64_t timeStamp;
-		std::map<std::string, T> nrChannelMsg; ///< number of message received per channel
-		std::map<std::string, T> sizeChannelMsg; ///< accumulate size of messages
-		T nrMetaMsgRcvd;
-        T sizeMetaMsgRcvd;
-        T nrMetaMsgSent;
-		T sizeMetaMsgSent;
+	/// counters shared with the publishers and the rates we derived from them
+	struct StatSlot {
+		StatSlot() : msgsPerSec(0), bytesPerSec(0), compressedPerSec(0), comprSkippedPerSec(0) {}
+		SharedPtr<ChannelStats> stats;
+		ChannelStats::Snapshot last; ///< counters when we last sampled
+		double msgsPerSec;
+		double bytesPerSec;
+		double compressedPerSec;
+		double comprSkippedPerSec;
 	};
 
-	std::list<StatBucket<size_t> > _buckets;
+	std::map<std::string, StatSlot> _channelStats; ///< per channel of our publishers
+	StatSlot _metaSent; ///< node-internal messages sent
+	StatSlot _metaRcvd; ///< node-internal messages received
+	uint64_t _lastStatsSample;
+
+	void sampleStats(uint64_t now);
+	static void sampleRates(StatSlot& slot);
+	void countMetaSent(size_t size) {
+		_metaSent.stats->countMessage(size);
+		_metaSent.stats->countBytes(size);
+	}
+	void countMetaRcvd(size_t size) {
+		_metaRcvd.stats->countMessage(size);
+		_metaRcvd.stats->countBytes(size);
+	}
 
 	ZeroMQNode();
 
@@ -180,6 +221,17 @@ protected:
 
 	std::map<std::string, Subscription> _subscriptions;
 
+	/// a publisher of a node we are connected to
+	struct RemotePublisher {
+		RemotePublisher() {}
+		RemotePublisher(const PublisherStub& pub_, const NodeStub& node_) : pub(pub_), node(node_) {}
+		PublisherStub pub;
+		NodeStub node;
+	};
+
+	ChannelIndex<Subscriber> _subsByChannel; ///< our subscribers to match remote publishers
+	ChannelIndex<RemotePublisher> _remotePubsByChannel; ///< publishers of connected nodes to match our subscribers
+
 	RMutex _mutex;
 	uint64_t _lastNodeInfoBroadCast;
 	uint64_t _lastDeadNodeRemoval;
@@ -198,9 +250,13 @@ protected:
 	void* _pubSocket; ///< node-global publisher to wrap added publishers
 	void* _writeOpSocket; ///< node-internal communication pair to guard zeromq operations from threads
 	void* _readOpSocket; ///< node-internal communication pair to guard zeromq operations from threads
-	void* _subSocket; ///< umundo internal socket to receive publications from publishers
+	void* _forwardSocket; ///< doorbells from publishers with messages in _forwardQueue
 	void* _monitorSocket;
 
+	SharedPtr<ZeroMQForwardQueue> _forwardQueue; ///< messages of our publishers for _pubSocket
+	bool _isForwarding; ///< there may be more messages in _forwardQueue
+	bool forwardQueued();
+
 	void run(); ///< see Thread
 
 	/** @name Remote publisher / subscriber maintenance */
@@ -208,6 +264,8 @@ protected:
 	void sendUnsubscribeFromPublisher(const std::string& nodeUUID, const umundo::Subscriber& sub, const umundo::PublisherStub& pub);
 	void sendSubscribeToPublisher(const std::string& nodeUUID, const umundo::Subscriber& sub, const umundo::PublisherStub& pub);
 	void confirmSubscription(const std::string& subUUID);
+	void requestedStaticHeader(const std::string& subUUID, const std::string& pubUUID);
+	void reportedSharedMemory(const std::string& subUUID, const std::string& pubUUID, bool canRead);
 	void receivedRemotePubAdded(SharedPtr<NodeConnection> client, SharedPtr<PublisherStubImpl> pub);
 	void receivedRemotePubRemoved(SharedPtr<NodeConnection> client, SharedPtr<PublisherStubImpl> pub);
 	//@}
@@ -234,15 +292,75 @@ protected:
 
 	void writeNodeInfo(zmq_msg_t* msg, Message::ControlType type);
 
+	/** @name Versioned publisher set */
+	//@{
+	enum PubDiffFlags {
+		PUB_DIFF_FULL = 0x01 ///< entries are the complete set, not the changes since a version
+	};
+
+	/// a publisher added to or removed from our set with the version it resulted in
+	struct PubChange {
+		uint64_t version;
+		bool added;
+		std::string uuid;
+		std::string info; ///< serialized as in write(char*, const PublisherStub&)
+	};
+
+	/// what we last learned about the publishers of a remote node
+	struct RemotePubSet {
+		RemotePubSet() : version(0) {}
+		uint64_t version;
+		std::map<std::string, std::string> pubs; ///< serialized publishers per uuid
+	};
+
+	void changedPubSet(bool added, const std::string& uuid, const std::string& info);
+	void writePubDiff(zmq_msg_t* msg, uint64_t since);
+	void flushPubDiff();
+	void receivedPubDiff(SharedPtr<NodeConnection> client, const char* buffer, size_t available);
+	void sendConnectReq(SharedPtr<NodeConnection> client);
+
+	uint64_t _pubSetVersion; ///< incremented with every change to our publishers
+	uint64_t _pubSetSent; ///< last version we broadcasted
+	size_t _pubLogSize; ///< changes to remember for peers asking for diffs
+	std::deque<PubChange> _pubLog; ///< most recent changes, the last one at _pubSetVersion
+	std::map<std::string, std::string> _pubSet; ///< serialized publishers per uuid as of _pubSetVersion
+	std::set<std::string> _diffPeers; ///< uuids of connected nodes that understand UM_PUB_DIFF
+	std::map<std::string, RemotePubSet> _remotePubSets; ///< publishers of remote nodes per uuid, kept across disconnects
+	std::map<std::string, std::string> _addressUUIDs; ///< uuid of the node last confirmed per address
+	//@}
+
+	/** @name Gossip about peers */
+	//@{
+	/// a node we connected to as another node told us about it
+	struct GossipPeer {
+		GossipPeer() : learnedAt(0), lastHeard(0) {}
+		EndPoint endPoint; ///< as we added it
+		uint64_t learnedAt;
+		uint64_t lastHeard; ///< last gossip it sent us, 0 if it never did
+	};
+
+	void sendGossip(SharedPtr<NodeConnection> to, bool withPeers = true);
+	void receivedGossip(const std::string& from, const char* buffer, size_t available, const std::string& fromIP);
+	void learnedFromGossip(const std::string& uuid, const std::string& address);
+	void expireGossipPeers(uint64_t now);
+
+	bool _gossip;
+	uint32_t _gossipInterval;
+	uint64_t _lastGossip;
+	std::map<std::string, GossipPeer> _gossipPeers; ///< peers of other nodes we added per uuid
+	//@}
+
 //	void broadCastNodeInfo(uint64_t now);
 //	void removeStaleNodes(uint64_t now);
 
 	void replyWithDebugInfo(const std::string uuid);
-	StatBucket<double> accumulateIntoBucket();
 
 	std::map<std::string, std::set<EndPoint> > _endPoints; ///< 0mq addresses to endpoints added
+	SharedPtr<ZeroMQDispatcher> _dispatcher; ///< delivers for our subscribers if configured
+	SocketOptions _socketOptions; ///< for our sockets to and from remote nodes
 private:
 	static void* _zmqContext; ///< global 0MQ context.
+	static bool _zmqContextConfigured; ///< a node already applied its context options
 
 
 	friend class Factory;
@@ -37,10 +37,13 @@
 
 #endif
 
+#define UMUNDO_COMPRESSION_MAX_RATIO 0.9 // adaptive compression sends payloads uncompressed above this ratio
+#define UMUNDO_COMPRESSION_PROBE_INTERVAL 64 // try compressing again after so many uncompressed messages
+
 
 namespace umundo {
 
-ZeroMQPublisher::ZeroMQPublisher() : _comressionLevel(-1), _compressionWithState(false), _compressionContext(NULL) {
+ZeroMQPublisher::ZeroMQPublisher() : _stats(new ChannelStats("")), _zeroCopy(false), _shmEnabled(true), _shmSize(UMUNDO_SHM_RING_SIZE), _nrLocalSubs(0), _nrCopySubs(0), _staticHeaderGen(0), _staticMetaVersion(0), _comressionLevel(-1), _compressionWithState(false), _compressionAdaptive(false), _nrFrames(0), _sndHwm(NET_ZEROMQ_SND_HWM), _lvcDepth(0), _trace(false), _traceSeq(0), _traceSentUs(0), _compressionContext(NULL) {
     _refreshedCompressionContext = 0;
     _compressionRefreshInterval = 0;
 }
@@ -50,19 +53,19 @@ void ZeroMQPublisher::init(const Options* config) {
 
 	_transport = "tcp";
 
-	(_pubSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PUB)) || UM_LOG_WARN("zmq_socket: %s",zmq_strerror(errno));
-
-	int hwm = NET_ZEROMQ_SND_HWM;
-	std::string pubId("um.pub.intern." + _uuid);
-
-//	zmq_setsockopt(_pubSocket, ZMQ_IDENTITY, pubId.c_str(), pubId.length()) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
-	zmq_setsockopt(_pubSocket, ZMQ_SNDHWM, &hwm, sizeof(hwm)) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
-	zmq_bind(_pubSocket, std::string("inproc://" + pubId).c_str());
-
 	std::map<std::string, std::string> options = config->getKVPs();
 
+	// messages a node has yet to forward before we drop more, as the hwm of a socket
+	if (options.find("pub.zmq.sndhwm") != options.end()) {
+		_sndHwm = strTo<size_t>(options["pub.zmq.sndhwm"]);
+	}
+
 	if (options.find("pub.compression.type") != options.end()) {
 		_compressionType = options["pub.compression.type"];
+		if (Message::getCompressionType(_compressionType) == 0) {
+			UM_LOG_ERR("Compression '%s' is not available, publishing %s uncompressed", _compressionType.c_str(), _channelName.c_str());
+			_compressionType = "";
+		}
 	}
 	if (options.find("pub.compression.level") != options.end()) {
 		_comressionLevel = strTo<int>(options["pub.compression.level"]);
@@ -74,29 +77,53 @@ void ZeroMQPublisher::init(const Options* config) {
         int refreshInterval = strTo<int>(options["pub.compression.refreshInterval"]);
         _compressionRefreshInterval = refreshInterval;
     }
+	if (options.find("pub.compression.adaptive") != options.end()) {
+		_compressionAdaptive = strTo<bool>(options["pub.compression.adaptive"]);
+	}
+	if (options.find("pub.zeroCopy") != options.end()) {
+		_zeroCopy = strTo<bool>(options["pub.zeroCopy"]);
+	}
+	if (options.find("pub.shm") != options.end()) {
+		_shmEnabled = strTo<bool>(options["pub.shm"]);
+	}
+	if (options.find("pub.shm.size") != options.end()) {
+		_shmSize = strTo<size_t>(options["pub.shm.size"]);
+	}
+	if (options.find("pub.queue.maxMsgs") != options.end()) {
+		_queueLimits.maxMsgs = strTo<size_t>(options["pub.queue.maxMsgs"]);
+	}
+	if (options.find("pub.queue.maxBytes") != options.end()) {
+		_queueLimits.maxBytes = strTo<size_t>(options["pub.queue.maxBytes"]);
+	}
+	if (options.find("pub.queue.ttl") != options.end()) {
+		_queueLimits.ttlMs = strTo<uint64_t>(options["pub.queue.ttl"]);
+	}
+	if (options.find("pub.queue.dropNewest") != options.end()) {
+		_queueLimits.policy = (strTo<bool>(options["pub.queue.dropNewest"]) ? SubscriberQueue::DROP_NEWEST : SubscriberQueue::DROP_OLDEST);
+	}
+	if (options.find("pub.lvc.depth") != options.end()) {
+		_lvcDepth = strTo<size_t>(options["pub.lvc.depth"]);
+	}
+	if (options.find("pub.lvc.key") != options.end()) {
+		_lvcKey = options["pub.lvc.key"];
+	}
+	if (options.find("pub.trace") != options.end()) {
+		_trace = strTo<bool>(options["pub.trace"]);
+	}
     
-	UM_LOG_INFO("creating internal publisher%s for %s on %s", (_compressionType.size() > 0 ? " with compression" : ""), _channelName.c_str(), std::string("inproc://" + pubId).c_str());
+	UM_LOG_INFO("creating internal publisher%s for %s", (_compressionType.size() > 0 ? " with compression" : ""), _channelName.c_str());
 
 }
 
 ZeroMQPublisher::~ZeroMQPublisher() {
 	UM_LOG_INFO("deleting publisher for %s", _channelName.c_str());
 
-	std::string pubId("um.pub.intern." + _uuid);
-//	zmq_unbind(_pubSocket, std::string("inproc://" + pubId).c_str()) && UM_LOG_WARN("zmq_unbind: %s", zmq_strerror(errno));
-	zmq_close(_pubSocket);
-
-	// clean up pending messages
-	std::map<std::string, std::list<std::pair<uint64_t, Message*> > >::iterator queuedMsgSubIter = _queuedMessages.begin();
-	while(queuedMsgSubIter != _queuedMessages.end()) {
-		std::list<std::pair<uint64_t, Message*> >::iterator queuedMsgIter = queuedMsgSubIter->second.begin();
-		while(queuedMsgIter != queuedMsgSubIter->second.end()) {
-			delete (queuedMsgIter->second);
-			queuedMsgIter++;
-		}
-		queuedMsgSubIter++;
-	}
+	for (size_t i = 0; i < _nrFrames; i++)
+		zmq_msg_close(&_frames[i]) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+
+	Message::freeCompression(_compressionContext, _compressionType);
 
+	// pending messages are deleted with their queues
 }
 
 SharedPtr<Implementation> ZeroMQPublisher::create() {
@@ -117,6 +144,96 @@ void ZeroMQPublisher::resume() {
 	_isSuspended = false;
 };
 
+void ZeroMQPublisher::sendBatch(const std::vector<Message*>& msgs) {
+	if (_isSuspended) {
+		UM_LOG_WARN("Not sending messages on suspended publisher");
+		return;
+	}
+
+	RScopeLock lock(_mutex);
+
+	if (_compressionType.size() > 0) {
+		// compressed messages are sent one by one
+		PublisherImpl::sendBatch(msgs);
+		return;
+	}
+
+	// coalesce consecutive messages on the channel, keep the order with explicit destinations
+	// and with payloads for the shared memory ring
+	std::vector<Message*> batch;
+	batch.reserve(msgs.size());
+	for (std::vector<Message*>::const_iterator msgIter = msgs.begin(); msgIter != msgs.end(); msgIter++) {
+		bool viaShm = (_shmRing && _nrLocalSubs > 0 && (*msgIter)->size() >= UMUNDO_SHM_MIN_PAYLOAD);
+		if (!(*msgIter)->hasMeta("um.sub") && !viaShm) {
+			batch.push_back(*msgIter);
+			continue;
+		}
+		if (batch.size() > 0) {
+			sendCompactBatch(batch);
+			batch.clear();
+		}
+		send(*msgIter);
+	}
+	if (batch.size() > 0)
+		sendCompactBatch(batch);
+}
+
+void ZeroMQPublisher::setStats(SharedPtr<ChannelStats> stats) {
+	RScopeLock lock(_mutex);
+	_stats = stats;
+}
+
+void ZeroMQPublisher::attachNode(const std::string& nodeUUID, SharedPtr<ZeroMQForwardQueue> queue) {
+	RScopeLock lock(_mutex);
+	_forwardQueues[nodeUUID] = queue;
+}
+
+void ZeroMQPublisher::detachNode(const std::string& nodeUUID) {
+	RScopeLock lock(_mutex);
+	_forwardQueues.erase(nodeUUID);
+}
+
+/**
+ * Send a frame on to the nodes we were added to.
+ *
+ * The frames of a message are collected until the last one and handed to the
+ * thread of every node as a whole, without a socket of our own in between.
+ * All but the last node get copies of the zmq messages sharing their buffers.
+ * As with a socket, messages are dropped above the high-water mark or without
+ * any node. The caller still closes the frame.
+ */
+void ZeroMQPublisher::sendFrame(zmq_msg_t* frame, int flags) {
+	if (_nrFrames == UMUNDO_FORWARD_MAX_FRAMES) {
+		UM_LOG_ERR("Message on %s has more than %d frames - dropping", _channelName.c_str(), UMUNDO_FORWARD_MAX_FRAMES);
+		return;
+	}
+	zmq_msg_init(&_frames[_nrFrames]) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
+	zmq_msg_copy(&_frames[_nrFrames++], frame) && UM_LOG_WARN("zmq_msg_copy: %s", zmq_strerror(errno));
+	if (flags & ZMQ_SNDMORE)
+		return;
+
+	size_t nrQueues = _forwardQueues.size();
+	for (std::map<std::string, SharedPtr<ZeroMQForwardQueue> >::iterator queueIter = _forwardQueues.begin(); queueIter != _forwardQueues.end(); queueIter++) {
+		if (--nrQueues == 0) {
+			// the last node gets our frames
+			queueIter->second->push(_frames, _nrFrames, _sndHwm);
+			break;
+		}
+		zmq_msg_t copies[UMUNDO_FORWARD_MAX_FRAMES];
+		for (size_t i = 0; i < _nrFrames; i++) {
+			zmq_msg_init(&copies[i]) && UM_LOG_WARN("zmq_msg_init: %s", zmq_strerror(errno));
+			zmq_msg_copy(&copies[i], &_frames[i]) && UM_LOG_WARN("zmq_msg_copy: %s", zmq_strerror(errno));
+		}
+		queueIter->second->push(copies, _nrFrames, _sndHwm);
+		for (size_t i = 0; i < _nrFrames; i++)
+			zmq_msg_close(&copies[i]) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+	}
+
+	for (size_t i = 0; i < _nrFrames; i++)
+		zmq_msg_close(&_frames[i]) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+	_nrFrames = 0;
+}
+
 int ZeroMQPublisher::waitForSubscribers(int count, int timeoutMs) {
 	RScopeLock lock(_mutex);
 	uint64_t now = Thread::getTimeStampMs();
@@ -141,6 +258,9 @@ void ZeroMQPublisher::added(const SubscriberStub& sub, const NodeStub& node) {
 
 	_subs[sub.getUUID()] = sub;
 
+	// new subscribers and those that missed it need the static header
+	_staticHeaderPending.insert(sub.getUUID());
+
 	// do we already now about this sub via this node?
 	std::pair<_domainSubs_t::iterator, _domainSubs_t::iterator> subIter = _domainSubs.equal_range(sub.getUUID());
 	while(subIter.first != subIter.second) {
@@ -161,17 +281,28 @@ void ZeroMQPublisher::added(const SubscriberStub& sub, const NodeStub& node) {
 	}
 
     // reset compression context
+    Message::freeCompression(_compressionContext, _compressionType);
     _compressionContext = NULL;
-    
+
+	// late joiners get the last values before anything else
+	if (_lastValues.size() > 0 && _domainSubs.count(sub.getUUID()) == 1)
+		replayLastValues(sub);
+
 	if (_queuedMessages.find(sub.getUUID()) != _queuedMessages.end()) {
-		UM_LOG_INFO("Subscriber with queued messages joined, sending %d old messages", _queuedMessages[sub.getUUID()].size());
-		std::list<std::pair<uint64_t, Message*> >::iterator msgIter = _queuedMessages[sub.getUUID()].begin();
-		while(msgIter != _queuedMessages[sub.getUUID()].end()) {
-			send(msgIter->second);
-			msgIter++;
-		}
+		SharedPtr<SubscriberQueue> queue = _queuedMessages[sub.getUUID()];
 		_queuedMessages.erase(sub.getUUID());
+
+		size_t expired = queue->expire(Thread::getTimeStampMs(), _queueLimits);
+		_stats->countQueueDropped(expired);
+		UM_LOG_INFO("Subscriber with queued messages joined, sending %lu old messages, %lu were dropped", (unsigned long)queue->size(), (unsigned long)queue->dropped());
+
+		Message* msg;
+		while((msg = queue->pop()) != NULL) {
+			send(msg);
+			delete msg;
+		}
 	}
+	updateSharedMemory();
 	UMUNDO_SIGNAL(_pubLock);
 }
 
@@ -199,70 +330,290 @@ void ZeroMQPublisher::removed(const SubscriberStub& sub, const NodeStub& node) {
 			_greeter->farewell(pub, sub);
 		}
 		_subs.erase(sub.getUUID());
+		_staticHeaderPending.erase(sub.getUUID());
+		_shmReaders.erase(sub.getUUID());
 	}
 
 	_domainSubs.erase(subIter.first);
+	updateSharedMemory();
 	UMUNDO_SIGNAL(_pubLock);
 }
 
+void ZeroMQPublisher::readsSharedMemory(const std::string& subUUID, bool canRead) {
+	RScopeLock lock(_mutex);
+	if (_subs.find(subUUID) == _subs.end())
+		return;
+
+	UM_LOG_INFO("Publisher %s on channel %s sends %s to subscriber %s",
+	            SHORT_UUID(_uuid).c_str(), _channelName.c_str(), (canRead ? "payloads via its ring" : "copies of payloads"), SHORT_UUID(subUUID).c_str());
+	if (canRead) {
+		_shmReaders.insert(subUUID);
+	} else {
+		_shmReaders.erase(subUUID);
+	}
+	updateSharedMemory();
+}
+
+void ZeroMQPublisher::updateSharedMemory() {
+	// the node marks subscribers on our host as not remote
+	_nrLocalSubs = 0;
+	_nrCopySubs = 0;
+	for (std::map<std::string, SubscriberStub>::iterator subIter = _subs.begin(); subIter != _subs.end(); subIter++) {
+		if (!subIter->second.isRemote())
+			_nrLocalSubs++;
+		// local subscribers get copies as well until they told us they read the ring
+		if (subIter->second.isRemote() || _shmReaders.find(subIter->first) == _shmReaders.end())
+			_nrCopySubs++;
+	}
+
+	// once created, the ring stays until we are gone, subscribers may still read
+	if (_nrLocalSubs > 0 && _shmEnabled && !_shmRing) {
+		_shmRing = SharedMemoryRing::create(SharedMemoryRing::nameFor(_uuid), _shmSize);
+		if (_shmRing) {
+			UM_LOG_INFO("Publisher %s on channel %s sends payloads to subscribers on this host via %s",
+			            SHORT_UUID(_uuid).c_str(), _channelName.c_str(), SharedMemoryRing::nameFor(_uuid).c_str());
+		} else {
+			_shmEnabled = false;
+		}
+	}
+}
+
+/**
+ * Subscribers addressed explicitly might just not be connected yet, keep a copy
+ * of the message within the configured limits until they are.
+ */
+void ZeroMQPublisher::queueMessage(Message* msg) {
+	uint64_t now = Thread::getTimeStampMs();
+	expireQueues(now);
+
+	std::string subUUID = msg->getMeta(MetaFields::SUB);
+	if (_queuedMessages.find(subUUID) == _queuedMessages.end())
+		_queuedMessages[subUUID] = SharedPtr<SubscriberQueue>(new SubscriberQueue());
+
+	Message* queuedMsg = new Message(*msg); // copy message
+	queuedMsg->setQueued(true);
+	size_t dropped = _queuedMessages[subUUID]->push(queuedMsg, now, _queueLimits);
+	if (dropped > 0) {
+		_stats->countQueueDropped(dropped);
+		UM_LOG_INFO("Dropped %lu messages queued for subscriber %s on %s", (unsigned long)dropped, subUUID.c_str(), _channelName.c_str());
+	}
+}
+
+void ZeroMQPublisher::expireQueues(uint64_t now) {
+	std::map<std::string, SharedPtr<SubscriberQueue> >::iterator queueIter = _queuedMessages.begin();
+	while(queueIter != _queuedMessages.end()) {
+		_stats->countQueueDropped(queueIter->second->expire(now, _queueLimits));
+		if (queueIter->second->empty()) {
+			UM_LOG_INFO("Subscriber %s did not show up on %s, %lu queued messages expired", queueIter->first.c_str(), _channelName.c_str(), (unsigned long)queueIter->second->dropped());
+			_queuedMessages.erase(queueIter++);
+		} else {
+			queueIter++;
+		}
+	}
+}
+
+/**
+ * Adaptive compression keeps the achieved ratio per payload size class and sends
+ * messages uncompressed while compression does not pay off, probing every now and then.
+ */
+static size_t compressionSizeClass(size_t payloadSize) {
+	size_t sizeClass = 0;
+	payloadSize >>= 8;
+	while (payloadSize > 0 && sizeClass < UMUNDO_COMPRESSION_SIZE_CLASSES - 1) {
+		payloadSize >>= 2;
+		sizeClass++;
+	}
+	return sizeClass;
+}
+
+bool ZeroMQPublisher::shouldCompress(size_t payloadSize) {
+	if (!_compressionAdaptive)
+		return true;
+
+	CompressionProbe& probe = _compressionProbes[compressionSizeClass(payloadSize)];
+	if (!probe.isSkipping)
+		return true;
+
+	if (++probe.skipped >= UMUNDO_COMPRESSION_PROBE_INTERVAL) {
+		probe.skipped = 0;
+		return true;
+	}
+	_stats->countComprSkipped();
+	return false;
+}
+
+void ZeroMQPublisher::updateCompressionProbe(size_t payloadSize, size_t compressedSize) {
+	if (!_compressionAdaptive || payloadSize == 0)
+		return;
+
+	CompressionProbe& probe = _compressionProbes[compressionSizeClass(payloadSize)];
+	double ratio = (double)compressedSize / (double)payloadSize;
+
+	if (probe.isSkipping || probe.ratio == 0) {
+		// a single probe decides while skipping
+		probe.ratio = ratio;
+	} else {
+		probe.ratio = 0.7 * probe.ratio + 0.3 * ratio;
+	}
+
+	bool isSkipping = (probe.ratio > UMUNDO_COMPRESSION_MAX_RATIO);
+	if (isSkipping != probe.isSkipping) {
+		UM_LOG_INFO("Publisher %s on channel %s %s compressing payloads of %d bytes at ratio %.2f",
+		            SHORT_UUID(_uuid).c_str(), _channelName.c_str(), (isSkipping ? "stops" : "resumes"), (int)payloadSize, probe.ratio);
+	}
+	probe.isSkipping = isSkipping;
+}
+
+static size_t compactSize(uint64_t value) {
+    if (value < 254)
+        return 1;
+    if (value < (1 << 16))
+        return 3;
+    return 9;
+}
+
+/**
+ * Keep the last messages sent to everyone on the channel, or the last one per
+ * value of a meta field, as they went on the wire. With stateful compression,
+ * frames depend on the ones before, we keep them uncompressed instead.
+ */
+void ZeroMQPublisher::updateLastValues(Message* msg, bool isCompact, const char* data, size_t size) {
+	LastValue value;
+	value.isCompact = isCompact;
+	if (_lvcKey.size() > 0) {
+		value.key = msg->getMeta(_lvcKey);
+		for (std::list<LastValue>::iterator valueIter = _lastValues.begin(); valueIter != _lastValues.end(); valueIter++) {
+			if (valueIter->key == value.key) {
+				_lastValues.erase(valueIter);
+				break;
+			}
+		}
+	}
+
+	if (data != NULL) {
+		value.data.assign(data, size);
+	} else {
+		// the payload did not go into the frame, encode what follows the prelude
+		size_t headerSize = msg->getHeaderDataSize(Message::UM_MSG_VERSION_02);
+		value.data.resize(compactSize(headerSize) + headerSize + msg->size());
+		char* start = &value.data[0];
+		char* writePtr = Message::writeCompact(start, headerSize, value.data.size());
+		writePtr = msg->writeHeaders(writePtr, headerSize, Message::UM_MSG_VERSION_02);
+		if (msg->size() > 0)
+			memcpy(writePtr, msg->data(), msg->size());
+	}
+
+	_lastValues.push_back(value);
+	while(_lastValues.size() > _lvcDepth)
+		_lastValues.pop_front();
+}
+
+void ZeroMQPublisher::replayLastValues(const SubscriberStub& sub) {
+	UM_LOG_INFO("Publisher %s on channel %s replays %lu last values to %s",
+	            SHORT_UUID(_uuid).c_str(), _channelName.c_str(), (unsigned long)_lastValues.size(), SHORT_UUID(sub.getUUID()).c_str());
+
+	updateStaticHeader();
+	std::string envelope("~" + sub.getUUID());
+
+	for (std::list<LastValue>::iterator valueIter = _lastValues.begin(); valueIter != _lastValues.end(); valueIter++) {
+		zmq_msg_t channelEnvlp;
+		ZMQ_PREPARE_STRING(channelEnvlp, envelope.c_str(), envelope.size());
+		_stats->countBytes(zmq_msg_size(&channelEnvlp));
+		sendFrame(&channelEnvlp, ZMQ_SNDMORE);
+		zmq_msg_close(&channelEnvlp) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+
+		// a direct message, with the static header as it is now
+		size_t preludeSize = (valueIter->isCompact ? getCompactPreludeSize(true) : 0);
+		size_t frameSize = preludeSize + valueIter->data.size();
+
+		zmq_msg_t frame;
+		ZMQ_PREPARE(frame, frameSize);
+		char* start = (char*)zmq_msg_data(&frame);
+		if (valueIter->isCompact)
+			writeCompactPrelude(start, Message::UM_STATIC_REF | Message::UM_STATIC_HEADER, true, frameSize);
+		memcpy(start + preludeSize, valueIter->data.data(), valueIter->data.size());
+
+		_stats->countBytes(frameSize);
+		sendFrame(&frame, 0);
+		zmq_msg_close(&frame) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+	}
+}
+
 void ZeroMQPublisher::send(Message* msg) {
 	if (_isSuspended) {
 		UM_LOG_WARN("Not sending message on suspended publisher");
 		return;
 	}
 
+	RScopeLock lock(_mutex);
+
 	// topic name or explicit subscriber id is first message in envelope
 	zmq_msg_t channelEnvlp;
 
-	if (msg->getMeta().find("um.sub") != msg->getMeta().end()) {
+	bool isDirect = msg->hasMeta("um.sub");
+	if (isDirect) {
 		// explicit destination
-		if (_domainSubs.count(msg->getMeta("um.sub")) == 0 && !msg->isQueued()) {
-			UM_LOG_INFO("Subscriber %s is not (yet) connected on %s - queuing message", msg->getMeta("um.sub").c_str(), _channelName.c_str());
-			Message* queuedMsg = new Message(*msg); // copy message
-			queuedMsg->setQueued(true);
-			_queuedMessages[msg->getMeta("um.sub")].push_back(std::make_pair(Thread::getTimeStampMs(), queuedMsg));
+		if (_domainSubs.count(msg->getMeta(MetaFields::SUB)) == 0 && !msg->isQueued()) {
+			UM_LOG_INFO("Subscriber %s is not (yet) connected on %s - queuing message", msg->getMeta(MetaFields::SUB).c_str(), _channelName.c_str());
+			queueMessage(msg);
 			return;
 		}
-		ZMQ_PREPARE_STRING(channelEnvlp, std::string("~" + msg->getMeta("um.sub")).c_str(), msg->getMeta("um.sub").size() + 1);
+		ZMQ_PREPARE_STRING(channelEnvlp, std::string("~" + msg->getMeta(MetaFields::SUB)).c_str(), msg->getMeta(MetaFields::SUB).size() + 1);
 	} else {
 		// everyone on channel
 		ZMQ_PREPARE_STRING(channelEnvlp, _channelName.c_str(), _channelName.size());
 	}
-	zmq_sendmsg(_pubSocket, &channelEnvlp, ZMQ_SNDMORE) >= 0 || UM_LOG_WARN("zmq_sendmsg: %s", zmq_strerror(errno));
+	_stats->countMessage(msg->size());
+	_stats->countBytes(zmq_msg_size(&channelEnvlp));
+	sendFrame(&channelEnvlp, ZMQ_SNDMORE);
 	zmq_msg_close(&channelEnvlp) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
 
+    if (_compressionType.size() == 0 || !shouldCompress(msg->size())) {
+        sendCompact(msg, isDirect);
+        return;
+    }
+    _stats->countCompressed();
+
 	// user supplied mandatory meta fields
     for (std::map<std::string, std::string>::const_iterator metaIter = _mandatoryMeta.begin(); metaIter != _mandatoryMeta.end(); metaIter++) {
         msg->putMeta(metaIter->first, metaIter->second);
     }
 
     // default meta fields
-    msg->putMeta("um.pub", _uuid);
-    msg->putMeta("um.proc", procUUID);
-    msg->putMeta("um.host", hostUUID);
+    msg->putMeta(MetaFields::PUB, _uuid);
+    msg->putMeta(MetaFields::PROC, procUUID);
+    msg->putMeta(MetaFields::HOST, hostUUID);
 
     
     /**
+     Compressed messages are sent with version 0.1, the compression
+     dictionary already takes care of the repetitive header fields.
+     
                                 Bits
      Message Version            8,
      Publisher UUID             128,
      Compressed Header          1,
      Compression KeyFrame       1,
+     Compression Sizes          1,
+     Reserved                   2,
      Compression Type           3,
-     Reserved                   3,
+     Uncompressed Header Length 8 - 72 (compact as below),
+     Uncompressed Payload Length 8 - 72 (compact as below),
      Header Length < 254        8  (Len < 254),
      Header Length < (1 << 16)  16 (Len == 254),
      Header Length < (1 << 64)  48 (Len == 255),
      Header Data                ..
      Payload Data               ..
      
+     The uncompressed lengths allow subscribers to decompress in a single pass.
      */
-    RScopeLock lock(_mutex);
 
 #define MAX_MESSAGE_PRELUDE \
     1 +  /* Message version */ \
     16 + /* Pub UUID */ \
     1 +  /* Header Flags */ \
+    9 +  /* Uncompressed header length */ \
+    9 +  /* Uncompressed payload length */ \
     9    /* Header Length (may be smaller by preludeOffset) */
     
     bool isCompressionKeyFrame = !_compressionWithState;
@@ -272,18 +623,20 @@ void ZeroMQPublisher::send(Message* msg) {
             uint64_t now = Thread::getTimeStampMs();
 
             if (now - _compressionRefreshInterval > _refreshedCompressionContext) {
+                Message::freeCompression(_compressionContext, _compressionType);
                 _compressionContext = NULL;
                 _refreshedCompressionContext = now;
                 // UM_LOG_WARN("asdf: %d:%d > %d:%d", elapsed.tv_sec, elapsed.tv_usec, _compressionRefreshInterval.tv_sec, _compressionRefreshInterval.tv_usec);
             }
         }
         
-        if (_compressionContext == NULL && _compressionType.size() > 0) {
-            _compressionContext = Message::createCompression();
+        if (_compressionContext == NULL) {
+            _compressionContext = Message::createCompression(_compressionType);
             isCompressionKeyFrame = true;
 //            UM_LOG_WARN("New compression context!");
         }
     } else {
+        Message::freeCompression(_compressionContext, _compressionType);
         _compressionContext = NULL;
     }
     
@@ -292,81 +645,61 @@ void ZeroMQPublisher::send(Message* msg) {
         UM_LOG_INFO("Publisher %s on channel %s sending compression keyframe",
                     SHORT_UUID(_uuid).c_str(), _channelName.c_str());
 
-    // we can only know the size of the header once we compressed it
-    size_t preludeOffset = 0;
-    size_t headerSize = 0;
-    size_t payloadSize = 0;
-    
-    // maximum size for compressed header and payload
-    if (_compressionType.size() > 0) {
-        // compress
-        headerSize  = msg->getCompressBounds(_compressionType, _compressionContext, Message::HEADER);
-        payloadSize = msg->getCompressBounds(_compressionType, _compressionContext, Message::PAYLOAD);
-    } else {
-        // do not compress
-        headerSize = msg->getHeaderDataSize();
-        payloadSize = msg->size();
+    // header flags for the prelude
+    uint8_t headerFlags = Message::UM_COMPR_MSG | Message::UM_COMPR_SIZES;
+    if (isCompressionKeyFrame) {
+        headerFlags |= Message::UM_COMPR_KEYFRAME;
     }
+    headerFlags |= Message::getCompressionType(_compressionType);
+
+    size_t origHeaderSize  = msg->getHeaderDataSize();
+    size_t origPayloadSize = msg->size();
+
+    // we can only know the size of the header once we compressed it
+    size_t headerSize  = msg->getCompressBounds(_compressionType, _compressionContext, Message::HEADER);
+    size_t payloadSize = msg->getCompressBounds(_compressionType, _compressionContext, Message::PAYLOAD);
+
     // this buffer has to be large enough to hold the complete message
-    char* onwire = (char*)malloc(headerSize + payloadSize + MAX_MESSAGE_PRELUDE);
+    char* onwire = BufferPool::alloc(headerSize + payloadSize + MAX_MESSAGE_PRELUDE);
     
-    if (_compressionType.size() > 0) {
-        headerSize  = msg->compress(_compressionType, _compressionContext, onwire + MAX_MESSAGE_PRELUDE, headerSize, Message::HEADER);
-        payloadSize = msg->compress(_compressionType, _compressionContext, onwire + headerSize + MAX_MESSAGE_PRELUDE, payloadSize, Message::PAYLOAD);
-    } else {
-        msg->writeHeaders(onwire + MAX_MESSAGE_PRELUDE, headerSize);
-        memcpy(onwire + headerSize + MAX_MESSAGE_PRELUDE, msg->data(), payloadSize);
-    }
+    headerSize  = msg->compress(_compressionType, _compressionContext, onwire + MAX_MESSAGE_PRELUDE, headerSize, Message::HEADER, _comressionLevel);
+    payloadSize = msg->compress(_compressionType, _compressionContext, onwire + headerSize + MAX_MESSAGE_PRELUDE, payloadSize, Message::PAYLOAD, _comressionLevel);
+    updateCompressionProbe(origPayloadSize, payloadSize);
     
-    // we may need to trim some bytes in front as the header length is dynamic
-    if (headerSize < 254) {
-        preludeOffset = 8; // only a single byte for the header
-    } else if (headerSize < (1 << 16)) {
-        preludeOffset = 6; // three bytes for the header
-    }
+    // we may need to trim some bytes in front as the lengths are dynamic
+    size_t preludeOffset = (MAX_MESSAGE_PRELUDE) - (1 + 16 + 1 +
+                                                    compactSize(origHeaderSize) +
+                                                    compactSize(origPayloadSize) +
+                                                    compactSize(headerSize));
     
     // advance buffer write pointer to account for dynamic header size
     char* onwireStart = onwire + preludeOffset;
     char* writePtr = onwireStart;
-    
-    // first byte is the message version
-    writePtr = Message::write(writePtr, (uint8_t)Message::UM_MSG_VERSION);
-    assert(writePtr = onwireStart + 1);
-    
-    // then 16 bytes publisher uuid
+    writePtr = Message::write(writePtr, (uint8_t)Message::UM_MSG_VERSION_01);
     writePtr = UUID::writeHexToBin(writePtr, _uuid);
-    assert(writePtr = onwireStart + 1 + 16);
-
-    // second byte is the compression info
-    writePtr[0] = '0';
-    if (_compressionType.size() > 0) {
-        writePtr[0] |= Message::UM_COMPR_MSG;
-        if (isCompressionKeyFrame) {
-            writePtr[0] |= Message::UM_COMPR_KEYFRAME;
-        }
-        
-        if (_compressionType == "lz4") {
-            writePtr[0] |= Message::UM_COMPR_LZ4;
-        }
-    }
-    writePtr++;
-    
-    assert(writePtr = onwireStart + 1 + 16 + 1);
-
-    writePtr = Message::writeCompact(writePtr, headerSize, (headerSize + payloadSize + MAX_MESSAGE_PRELUDE) - preludeOffset);
-    assert(writePtr = onwireStart + 1 + 16 + 1 + (9 - preludeOffset));
+    writePtr = Message::write(writePtr, headerFlags);
+    writePtr = Message::writeCompact(writePtr, origHeaderSize, (onwire + MAX_MESSAGE_PRELUDE) - writePtr);
+    writePtr = Message::writeCompact(writePtr, origPayloadSize, (onwire + MAX_MESSAGE_PRELUDE) - writePtr);
+    writePtr = Message::writeCompact(writePtr, headerSize, (onwire + MAX_MESSAGE_PRELUDE) - writePtr);
+    (void)writePtr; // surpress unused warning without assert
     assert(writePtr == onwire + MAX_MESSAGE_PRELUDE);
     
     size_t msgSize = (headerSize + payloadSize + (MAX_MESSAGE_PRELUDE - preludeOffset));
+
+    if (_lvcDepth > 0 && !isDirect) {
+        if (_compressionWithState) {
+            updateLastValues(msg, true, NULL, 0);
+        } else {
+            updateLastValues(msg, false, onwireStart, msgSize);
+        }
+    }
     
-    assert(onwireStart[0] == Message::UM_MSG_VERSION);
-    
+    // 0MQ takes ownership of the buffer and frees it once sent
     zmq_msg_t zqmMsg;
-    ZMQ_PREPARE_DATA(zqmMsg, onwireStart, msgSize); // this is yet another memcpy :(
+    zmq_msg_init_data(&zqmMsg, onwireStart, msgSize, releaseWireBuffer, onwire) && UM_LOG_WARN("zmq_msg_init_data: %s", zmq_strerror(errno));
+    _stats->countBytes(msgSize);
 
-    free(onwire);
-    
-    zmq_sendmsg(_pubSocket, &zqmMsg, 0) >= 0 || UM_LOG_WARN("zmq_sendmsg: %s", zmq_strerror(errno));
+    sendFrame(&zqmMsg, 0);
     zmq_msg_close(&zqmMsg) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
 
 #if 0
@@ -471,4 +804,292 @@ void ZeroMQPublisher::send(Message* msg) {
 }
 
 
+void ZeroMQPublisher::updateStaticHeader() {
+    if (_staticHeader.size() > 0 && _staticMetaVersion == _mandatoryMetaVersion)
+        return;
+
+    // fields that are the same for every message of this publisher
+    std::map<std::string, std::string> staticMeta = _mandatoryMeta;
+    staticMeta["um.proc"] = procUUID;
+    staticMeta["um.host"] = hostUUID;
+
+    _staticHeader.resize(Message::getCompactHeaderSize(staticMeta));
+    Message::writeCompactHeaders(&_staticHeader[0], _staticHeader.size(), staticMeta);
+
+    _staticMetaVersion = _mandatoryMetaVersion;
+    _staticHeaderGen++;
+
+    // everyone needs the new one
+    _staticHeaderPending.clear();
+    for (std::map<std::string, SubscriberStub>::iterator subIter = _subs.begin(); subIter != _subs.end(); subIter++)
+        _staticHeaderPending.insert(subIter->first);
+}
+
+size_t ZeroMQPublisher::getCompactPreludeSize(bool withStaticHeader, bool withTrace) {
+    size_t preludeSize = 1 + 16 + 1 + 4;
+    if (withTrace)
+        preludeSize += UMUNDO_TRACE_SIZE;
+    if (withStaticHeader)
+        preludeSize += compactSize(_staticHeader.size()) + _staticHeader.size();
+    return preludeSize;
+}
+
+char* ZeroMQPublisher::writeCompactPrelude(char* to, uint8_t headerFlags, bool withStaticHeader, size_t remaining) {
+    char* start = to;
+    to = Message::write(to, (uint8_t)Message::UM_MSG_VERSION_02);
+    to = UUID::writeHexToBin(to, _uuid);
+    to = Message::write(to, headerFlags);
+    to = Message::write(to, _staticHeaderGen);
+    if (headerFlags & Message::UM_TRACE) {
+        // the node forwarding the frame fills in its time
+        to = Message::write(to, _traceSeq);
+        to = Message::write(to, _traceSentUs);
+        to = Message::write(to, (uint64_t)0);
+    }
+    if (withStaticHeader) {
+        to = Message::writeCompact(to, _staticHeader.size(), remaining - (to - start));
+        memcpy(to, _staticHeader.data(), _staticHeader.size());
+        to += _staticHeader.size();
+    }
+    return to;
+}
+
+void ZeroMQPublisher::stampTrace() {
+    // once per message, its shared memory descriptor and copy are the same message
+    _traceSeq++;
+    _traceSentUs = Thread::getMonotonicTimeStampUs();
+}
+
+void ZeroMQPublisher::sendCompact(Message* msg, bool isDirect) {
+    /**
+                                Bits
+     Message Version            8,
+     Publisher UUID             128,
+     Compressed Header          1,    (unset)
+     Trace                      1,
+     Static Header              1,
+     Static Reference           1,
+     Payload Frame              1,
+     Batch                      1,    (unset)
+     Shared Memory Payload      1,
+     Shared Memory Copy         1,
+     Static Generation          32,
+     Trace Sequence Number      64    (with Trace only),
+     Trace Sent Time            64    (with Trace only),
+     Trace Forwarded Time       64    (with Trace only, set by the node),
+     Static Header Length       8-72  (with Static Header only),
+     Static Header Data         ..    (with Static Header only),
+     Header Length              8-72,
+     Header Data                ..
+     Payload Data               ..    (unless Payload Frame or Shared Memory Payload)
+     Ring Position              8-72  (with Shared Memory Payload only),
+     Payload Length             8-72  (with Shared Memory Payload only),
+
+     Header fields are binary encoded, see Message::writeCompactHeaders. The
+     static header is sent with every message to an explicit subscriber and to
+     everyone until all subscribers got its current generation. Subscribers that
+     were added or changed it since are pending, as are the ones the node tells
+     us about again as they missed it, see ZeroMQSubscriber::requestStaticHeader.
+
+     Large payloads for subscribers on this host are written into our shared
+     memory ring and only their position is sent. If there are subscribers on
+     other hosts or on ours that did not tell us they read the ring, see
+     ZeroMQSubscriber::reportSharedMemory, the message is sent as usual right
+     after, flagged as a copy for the subscribers that already read it.
+
+     With tracing, every frame to everyone on the channel carries the trace
+     block at a fixed offset for the node to stamp without parsing. Times are
+     taken from the monotonic clock, they only compare on the same host.
+     */
+
+    updateStaticHeader();
+
+    bool withStaticHeader = (isDirect || !_staticHeaderPending.empty());
+    if (isDirect) {
+        _staticHeaderPending.erase(msg->getMeta(MetaFields::SUB));
+    } else {
+        _staticHeaderPending.clear();
+    }
+
+    uint8_t headerFlags = Message::UM_STATIC_REF;
+    if (withStaticHeader)
+        headerFlags |= Message::UM_STATIC_HEADER;
+    if (_zeroCopy)
+        headerFlags |= Message::UM_PAYLOAD_FRAME;
+    if (_trace && !isDirect) {
+        headerFlags |= Message::UM_TRACE;
+        stampTrace();
+    }
+
+    uint64_t shmPosition = 0;
+    if (!isDirect && _nrLocalSubs > 0 && _shmRing && msg->size() >= UMUNDO_SHM_MIN_PAYLOAD &&
+            _shmRing->write(msg->data(), msg->size(), &shmPosition)) {
+        sendShmDescriptor(msg, (uint8_t)(headerFlags & ~Message::UM_PAYLOAD_FRAME), withStaticHeader, shmPosition);
+        if (_nrCopySubs == 0) {
+            if (_lvcDepth > 0)
+                updateLastValues(msg, true, NULL, 0);
+            return;
+        }
+
+        zmq_msg_t channelEnvlp;
+        ZMQ_PREPARE_STRING(channelEnvlp, _channelName.c_str(), _channelName.size());
+        _stats->countBytes(zmq_msg_size(&channelEnvlp));
+        sendFrame(&channelEnvlp, ZMQ_SNDMORE);
+        zmq_msg_close(&channelEnvlp) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+
+        headerFlags |= Message::UM_SHM_COPY;
+    }
+
+    size_t headerSize = msg->getHeaderDataSize(Message::UM_MSG_VERSION_02);
+    size_t payloadSize = (_zeroCopy ? 0 : msg->size());
+    size_t preludeSize = getCompactPreludeSize(withStaticHeader, headerFlags & Message::UM_TRACE) + compactSize(headerSize);
+    size_t frameSize = preludeSize + headerSize + payloadSize;
+
+    zmq_msg_t frame;
+    ZMQ_PREPARE(frame, frameSize);
+    char* start = (char*)zmq_msg_data(&frame);
+    char* writePtr = start;
+
+    writePtr = writeCompactPrelude(writePtr, headerFlags, withStaticHeader, frameSize);
+    writePtr = Message::writeCompact(writePtr, headerSize, frameSize - (writePtr - start));
+    assert(writePtr == start + preludeSize);
+
+    writePtr = msg->writeHeaders(writePtr, headerSize, Message::UM_MSG_VERSION_02);
+    assert(writePtr == start + preludeSize + headerSize);
+
+    if (payloadSize > 0)
+        memcpy(writePtr, msg->data(), payloadSize);
+
+    if (_lvcDepth > 0 && !isDirect) {
+        if (_zeroCopy) {
+            updateLastValues(msg, true, NULL, 0);
+        } else {
+            updateLastValues(msg, true, start + preludeSize - compactSize(headerSize), frameSize - preludeSize + compactSize(headerSize));
+        }
+    }
+
+    _stats->countBytes(frameSize);
+    sendFrame(&frame, (_zeroCopy ? ZMQ_SNDMORE : 0));
+    zmq_msg_close(&frame) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+
+    if (!_zeroCopy)
+        return;
+
+    // hand the payload to 0MQ as is
+    zmq_msg_t payloadMsg;
+    if (msg->size() == 0) {
+        ZMQ_PREPARE(payloadMsg, 0);
+    } else if (msg->_flags & Message::WRAP_DATA) {
+        // we do not know for how long wrapped data will be around
+        ZMQ_PREPARE_DATA(payloadMsg, msg->data(), msg->size());
+    } else {
+        // keep a reference to the payload until 0MQ is done with it, a done callback runs with the last one
+        zmq_msg_init_data(&payloadMsg, msg->data(), msg->size(), releasePayload, new SharedPtr<char>(msg->_data)) && UM_LOG_WARN("zmq_msg_init_data: %s", zmq_strerror(errno));
+    }
+
+    _stats->countBytes(msg->size());
+    sendFrame(&payloadMsg, 0);
+    zmq_msg_close(&payloadMsg) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+}
+
+void ZeroMQPublisher::sendShmDescriptor(Message* msg, uint8_t headerFlags, bool withStaticHeader, uint64_t position) {
+    headerFlags |= Message::UM_SHM_PAYLOAD;
+
+    size_t headerSize = msg->getHeaderDataSize(Message::UM_MSG_VERSION_02);
+    size_t frameSize = getCompactPreludeSize(withStaticHeader, headerFlags & Message::UM_TRACE) + compactSize(headerSize) + headerSize +
+                       compactSize(position) + compactSize(msg->size());
+
+    zmq_msg_t frame;
+    ZMQ_PREPARE(frame, frameSize);
+    char* start = (char*)zmq_msg_data(&frame);
+    char* writePtr = start;
+
+    writePtr = writeCompactPrelude(writePtr, headerFlags, withStaticHeader, frameSize);
+    writePtr = Message::writeCompact(writePtr, headerSize, frameSize - (writePtr - start));
+    writePtr = msg->writeHeaders(writePtr, headerSize, Message::UM_MSG_VERSION_02);
+    writePtr = Message::writeCompact(writePtr, position, frameSize - (writePtr - start));
+    writePtr = Message::writeCompact(writePtr, msg->size(), frameSize - (writePtr - start));
+    assert(writePtr == start + frameSize);
+
+    _stats->countBytes(frameSize);
+    sendFrame(&frame, 0);
+    zmq_msg_close(&frame) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+}
+
+void ZeroMQPublisher::sendCompactBatch(const std::vector<Message*>& msgs) {
+    /**
+     Same prelude as with sendCompact and the UM_BATCH flag, followed by
+     
+     Message Count              8-72,
+     Header Length              8-72,  (per message)
+     Header Data                ..
+     Payload Length             8-72,
+     Payload Data               ..
+     */
+
+    zmq_msg_t channelEnvlp;
+    ZMQ_PREPARE_STRING(channelEnvlp, _channelName.c_str(), _channelName.size());
+    for (size_t i = 0; i < msgs.size(); i++)
+        _stats->countMessage(msgs[i]->size());
+    _stats->countBytes(zmq_msg_size(&channelEnvlp));
+    sendFrame(&channelEnvlp, ZMQ_SNDMORE);
+    zmq_msg_close(&channelEnvlp) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+
+    updateStaticHeader();
+
+    bool withStaticHeader = !_staticHeaderPending.empty();
+    _staticHeaderPending.clear();
+
+    uint8_t headerFlags = Message::UM_STATIC_REF | Message::UM_BATCH;
+    if (withStaticHeader)
+        headerFlags |= Message::UM_STATIC_HEADER;
+    if (_trace) {
+        headerFlags |= Message::UM_TRACE;
+        stampTrace();
+    }
+
+    std::vector<size_t> headerSizes(msgs.size());
+    size_t frameSize = getCompactPreludeSize(withStaticHeader, _trace) + compactSize(msgs.size());
+    for (size_t i = 0; i < msgs.size(); i++) {
+        headerSizes[i] = msgs[i]->getHeaderDataSize(Message::UM_MSG_VERSION_02);
+        frameSize += compactSize(headerSizes[i]) + headerSizes[i];
+        frameSize += compactSize(msgs[i]->size()) + msgs[i]->size();
+    }
+
+    zmq_msg_t frame;
+    ZMQ_PREPARE(frame, frameSize);
+    char* start = (char*)zmq_msg_data(&frame);
+    char* writePtr = start;
+
+    writePtr = writeCompactPrelude(writePtr, headerFlags, withStaticHeader, frameSize);
+    writePtr = Message::writeCompact(writePtr, msgs.size(), frameSize - (writePtr - start));
+    for (size_t i = 0; i < msgs.size(); i++) {
+        writePtr = Message::writeCompact(writePtr, headerSizes[i], frameSize - (writePtr - start));
+        writePtr = msgs[i]->writeHeaders(writePtr, headerSizes[i], Message::UM_MSG_VERSION_02);
+        writePtr = Message::writeCompact(writePtr, msgs[i]->size(), frameSize - (writePtr - start));
+        if (msgs[i]->size() > 0)
+            memcpy(writePtr, msgs[i]->data(), msgs[i]->size());
+        writePtr += msgs[i]->size();
+    }
+    assert(writePtr == start + frameSize);
+
+    _stats->countBytes(frameSize);
+    sendFrame(&frame, 0);
+    zmq_msg_close(&frame) && UM_LOG_WARN("zmq_msg_close: %s", zmq_strerror(errno));
+
+    // batches are not replayed as such, but their messages
+    for (size_t i = 0; _lvcDepth > 0 && i < msgs.size(); i++)
+        updateLastValues(msgs[i], true, NULL, 0);
+}
+
+void ZeroMQPublisher::releasePayload(void* data, void* hint) {
+    // drop our reference on the message payload
+    delete (SharedPtr<char>*)hint;
+}
+
+void ZeroMQPublisher::releaseWireBuffer(void* data, void* hint) {
+    // hint is the start of the pooled buffer, data may be offset into it
+    BufferPool::release((char*)hint);
+}
+
 }
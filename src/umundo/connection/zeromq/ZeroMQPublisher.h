@@ -23,11 +23,18 @@
 
 
 #include "umundo/Common.h"
+#include "umundo/Statistics.h"
+#include "umundo/SharedMemoryRing.h"
 
 #include "umundo/connection/Publisher.h"
+#include "umundo/connection/SubscriberQueue.h"
+#include "umundo/connection/zeromq/ZeroMQForwardQueue.h"
 #include "umundo/thread/Thread.h"
 
 #include <list>
+#include <set>
+
+#define UMUNDO_COMPRESSION_SIZE_CLASSES 7 // payload size classes for adaptive compression: <256B, <1K, .. >=256K
 
 namespace umundo {
 
@@ -46,8 +53,19 @@ public:
 	void resume();
 
 	void send(Message* msg);
+	void sendBatch(const std::vector<Message*>& msgs);
 	int waitForSubscribers(int count, int timeoutMs);
 
+	/// count traffic into the slot the node keeps for our channel
+	void setStats(SharedPtr<ChannelStats> stats);
+
+	/// hand our messages to the thread of the node with the given uuid
+	void attachNode(const std::string& nodeUUID, SharedPtr<ZeroMQForwardQueue> queue);
+	void detachNode(const std::string& nodeUUID);
+
+	/// whether a subscriber on our host reads payloads from our ring or needs copies
+	void readsSharedMemory(const std::string& subUUID, bool canRead);
+
 protected:
 	/**
 	 * Constructor used for prototype in Factory only.
@@ -60,17 +78,82 @@ protected:
 private:
 	void run();
 
+	SharedPtr<ChannelStats> _stats;
+
+	void sendCompact(Message* msg, bool isDirect);
+	void sendCompactBatch(const std::vector<Message*>& msgs);
+	void updateStaticHeader();
+	size_t getCompactPreludeSize(bool withStaticHeader, bool withTrace = false);
+	char* writeCompactPrelude(char* to, uint8_t headerFlags, bool withStaticHeader, size_t remaining);
+	void stampTrace();
+	bool shouldCompress(size_t payloadSize);
+	void updateCompressionProbe(size_t payloadSize, size_t compressedSize);
+	void updateSharedMemory();
+	void queueMessage(Message* msg);
+	void expireQueues(uint64_t now);
+	void updateLastValues(Message* msg, bool isCompact, const char* data, size_t size);
+	void replayLastValues(const SubscriberStub& sub);
+	void sendShmDescriptor(Message* msg, uint8_t headerFlags, bool withStaticHeader, uint64_t position);
+	static void releasePayload(void* data, void* hint);
+	static void releaseWireBuffer(void* data, void* hint);
+	void sendFrame(zmq_msg_t* frame, int flags);
+
+	bool _zeroCopy;
+
+	/// payloads for subscribers on this host, see sendCompact
+	SharedPtr<SharedMemoryRing> _shmRing;
+	bool _shmEnabled;
+	size_t _shmSize;
+	size_t _nrLocalSubs;
+	size_t _nrCopySubs; ///< subscribers that need payloads inline, remote or not reading the ring
+	std::set<std::string> _shmReaders; ///< local subscribers that told us they read the ring
+
+	/// binary header fields shared by all messages, see sendCompact
+	std::string _staticHeader;
+	std::set<std::string> _staticHeaderPending; ///< subscribers still to be sent the current static header
+	uint32_t _staticHeaderGen;
+	uint32_t _staticMetaVersion;
 	std::string _compressionType;
     int _comressionLevel;
     bool _compressionWithState;
     uint64_t _compressionRefreshInterval;
 
-	void* _pubSocket;
+	/// achieved compression per payload size class, see shouldCompress
+	struct CompressionProbe {
+		CompressionProbe() : ratio(0), skipped(0), isSkipping(false) {}
+		double ratio; ///< moving average of compressed to uncompressed payload size
+		size_t skipped; ///< messages sent uncompressed since the last probe
+		bool isSkipping;
+	};
+	bool _compressionAdaptive;
+	CompressionProbe _compressionProbes[UMUNDO_COMPRESSION_SIZE_CLASSES];
+
+	/// the nodes we were added to, see sendFrame
+	std::map<std::string, SharedPtr<ZeroMQForwardQueue> > _forwardQueues;
+	zmq_msg_t _frames[UMUNDO_FORWARD_MAX_FRAMES]; ///< frames of the message we are sending
+	size_t _nrFrames;
+	size_t _sndHwm;
+
 	std::multimap<std::string, std::pair<NodeStub, SubscriberStub> > _domainSubs;
 	typedef std::multimap<std::string, std::pair<NodeStub, SubscriberStub> > _domainSubs_t;
 
-	/// messages for subscribers we do not know yet
-	std::map<std::string, std::list<std::pair<uint64_t, umundo::Message*> > > _queuedMessages;
+	/// messages for subscribers we do not know yet, see queueMessage
+	std::map<std::string, SharedPtr<SubscriberQueue> > _queuedMessages;
+	SubscriberQueue::Limits _queueLimits;
+
+	/// encoded messages replayed to new subscribers, see updateLastValues
+	struct LastValue {
+		std::string key; ///< value of the meta field we cache by
+		bool isCompact; ///< data follows the prelude of sendCompact, else a whole frame
+		std::string data;
+	};
+	std::list<LastValue> _lastValues;
+	size_t _lvcDepth;
+	std::string _lvcKey;
+
+	bool _trace; ///< stamp messages to everyone with the UM_TRACE block
+	uint64_t _traceSeq; ///< of the message being sent, all of its frames carry the same
+	uint64_t _traceSentUs;
 
 	Monitor _pubLock;
 	RMutex _mutex;
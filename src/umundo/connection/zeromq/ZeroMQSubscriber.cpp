@@ -25,6 +25,7 @@
 
 // include order matters with MSVC ...
 #include "umundo/connection/zeromq/ZeroMQSubscriber.h"
+#include "umundo/connection/zeromq/ZeroMQDispatcher.h"
 
 #include "umundo/config.h"
 #if defined UNIX || defined IOS || defined IOSSIM
@@ -33,10 +34,38 @@
 
 namespace umundo {
 
-ZeroMQSubscriber::ZeroMQSubscriber() {}
+static zmq_msg_t* adoptFrame(zmq_msg_t* message) {
+	// small messages are stored within zmq_msg_t, always take the data pointer after moving
+	zmq_msg_t* frame = new zmq_msg_t();
+	zmq_msg_init(frame) && UM_LOG_WARN("zmq_msg_init: %s",zmq_strerror(errno));
+	zmq_msg_move(frame, message) && UM_LOG_WARN("zmq_msg_move: %s",zmq_strerror(errno));
+	return frame;
+}
+
+static void releaseFrame(void* data, void* hint) {
+	zmq_msg_t* frame = (zmq_msg_t*)hint;
+	zmq_msg_close(frame) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+	delete frame;
+}
+
+ZeroMQSubscriber::ZeroMQSubscriber() : _zeroCopy(false), _conflate(false), _rcvHwm(NET_ZEROMQ_RCV_HWM), _useDispatcher(-1), _isDispatched(false) {}
 
 void ZeroMQSubscriber::init(const Options* config) {
 
+	std::map<std::string, std::string> options = config->getKVPs();
+	if (options.find("sub.zeroCopy") != options.end()) {
+		_zeroCopy = strTo<bool>(options["sub.zeroCopy"]);
+	}
+	if (options.find("sub.dispatch") != options.end()) {
+		_useDispatcher = strTo<bool>(options["sub.dispatch"]);
+	}
+	if (options.find("sub.conflate") != options.end()) {
+		_conflate = strTo<bool>(options["sub.conflate"]);
+	}
+	if (options.find("sub.conflate.key") != options.end()) {
+		_conflateKey = options["sub.conflate.key"];
+	}
+
 	(_subSocket     = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_SUB))     || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_readOpSocket  = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR))    || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
 	(_writeOpSocket = zmq_socket(ZeroMQNode::getZeroMQContext(), ZMQ_PAIR))    || UM_LOG_ERR("zmq_socket: %s", zmq_strerror(errno));
@@ -47,12 +76,16 @@ void ZeroMQSubscriber::init(const Options* config) {
 
 	assert(_channelName.size() > 0);
 
-	int hwm = NET_ZEROMQ_RCV_HWM;
+	ZeroMQNode::SocketOptions socketOptions;
+	socketOptions.rcvHwm = NET_ZEROMQ_RCV_HWM;
+	socketOptions.read(options, "sub.zmq.");
+	_rcvHwm = socketOptions.rcvHwm;
+
 	std::string subId("um.sub." + _uuid);
 	std::string lastSub("~" + _uuid); ///< this needs to have very "late" alphabetical order to ensure all channels are subscribed to first
 
 //	zmq_setsockopt(_subSocket, ZMQ_IDENTITY, subId.c_str(), subId.length()) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
-	zmq_setsockopt(_subSocket, ZMQ_RCVHWM, &hwm, sizeof(hwm)) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+	socketOptions.apply(_subSocket);
 	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, _channelName.c_str(), _channelName.length())  && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
 	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, lastSub.c_str(), lastSub.length())  && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
 
@@ -78,6 +111,9 @@ ZeroMQSubscriber::~ZeroMQSubscriber() {
 	zmq_send(_writeOpSocket, tmp, 4, 0) == -1 && UM_LOG_ERR("zmq_send: %s", zmq_strerror(errno)); // unblock poll
 	join(); // wait for thread to finish
 
+	if (_isDispatched)
+		_dispatcher->remove(this);
+
 	std::string subId("um.sub." + _uuid);
 	std::string readOpId("inproc://um.node.readop." + _uuid);
 	zmq_disconnect(_writeOpSocket, readOpId.c_str()) && UM_LOG_ERR("zmq_disconnect %s: %s", readOpId.c_str(), zmq_strerror(errno));
@@ -86,6 +122,15 @@ ZeroMQSubscriber::~ZeroMQSubscriber() {
 //	zmq_unbind(_readOpSocket, readOpId.c_str()) && UM_LOG_WARN("zmq_unbind: %s", zmq_strerror(errno));
 //	zmq_unbind(_subSocket, std::string("inproc://" + subId).c_str()) && UM_LOG_WARN("zmq_unbind: %s", zmq_strerror(errno));
 
+	while(!_batchedMsgs.empty()) {
+		delete _batchedMsgs.front();
+		_batchedMsgs.pop_front();
+	}
+
+	for (std::map<std::string, std::pair<std::string, void*> >::iterator ctxIter = _pubComprCtx.begin(); ctxIter != _pubComprCtx.end(); ctxIter++) {
+		Message::freeCompression(ctxIter->second.second, ctxIter->second.first);
+	}
+
 	zmq_close(_subSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
 	zmq_close(_readOpSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
 	zmq_close(_writeOpSocket) && UM_LOG_WARN("zmq_close: %s",zmq_strerror(errno));
@@ -129,7 +174,7 @@ void ZeroMQSubscriber::added(const PublisherStub& pub, const NodeStub& node) {
 
 		UM_LOG_INFO("%s subscribing to %s on %s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), ss.str().c_str());
 
-		if (isStarted()) {
+		if (isStarted() || _isDispatched) {
 			ZMQ_INTERNAL_SEND("connectPub", ss.str().c_str());
 		} else {
 			zmq_connect(_subSocket, ss.str().c_str()) && UM_LOG_ERR("zmq_connect %s: %s", ss.str().c_str(), zmq_strerror(errno));
@@ -144,9 +189,17 @@ void ZeroMQSubscriber::removed(const PublisherStub& pub, const NodeStub& node) {
 	RScopeLock lock(_mutex);
 
 	// TODO: This fails for publishers added via different nodes
-	if (_pubs.find(pub.getUUID()) != _pubs.end())
+	if (_pubs.find(pub.getUUID()) != _pubs.end()) {
 		_pubs.erase(pub.getUUID());
 
+		// do not keep the ring of a publisher that is gone mapped
+		if (isStarted() || _isDispatched) {
+			ZMQ_INTERNAL_SEND("releasePub", pub.getUUID().c_str());
+		} else {
+			_pubRings.erase(pub.getUUID());
+		}
+	}
+
 	if (_domainPubs.count(pub.getDomain()) == 0)
 		return;
 
@@ -175,7 +228,7 @@ void ZeroMQSubscriber::removed(const PublisherStub& pub, const NodeStub& node) {
 
 		UM_LOG_INFO("%s unsubscribing from %s on %s", SHORT_UUID(_uuid).c_str(), pub.getChannelName().c_str(), ss.str().c_str());
 
-		if (isStarted()) {
+		if (isStarted() || _isDispatched) {
 			ZMQ_INTERNAL_SEND("disconnectPub", ss.str().c_str());
 		} else {
 			zmq_disconnect(_subSocket, ss.str().c_str()) && UM_LOG_ERR("zmq_disconnect %s: %s", ss.str().c_str(), zmq_strerror(errno));
@@ -184,17 +237,50 @@ void ZeroMQSubscriber::removed(const PublisherStub& pub, const NodeStub& node) {
 }
 
 void ZeroMQSubscriber::setReceiver(Receiver* receiver) {
-	stop();
-	ZMQ_INTERNAL_SEND("",""); // just unblock
-	join();
+	stopDispatching();
 	_receiver = receiver;
 	if (_receiver != NULL) {
-		start();
+		startDispatching();
 	} else {
 		UM_LOG_INFO("Unsetting receiver - subscriber stopped");
 	}
 }
 
+void ZeroMQSubscriber::setDispatcher(SharedPtr<ZeroMQDispatcher> dispatcher) {
+	if (_useDispatcher == 0 || _dispatcher == dispatcher)
+		return;
+
+	stopDispatching();
+	_dispatcher = dispatcher;
+	startDispatching();
+}
+
+void ZeroMQSubscriber::startDispatching() {
+	if (_receiver == NULL)
+		return;
+
+	if (_useDispatcher == 1 && !_dispatcher)
+		_dispatcher = ZeroMQDispatcher::getDefault();
+
+	if (_dispatcher) {
+		_isDispatched = true;
+		_dispatcher->add(this);
+	} else {
+		start();
+	}
+}
+
+void ZeroMQSubscriber::stopDispatching() {
+	stop();
+	ZMQ_INTERNAL_SEND("",""); // just unblock
+	join();
+
+	if (_isDispatched) {
+		_dispatcher->remove(this);
+		_isDispatched = false;
+	}
+}
+
 void ZeroMQSubscriber::run() {
 	zmq_pollitem_t items [] = {
 		{ _readOpSocket, 0, ZMQ_POLLIN, 0 }, // one of our members wants to manipulate a socket
@@ -210,55 +296,126 @@ void ZeroMQSubscriber::run() {
 		if (!isStarted())
 			return;
 
-		if (items[1].revents & ZMQ_POLLIN && _receiver != NULL) {
-			Message* msg = getNextMsg();
-			if (msg) {
-				_receiver->receive(msg);
-				delete msg;
+		dispatch(items[1].revents & ZMQ_POLLIN, items[0].revents & ZMQ_POLLIN);
+	}
+}
+
+void ZeroMQSubscriber::dispatch(bool readMsgs, bool readOps) {
+	if (readMsgs && _receiver != NULL && _conflate) {
+		dispatchConflated();
+	} else if (readMsgs && _receiver != NULL) {
+		Message* msg = getNextMsg();
+		if (msg) {
+			_receiver->receive(msg);
+			delete msg;
+		}
+		// deliver the rest of a batch
+		while (!_batchedMsgs.empty()) {
+			msg = getNextMsg();
+			_receiver->receive(msg);
+			delete msg;
+		}
+	}
+
+	if (readOps) {
+		/**
+		 * Node internal request from member methods for socket operations
+		 * We need this here for thread safety.
+		 */
+		while (1) {
+			int more;
+			size_t more_size = sizeof (more);
+
+			zmq_msg_t message;
+			zmq_msg_t endpointMsg;
+
+			zmq_msg_init (&message);
+			zmq_msg_recv (&message, _readOpSocket, 0);
+			char* op = (char*)zmq_msg_data(&message);
+
+			zmq_msg_init (&endpointMsg);
+			zmq_msg_recv (&endpointMsg, _readOpSocket, 0);
+			char* endpoint = (char*)zmq_msg_data(&endpointMsg);
+
+			if (false) {
+			} else if (strcmp(op, "connectPub") == 0) {
+				zmq_connect(_subSocket, endpoint) && UM_LOG_ERR("zmq_connect %s: %s", endpoint, zmq_strerror(errno));
+			} else if (strcmp(op, "disconnectPub") == 0) {
+				zmq_disconnect(_subSocket, endpoint) && UM_LOG_ERR("zmq_disconnect %s: %s", endpoint, zmq_strerror(errno));
+			} else if (strcmp(op, "releasePub") == 0) {
+				_pubRings.erase(endpoint);
 			}
+
+			zmq_getsockopt (_readOpSocket, ZMQ_RCVMORE, &more, &more_size);
+			zmq_msg_close (&message);
+			zmq_msg_close (&endpointMsg);
+
+			assert(!more); // we read all messages
+			if (!more)
+				break;      //  Last message part
 		}
+	}
+
+}
 
-		if (items[0].revents & ZMQ_POLLIN) {
-			/**
-			 * Node internal request from member methods for socket operations
-			 * We need this here for thread safety.
-			 */
-			while (1) {
-				int more;
-				size_t more_size = sizeof (more);
-
-				zmq_msg_t message;
-				zmq_msg_t endpointMsg;
-
-				zmq_msg_init (&message);
-				zmq_msg_recv (&message, _readOpSocket, 0);
-				char* op = (char*)zmq_msg_data(&message);
-
-				zmq_msg_init (&endpointMsg);
-				zmq_msg_recv (&endpointMsg, _readOpSocket, 0);
-				char* endpoint = (char*)zmq_msg_data(&endpointMsg);
-
-				if (false) {
-				} else if (strcmp(op, "connectPub") == 0) {
-					zmq_connect(_subSocket, endpoint) && UM_LOG_ERR("zmq_connect %s: %s", endpoint, zmq_strerror(errno));
-				} else if (strcmp(op, "disconnectPub") == 0) {
-					zmq_disconnect(_subSocket, endpoint) && UM_LOG_ERR("zmq_disconnect %s: %s", endpoint, zmq_strerror(errno));
-				}
-
-				zmq_getsockopt (_readOpSocket, ZMQ_RCVMORE, &more, &more_size);
-				zmq_msg_close (&message);
-				zmq_msg_close (&endpointMsg);
-
-				assert(!more); // we read all messages
-				if (!more)
-					break;      //  Last message part
+/**
+ * A receiver slower than the publisher only gets the latest message pending per
+ * publisher, or per publisher and value of a meta field, in the order they came.
+ */
+void ZeroMQSubscriber::dispatchConflated() {
+	std::list<std::pair<std::string, Message*> > latest;
+	size_t nrRead = 0;
+	size_t nrDropped = 0;
+
+	// the publisher might be faster still, stop after as many as the socket would hold
+	while ((nrRead == 0 || hasNextMsg()) && (_rcvHwm <= 0 || nrRead < (size_t)_rcvHwm)) {
+		Message* msg = getNextMsg();
+		nrRead++;
+		if (msg == NULL)
+			continue;
+
+		std::string key = msg->getMeta("um.pub");
+		if (_conflateKey.size() > 0)
+			key += ":" + msg->getMeta(_conflateKey);
+
+		for (std::list<std::pair<std::string, Message*> >::iterator msgIter = latest.begin(); msgIter != latest.end(); msgIter++) {
+			if (msgIter->first == key) {
+				delete msgIter->second;
+				latest.erase(msgIter);
+				nrDropped++;
+				break;
 			}
 		}
+		latest.push_back(std::make_pair(key, msg));
+	}
 
+	if (nrDropped > 0)
+		UM_LOG_DEBUG("Subscriber %s on %s conflated %lu messages", SHORT_UUID(_uuid).c_str(), _channelName.c_str(), (unsigned long)nrDropped);
+
+	for (std::list<std::pair<std::string, Message*> >::iterator msgIter = latest.begin(); msgIter != latest.end(); msgIter++) {
+		_receiver->receive(msgIter->second);
+		delete msgIter->second;
 	}
 }
 
 Message* ZeroMQSubscriber::getNextMsg() {
+	// copies of payloads we read from a ring and the like are skipped, not delivered
+	for (;;) {
+		bool isSkipped = false;
+		Message* msg = readNextMsg(isSkipped);
+		if (msg != NULL || !isSkipped || !hasNextMsg())
+			return msg;
+	}
+}
+
+Message* ZeroMQSubscriber::readNextMsg(bool& isSkipped) {
+	if (!_batchedMsgs.empty()) {
+		// remaining messages from the last batch
+		Message* msg = _batchedMsgs.front();
+		_batchedMsgs.pop_front();
+		return msg;
+	}
+
 	int32_t more;
 	size_t more_size = sizeof(more);
 	bool readChannelName = false;
@@ -285,7 +442,7 @@ Message* ZeroMQSubscriber::getNextMsg() {
 		// is this the first message with the channelname?
 		if (!readChannelName) {
 			if (memchr(msgData, 0, msgSize) == msgData + (msgSize - 1)) {
-				msg->putMeta("um.channel", std::string(msgData, msgSize - 1));
+				msg->putMeta(MetaFields::CHANNEL, std::string(msgData, msgSize - 1));
 				zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
 				readChannelName = true;
 				continue;
@@ -332,17 +489,32 @@ Message* ZeroMQSubscriber::getNextMsg() {
                     readPtr = Message::read(readPtr, &headerFlags);
                     remainingSize -= 1;
                     
+                    // uncompressed sizes to decompress in a single pass
+                    uint64_t origHeaderSize = 0;
+                    uint64_t origPayloadSize = 0;
+                    if ((headerFlags & Message::UM_COMPR_MSG) && (headerFlags & Message::UM_COMPR_SIZES)) {
+                        readPtr = Message::readCompact(readPtr, &origHeaderSize, remainingSize);
+                        if (readPtr != 0) {
+                            remainingSize = msgSize - (readPtr - msgData);
+                            readPtr = Message::readCompact(readPtr, &origPayloadSize, remainingSize);
+                        }
+                        if (readPtr != 0) {
+                            remainingSize = msgSize - (readPtr - msgData);
+                        }
+                    }
                     
                     // read next byte++ with the header length
                     uint64_t headerSize = 0;
-                    readPtr = Message::readCompact(readPtr, &headerSize, remainingSize);
+                    if (readPtr != 0)
+                        readPtr = Message::readCompact(readPtr, &headerSize, remainingSize);
                     if (readPtr == 0) {
                         UM_LOG_ERR("Subscriber on channel %s received gibberish", _channelName.c_str());
                         zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
                         delete msg;
                         return NULL;
                     }
-                    remainingSize -= 1;
+                    // header length takes one, three or nine bytes
+                    remainingSize = msgSize - (readPtr - msgData);
                     
                     if (headerSize > remainingSize) {
                         UM_LOG_ERR("Subscriber on channel %s received wrong header size", _channelName.c_str());
@@ -362,13 +534,21 @@ Message* ZeroMQSubscriber::getNextMsg() {
                     
                     if (headerFlags & Message::UM_COMPR_MSG) {
 
+                        std::string codec = Message::getCompressionName(headerFlags & Message::UM_COMPR_TYPE);
+                        if (codec.size() == 0) {
+                            UM_LOG_ERR("Subscriber on channel %s received message with unsupported compression %d", _channelName.c_str(), headerFlags & Message::UM_COMPR_TYPE);
+                            zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                            delete msg;
+                            return NULL;
+                        }
+                        
                         if (headerFlags & Message::UM_COMPR_KEYFRAME) {
                             if (_pubComprCtx.find(pubUUID) != _pubComprCtx.end()) {
-                                Message::freeCompression(_pubComprCtx[pubUUID]);
+                                Message::freeCompression(_pubComprCtx[pubUUID].second, _pubComprCtx[pubUUID].first);
                             }
-                            _pubComprCtx[pubUUID] = Message::createCompression();
+                            _pubComprCtx[pubUUID] = std::make_pair(codec, Message::createCompression(codec));
                         } else {
-                            if (_pubComprCtx.find(pubUUID) == _pubComprCtx.end()) {
+                            if (_pubComprCtx.find(pubUUID) == _pubComprCtx.end() || _pubComprCtx[pubUUID].first != codec) {
                                 UM_LOG_ERR("Subscriber on channel %s waiting for keyframe", _channelName.c_str());
                                 zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
                                 delete msg;
@@ -376,17 +556,15 @@ Message* ZeroMQSubscriber::getNextMsg() {
                             }
                         }
                         
-                        void* ctx = _pubComprCtx[pubUUID];
-                        if (headerFlags & Message::UM_COMPR_LZ4) {
-                            if (headerSize > 0)
-                                msg->uncompress("lz4", ctx, headerData, headerSize, Message::HEADER);
-                            if (payloadSize > 0)
-                                msg->uncompress("lz4", ctx, payloadData, payloadSize, Message::PAYLOAD);
-                        }
-                    } else {
-                        // uncompressed, just read into the message
-                        msg->setData(payloadData, payloadSize);
-                        msg->readHeaders(headerData, headerSize);
+                        void* ctx = _pubComprCtx[pubUUID].second;
+                        if (headerSize > 0)
+                            msg->uncompress(codec, ctx, headerData, headerSize, Message::HEADER, origHeaderSize);
+                        if (payloadSize > 0)
+                            msg->uncompress(codec, ctx, payloadData, payloadSize, Message::PAYLOAD, origPayloadSize);
+                    } else if (!readUncompressed(msg, &message, headerData, headerSize, payloadData, payloadSize, headerFlags, msgVersion, more)) {
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        delete msg;
+                        return NULL;
                     }
                     
                     zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
@@ -395,6 +573,165 @@ Message* ZeroMQSubscriber::getNextMsg() {
                 }
                         
                     
+                case Message::UM_MSG_VERSION_02: {
+                    // see ZeroMQPublisher::sendCompact for the layout
+                    if (remainingSize < 16 + 1 + 4) {
+                        UM_LOG_ERR("Subscriber on channel %s received gibberish", _channelName.c_str());
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        delete msg;
+                        return NULL;
+                    }
+
+                    std::string pubUUID;
+                    readPtr = UUID::readBinToHex(readPtr, pubUUID);
+
+                    uint8_t headerFlags;
+                    readPtr = Message::read(readPtr, &headerFlags);
+
+                    uint32_t staticGen;
+                    readPtr = Message::read(readPtr, &staticGen);
+                    remainingSize = msgSize - (readPtr - msgData);
+
+                    uint64_t traceSeq = 0, sentUs = 0, forwardedUs = 0, receivedUs = 0;
+                    if (headerFlags & Message::UM_TRACE) {
+                        if (remainingSize < UMUNDO_TRACE_SIZE) {
+                            UM_LOG_ERR("Subscriber on channel %s received gibberish", _channelName.c_str());
+                            zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                            delete msg;
+                            return NULL;
+                        }
+                        readPtr = Message::read(readPtr, &traceSeq);
+                        readPtr = Message::read(readPtr, &sentUs);
+                        readPtr = Message::read(readPtr, &forwardedUs);
+                        remainingSize -= UMUNDO_TRACE_SIZE;
+                        receivedUs = Thread::getMonotonicTimeStampUs();
+                    }
+
+                    if (headerFlags & Message::UM_COMPR_MSG) {
+                        UM_LOG_ERR("Subscriber on channel %s received compressed message with version %d", _channelName.c_str(), msgVersion);
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        delete msg;
+                        return NULL;
+                    }
+
+                    if (headerFlags & Message::UM_STATIC_HEADER) {
+                        uint64_t staticSize = 0;
+                        readPtr = Message::readCompact(readPtr, &staticSize, remainingSize);
+                        if (readPtr != 0)
+                            remainingSize = msgSize - (readPtr - msgData);
+                        if (readPtr == 0 || staticSize > remainingSize) {
+                            UM_LOG_ERR("Subscriber on channel %s received wrong static header size", _channelName.c_str());
+                            zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                            delete msg;
+                            return NULL;
+                        }
+
+                        StaticHeader& staticHeader = _pubStaticHeaders[pubUUID];
+                        if (staticHeader.gen != staticGen || staticHeader.meta.size() == 0) {
+                            staticHeader.gen = staticGen;
+                            staticHeader.meta.clear();
+                            if (Message::readCompactHeaders(readPtr, staticSize, staticHeader.meta) == 0) {
+                                UM_LOG_ERR("Subscriber on channel %s received gibberish", _channelName.c_str());
+                                _pubStaticHeaders.erase(pubUUID);
+                                zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                                delete msg;
+                                return NULL;
+                            }
+                        }
+                        readPtr += staticSize;
+                        remainingSize -= staticSize;
+                    }
+
+                    // trace times are from the monotonic clock of the publisher's host, we only record ours
+                    bool isTraced = false;
+                    if (headerFlags & Message::UM_TRACE) {
+                        std::map<std::string, StaticHeader>::iterator staticIter = _pubStaticHeaders.find(pubUUID);
+                        if (staticIter != _pubStaticHeaders.end() && staticIter->second.gen == staticGen) {
+                            const std::string* pubHost = staticIter->second.meta.find(MetaFields::HOST);
+                            isTraced = (pubHost != NULL && *pubHost == hostUUID);
+                        }
+                    }
+
+                    if (headerFlags & Message::UM_SHM_COPY) {
+                        std::map<std::string, SharedMemoryReader>::iterator readerIter = _pubRings.find(pubUUID);
+                        if (readerIter != _pubRings.end() && readerIter->second.delivered) {
+                            // we already read this one from the publisher's ring
+                            zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                            skipFrames(more);
+                            delete msg;
+                            isSkipped = true;
+                            return NULL;
+                        }
+                    }
+
+                    // a message we read from shared memory is only traced once we got it from the ring
+                    if (isTraced && !(headerFlags & Message::UM_SHM_PAYLOAD))
+                        _traceStats.record(pubUUID, traceSeq, sentUs, forwardedUs, receivedUs);
+
+                    msg->putMeta(MetaFields::PUB, pubUUID);
+                    if (headerFlags & Message::UM_STATIC_REF) {
+                        std::map<std::string, StaticHeader>::iterator staticIter = _pubStaticHeaders.find(pubUUID);
+                        if (staticIter != _pubStaticHeaders.end() && staticIter->second.gen == staticGen && staticIter->second.meta.size() > 0) {
+                            msg->putMeta(staticIter->second.meta);
+                        } else {
+                            // we were connected before the publisher knew us or its header got lost
+                            UM_LOG_WARN("Subscriber on channel %s has no static header %lu from publisher %s, dropping message", _channelName.c_str(), (unsigned long)staticGen, SHORT_UUID(pubUUID).c_str());
+                            requestStaticHeader(pubUUID);
+                            zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                            skipFrames(more);
+                            delete msg;
+                            return NULL;
+                        }
+                    }
+
+                    if (headerFlags & Message::UM_BATCH) {
+                        if (!readBatch(msg, &message, readPtr, remainingSize)) {
+                            zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                            delete msg;
+                            return NULL;
+                        }
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        goto MESSAGE_READ;
+                    }
+
+                    uint64_t headerSize = 0;
+                    readPtr = Message::readCompact(readPtr, &headerSize, remainingSize);
+                    if (readPtr != 0)
+                        remainingSize = msgSize - (readPtr - msgData);
+                    if (readPtr == 0 || headerSize > remainingSize) {
+                        UM_LOG_ERR("Subscriber on channel %s received wrong header size", _channelName.c_str());
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        delete msg;
+                        return NULL;
+                    }
+
+                    const char* headerData = readPtr;
+                    const char* payloadData = headerData + headerSize;
+                    uint64_t payloadSize = (remainingSize - headerSize);
+
+                    if (headerFlags & Message::UM_SHM_PAYLOAD) {
+                        bool isRead = readShared(msg, pubUUID, headerData, headerSize, payloadData, payloadSize);
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        if (!isRead) {
+                            delete msg;
+                            isSkipped = true;
+                            return NULL;
+                        }
+                        if (isTraced)
+                            _traceStats.record(pubUUID, traceSeq, sentUs, forwardedUs, receivedUs);
+                        goto MESSAGE_READ;
+                    }
+
+                    if (!readUncompressed(msg, &message, headerData, headerSize, payloadData, payloadSize, headerFlags, msgVersion, more)) {
+                        zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                        delete msg;
+                        return NULL;
+                    }
+
+                    zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+                    goto MESSAGE_READ;
+                }
+
                 default:
                     UM_LOG_ERR("Unsupported message version %d", msgVersion);
                     delete msg;
@@ -418,7 +755,210 @@ MESSAGE_READ:
     return msg;
 }
 
+/**
+ * Subscribing to our uuid followed by the publisher's has its node tell the publisher
+ * about us again. It will send the static header to everyone with its next message.
+ */
+void ZeroMQSubscriber::requestStaticHeader(const std::string& pubUUID) {
+	StaticHeader& staticHeader = _pubStaticHeaders[pubUUID];
+	uint64_t now = Thread::getTimeStampMs();
+	if (now - staticHeader.requestedAt < UMUNDO_STATIC_HEADER_RETRY_MS)
+		return;
+	staticHeader.requestedAt = now;
+
+	std::string request("~" + _uuid + pubUUID);
+	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, request.data(), request.size()) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+	zmq_setsockopt(_subSocket, ZMQ_UNSUBSCRIBE, request.data(), request.size()) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+}
+
+/**
+ * Subscribing to our uuid followed by the publisher's and a '+' or '-' tells the
+ * publisher whether we read payloads from its ring or need them as copies.
+ */
+void ZeroMQSubscriber::reportSharedMemory(const std::string& pubUUID, bool canRead) {
+	std::string report("~" + _uuid + pubUUID + (canRead ? "+" : "-"));
+	zmq_setsockopt(_subSocket, ZMQ_SUBSCRIBE, report.data(), report.size()) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+	zmq_setsockopt(_subSocket, ZMQ_UNSUBSCRIBE, report.data(), report.size()) && UM_LOG_WARN("zmq_setsockopt: %s",zmq_strerror(errno));
+}
+
+/// read and drop the remaining frames of a message
+void ZeroMQSubscriber::skipFrames(int32_t more) {
+	size_t more_size = sizeof(more);
+	while (more) {
+		zmq_msg_t message;
+		zmq_msg_init(&message) && UM_LOG_WARN("zmq_msg_init: %s",zmq_strerror(errno));
+		zmq_recvmsg(_subSocket, &message, 0) >= 0 || UM_LOG_WARN("zmq_recvmsg: %s",zmq_strerror(errno));
+		zmq_getsockopt(_subSocket, ZMQ_RCVMORE, &more, &more_size) && UM_LOG_WARN("zmq_getsockopt: %s",zmq_strerror(errno));
+		zmq_msg_close(&message) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+	}
+}
+
+bool ZeroMQSubscriber::readUncompressed(Message* msg,
+                                        zmq_msg_t* message,
+                                        const char* headerData,
+                                        size_t headerSize,
+                                        const char* payloadData,
+                                        size_t payloadSize,
+                                        uint8_t headerFlags,
+                                        uint8_t version,
+                                        bool more) {
+	const char* msgData = (const char*)zmq_msg_data(message);
+
+	if (headerFlags & Message::UM_PAYLOAD_FRAME) {
+		// zero-copy publisher, payload follows in its own frame
+		if (payloadSize > 0 || !more) {
+			UM_LOG_ERR("Subscriber on channel %s received wrong message format", _channelName.c_str());
+			return false;
+		}
+		if (_zeroCopy) {
+			// keep the frame around until headers are parsed
+			size_t headerOffset = headerData - msgData;
+			zmq_msg_t* frame = adoptFrame(message);
+			msg->setRawHeaders((char*)zmq_msg_data(frame) + headerOffset, headerSize, version, releaseFrame, frame);
+		} else {
+			msg->readHeaders(headerData, headerSize, version);
+		}
+
+		zmq_msg_t payload;
+		zmq_msg_init(&payload) && UM_LOG_WARN("zmq_msg_init: %s",zmq_strerror(errno));
+		if (zmq_recvmsg(_subSocket, &payload, 0) < 0) {
+			UM_LOG_WARN("zmq_recvmsg: %s",zmq_strerror(errno));
+			zmq_msg_close(&payload) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+			return false;
+		}
+		if (_zeroCopy) {
+			zmq_msg_t* frame = adoptFrame(&payload);
+			msg->setData((char*)zmq_msg_data(frame), zmq_msg_size(frame), releaseFrame, frame);
+		} else {
+			msg->setData((char*)zmq_msg_data(&payload), zmq_msg_size(&payload));
+		}
+		zmq_msg_close(&payload) && UM_LOG_WARN("zmq_msg_close: %s",zmq_strerror(errno));
+
+	} else if (_zeroCopy) {
+		// refer into the frame and parse headers on demand
+		size_t headerOffset = headerData - msgData;
+		size_t payloadOffset = payloadData - msgData;
+		zmq_msg_t* frame = adoptFrame(message);
+		msg->setData((char*)zmq_msg_data(frame) + payloadOffset, payloadSize, releaseFrame, frame);
+		msg->setRawHeaders((char*)zmq_msg_data(frame) + headerOffset, headerSize, version);
+
+	} else {
+		// just read into the message
+		msg->setData(payloadData, payloadSize);
+		msg->readHeaders(headerData, headerSize, version);
+	}
+	return true;
+}
+
+bool ZeroMQSubscriber::readShared(Message* msg, const std::string& pubUUID, const char* headerData, size_t headerSize, const char* readPtr, size_t remainingSize) {
+	SharedMemoryReader& reader = _pubRings[pubUUID];
+	reader.delivered = false;
+
+	const char* endPtr = readPtr + remainingSize;
+	uint64_t position = 0;
+	uint64_t payloadSize = 0;
+	if ((readPtr = Message::readCompact(readPtr, &position, remainingSize)) == 0 ||
+	        (readPtr = Message::readCompact(readPtr, &payloadSize, endPtr - readPtr)) == 0 ||
+	        readPtr != endPtr) {
+		UM_LOG_ERR("Subscriber on channel %s received gibberish", _channelName.c_str());
+		return false;
+	}
+
+	if (!reader.ring && !reader.isMissing) {
+		reader.ring = SharedMemoryRing::open(SharedMemoryRing::nameFor(pubUUID));
+		reader.isMissing = !reader.ring;
+		if (reader.isMissing) {
+			UM_LOG_INFO("Subscriber on channel %s cannot map the ring of publisher %s, waiting for copies", _channelName.c_str(), SHORT_UUID(pubUUID).c_str());
+		} else {
+			// the publisher keeps sending copies until it knows
+			reportSharedMemory(pubUUID, true);
+		}
+	}
+	if (!reader.ring || payloadSize > reader.ring->getCapacity())
+		return false;
+
+	char* payload = BufferPool::alloc(payloadSize);
+	if (!reader.ring->read(position, payload, payloadSize)) {
+		UM_LOG_WARN("Subscriber on channel %s fell behind publisher %s by a whole ring, lost a message and asking for copies", _channelName.c_str(), SHORT_UUID(pubUUID).c_str());
+		BufferPool::release(payload);
+		reader.ring = SharedPtr<SharedMemoryRing>();
+		reader.isMissing = true;
+		reportSharedMemory(pubUUID, false);
+		return false;
+	}
+
+	msg->setData(payload, payloadSize, BufferPool::releaseCallback, NULL);
+	msg->readHeaders(headerData, headerSize, Message::UM_MSG_VERSION_02);
+	reader.delivered = true;
+	return true;
+}
+
+bool ZeroMQSubscriber::readBatch(Message* msg, zmq_msg_t* message, const char* readPtr, size_t remainingSize) {
+	const char* msgData = (const char*)zmq_msg_data(message);
+	const char* msgEnd = readPtr + remainingSize;
+
+	uint64_t count = 0;
+	if (remainingSize == 0 || (readPtr = Message::readCompact(readPtr, &count, remainingSize)) == 0 || count == 0) {
+		UM_LOG_ERR("Subscriber on channel %s received wrong batch size", _channelName.c_str());
+		return false;
+	}
+
+	// every message in the batch starts with the meta fields of the first one
+	Message prototype(*msg);
+	std::list<Message*> batch;
+
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t headerSize = 0;
+		uint64_t payloadSize = 0;
+		if (readPtr >= msgEnd ||
+		        (readPtr = Message::readCompact(readPtr, &headerSize, msgEnd - readPtr)) == 0 ||
+		        headerSize > (uint64_t)(msgEnd - readPtr)) {
+			break;
+		}
+		const char* headerData = readPtr;
+		readPtr += headerSize;
+
+		if (readPtr >= msgEnd ||
+		        (readPtr = Message::readCompact(readPtr, &payloadSize, msgEnd - readPtr)) == 0 ||
+		        payloadSize > (uint64_t)(msgEnd - readPtr)) {
+			break;
+		}
+		const char* payloadData = readPtr;
+		readPtr += payloadSize;
+
+		Message* batched = (i == 0 ? msg : new Message(prototype));
+		if (_zeroCopy) {
+			// every message holds on to the frame, 0MQ reference counts the data
+			zmq_msg_t* frame = new zmq_msg_t();
+			zmq_msg_init(frame) && UM_LOG_WARN("zmq_msg_init: %s",zmq_strerror(errno));
+			zmq_msg_copy(frame, message) && UM_LOG_WARN("zmq_msg_copy: %s",zmq_strerror(errno));
+			batched->setData((char*)zmq_msg_data(frame) + (payloadData - msgData), payloadSize, releaseFrame, frame);
+			batched->setRawHeaders((char*)zmq_msg_data(frame) + (headerData - msgData), headerSize, Message::UM_MSG_VERSION_02);
+		} else {
+			batched->setData(payloadData, payloadSize);
+			batched->readHeaders(headerData, headerSize, Message::UM_MSG_VERSION_02);
+		}
+		if (i > 0)
+			batch.push_back(batched);
+	}
+
+	if (batch.size() + 1 != count || readPtr != msgEnd) {
+		UM_LOG_ERR("Subscriber on channel %s received gibberish", _channelName.c_str());
+		while(!batch.empty()) {
+			delete batch.front();
+			batch.pop_front();
+		}
+		return false;
+	}
+
+	_batchedMsgs.splice(_batchedMsgs.end(), batch);
+	return true;
+}
+
 bool ZeroMQSubscriber::hasNextMsg() {
+	if (!_batchedMsgs.empty())
+		return true;
+
 	zmq_pollitem_t items[1];
 	items[0].socket = _subSocket;
 	items[0].events = ZMQ_POLLIN;
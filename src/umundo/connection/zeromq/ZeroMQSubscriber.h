@@ -22,14 +22,22 @@
 #ifndef ZEROMQSUBSCRIBER_H_6DV3QJUH
 #define ZEROMQSUBSCRIBER_H_6DV3QJUH
 
+#include <zmq.h>
+
 #include "umundo/Common.h"
 #include "umundo/ResultSet.h"
 #include "umundo/connection/Subscriber.h"
+#include "umundo/SharedMemoryRing.h"
+
+#include <list>
+
+#define UMUNDO_STATIC_HEADER_RETRY_MS 100 // ask a publisher for its static header at most this often
 
 namespace umundo {
 
 class PublisherStub;
 class NodeStub;
+class ZeroMQDispatcher;
 
 /**
  * Concrete subscriber implementor for 0MQ (bridge pattern).
@@ -46,26 +54,86 @@ public:
 	virtual Message* getNextMsg();
 	virtual bool hasNextMsg();
 
+	TraceStats::Snapshot getTraceStats() {
+		return _traceStats.snapshot();
+	}
+
 	void added(const PublisherStub& pub, const NodeStub& node);
 	void removed(const PublisherStub& pub, const NodeStub& node);
 
+	/// have the workers of dispatcher deliver our messages unless we were configured otherwise
+	void setDispatcher(SharedPtr<ZeroMQDispatcher> dispatcher);
+
 	// Thread
 	void run();
 
 protected:
 	ZeroMQSubscriber();
 
+	void startDispatching();
+	void stopDispatching();
+	/// deliver pending messages and socket operations, from our thread or a dispatcher
+	void dispatch(bool readMsgs, bool readOps);
+	void dispatchConflated();
+
 	void* _subSocket;
 	void* _readOpSocket;
 	void* _writeOpSocket;
 	std::multimap<std::string, std::string> _domainPubs;
     
-    std::map<std::string, void*> _pubComprCtx;
+    std::map<std::string, std::pair<std::string, void*> > _pubComprCtx; ///< codec and context per publisher
 	RMutex _mutex;
 
+	/// static header fields per publisher, see ZeroMQPublisher::sendCompact
+	struct StaticHeader {
+		StaticHeader() : gen(0), requestedAt(0) {}
+		uint32_t gen;
+		MetaFields meta;
+		uint64_t requestedAt; ///< when we last asked for it, see requestStaticHeader
+	};
+	std::map<std::string, StaticHeader> _pubStaticHeaders;
+
+	/// rings of publishers announcing payloads via shared memory
+	struct SharedMemoryReader {
+		SharedMemoryReader() : isMissing(false), delivered(false) {}
+		SharedPtr<SharedMemoryRing> ring;
+		bool isMissing; ///< the publisher is on another host or we fell behind, we get copies
+		bool delivered; ///< the last payload announced was read from the ring
+	};
+	std::map<std::string, SharedMemoryReader> _pubRings;
+
+	/// messages from a batch not yet returned by getNextMsg
+	std::list<Message*> _batchedMsgs;
+
+	bool _zeroCopy;
+	bool _conflate; ///< deliver only the latest of the messages pending, see dispatch
+	std::string _conflateKey;
+	int _rcvHwm; ///< messages 0MQ keeps per publisher, 0 for no limit
+	TraceStats _traceStats; ///< of messages from tracing publishers
+
+	SharedPtr<ZeroMQDispatcher> _dispatcher;
+	int _useDispatcher; ///< as with sub.dispatch, -1 if unset and up to the node
+	bool _isDispatched; ///< registered with _dispatcher
+
 private:
+	Message* readNextMsg(bool& isSkipped);
+	void requestStaticHeader(const std::string& pubUUID);
+	void reportSharedMemory(const std::string& pubUUID, bool canRead);
+	void skipFrames(int32_t more);
+	bool readShared(Message* msg, const std::string& pubUUID, const char* headerData, size_t headerSize, const char* readPtr, size_t remainingSize);
+	bool readBatch(Message* msg, zmq_msg_t* message, const char* readPtr, size_t remainingSize);
+	bool readUncompressed(Message* msg,
+	                      zmq_msg_t* message,
+	                      const char* headerData,
+	                      size_t headerSize,
+	                      const char* payloadData,
+	                      size_t payloadSize,
+	                      uint8_t headerFlags,
+	                      uint8_t version,
+	                      bool more);
 
 	friend class Factory;
+	friend class ZeroMQDispatcher;
 };
 
 }
@@ -1,151 +1,535 @@
 #include "umundo/discovery/BroadcastDiscovery.h"
+#include "umundo/Message.h"
+#include "umundo/UUID.h"
+
+#include <string.h> // memcpy
+#include <errno.h>
+
+#if defined (_WIN32)
+#include <ws2tcpip.h>
+#define CLOSE_SOCKET(s) closesocket(s)
+#define SOCKET_INVALID INVALID_SOCKET
+#define SOCKET_ERRNO WSAGetLastError()
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define CLOSE_SOCKET(s) ::close(s)
+#define SOCKET_INVALID -1
+#define SOCKET_ERRNO errno
+#endif
+
+#define BEACON_MAGIC "UMB"
+#define BEACON_VERSION 1
 
 namespace umundo {
 
 /**
  * Have a look at https://github.com/zeromq/czmq/blob/master/src/zbeacon.c#L81 to
  * see how to setup UDP sockets for broadcast.
- *
- * Receiving Broadcast messages: https://github.com/zeromq/czmq/blob/master/src/zbeacon.c#L700
- * Sending Broadcast messages: https://github.com/zeromq/czmq/blob/master/src/zbeacon.c#L751
  */
 
-#if 0
-SOCKET BroadcastDiscovery::udpSocket = 0;
-RMutex BroadcastDiscovery::globalMutex;
-
-sockaddr_in BroadcastDiscovery::bCastAddress;
-char BroadcastDiscovery::hostName[NI_MAXHOST];
-#endif
-
-BroadcastDiscovery::BroadcastDiscovery() {
+BroadcastDiscovery::BroadcastDiscovery() :
+	_domainHash(0),
+	_port(BCAST_PORT),
+	_ttl(1),
+	_interval(BCAST_INTERVAL_MS),
+	_missedBeacons(BCAST_MISSED_BEACONS),
+	_senderId(0),
+	_random(0),
+	_stateVersion(0),
+	_nextBeacon(0),
+	_nextExpiry(0),
+	_fastBeacons(0),
+	_isSuspended(false),
+	_socket(SOCKET_INVALID) {
 	/**
-	 * This is called twice overall, once for the prototype in the factory and
-	 * once for the instance that is actually used.
+	 * This is called for the prototype in the factory and for every instance
+	 * created from it, only the latter are initialized.
 	 */
 }
 
 BroadcastDiscovery::~BroadcastDiscovery() {
-}
+	if (isStarted()) {
+		std::list<LocalAd> ads;
+		{
+			RScopeLock lock(_mutex);
+			for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin(); adIter != _localAds.end(); adIter++) {
+				ads.push_back(adIter->second);
+			}
+			_localAds.clear();
+		}
+		stop();
+		// we receive our own farewell as well, waking up the thread
+		sendBeacons(ads, BEACON_BYE);
+		join();
+	}
 
-#if 0
-void BroadcastDiscovery::setupUDPSocket() {
-	RScopeLock(globalMutex);
-	if (udpSocket == 0) {
-		int enable = 1;
+	// unreport all found endpoints from all queries
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin(); adIter != _remoteAds.end(); adIter++) {
+		for (std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin(); queryIter != _queries.end(); queryIter++) {
+			(*queryIter)->remove(adIter->second.endPoint, toStr(this));
+		}
+	}
 
-		udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-		if (udpSocket == INVALID_SOCKET)
-			return;
+	if (_socket != SOCKET_INVALID)
+		CLOSE_SOCKET(_socket);
+}
 
-		if (setsockopt (udpSocket, SOL_SOCKET, SO_BROADCAST, (char*)&enable, sizeof(enable)) == SOCKET_ERROR) {
-			//error
-		}
-		if (setsockopt (udpSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&enable, sizeof(enable)) == SOCKET_ERROR) {
-			//error
-		}
+SharedPtr<Implementation> BroadcastDiscovery::create() {
+	return SharedPtr<BroadcastDiscovery>(new BroadcastDiscovery());
+}
 
-#if defined (SO_REUSEPORT)
-		if (setsockopt (udpSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&enable, sizeof(enable)) == SOCKET_ERROR) {
-			//error
-		}
-#endif
-		in_addr_t bindTo = INADDR_ANY;
-		in_addr_t sendTo = INADDR_BROADCAST;
+void BroadcastDiscovery::init(const Options* config) {
+	// defaults
+	_domain = "local.";
+	_group = BCAST_GROUP;
 
-		bCastAddress.sin_family = AF_INET;
-		bCastAddress.sin_port = htons(43005);
-		bCastAddress.sin_addr.s_addr = sendTo;
+	// override
+	if (config != NULL) {
+		std::map<std::string, std::string> options = config->getKVPs();
+		if (options["bcast.domain"].length() > 0)
+			_domain = options["bcast.domain"];
+		if (options["bcast.group"].length() > 0)
+			_group = options["bcast.group"];
+		if (options["bcast.port"].length() > 0)
+			_port = strTo<uint16_t>(options["bcast.port"]);
+		if (options["bcast.interface"].length() > 0)
+			_interface = options["bcast.interface"];
+		if (options["bcast.ttl"].length() > 0)
+			_ttl = strTo<uint16_t>(options["bcast.ttl"]);
+		if (options["bcast.interval"].length() > 0)
+			_interval = strTo<uint32_t>(options["bcast.interval"]);
+		if (options["bcast.missedBeacons"].length() > 0)
+			_missedBeacons = strTo<uint32_t>(options["bcast.missedBeacons"]);
+	}
+	if (_interval < 4)
+		_interval = 4;
+	if (_missedBeacons == 0)
+		_missedBeacons = 1;
 
-		sockaddr_in address = bCastAddress;
-		address.sin_addr.s_addr = bindTo;
+	_domainHash = hashDomain(_domain);
 
-#if (defined (__WINDOWS__))
-		sockaddr_in sockaddr = address;
-#elif (defined (__APPLE__))
-		sockaddr_in sockaddr = bCastAddress;
-		sockaddr.sin_addr.s_addr = htons (INADDR_ANY);
-#else
-		sockaddr_in sockaddr = bCastAddress;
-#endif
+	// first eight bytes of a random uuid
+	std::string binUUID = UUID::hexToBin(UUID::getUUID());
+	Message::read(binUUID.data(), &_senderId);
+	_random = _senderId | 1;
 
-		if (bind (udpSocket, (struct sockaddr *) &sockaddr, sizeof (sockaddr_in))) {
-			// error
-		}
+	setupSocket();
+	if (_socket == SOCKET_INVALID)
+		return;
 
-		getnameinfo ((struct sockaddr *) &address, sizeof (sockaddr_in), hostName, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
+	_nextExpiry = Thread::getTimeStampMs() + _interval;
+	start();
+}
 
+void BroadcastDiscovery::setupSocket() {
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_socket == SOCKET_INVALID) {
+		UM_LOG_ERR("socket: %s", strerror(SOCKET_ERRNO));
+		return;
 	}
-}
+
+	int enable = 1;
+	// every instance on the host receives a copy of each beacon
+	setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&enable, sizeof(enable)) && UM_LOG_WARN("setsockopt SO_REUSEADDR: %s", strerror(SOCKET_ERRNO));
+#if defined (SO_REUSEPORT)
+	setsockopt(_socket, SOL_SOCKET, SO_REUSEPORT, (char*)&enable, sizeof(enable)) && UM_LOG_WARN("setsockopt SO_REUSEPORT: %s", strerror(SOCKET_ERRNO));
 #endif
 
-SharedPtr<BroadcastDiscovery> BroadcastDiscovery::getInstance() {
-	if (_instance.get() == NULL) {
-		// setup UDP socket when th first instance is required
-		//setupUDPSocket();
+	sockaddr_in bindAddress;
+	memset(&bindAddress, 0, sizeof(bindAddress));
+	bindAddress.sin_family = AF_INET;
+	bindAddress.sin_port = htons(_port);
+	bindAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	memset(&_groupAddress, 0, sizeof(_groupAddress));
+	_groupAddress.sin_family = AF_INET;
+	_groupAddress.sin_port = htons(_port);
+	_groupAddress.sin_addr.s_addr = inet_addr(_group.c_str());
 
-		_instance = SharedPtr<BroadcastDiscovery>(new BroadcastDiscovery());
-		_instance->start();
+	ip_mreq membership;
+	membership.imr_multiaddr.s_addr = _groupAddress.sin_addr.s_addr;
+	membership.imr_interface.s_addr = (_interface.length() > 0 ? inet_addr(_interface.c_str()) : htonl(INADDR_ANY));
+
+	if (bind(_socket, (sockaddr*)&bindAddress, sizeof(bindAddress)) != 0) {
+		UM_LOG_ERR("bind to port %d: %s", _port, strerror(SOCKET_ERRNO));
+		goto FAILED;
+	}
+	if (setsockopt(_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&membership, sizeof(membership)) != 0) {
+		UM_LOG_ERR("joining multicast group %s: %s", _group.c_str(), strerror(SOCKET_ERRNO));
+		goto FAILED;
+	}
+	if (_interface.length() > 0) {
+		setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_IF, (char*)&membership.imr_interface, sizeof(membership.imr_interface)) && UM_LOG_WARN("setsockopt IP_MULTICAST_IF: %s", strerror(SOCKET_ERRNO));
+	}
+
+	{
+		int ttl = _ttl;
+		setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_TTL, (char*)&ttl, sizeof(ttl)) && UM_LOG_WARN("setsockopt IP_MULTICAST_TTL: %s", strerror(SOCKET_ERRNO));
+		// instances on this host need to see each other
+		setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_LOOP, (char*)&enable, sizeof(enable)) && UM_LOG_WARN("setsockopt IP_MULTICAST_LOOP: %s", strerror(SOCKET_ERRNO));
 	}
-	return _instance;
+	return;
+
+FAILED:
+	CLOSE_SOCKET(_socket);
+	_socket = SOCKET_INVALID;
 }
-SharedPtr<BroadcastDiscovery> BroadcastDiscovery::_instance;
 
-SharedPtr<Implementation> BroadcastDiscovery::create() {
-	return getInstance();
+uint32_t BroadcastDiscovery::hashDomain(const std::string& domain) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < domain.size(); i++) {
+		hash ^= (uint8_t)domain[i];
+		hash *= 16777619u;
+	}
+	return hash;
 }
 
-void BroadcastDiscovery::init(const Options*) {
-	/*
-	 * This is where you can setup the non-prototype instance, i.e. not the one
-	 * in the factory, but the one created from the prototype.
-	 *
-	 * The options object is not used and empty.
-	 */
+uint32_t BroadcastDiscovery::jitter(uint32_t intervalMs) {
+	// xorshift, only ever called with _mutex held
+	_random ^= _random << 13;
+	_random ^= _random >> 7;
+	_random ^= _random << 17;
+	// somewhere within a quarter of the interval in either direction
+	return intervalMs - intervalMs / 4 + (uint32_t)(_random % (intervalMs / 2 + 1));
 }
 
 void BroadcastDiscovery::suspend() {
+	std::list<LocalAd> ads;
+	{
+		RScopeLock lock(_mutex);
+		if (_isSuspended)
+			return;
+		_isSuspended = true;
+		for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin(); adIter != _localAds.end(); adIter++) {
+			ads.push_back(adIter->second);
+		}
+	}
+	sendBeacons(ads, BEACON_BYE);
 }
 
 void BroadcastDiscovery::resume() {
+	RScopeLock lock(_mutex);
+	if (!_isSuspended)
+		return;
+	_isSuspended = false;
+	_fastBeacons = 3;
+	_nextBeacon = 0;
 }
 
 void BroadcastDiscovery::advertise(const EndPoint& node) {
-	/**
-	 * umundo.core asks you to make the given node discoverable
-	 */
+	advertise(node, 0);
+}
+
+void BroadcastDiscovery::advertise(const EndPoint& node, uint16_t pubPort) {
+	std::list<LocalAd> ads;
+	{
+		RScopeLock lock(_mutex);
+		if (_localAds.find(node) != _localAds.end()) {
+			UM_LOG_WARN("Already advertising endpoint");
+			return;
+		}
+
+		LocalAd ad;
+		ad.uuid = node.getUUID();
+		if (!UUID::isUUID(ad.uuid))
+			ad.uuid = UUID::getUUID();
+
+		ad.ip = 0;
+		uint32_t ip = inet_addr(node.getIP().c_str());
+		if (ip != INADDR_NONE)
+			ad.ip = ntohl(ip);
+
+		ad.port = node.getPort();
+		ad.pubPort = pubPort;
+		ad.transport = (node.getTransport() == "udp" ? 1 : 0);
+		ad.version = ++_stateVersion;
+		_localAds[node] = ad;
+
+		if (_isSuspended)
+			return;
+
+		// announce right away and repeat a few times in quick succession
+		ads.push_back(ad);
+		_fastBeacons = 3;
+		_nextBeacon = Thread::getTimeStampMs() + jitter(_interval / 4);
+	}
+	sendBeacons(ads, 0);
 }
 
 void BroadcastDiscovery::add(Node& node) {
+	advertise(node, node.getImpl()->getPubPort());
+	browse(node.getImpl().get());
 }
 
 void BroadcastDiscovery::unadvertise(const EndPoint& node) {
-	/**
-	 * umundo.core asks you to announce the removal of the given node
-	 */
+	std::list<LocalAd> ads;
+	{
+		RScopeLock lock(_mutex);
+		if (_localAds.find(node) == _localAds.end()) {
+			UM_LOG_WARN("Not unadvertising %s://%s:%d - node unknown",
+			            node.getTransport().c_str(),
+			            node.getIP().c_str(),
+			            node.getPort());
+			return;
+		}
+		ads.push_back(_localAds[node]);
+		_localAds.erase(node);
+		if (_isSuspended)
+			return;
+	}
+	sendBeacons(ads, BEACON_BYE);
 }
 
 void BroadcastDiscovery::remove(Node& node) {
+	unbrowse(node.getImpl().get());
+	unadvertise(node);
 }
 
 void BroadcastDiscovery::browse(ResultSet<ENDPOINT_RS_TYPE>* query) {
-	/**
-	 * Another node wants to browse for nodes
-	 */
+	RScopeLock lock(_mutex);
+
+	if (_queries.find(query) != _queries.end()) {
+		UM_LOG_WARN("Query %p already added for browsing - ignored", query);
+		return;
+	}
+	_queries.insert(query);
+
+	// report all existing remote endpoints
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin(); adIter != _remoteAds.end(); adIter++) {
+		query->add(adIter->second.endPoint, toStr(this));
+	}
 }
 
 void BroadcastDiscovery::unbrowse(ResultSet<ENDPOINT_RS_TYPE>* query) {
-	/**
-	 * Another node no longer wants to browse for nodes
-	 */
+	RScopeLock lock(_mutex);
+
+	if (_queries.find(query) == _queries.end()) {
+		UM_LOG_WARN("No such query %p to unbrowse - ignored", query);
+		return;
+	}
+
+	// unreport all existing remote endpoints
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin(); adIter != _remoteAds.end(); adIter++) {
+		query->remove(adIter->second.endPoint, toStr(this));
+	}
+	_queries.erase(query);
 }
 
 std::vector<EndPoint> BroadcastDiscovery::list() {
-	return std::vector<EndPoint>();
+	RScopeLock lock(_mutex);
+
+	std::vector<EndPoint> endpoints;
+	for (std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin(); adIter != _remoteAds.end(); adIter++) {
+		endpoints.push_back(adIter->second.endPoint);
+	}
+	return endpoints;
+}
+
+/**
+ * Send the given advertisements in as few datagrams as possible, always at least one.
+ */
+void BroadcastDiscovery::sendBeacons(const std::list<LocalAd>& ads, uint8_t flags) {
+	if (_socket == SOCKET_INVALID)
+		return;
+
+	char buffer[BEACON_HEADER_SIZE + BEACON_MAX_RECORDS * BEACON_RECORD_SIZE];
+	std::list<LocalAd>::const_iterator adIter = ads.begin();
+	do {
+		char* writePtr = buffer;
+		memcpy(writePtr, BEACON_MAGIC, 3);
+		writePtr = Message::write(writePtr + 3, (uint8_t)BEACON_VERSION);
+		writePtr = Message::write(writePtr, _domainHash);
+		writePtr = Message::write(writePtr, _senderId);
+		char* countPtr = writePtr++;
+
+		uint8_t count = 0;
+		while (adIter != ads.end() && count < BEACON_MAX_RECORDS) {
+			writePtr = Message::write(writePtr, flags);
+			writePtr = UUID::writeHexToBin(writePtr, adIter->uuid);
+			writePtr = Message::write(writePtr, adIter->ip);
+			writePtr = Message::write(writePtr, adIter->port);
+			writePtr = Message::write(writePtr, adIter->pubPort);
+			writePtr = Message::write(writePtr, adIter->transport);
+			writePtr = Message::write(writePtr, adIter->version);
+			adIter++;
+			count++;
+		}
+		Message::write(countPtr, count);
+
+		if (sendto(_socket, buffer, writePtr - buffer, 0, (sockaddr*)&_groupAddress, sizeof(_groupAddress)) < 0) {
+			UM_LOG_WARN("sendto %s:%d: %s", _group.c_str(), _port, strerror(SOCKET_ERRNO));
+		}
+	} while (adIter != ads.end());
+}
+
+void BroadcastDiscovery::received(const char* data, size_t size, uint32_t sourceIP) {
+	if (size < BEACON_HEADER_SIZE || memcmp(data, BEACON_MAGIC, 3) != 0 || data[3] != BEACON_VERSION)
+		return;
+
+	const char* readPtr = data + 4;
+	uint32_t domainHash;
+	uint64_t senderId;
+	uint8_t count;
+	readPtr = Message::read(readPtr, &domainHash);
+	readPtr = Message::read(readPtr, &senderId);
+	readPtr = Message::read(readPtr, &count);
+
+	if (domainHash != _domainHash || senderId == _senderId)
+		return;
+	if (size < BEACON_HEADER_SIZE + count * BEACON_RECORD_SIZE) {
+		UM_LOG_WARN("Ignoring truncated beacon with %d records in %lu bytes", count, (unsigned long)size);
+		return;
+	}
+
+	uint64_t now = Thread::getTimeStampMs();
+	RScopeLock lock(_mutex);
+
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t flags;
+		std::string uuid;
+		uint32_t ip;
+		uint16_t port;
+		uint8_t transport;
+		uint32_t version;
+		readPtr = Message::read(readPtr, &flags);
+		readPtr = UUID::readBinToHex(readPtr, uuid);
+		readPtr = Message::read(readPtr, &ip);
+		readPtr = Message::read(readPtr, &port);
+		readPtr += 2; // publisher port, nodes tell each other about their publishers when connected
+		readPtr = Message::read(readPtr, &transport);
+		readPtr = Message::read(readPtr, &version);
+
+		std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.find(uuid);
+		if (adIter != _remoteAds.end()) {
+			if (!(flags & BEACON_BYE) && adIter->second.version == version) {
+				adIter->second.lastSeen = now;
+				continue;
+			}
+
+			// gone or advertised anew with another address
+			UM_LOG_INFO("Beacon reported %s of %s in %s - notifying nodes",
+			            (flags & BEACON_BYE ? "removal" : "change"), adIter->second.endPoint.getAddress().c_str(), _domain.c_str());
+			for (std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin(); queryIter != _queries.end(); queryIter++) {
+				(*queryIter)->remove(adIter->second.endPoint, toStr(this));
+			}
+			_remoteAds.erase(adIter);
+		}
+
+		if (flags & BEACON_BYE)
+			continue;
+
+		if (ip == 0)
+			ip = sourceIP;
+
+		EndPoint endPoint(SharedPtr<EndPointImpl>(new EndPointImpl()));
+		endPoint.getImpl()->setDomain(_domain);
+		endPoint.getImpl()->setIP(toStr(ip >> 24) + "." + toStr((ip >> 16) & 0xff) + "." + toStr((ip >> 8) & 0xff) + "." + toStr(ip & 0xff));
+		endPoint.getImpl()->setPort(port);
+		endPoint.getImpl()->setTransport(transport == 1 ? "udp" : "tcp");
+		endPoint.getImpl()->setUUID(uuid);
+		endPoint.getImpl()->setRemote(true);
+		endPoint.getImpl()->setLastSeen(now);
+
+		RemoteAd& remoteAd = _remoteAds[uuid];
+		remoteAd.endPoint = endPoint;
+		remoteAd.version = version;
+		remoteAd.lastSeen = now;
+
+		UM_LOG_INFO("Beacon reported new node %s in %s - notifying nodes", endPoint.getAddress().c_str(), _domain.c_str());
+		for (std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin(); queryIter != _queries.end(); queryIter++) {
+			(*queryIter)->add(endPoint, toStr(this));
+		}
+	}
+}
+
+/**
+ * Remove endpoints we have not heard of for some beacon intervals.
+ */
+void BroadcastDiscovery::expire(uint64_t now) {
+	RScopeLock lock(_mutex);
+	uint64_t maxAge = (uint64_t)_interval * _missedBeacons + _interval / 4;
+
+	std::map<std::string, RemoteAd>::iterator adIter = _remoteAds.begin();
+	while (adIter != _remoteAds.end()) {
+		if (now - adIter->second.lastSeen <= maxAge) {
+			adIter++;
+			continue;
+		}
+		UM_LOG_INFO("Missed beacons of %s in %s - notifying nodes", adIter->second.endPoint.getAddress().c_str(), _domain.c_str());
+		for (std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin(); queryIter != _queries.end(); queryIter++) {
+			(*queryIter)->remove(adIter->second.endPoint, toStr(this));
+		}
+		_remoteAds.erase(adIter++);
+	}
 }
 
 void BroadcastDiscovery::run() {
-	// your very own thread!
+	char buffer[BEACON_HEADER_SIZE + 256 * BEACON_RECORD_SIZE];
+
+	while(isStarted()) {
+		uint64_t now = Thread::getTimeStampMs();
+		uint64_t wakeUp;
+
+		std::list<LocalAd> ads;
+		{
+			RScopeLock lock(_mutex);
+			if (now >= _nextBeacon) {
+				if (!_isSuspended) {
+					for (std::map<EndPoint, LocalAd>::iterator adIter = _localAds.begin(); adIter != _localAds.end(); adIter++) {
+						ads.push_back(adIter->second);
+					}
+				}
+				if (_fastBeacons > 0) {
+					_fastBeacons--;
+					_nextBeacon = now + jitter(_interval / 4);
+				} else {
+					_nextBeacon = now + jitter(_interval);
+				}
+			}
+			wakeUp = (_nextBeacon < _nextExpiry ? _nextBeacon : _nextExpiry);
+		}
+		if (ads.size() > 0)
+			sendBeacons(ads, 0);
+
+		if (now >= _nextExpiry) {
+			expire(now);
+			_nextExpiry = now + _interval / 2;
+			continue;
+		}
+
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET(_socket, &readFds);
+		uint64_t timeoutMs = (wakeUp > now ? wakeUp - now : 0);
+		struct timeval timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+		int ready = select(_socket + 1, &readFds, NULL, NULL, &timeout);
+		if (ready < 0) {
+			if (SOCKET_ERRNO != EINTR)
+				UM_LOG_WARN("select: %s", strerror(SOCKET_ERRNO));
+			continue;
+		}
+		if (ready == 0 || !FD_ISSET(_socket, &readFds))
+			continue;
+
+		sockaddr_in source;
+		socklen_t sourceLength = sizeof(source);
+		int size = recvfrom(_socket, buffer, sizeof(buffer), 0, (sockaddr*)&source, &sourceLength);
+		if (size < 0) {
+			UM_LOG_WARN("recvfrom: %s", strerror(SOCKET_ERRNO));
+			continue;
+		}
+		if (!isStarted())
+			break;
+		received(buffer, size, ntohl(source.sin_addr.s_addr));
+	}
 }
 
 }
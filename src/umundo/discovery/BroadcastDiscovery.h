@@ -5,71 +5,35 @@
 #include "umundo/thread/Thread.h"
 #include "umundo/discovery/Discovery.h"
 
-#if (defined (__UNIX__) || defined (__APPLE__))
+#if (defined (_WIN32))
+#include <winsock2.h>
+#else
 #include <netinet/in.h>
 #include <netdb.h>
 #endif
 
-#if (defined (_WIN32))
-#include <winsock2.h>
-//#include <ws2tcpip.h>            //  getnameinfo ()
-//#include <iphlpapi.h>            //  GetAdaptersAddresses ()
-//#include <sys/types.h>
-#endif
+#define BCAST_GROUP "239.192.43.5"
+#define BCAST_PORT 43005
+#define BCAST_INTERVAL_MS 1000
+#define BCAST_MISSED_BEACONS 3
 
 namespace umundo {
 
-class NodeQuery;
-
-class BroadcastDiscoveryOptions : public Options {
-public:
-	enum Protocol {
-		TCP, UDP
-	};
-
-	BroadcastDiscoveryOptions() {
-		options["broadcast.domain"] = "local.";
-		options["broadcast.protocol"] = "tcp";
-		options["broadcast.serviceType"] = "umundo";
-	}
-
-	std::string getType() {
-		return "broadcast";
-	}
-
-	void setDomain(const std::string& domain) {
-		options["broadcast.domain"] = domain;
-	}
-
-	void setProtocol(Protocol protocol) {
-		switch (protocol) {
-		case UDP:
-			options["broadcast.protocol"] = "udp";
-			break;
-		case TCP:
-			options["broadcast.protocol"] = "tcp";
-			break;
-
-		default:
-			break;
-		}
-	}
-
-	void setServiceType(const std::string& serviceType) {
-		options["broadcast.serviceType"] = serviceType;
-	}
-
-};
-
 /**
- * Concrete discovery implementor for Broadcast (bridge pattern).
+ * Concrete discovery implementor for UDP multicast beacons (bridge pattern).
+ *
+ * Every instance sends a compact binary beacon for each of its advertised endpoints
+ * to a multicast group and reports the endpoints in beacons from other instances of
+ * the same domain, including those in the same process. There is no daemon involved.
  *
- * This class is a concrete implementor (in the bridge pattern sense) for the Discovery subsystem.
+ * Beacons are sent with a jittered interval, a few times in quick succession after
+ * an endpoint was advertised. Endpoints are removed when their beacons were missed
+ * for some intervals or right away when they were unadvertised.
  */
 class UMUNDO_API BroadcastDiscovery : public DiscoveryImpl, public Thread {
 public:
+	BroadcastDiscovery();
 	virtual ~BroadcastDiscovery();
-	static SharedPtr<BroadcastDiscovery> getInstance();  ///< Return the singleton instance.
 
 	SharedPtr<Implementation> create();
 	void init(const Options*);
@@ -88,26 +52,68 @@ public:
 
 	void run();
 
-protected:
-	BroadcastDiscovery();
-	static SharedPtr<BroadcastDiscovery> _instance;  ///< The singleton instance.
+	/// beacon layout: magic and version, domain hash, sender id, record count and endpoint records
+	enum BeaconFlags {
+		BEACON_BYE = 0x01 ///< the endpoint was unadvertised
+	};
 
-private:
-#if 0
-	void static setupUDPSocket();
+	static const size_t BEACON_HEADER_SIZE = 4 + 4 + 8 + 1;
+	static const size_t BEACON_RECORD_SIZE = 1 + 16 + 4 + 2 + 2 + 1 + 4;
+	static const size_t BEACON_MAX_RECORDS = 40;
 
-#if !defined (_WIN32)
-#define SOCKET         int
-#define closesocket    close
-#define INVALID_SOCKET -1
-#define SOCKET_ERROR   -1
-#endif
+protected:
+	struct LocalAd {
+		std::string uuid; ///< endpoint uuid or one made up for it
+		uint32_t ip; ///< advertised ipv4 address, 0 to use the senders
+		uint16_t port;
+		uint16_t pubPort;
+		uint8_t transport;
+		uint32_t version; ///< state version, changes whenever the endpoint does
+	};
+
+	struct RemoteAd {
+		EndPoint endPoint;
+		uint32_t version;
+		uint64_t lastSeen;
+	};
 
-	static SOCKET udpSocket;
-	static sockaddr_in bCastAddress;
-	static char hostName[NI_MAXHOST];
-	static RMutex globalMutex;
+	void advertise(const EndPoint& node, uint16_t pubPort);
+	void setupSocket();
+	void sendBeacons(const std::list<LocalAd>& ads, uint8_t flags);
+	void received(const char* data, size_t size, uint32_t sourceIP);
+	void expire(uint64_t now);
+	uint32_t jitter(uint32_t intervalMs);
+
+	static uint32_t hashDomain(const std::string& domain);
+
+	std::string _domain;
+	uint32_t _domainHash;
+	std::string _group;
+	std::string _interface;
+	uint16_t _port;
+	uint8_t _ttl;
+	uint32_t _interval;
+	uint32_t _missedBeacons;
+	uint64_t _senderId; ///< tells our own beacons apart
+	uint64_t _random;
+	uint32_t _stateVersion;
+
+	uint64_t _nextBeacon;
+	uint64_t _nextExpiry;
+	uint32_t _fastBeacons; ///< beacons still to send in quick succession
+	bool _isSuspended;
+
+	std::map<EndPoint, LocalAd> _localAds;
+	std::map<std::string, RemoteAd> _remoteAds; // by uuid
+	std::set<ResultSet<ENDPOINT_RS_TYPE>*> _queries;
+	RMutex _mutex;
+
+#if defined (_WIN32)
+	SOCKET _socket;
+#else
+	int _socket;
 #endif
+	sockaddr_in _groupAddress;
 
 	friend class Factory;
 };
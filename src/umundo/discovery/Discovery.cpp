@@ -20,6 +20,7 @@
 #include "umundo/discovery/Discovery.h"
 #include "umundo/discovery/MDNSDiscovery.h"
 #include "umundo/discovery/BroadcastDiscovery.h"
+#include "umundo/discovery/StaticDiscovery.h"
 
 #include "umundo/Factory.h"
 #include "umundo/connection/Node.h"
@@ -33,6 +34,10 @@ Discovery::Discovery(DiscoveryType type, const std::string domain) {
 		config = new DiscoveryConfigBCast();
 		break;
 	}
+	case STATIC: {
+		config = new DiscoveryConfigStatic();
+		break;
+	}
 	default:
 		config = new DiscoveryConfigMDNS();
 		break;
@@ -64,6 +69,9 @@ void Discovery::init(DiscoveryConfig* config) {
 	case BROADCAST:
 		_impl = StaticPtrCast<DiscoveryImpl>(Factory::create("discovery.broadcast"));
 		break;
+	case STATIC:
+		_impl = StaticPtrCast<DiscoveryImpl>(Factory::create("discovery.static"));
+		break;
 	default:
 		break;
 	}
@@ -74,7 +74,8 @@ public:
 
 	enum DiscoveryType {
 		MDNS,
-		BROADCAST
+		BROADCAST,
+		STATIC
 	};
 
 	/**
@@ -211,6 +212,68 @@ class UMUNDO_API DiscoveryConfigBCast : public DiscoveryConfig {
 public:
 	DiscoveryConfigBCast() : DiscoveryConfig() {
 		_type = Discovery::BROADCAST;
+		options["bcast.domain"] = "local.";
+	}
+
+	/// multicast group and port to send and receive beacons on
+	void setGroup(const std::string& group, uint16_t port) {
+		options["bcast.group"] = group;
+		options["bcast.port"] = toStr(port);
+	}
+
+	/// address of the interface to send beacons from, e.g. 127.0.0.1 for this host only
+	void setInterface(const std::string& ip) {
+		options["bcast.interface"] = ip;
+	}
+
+	/// time to live of beacons, 1 keeps them in the local network
+	void setTTL(uint8_t ttl) {
+		options["bcast.ttl"] = toStr((uint16_t)ttl);
+	}
+
+	/**
+	 * Send beacons every intervalMs on average and remove endpoints after missing
+	 * as many of their beacons.
+	 *
+	 * Intervals are randomized by a quarter in either direction, endpoints that are
+	 * unadvertised are removed right away with a final beacon.
+	 */
+	void setBeaconInterval(uint32_t intervalMs, uint32_t missedBeacons = 3) {
+		options["bcast.interval"] = toStr(intervalMs);
+		options["bcast.missedBeacons"] = toStr(missedBeacons);
+	}
+
+protected:
+	friend class Discovery;
+};
+
+/**
+ * Peers known in advance, added nodes connect to them right away.
+ *
+ * Peers are addresses like tcp://10.0.0.1:4242, given here, in a file with one
+ * address per line or in the UMUNDO_PEERS environment variable, separated by
+ * commas or whitespace. UMUNDO_PEERS_FILE names another file. Nodes with gossip
+ * enabled will find the peers of these seeds as well, see NodeConfig::enableGossip.
+ */
+class UMUNDO_API DiscoveryConfigStatic : public DiscoveryConfig {
+public:
+	DiscoveryConfigStatic() : DiscoveryConfig() {
+		_type = Discovery::STATIC;
+	}
+
+	void addPeer(const std::string& address) {
+		if (options["static.peers"].size() > 0)
+			options["static.peers"] += ",";
+		options["static.peers"] += address;
+	}
+
+	void setPeerFile(const std::string& path) {
+		options["static.file"] = path;
+	}
+
+	/// whether to add the peers from UMUNDO_PEERS and UMUNDO_PEERS_FILE, enabled by default
+	void readEnvironment(bool enable) {
+		options["static.env"] = toStr(enable);
 	}
 
 protected:
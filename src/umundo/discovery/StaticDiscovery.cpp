@@ -0,0 +1,201 @@
+/**
+ *  @file
+ *  @brief      Discovery of peers known in advance.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#include "umundo/discovery/StaticDiscovery.h"
+
+#include <fstream>
+#include <stdlib.h> // getenv
+
+namespace umundo {
+
+StaticDiscovery::StaticDiscovery() {
+}
+
+StaticDiscovery::~StaticDiscovery() {
+	// unreport all peers from all queries
+	std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin();
+	while(queryIter != _queries.end()) {
+		unbrowse(*queryIter++);
+	}
+}
+
+SharedPtr<Implementation> StaticDiscovery::create() {
+	return SharedPtr<Implementation>(new StaticDiscovery());
+}
+
+void StaticDiscovery::init(const Options* config) {
+	bool readEnvironment = true;
+
+	if (config != NULL) {
+		std::map<std::string, std::string> options = config->getKVPs();
+		if (options["static.peers"].length() > 0)
+			addPeers(options["static.peers"]);
+		if (options["static.file"].length() > 0)
+			addPeerFile(options["static.file"]);
+		if (options["static.env"].length() > 0)
+			readEnvironment = strTo<bool>(options["static.env"]);
+	}
+
+	if (readEnvironment) {
+		if (getenv("UMUNDO_PEERS") != NULL)
+			addPeers(getenv("UMUNDO_PEERS"));
+		if (getenv("UMUNDO_PEERS_FILE") != NULL)
+			addPeerFile(getenv("UMUNDO_PEERS_FILE"));
+	}
+
+	UM_LOG_INFO("Static discovery with %lu peers", (unsigned long)_peers.size());
+}
+
+void StaticDiscovery::parsePeers(const std::string& peers, std::list<std::string>& addresses) {
+	std::string address;
+	bool isComment = false;
+	for (size_t i = 0; i <= peers.size(); i++) {
+		char c = (i < peers.size() ? peers[i] : '\n');
+		if (c == '\n' || c == '\r') {
+			isComment = false;
+		} else if (c == '#') {
+			isComment = true;
+		}
+
+		if (isComment || c == '#' || c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			if (address.size() > 0) {
+				// the transport is optional
+				if (address.find("://") == std::string::npos)
+					address = "tcp://" + address;
+				addresses.push_back(address);
+			}
+			address.clear();
+			continue;
+		}
+		address += c;
+	}
+}
+
+void StaticDiscovery::addPeers(const std::string& peers) {
+	std::list<std::string> addresses;
+	parsePeers(peers, addresses);
+
+	RScopeLock lock(_mutex);
+	for (std::list<std::string>::iterator addrIter = addresses.begin(); addrIter != addresses.end(); addrIter++) {
+		EndPoint endPoint(*addrIter);
+		if (!endPoint) // error was logged
+			continue;
+		endPoint.getImpl()->setRemote(true);
+		_peers.insert(endPoint);
+	}
+}
+
+void StaticDiscovery::addPeerFile(const std::string& path) {
+	std::ifstream file(path.c_str());
+	if (!file) {
+		UM_LOG_ERR("Cannot read peers from '%s'", path.c_str());
+		return;
+	}
+	std::stringstream content;
+	content << file.rdbuf();
+	addPeers(content.str());
+}
+
+void StaticDiscovery::suspend() {
+}
+
+void StaticDiscovery::resume() {
+}
+
+void StaticDiscovery::advertise(const EndPoint& node) {
+	RScopeLock lock(_mutex);
+	if (_localEndPoints.find(node) != _localEndPoints.end()) {
+		UM_LOG_WARN("Already advertising endpoint");
+		return;
+	}
+	_localEndPoints.insert(node);
+
+	for (std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin(); queryIter != _queries.end(); queryIter++) {
+		(*queryIter)->add(node, toStr(this));
+	}
+}
+
+void StaticDiscovery::add(Node& node) {
+	advertise(node);
+	browse(node.getImpl().get());
+}
+
+void StaticDiscovery::unadvertise(const EndPoint& node) {
+	RScopeLock lock(_mutex);
+	if (_localEndPoints.find(node) == _localEndPoints.end()) {
+		UM_LOG_WARN("Not unadvertising %s://%s:%d - node unknown",
+		            node.getTransport().c_str(),
+		            node.getIP().c_str(),
+		            node.getPort());
+		return;
+	}
+	_localEndPoints.erase(node);
+
+	for (std::set<ResultSet<ENDPOINT_RS_TYPE>*>::iterator queryIter = _queries.begin(); queryIter != _queries.end(); queryIter++) {
+		(*queryIter)->remove(node, toStr(this));
+	}
+}
+
+void StaticDiscovery::remove(Node& node) {
+	unbrowse(node.getImpl().get());
+	unadvertise(node);
+}
+
+void StaticDiscovery::browse(ResultSet<ENDPOINT_RS_TYPE>* query) {
+	RScopeLock lock(_mutex);
+
+	if (_queries.find(query) != _queries.end()) {
+		UM_LOG_WARN("Query %p already added for browsing - ignored", query);
+		return;
+	}
+	_queries.insert(query);
+
+	// no need to wait for anything
+	for (std::set<EndPoint>::iterator epIter = _peers.begin(); epIter != _peers.end(); epIter++) {
+		query->add(*epIter, toStr(this));
+	}
+	for (std::set<EndPoint>::iterator epIter = _localEndPoints.begin(); epIter != _localEndPoints.end(); epIter++) {
+		query->add(*epIter, toStr(this));
+	}
+}
+
+void StaticDiscovery::unbrowse(ResultSet<ENDPOINT_RS_TYPE>* query) {
+	RScopeLock lock(_mutex);
+
+	if (_queries.find(query) == _queries.end()) {
+		UM_LOG_WARN("No such query %p to unbrowse - ignored", query);
+		return;
+	}
+
+	for (std::set<EndPoint>::iterator epIter = _peers.begin(); epIter != _peers.end(); epIter++) {
+		query->remove(*epIter, toStr(this));
+	}
+	for (std::set<EndPoint>::iterator epIter = _localEndPoints.begin(); epIter != _localEndPoints.end(); epIter++) {
+		query->remove(*epIter, toStr(this));
+	}
+	_queries.erase(query);
+}
+
+std::vector<EndPoint> StaticDiscovery::list() {
+	RScopeLock lock(_mutex);
+	return std::vector<EndPoint>(_peers.begin(), _peers.end());
+}
+
+}
@@ -0,0 +1,71 @@
+/**
+ *  @file
+ *  @brief      Discovery of peers known in advance.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef STATICDISCOVERY_H_K7D2QW4N
+#define STATICDISCOVERY_H_K7D2QW4N
+
+#include "umundo/discovery/Discovery.h"
+
+namespace umundo {
+
+/**
+ * Concrete discovery implementor for configured peers (bridge pattern).
+ *
+ * There is nothing to wait for, every query is told about the configured peers
+ * as soon as it browses. Endpoints advertised at the same instance are reported
+ * as well, so nodes added to it find each other.
+ */
+class UMUNDO_API StaticDiscovery : public DiscoveryImpl {
+public:
+	StaticDiscovery();
+	virtual ~StaticDiscovery();
+
+	SharedPtr<Implementation> create();
+	void init(const Options*);
+	void suspend();
+	void resume();
+
+	void advertise(const EndPoint& node);
+	void add(Node& node);
+	void unadvertise(const EndPoint& node);
+	void remove(Node& node);
+
+	void browse(ResultSet<ENDPOINT_RS_TYPE>* query);
+	void unbrowse(ResultSet<ENDPOINT_RS_TYPE>* query);
+
+	std::vector<EndPoint> list();
+
+	/// add addresses separated by commas or whitespace, '#' comments out the rest of a line
+	static void parsePeers(const std::string& peers, std::list<std::string>& addresses);
+
+protected:
+	void addPeers(const std::string& peers);
+	void addPeerFile(const std::string& path);
+
+	std::set<EndPoint> _peers; ///< configured peers
+	std::set<EndPoint> _localEndPoints; ///< advertised at this instance
+	std::set<ResultSet<ENDPOINT_RS_TYPE>*> _queries;
+
+	RMutex _mutex;
+};
+
+}
+
+#endif /* end of include guard: STATICDISCOVERY_H_K7D2QW4N */
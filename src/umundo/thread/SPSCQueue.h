@@ -0,0 +1,135 @@
+/**
+ *  @file
+ *  @brief      Bounded queue between a single producer and a single consumer thread.
+ *  @author     2016 Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *  @copyright  Simplified BSD
+ *
+ *  @cond
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ *  @endcond
+ */
+
+#ifndef SPSCQUEUE_H_R4T7NWZK
+#define SPSCQUEUE_H_R4T7NWZK
+
+#include "umundo/Common.h"
+#include "umundo/thread/Thread.h"
+
+#ifndef WITHOUT_CXX11
+#include <atomic>
+#endif
+
+namespace umundo {
+
+/**
+ * Ring of fixed capacity, one thread pushes and one thread pops.
+ *
+ * Neither side ever waits for the other, push fails when the ring is full and
+ * pop when it is empty. Without C++11 atomics, both sides take a mutex.
+ */
+template<typename T> class SPSCQueue {
+public:
+	/// capacity is rounded up to a power of two
+	SPSCQueue(size_t capacity) : _head(0), _tail(0) {
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		_slots.resize(size);
+		_mask = size - 1;
+	}
+
+	/// from the producer only
+	bool push(const T& value) {
+#ifndef WITHOUT_CXX11
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) > _mask)
+			return false;
+		_slots[tail & _mask] = value;
+		_tail.store(tail + 1, std::memory_order_seq_cst); // ordered before the producer checks for sleeping consumers
+		return true;
+#else
+		ScopeLock lock(_mutex);
+		if (_tail - _head > _mask)
+			return false;
+		_slots[_tail & _mask] = value;
+		_tail++;
+		return true;
+#endif
+	}
+
+	/// from the consumer only
+	bool pop(T& value) {
+#ifndef WITHOUT_CXX11
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+		value = _slots[head & _mask];
+		_slots[head & _mask] = T();
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+#else
+		ScopeLock lock(_mutex);
+		if (_head == _tail)
+			return false;
+		value = _slots[_head & _mask];
+		_slots[_head & _mask] = T();
+		_head++;
+		return true;
+#endif
+	}
+
+	bool empty() {
+		return size() == 0;
+	}
+
+	/// exact from either side, an estimate from any other thread
+	size_t size() {
+#ifndef WITHOUT_CXX11
+		size_t head = _head.load(std::memory_order_seq_cst);
+		return _tail.load(std::memory_order_seq_cst) - head;
+#else
+		ScopeLock lock(_mutex);
+		return _tail - _head;
+#endif
+	}
+
+	size_t capacity() const {
+		return _mask + 1;
+	}
+
+protected:
+	std::vector<T> _slots;
+	size_t _mask;
+
+#ifndef WITHOUT_CXX11
+	// on cache lines of their own, the producer only writes the tail and the consumer the head
+	char _padHead[64];
+	std::atomic<size_t> _head;
+	char _padTail[64];
+	std::atomic<size_t> _tail;
+	char _padEnd[64];
+#else
+	size_t _head;
+	size_t _tail;
+	Mutex _mutex;
+#endif
+
+private:
+	SPSCQueue(const SPSCQueue& other) {}
+	SPSCQueue& operator=(const SPSCQueue& other) {
+		return *this;
+	}
+};
+
+}
+
+#endif /* end of include guard: SPSCQUEUE_H_R4T7NWZK */
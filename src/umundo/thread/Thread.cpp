@@ -33,6 +33,10 @@
 #include <windows.h> // LARGE_INTEGER
 #endif
 
+#ifndef WITHOUT_CXX11
+#include <chrono>
+#endif
+
 namespace umundo {
 
 Thread::Thread() {
@@ -144,6 +148,31 @@ uint64_t Thread::getTimeStampMs() {
 	return time;
 }
 
+uint64_t Thread::getTimeStampUs() {
+	uint64_t time = 0;
+#ifdef WIN32
+	FILETIME tv;
+	GetSystemTimeAsFileTime(&tv);
+	time = (((uint64_t) tv.dwHighDateTime) << 32) + tv.dwLowDateTime;
+	time /= 10;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	time += tv.tv_sec;
+	time *= 1000000LU;
+	time += tv.tv_usec;
+#endif
+	return time;
+}
+
+uint64_t Thread::getMonotonicTimeStampUs() {
+#ifndef WITHOUT_CXX11
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+	return getTimeStampUs();
+#endif
+}
+
 //Monitor::Monitor(const Monitor& other) {
 //	UM_LOG_ERR("CopyConstructor!");
 //}
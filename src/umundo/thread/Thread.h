@@ -142,6 +142,8 @@ public:
 	static void sleepUs(uint32_t us);
 	static unsigned long int getThreadId(); ///< integer unique to the current thread
 	static uint64_t getTimeStampMs(); ///< timestamp in ms since 01.01.1970
+	static uint64_t getTimeStampUs(); ///< timestamp in us since 01.01.1970
+	static uint64_t getMonotonicTimeStampUs(); ///< timestamp in us that never jumps, only to compare on this host
 
 private:
     bool _isStarted;
@@ -0,0 +1,181 @@
+#include "umundo.h"
+#include "umundo/connection/ChannelIndex.h"
+#include <iostream>
+#include <algorithm>
+#include <sstream>
+
+using namespace umundo;
+
+// lets us look at the tree to see whether nodes got split and merged
+class TestIndex : public ChannelIndex<int> {
+public:
+	size_t nrNodes() const {
+		return countNodes(&_root);
+	}
+
+	// labels of all nodes below the root in depth first order
+	std::string labels() const {
+		std::string all;
+		appendLabels(&_root, all);
+		return all;
+	}
+
+protected:
+	static size_t countNodes(const Node* node) {
+		size_t count = 1;
+		for (std::map<char, SharedPtr<Node> >::const_iterator childIter = node->children.begin(); childIter != node->children.end(); childIter++)
+			count += countNodes(childIter->second.get());
+		return count;
+	}
+
+	static void appendLabels(const Node* node, std::string& all) {
+		for (std::map<char, SharedPtr<Node> >::const_iterator childIter = node->children.begin(); childIter != node->children.end(); childIter++) {
+			all += "[" + childIter->second->label + "]";
+			appendLabels(childIter->second.get(), all);
+		}
+	}
+};
+
+// values from a space separated list, ascending as the lookups below sort them
+static std::vector<int> ints(const std::string& list) {
+	std::vector<int> values;
+	std::stringstream ss(list);
+	int value;
+	while(ss >> value)
+		values.push_back(value);
+	return values;
+}
+
+static std::vector<int> prefixesOf(const TestIndex& index, const std::string& channel) {
+	std::vector<int> found;
+	index.findPrefixesOf(channel, found);
+	std::sort(found.begin(), found.end());
+	return found;
+}
+
+static std::vector<int> startingWith(const TestIndex& index, const std::string& prefix) {
+	std::vector<int> found;
+	index.findStartingWith(prefix, found);
+	std::sort(found.begin(), found.end());
+	return found;
+}
+
+bool testInsertAndErase() {
+	TestIndex index;
+	index.insert("foo", "a", 1);
+	index.insert("foo", "b", 2);
+	index.insert("bar", "c", 3);
+	assert(index.size() == 3);
+
+	// replacing an entry does not add one
+	index.insert("foo", "a", 4);
+	assert(index.size() == 3);
+	assert(prefixesOf(index, "foo") == ints("2 4"));
+
+	// entries are erased by channel and id
+	assert(!index.erase("foo", "c"));
+	assert(!index.erase("fo", "a"));
+	assert(!index.erase("baz", "c"));
+	assert(index.erase("foo", "a"));
+	assert(!index.erase("foo", "a"));
+	assert(index.size() == 2);
+	assert(prefixesOf(index, "foo") == ints("2"));
+
+	assert(index.erase("foo", "b"));
+	assert(index.erase("bar", "c"));
+	assert(index.size() == 0);
+	assert(index.nrNodes() == 1);
+	assert(prefixesOf(index, "foo").empty());
+	assert(startingWith(index, "").empty());
+	return true;
+}
+
+bool testSplitAndMerge() {
+	TestIndex index;
+	index.insert("foobar", "a", 1);
+	assert(index.labels() == "[foobar]");
+
+	// a shorter channel splits the label
+	index.insert("foo", "b", 2);
+	assert(index.labels() == "[foo][bar]");
+
+	// diverging within the label splits it as well
+	index.insert("fox", "c", 3);
+	assert(index.labels() == "[fo][o][bar][x]");
+	assert(index.nrNodes() == 5);
+
+	// removing a leaf leaves the split node with one child, they are merged again
+	assert(index.erase("fox", "c"));
+	assert(index.labels() == "[foo][bar]");
+
+	// an inner node without entries is merged with its only child
+	assert(index.erase("foo", "b"));
+	assert(index.labels() == "[foobar]");
+	assert(prefixesOf(index, "foobar") == ints("1"));
+	assert(startingWith(index, "foo") == ints("1"));
+
+	assert(index.erase("foobar", "a"));
+	assert(index.labels() == "");
+	return true;
+}
+
+bool testPrefixLookups() {
+	TestIndex index;
+	index.insert("", "any", 0);
+	index.insert("a", "a", 1);
+	index.insert("ab", "ab", 2);
+	index.insert("abc", "abc", 3);
+	index.insert("abd", "abd", 4);
+	index.insert("b", "b", 5);
+
+	// subscribers for a publisher on a channel are all on the path to it
+	assert(prefixesOf(index, "abc") == ints("0 1 2 3"));
+	assert(prefixesOf(index, "abcdef") == ints("0 1 2 3"));
+	assert(prefixesOf(index, "ab") == ints("0 1 2"));
+	assert(prefixesOf(index, "abx") == ints("0 1 2"));
+	assert(prefixesOf(index, "c") == ints("0"));
+
+	// publishers for a subscriber are all below its channel, even if it ends within a label
+	assert(startingWith(index, "ab") == ints("2 3 4"));
+	assert(startingWith(index, "abd") == ints("4"));
+	assert(startingWith(index, "abdx").empty());
+	assert(startingWith(index, "c").empty());
+
+	TestIndex longer;
+	longer.insert("channel", "x", 1);
+	longer.insert("channels", "y", 2);
+	assert(startingWith(longer, "chan") == ints("1 2"));
+	assert(startingWith(longer, "chanx").empty());
+	assert(prefixesOf(longer, "chan").empty());
+	assert(prefixesOf(longer, "channels") == ints("1 2"));
+	return true;
+}
+
+bool testEmptyPrefix() {
+	TestIndex index;
+	index.insert("foo", "a", 1);
+	index.insert("bar", "b", 2);
+	index.insert("", "c", 3);
+
+	// the empty prefix matches every channel, an empty channel only the empty prefix
+	assert(startingWith(index, "") == ints("1 2 3"));
+	assert(prefixesOf(index, "") == ints("3"));
+	assert(prefixesOf(index, "bar") == ints("2 3"));
+
+	assert(index.erase("", "c"));
+	assert(startingWith(index, "") == ints("1 2"));
+	assert(prefixesOf(index, "bar") == ints("2"));
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if(!testInsertAndErase())
+		return EXIT_FAILURE;
+	if(!testSplitAndMerge())
+		return EXIT_FAILURE;
+	if(!testPrefixLookups())
+		return EXIT_FAILURE;
+	if(!testEmptyPrefix())
+		return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -3,6 +3,8 @@
 #include "umundo.h"
 #include "umundo/discovery/MDNSDiscovery.h"
 #include "umundo/discovery/BroadcastDiscovery.h"
+#include "umundo/discovery/StaticDiscovery.h"
+#include "umundo/config.h"
 #include <iostream>
 #include <stdio.h>
 
@@ -367,10 +369,235 @@ bool testPubSubConnections() {
 	return true;
 }
 
-//bool testBroadCast() {
-//	Discovery disc(Discovery::BROADCAST);
-//	return true;
-//}
+class CountingResultSet : public ResultSet<ENDPOINT_RS_TYPE> {
+public:
+	void added(ENDPOINT_RS_TYPE node) {
+		RScopeLock lock(_mutex);
+		_endPoints.insert(node);
+	}
+	void removed(ENDPOINT_RS_TYPE node) {
+		RScopeLock lock(_mutex);
+		_endPoints.erase(node);
+	}
+	void changed(ENDPOINT_RS_TYPE node, uint64_t what) {
+	}
+	size_t size() {
+		RScopeLock lock(_mutex);
+		return _endPoints.size();
+	}
+
+	RMutex _mutex;
+	std::set<EndPoint> _endPoints;
+};
+
+bool testBroadcastDiscovery() {
+	// many nodes in one process, find each other over loopback multicast
+	int nrNodes = 100;
+
+	DiscoveryConfigBCast bcastConfig;
+	bcastConfig.setDomain("convergence.");
+	bcastConfig.setInterface("127.0.0.1");
+	bcastConfig.setBeaconInterval(500);
+
+	std::vector<Discovery> discoveries;
+	std::vector<CountingResultSet*> resultSets;
+
+	uint64_t start = Thread::getTimeStampMs();
+	for (int i = 0; i < nrNodes; i++) {
+		Discovery disc(&bcastConfig);
+		CountingResultSet* rs = new CountingResultSet();
+		disc.browse(rs);
+		disc.advertise(EndPoint("tcp://127.0.0.1:" + toStr(20000 + i)));
+		discoveries.push_back(disc);
+		resultSets.push_back(rs);
+	}
+
+	int retries = 200;
+	for (int i = 0; i < nrNodes; i++) {
+		while(resultSets[i]->size() != nrNodes - 1) {
+			Thread::sleepMs(10);
+			if (retries-- == 0)
+				assert(false);
+		}
+	}
+	std::cout << nrNodes << " nodes converged in " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+
+	// unadvertised endpoints are gone without waiting for missed beacons
+	start = Thread::getTimeStampMs();
+	for (int i = 0; i < nrNodes / 2; i++) {
+		discoveries[i].unadvertise(EndPoint("tcp://127.0.0.1:" + toStr(20000 + i)));
+	}
+	retries = 200;
+	while(resultSets[nrNodes - 1]->size() != nrNodes - nrNodes / 2 - 1) {
+		Thread::sleepMs(10);
+		if (retries-- == 0)
+			assert(false);
+	}
+	std::cout << nrNodes / 2 << " unadvertised endpoints removed in " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+
+	for (int i = 0; i < nrNodes; i++) {
+		discoveries[i].unbrowse(resultSets[i]);
+		assert(resultSets[i]->size() == 0);
+		delete resultSets[i];
+	}
+	discoveries.clear();
+	return true;
+}
+
+class FirstMessageReceiver : public Receiver {
+public:
+	FirstMessageReceiver() : receivedAt(0) {}
+	void receive(Message* msg) {
+		RScopeLock lock(mutex);
+		if (receivedAt == 0)
+			receivedAt = Thread::getTimeStampMs();
+		monitor.signal();
+	}
+	uint64_t receivedAt;
+};
+
+bool testStaticDiscovery() {
+	std::list<std::string> addresses;
+	StaticDiscovery::parsePeers("tcp://10.0.0.1:4242, 10.0.0.2:4242\n# all commented tcp://10.0.0.3:4242\n\ttcp://10.0.0.4:4242 # here as well", addresses);
+	assert(addresses.size() == 3);
+	assert(addresses.front() == "tcp://10.0.0.1:4242");
+	assert(*(++addresses.begin()) == "tcp://10.0.0.2:4242");
+	assert(addresses.back() == "tcp://10.0.0.4:4242");
+
+	// every node only knows the seed and gossip tells them about the others
+	int nrNodes = 8;
+	uint64_t start = Thread::getTimeStampMs();
+
+	NodeConfig seedConfig("tcp://127.0.0.1:44770");
+	seedConfig.enableGossip(true, 500);
+	Node seed(&seedConfig);
+
+	DiscoveryConfigStatic staticConfig;
+	staticConfig.addPeer("tcp://127.0.0.1:44770");
+	staticConfig.readEnvironment(false);
+
+	// one discovery per node, nodes added to the same one would know each other
+	std::vector<Discovery> discs;
+	std::vector<Node> nodes;
+	for (int i = 0; i < nrNodes; i++) {
+		NodeConfig nodeConfig(0, 0);
+		nodeConfig.enableGossip(true, 500);
+		Node node(&nodeConfig);
+		Discovery disc(&staticConfig);
+		disc.add(node);
+		nodes.push_back(node);
+		discs.push_back(disc);
+	}
+
+	// time to first message between two nodes that never heard of each other
+	Publisher pub("static");
+	nodes.front().addPublisher(pub);
+	FirstMessageReceiver receiver;
+	Subscriber sub("static");
+	sub.setReceiver(&receiver);
+	nodes.back().addSubscriber(sub);
+
+	pub.waitForSubscribers(1, 5000);
+	assert(pub.waitForSubscribers(0) == 1);
+	pub.send("first", 5);
+	{
+		RScopeLock lock(mutex);
+		uint64_t deadline = Thread::getTimeStampMs() + 5000;
+		while(receiver.receivedAt == 0 && Thread::getTimeStampMs() < deadline)
+			monitor.wait(mutex, 100);
+		assert(receiver.receivedAt != 0);
+	}
+	std::cout << "first message after " << receiver.receivedAt - start << "ms" << std::endl;
+
+	// and everyone is connected to everyone else
+	int retries = 200;
+	for (int i = 0; i < nrNodes; i++) {
+		while(nodes[i].connectedTo().size() != nrNodes) {
+			Thread::sleepMs(10);
+			if (retries-- == 0)
+				assert(false);
+		}
+	}
+	std::cout << nrNodes << " nodes connected via gossip after " << Thread::getTimeStampMs() - start << "ms" << std::endl;
+
+	nodes.back().removeSubscriber(sub);
+	nodes.front().removePublisher(pub);
+	for (int i = 0; i < nrNodes; i++) {
+		discs[i].remove(nodes[i]);
+	}
+	return true;
+}
+
+bool testGossipExpiry() {
+	// seed and three nodes, one of them vanishes without saying goodbye
+	int nrNodes = 3;
+
+	NodeConfig seedConfig(0, 0);
+	seedConfig.enableGossip(true, 100);
+	Node seed(&seedConfig);
+
+	DiscoveryConfigStatic staticConfig;
+	staticConfig.addPeer("tcp://127.0.0.1:" + toStr(seed.getPort()));
+	staticConfig.readEnvironment(false);
+
+	std::vector<Discovery> discs;
+	std::vector<Node> nodes;
+	for (int i = 0; i < nrNodes; i++) {
+		NodeConfig nodeConfig(0, 0);
+		nodeConfig.enableGossip(true, 100);
+		Node node(&nodeConfig);
+		Discovery disc(&staticConfig);
+		disc.add(node);
+		nodes.push_back(node);
+		discs.push_back(disc);
+	}
+
+	int retries = 200;
+	for (int i = 0; i < nrNodes; i++) {
+		while(nodes[i].connectedTo().size() != nrNodes) {
+			Thread::sleepMs(10);
+			if (retries-- == 0)
+				assert(false);
+		}
+	}
+
+	// the first node learned the last one from gossip and the other way around
+	std::string goneUUID = nodes.back().getUUID();
+	SharedPtr<ZeroMQNode> firstImpl = StaticPtrCast<ZeroMQNode>(nodes.front().getImpl());
+	{
+		RScopeLock lock(firstImpl->_mutex);
+		assert(firstImpl->_gossipPeers.find(goneUUID) != firstImpl->_gossipPeers.end());
+	}
+
+	// forget everyone connected to us, so no one is told about the shutdown
+	{
+		SharedPtr<ZeroMQNode> goneImpl = StaticPtrCast<ZeroMQNode>(nodes.back().getImpl());
+		RScopeLock lock(goneImpl->_mutex);
+		goneImpl->_connFrom.clear();
+	}
+	discs.back().remove(nodes.back());
+	discs.pop_back();
+	nodes.pop_back();
+
+	retries = 300;
+	while(true) {
+		{
+			RScopeLock lock(firstImpl->_mutex);
+			std::map<std::string, NodeStub> connected = nodes.front().connectedTo();
+			if (firstImpl->_gossipPeers.find(goneUUID) == firstImpl->_gossipPeers.end() &&
+			        connected.find(goneUUID) == connected.end())
+				break;
+		}
+		Thread::sleepMs(10);
+		if (retries-- == 0)
+			assert(false);
+	}
+
+	for (int i = 0; i < nrNodes - 1; i++) {
+		discs[i].remove(nodes[i]);
+	}
+	return true;
+}
 
 //bool testExplicitAdressed() {
 //	Node n1("tcp://127.0.0.1:7700");
@@ -379,8 +606,15 @@ bool testPubSubConnections() {
 
 int main(int argc, char** argv, char** envp) {
 	setenv("UMUNDO_LOGLEVEL", "4", 1);
-//	if (!testBroadCast())
-//		return EXIT_FAILURE;
+	if (!testStaticDiscovery())
+		return EXIT_FAILURE;
+	if (!testGossipExpiry())
+		return EXIT_FAILURE;
+
+#ifdef DISC_BROADCAST
+	if (!testBroadcastDiscovery())
+		return EXIT_FAILURE;
+#endif
 
 //	if (!testExplicitAdressed())
 //		return EXIT_FAILURE;
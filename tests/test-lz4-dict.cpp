@@ -21,7 +21,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include "lz4.h"
+#include "lz4hc.h"
 #include "umundo.h"
 #include "umundo/util/crypto/MD5.h"
 
@@ -193,6 +195,9 @@ struct comprCtxLZ4 {
     size_t dataDictSize;
     char* headDict;
     size_t headDictSize;
+    size_t decompressPasses;
+    LZ4_streamHC_t* comprHeadStreamHC;
+    LZ4_streamHC_t* comprDataStreamHC;
 };
 
 bool testDictContent() {
@@ -220,8 +225,48 @@ bool testDictContent() {
     return true;
 }
 
+bool testDecompressPasses() {
+    // highly compressible payload needs several passes when the size is guessed
+    std::string data(1 << 18, 'a');
+    umundo::Message msg(data.data(), data.size());
+
+    void* comprCtx = umundo::Message::createCompression();
+    size_t bounds = msg.getCompressBounds("lz4", comprCtx, umundo::Message::PAYLOAD);
+    char* compressed = (char*)malloc(bounds);
+    size_t compressedSize = msg.compress("lz4", comprCtx, compressed, bounds, umundo::Message::PAYLOAD);
+    umundo::Message::freeCompression(comprCtx);
+
+    // with the uncompressed size from the prelude
+    {
+        void* ctx = umundo::Message::createCompression();
+        umundo::Message received;
+        size_t decSize = received.uncompress("lz4", ctx, compressed, compressedSize, umundo::Message::PAYLOAD, data.size());
+        assert(decSize == data.size());
+        assert(memcmp(received.data(), data.data(), data.size()) == 0);
+        std::cout << "Decompression passes with size: " << ((comprCtxLZ4*)ctx)->decompressPasses << std::endl;
+        assert(((comprCtxLZ4*)ctx)->decompressPasses == 1);
+        umundo::Message::freeCompression(ctx);
+    }
+
+    // without, as with older publishers
+    {
+        void* ctx = umundo::Message::createCompression();
+        umundo::Message received;
+        size_t decSize = received.uncompress("lz4", ctx, compressed, compressedSize, umundo::Message::PAYLOAD);
+        assert(decSize == data.size());
+        assert(memcmp(received.data(), data.data(), data.size()) == 0);
+        std::cout << "Decompression passes without size: " << ((comprCtxLZ4*)ctx)->decompressPasses << std::endl;
+        assert(((comprCtxLZ4*)ctx)->decompressPasses > 1);
+        umundo::Message::freeCompression(ctx);
+    }
+
+    free(compressed);
+    return true;
+}
+
 int main(int argc, char** argv)
 {
+    testDecompressPasses();
     testDictContent();
     exit(0);
     
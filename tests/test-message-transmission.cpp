@@ -1,6 +1,8 @@
 #include "umundo.h"
 #include "umundo/config.h"
 #include "umundo/util/crypto/MD5.h"
+#include "umundo/SharedMemoryRing.h"
+#include "umundo/connection/SubscriberQueue.h"
 #include <iostream>
 #include <stdio.h>
 
@@ -11,11 +13,13 @@ using namespace umundo;
 static int nrReceptions = 0;
 static int bytesRecvd = 0;
 static int nrMissing = 0;
+static int nrCompressed = 0;
 static std::string hostId;
 
 class TestReceiver : public Receiver {
     void receive(Message* msg) {
         assert(msg->getMeta("seq").size() > 0);
+        assert(msg->getMeta("um.host") == hostId); // from the static header
         if (msg->size() > 0 && msg->getMeta("md5").length() > 0)
             assert(msg->getMeta("md5").compare(md5(msg->data(), msg->size())) == 0);
         if (nrReceptions + nrMissing == strTo<int>(msg->getMeta("seq"))) {
@@ -28,6 +32,8 @@ class TestReceiver : public Receiver {
             std::cout << " F" << nrReceptions + nrMissing;
         }
         nrReceptions++;
+        if (msg->hasMeta("um.compressRatio.payload"))
+            nrCompressed++;
         bytesRecvd += msg->size();
     }
 };
@@ -208,73 +214,180 @@ bool testByteWriting() {
     return true;
 }
 
+bool testCompactHeaders() {
+    std::map<std::string, std::string> meta;
+    meta["um.pub"]  = "f56fbaaf-e7be-4d80-a67b-3f712961b258";
+    meta["um.proc"] = "896e8001-6389-4543-a5d7-d7ae745900a2";
+    meta["um.sub"]  = "not a uuid";
+    meta["foo"]     = std::string(300, 'x');
+    meta["bar"]     = "";
+    meta[""]        = "empty keys are dropped";
+
+    size_t size = Message::getCompactHeaderSize(meta);
+    // two binary uuids, one short and two length prefixed strings
+    assert(size == (1 + 16) * 2 + (1 + 1 + 6 + 1 + 10) + (1 + 1 + 3 + 3 + 300) + (1 + 1 + 3 + 1));
+
+    char* data = (char*)malloc(size);
+    char* writePtr = Message::writeCompactHeaders(data, size, meta);
+    assert(writePtr == data + size);
+    assert(Message::writeCompactHeaders(data, size - 1, meta) == 0);
+
+    std::map<std::string, std::string> readMeta;
+    const char* readPtr = Message::readCompactHeaders(data, size, readMeta);
+    assert(readPtr == data + size);
+    meta.erase("");
+    assert(readMeta == meta);
+
+    // truncated headers are rejected
+    readMeta.clear();
+    assert(Message::readCompactHeaders(data, size - 1, readMeta) == 0);
+
+    // through the message with both versions
+    Message msg;
+    msg.putMeta("um.host", "affa8baa-0c9a-4f1e-a08e-c87847fb61ba");
+    msg.putMeta("foo", "bar");
+    assert(msg.getHeaderDataSize(Message::UM_MSG_VERSION_02) < msg.getHeaderDataSize(Message::UM_MSG_VERSION_01));
+
+    size = msg.getHeaderDataSize(Message::UM_MSG_VERSION_02);
+    data = (char*)realloc(data, size);
+    msg.writeHeaders(data, size, Message::UM_MSG_VERSION_02);
+
+    Message readMsg;
+    readMsg.setRawHeaders(data, size, Message::UM_MSG_VERSION_02, NULL, NULL);
+    assert(readMsg.getMeta("um.host") == "affa8baa-0c9a-4f1e-a08e-c87847fb61ba");
+    assert(readMsg.getMeta("foo") == "bar");
+
+    free(data);
+    return true;
+}
+
+bool testMetaFields() {
+    MetaFields fields;
+    for (int i = 0; i < 2 * UMUNDO_META_INLINE; i++)
+        fields.put("key" + toStr(i), toStr(i));
+    fields.put(MetaFields::PUB, "f56fbaaf-e7be-4d80-a67b-3f712961b258");
+    fields.put("key3", "overwritten");
+    assert(fields.size() == 2 * UMUNDO_META_INLINE + 1);
+    assert(*fields.find("key3") == "overwritten");
+    assert(*fields.find("um.pub") == "f56fbaaf-e7be-4d80-a67b-3f712961b258");
+    assert(fields.find("nokey") == NULL);
+
+    // erasing keeps the order of the other fields
+    assert(fields.erase("key1"));
+    assert(!fields.erase("key1"));
+    MetaFields::const_iterator fieldIter = fields.begin();
+    assert(fieldIter->first == "key0");
+    fieldIter++;
+    assert(fieldIter->first == "key2");
+
+    // encoded as with a map
+    std::map<std::string, std::string> meta = fields.toMap();
+    size_t size = Message::getCompactHeaderSize(fields);
+    assert(size == Message::getCompactHeaderSize(meta));
+    char* data = (char*)malloc(size);
+    assert(Message::writeCompactHeaders(data, size, fields) == data + size);
+    MetaFields readFields;
+    assert(Message::readCompactHeaders(data, size, readFields) == data + size);
+    assert(readFields.toMap() == meta);
+    free(data);
+
+    // values of our own fields stay valid while the overflow grows
+    MetaFields copies;
+    copies.put("copy0", std::string(100, 'x'));
+    for (int i = 1; i < 4 * UMUNDO_META_INLINE; i++)
+        copies.put("copy" + toStr(i), *copies.find("copy" + toStr(i - 1)));
+    assert(*copies.find("copy" + toStr(4 * UMUNDO_META_INLINE - 1)) == std::string(100, 'x'));
+
+    // the map of a message follows its changes
+    Message msg;
+    msg.putMeta("foo", "bar");
+    assert(msg.getMeta().size() == 1);
+    msg.putMeta(MetaFields::SUB, "baz");
+    assert(msg.getMeta().size() == 2);
+    assert(msg.getMeta("um.sub") == "baz");
+    assert(msg.hasMeta("foo") && !msg.hasMeta("bar"));
+    assert(msg.getMeta("bar").size() == 0);
+    assert(msg.getMetaRef("um.sub") == "baz" && msg.getMetaRef("bar").size() == 0);
+
+    Message copy(msg);
+    assert(copy.getMeta() == msg.getMeta());
+    return true;
+}
+
 bool testCompression() {
     std::string test1;
     for (int i = 0; i < 20; i++)
         test1 += "This is some test right here!";
     
     {
-        /**
-         * Test compression with a context
-         * This will compress all of the message
-         */
+        std::vector<std::string> codecs = Message::getCompressionCodecs();
+        for (std::vector<std::string>::iterator codecIter = codecs.begin(); codecIter != codecs.end(); codecIter++) {
+            std::string codec = *codecIter;
+            std::cout << "Testing compression with " << codec << std::endl;
+            assert(Message::getCompressionName(Message::getCompressionType(codec)) == codec);
+
+            /**
+             * Test compression with a context
+             * This will compress all of the message with every codec
+             */
         
-        std::list<std::pair<std::pair<size_t, size_t>, std::pair<char*, char*> > > data;
-        size_t iterations = 10;
+            std::list<std::pair<std::pair<size_t, size_t>, std::pair<char*, char*> > > data;
+            size_t iterations = 10;
         
-        std::string procUUID = "896e8001-6389-4543-a5d7-d7ae745900a2";
-        std::string hostUUID = "affa8baa-0c9a-4f1e-a08e-c87847fb61ba";
-        std::string pubUUID  = "f56fbaaf-e7be-4d80-a67b-3f712961b258";
+            std::string procUUID = "896e8001-6389-4543-a5d7-d7ae745900a2";
+            std::string hostUUID = "affa8baa-0c9a-4f1e-a08e-c87847fb61ba";
+            std::string pubUUID  = "f56fbaaf-e7be-4d80-a67b-3f712961b258";
         
-        void* ctx1 = Message::createCompression();
-        for (size_t i = 0; i < iterations; i++) {
+            void* ctx1 = Message::createCompression(codec);
+            for (size_t i = 0; i < iterations; i++) {
             
-            Message msg(test1.data(), test1.size());
-            msg.putMeta("um.pub", pubUUID);
-            msg.putMeta("um.proc", procUUID);
-            msg.putMeta("um.host", hostUUID);
+                Message msg(test1.data(), test1.size());
+                msg.putMeta("um.pub", pubUUID);
+                msg.putMeta("um.proc", procUUID);
+                msg.putMeta("um.host", hostUUID);
             
-            size_t headerSize  = msg.getCompressBounds("lz4", ctx1, Message::HEADER);
-            size_t payloadSize = msg.getCompressBounds("lz4", ctx1, Message::PAYLOAD);
+                size_t headerSize  = msg.getCompressBounds(codec, ctx1, Message::HEADER);
+                size_t payloadSize = msg.getCompressBounds(codec, ctx1, Message::PAYLOAD);
             
-            char* onwireHeader  = (char*)malloc(headerSize);
-            char* onwirePayload = (char*)malloc(payloadSize);
+                char* onwireHeader  = (char*)malloc(headerSize);
+                char* onwirePayload = (char*)malloc(payloadSize);
             
-            headerSize  = msg.compress("lz4", ctx1, onwireHeader, headerSize, Message::HEADER);
-            payloadSize = msg.compress("lz4", ctx1, onwirePayload, payloadSize, Message::PAYLOAD);
-            data.push_back(std::make_pair(std::make_pair(headerSize, payloadSize), std::make_pair(onwireHeader, onwirePayload)));
+                headerSize  = msg.compress(codec, ctx1, onwireHeader, headerSize, Message::HEADER);
+                payloadSize = msg.compress(codec, ctx1, onwirePayload, payloadSize, Message::PAYLOAD);
+                data.push_back(std::make_pair(std::make_pair(headerSize, payloadSize), std::make_pair(onwireHeader, onwirePayload)));
             
-        }
-        Message::freeCompression(ctx1);
+            }
+            Message::freeCompression(ctx1, codec);
         
-        void* ctx2 = Message::createCompression();
-        for (size_t i = 0; i < iterations; i++) {
-            std::pair<std::pair<size_t, size_t>, std::pair<char*, char*> > msgData = data.front();
-            data.pop_front();
+            void* ctx2 = Message::createCompression(codec);
+            for (size_t i = 0; i < iterations; i++) {
+                std::pair<std::pair<size_t, size_t>, std::pair<char*, char*> > msgData = data.front();
+                data.pop_front();
             
-            size_t headerSize = msgData.first.first;
-            size_t payloadSize = msgData.first.second;
-            char* onwireHeader  = msgData.second.first;
-            char* onwirePayload = msgData.second.second;
+                size_t headerSize = msgData.first.first;
+                size_t payloadSize = msgData.first.second;
+                char* onwireHeader  = msgData.second.first;
+                char* onwirePayload = msgData.second.second;
             
-            std::cout << headerSize << ":" << payloadSize << std::endl;
+                std::cout << headerSize << ":" << payloadSize << std::endl;
             
-            Message msg("lz4", ctx2, onwireHeader, headerSize, onwirePayload, payloadSize);
-//            msg.uncompress("lz4", ctx2, onwireHeader, headerSize, Message::HEADER);
-//            msg.uncompress("lz4", ctx2, onwirePayload, payloadSize, Message::PAYLOAD);
-            //std::cout << std::string(msg.data(), msg.size()) << std::endl;
+                Message msg(codec, ctx2, onwireHeader, headerSize, onwirePayload, payloadSize);
+//                msg.uncompress(codec, ctx2, onwireHeader, headerSize, Message::HEADER);
+//                msg.uncompress(codec, ctx2, onwirePayload, payloadSize, Message::PAYLOAD);
+                //std::cout << std::string(msg.data(), msg.size()) << std::endl;
             
-            assert(msg.getMeta("um.pub") == pubUUID);
-            assert(msg.getMeta("um.proc") == procUUID);
-            assert(msg.getMeta("um.host") == hostUUID);
-            assert(msg.size() == test1.size());
+                assert(msg.getMeta("um.pub") == pubUUID);
+                assert(msg.getMeta("um.proc") == procUUID);
+                assert(msg.getMeta("um.host") == hostUUID);
+                assert(msg.size() == test1.size());
             
-            assert(md5(std::string(msg.data(), msg.size())) == md5(test1));
+                assert(md5(std::string(msg.data(), msg.size())) == md5(test1));
             
-            free(onwireHeader);
-            free(onwirePayload);
+                free(onwireHeader);
+                free(onwirePayload);
+            }
+            Message::freeCompression(ctx2, codec);
         }
-        Message::freeCompression(ctx2);
     }
 
     {
@@ -374,6 +487,73 @@ bool testCompression() {
 
     }
     
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+    {
+        /**
+         * Test a publisher with adaptive compression
+         */
+        Node pubNode;
+        PublisherConfigTCP pubConfig("bar");
+        pubConfig.enableCompression("lz4");
+        pubConfig.enableAdaptiveCompression();
+        Publisher pub(&pubConfig);
+        pubNode.addPublisher(pub);
+        
+        TestReceiver* testRecv = new TestReceiver();
+        Node subNode;
+        Subscriber sub("bar");
+        sub.setReceiver(testRecv);
+        subNode.addSubscriber(sub);
+        
+        subNode.add(pubNode);
+        pubNode.add(subNode);
+        
+        pub.waitForSubscribers(1);
+        assert(pub.waitForSubscribers(0) == 1);
+        
+        int iterations = 1000;
+        nrReceptions = 0;
+        nrMissing = 0;
+        nrCompressed = 0;
+        bytesRecvd = 0;
+        
+        // incompressible payloads are only compressed when probing
+        for (int j = 0; j < iterations; j++) {
+            char* buffer = (char*)malloc(BUFFER_SIZE);
+            for (int k = 0; k < BUFFER_SIZE; k++)
+                buffer[k] = rand();
+            
+            Message* msg = new Message(buffer, BUFFER_SIZE, Message::ADOPT_DATA);
+            msg->putMeta("md5", md5(buffer, BUFFER_SIZE));
+            msg->putMeta("seq",toStr(j));
+            pub.send(msg);
+            delete msg;
+        }
+        Thread::sleepMs(500);
+        std::cout << "Compressed " << nrCompressed << " of " << nrReceptions << " random payloads" << std::endl;
+        assert(nrReceptions == iterations);
+        assert(nrCompressed < iterations / 10);
+        
+        // compressible payloads of the same size are compressed again after the next probe
+        nrCompressed = 0;
+        for (int j = iterations; j < 2 * iterations; j++) {
+            char* buffer = (char*)malloc(BUFFER_SIZE);
+            memset(buffer, j, BUFFER_SIZE);
+            
+            Message* msg = new Message(buffer, BUFFER_SIZE, Message::ADOPT_DATA);
+            msg->putMeta("md5", md5(buffer, BUFFER_SIZE));
+            msg->putMeta("seq",toStr(j));
+            pub.send(msg);
+            delete msg;
+        }
+        Thread::sleepMs(500);
+        std::cout << "Compressed " << nrCompressed << " of " << nrReceptions - iterations << " repetitive payloads" << std::endl;
+        assert(nrReceptions == 2 * iterations);
+        assert(nrCompressed > iterations - iterations / 10);
+        delete testRecv;
+    }
+#endif
+    
     return true;
 }
 
@@ -405,12 +585,25 @@ bool testMessageTransmission() {
 
 		int iterations = 1000;
 
+		std::vector<Message*> batch;
 		for (int j = 0; j < iterations; j++) {
 			Message* msg = new Message(buffer, BUFFER_SIZE);
 			msg->putMeta("md5", md5(buffer, BUFFER_SIZE));
 			msg->putMeta("seq",toStr(j));
-			pub.send(msg);
-			delete msg;
+			if (i == 0) {
+				pub.send(msg);
+				delete msg;
+				continue;
+			}
+
+			// second run sends batches of 10 messages
+			batch.push_back(msg);
+			if (batch.size() == 10) {
+				pub.sendBatch(batch);
+				for (size_t k = 0; k < batch.size(); k++)
+					delete batch[k];
+				batch.clear();
+			}
 		}
 
 		// wait until all messages are delivered
@@ -434,13 +627,505 @@ bool testMessageTransmission() {
 	return true;
 }
 
+static int nrReleased = 0;
+static RMutex releaseMutex;
+
+static void releaseBuffer(void* data, void* hint) {
+	RScopeLock lock(releaseMutex);
+	assert(data == hint);
+	free(data);
+	nrReleased++;
+}
+
+bool testZeroCopySend() {
+	hostId = Host::getHostId();
+	nrReceptions = 0;
+	nrMissing = 0;
+	bytesRecvd = 0;
+	nrReleased = 0;
+
+	Node pubNode;
+	PublisherConfigTCP pubConfig("zerocopy");
+	pubConfig.enableZeroCopy();
+	Publisher pub(&pubConfig);
+	pubNode.addPublisher(pub);
+
+	TestReceiver* testRecv = new TestReceiver();
+	Node subNode;
+	Subscriber sub("zerocopy");
+	sub.setReceiver(testRecv);
+	subNode.addSubscriber(sub);
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+	pub.waitForSubscribers(1);
+
+	// every other payload is large enough for the shared memory ring
+	int iterations = 100;
+	int bytesSent = 0;
+	for (int i = 0; i < iterations; i++) {
+		size_t size = (i % 2 == 0 ? BUFFER_SIZE : 16 * BUFFER_SIZE);
+		char* buffer = (char*)malloc(size);
+		memset(buffer, 'a' + (i % 26), size);
+		bytesSent += size;
+
+		Message* msg = new Message(buffer, size, releaseBuffer, buffer);
+		msg->putMeta("md5", md5(buffer, size));
+		msg->putMeta("seq", toStr(i));
+
+		// copies share the data and must not release it on their own
+		Message* copy = new Message(*msg);
+		pub.send(msg);
+		delete msg;
+		delete copy;
+	}
+
+	for (int i = 0; i < 20 && (nrReceptions < iterations || nrReleased < iterations); i++)
+		Thread::sleepMs(500);
+
+	std::cout << "received " << nrReceptions << " of " << iterations << " zero-copy messages, released " << nrReleased << std::endl;
+	assert(nrReceptions == iterations);
+	assert(bytesRecvd == bytesSent);
+	assert(nrReleased == iterations);
+
+	subNode.removeSubscriber(sub);
+	pubNode.removePublisher(pub);
+	sub.setReceiver(NULL);
+	delete testRecv;
+	return true;
+}
+
+class HoldingReceiver : public Receiver {
+public:
+	void receive(Message* msg) {
+		RScopeLock lock(mutex);
+		// keep a copy around, it refers into the frame we were given
+		held.push_back(new Message(*msg));
+	}
+	size_t nrHeld() {
+		RScopeLock lock(mutex);
+		return held.size();
+	}
+	std::vector<Message*> held;
+	RMutex mutex;
+};
+
+bool testZeroCopyReceive() {
+	hostId = Host::getHostId();
+	nrReleased = 0;
+
+	// payloads in their own frame and inline after the headers
+	Node pubNode;
+	PublisherConfigTCP framePubConfig("zerocopy.recv");
+	framePubConfig.enableZeroCopy();
+	Publisher framePub(&framePubConfig);
+	Publisher inlinePub("zerocopy.recv");
+	pubNode.addPublisher(framePub);
+	pubNode.addPublisher(inlinePub);
+
+	HoldingReceiver* holdRecv = new HoldingReceiver();
+	Node subNode;
+	SubscriberConfigTCP subConfig("zerocopy.recv");
+	subConfig.enableZeroCopy();
+	Subscriber sub(&subConfig);
+	sub.setReceiver(holdRecv);
+	subNode.addSubscriber(sub);
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+	framePub.waitForSubscribers(1);
+	inlinePub.waitForSubscribers(1);
+
+	int iterations = 50;
+	for (int i = 0; i < iterations; i++) {
+		char* buffer = (char*)malloc(BUFFER_SIZE);
+		memset(buffer, 'a' + (i % 26), BUFFER_SIZE);
+		Message* msg = new Message(buffer, BUFFER_SIZE, releaseBuffer, buffer);
+		msg->putMeta("seq", toStr(i));
+		msg->putMeta("pub", "frame");
+		framePub.send(msg);
+		delete msg;
+
+		std::string payload(BUFFER_SIZE, 'A' + (i % 26));
+		msg = new Message(payload.data(), payload.size());
+		msg->putMeta("seq", toStr(i));
+		msg->putMeta("pub", "inline");
+		inlinePub.send(msg);
+		delete msg;
+	}
+
+	for (int i = 0; i < 20 && holdRecv->nrHeld() < (size_t)iterations * 2; i++)
+		Thread::sleepMs(500);
+
+	std::cout << "holding " << holdRecv->nrHeld() << " of " << iterations * 2 << " zero-copy messages" << std::endl;
+	assert(holdRecv->nrHeld() == (size_t)iterations * 2);
+
+	// meta fields are parsed from the frames on first access
+	int nrFrame = 0;
+	int nrInline = 0;
+	for (size_t i = 0; i < holdRecv->held.size(); i++) {
+		Message* msg = holdRecv->held[i];
+		assert(msg->getMeta("um.host") == hostId);
+		assert(msg->size() == BUFFER_SIZE);
+		int seq = strTo<int>(msg->getMeta("seq"));
+		if (msg->getMeta("pub") == "frame") {
+			assert(seq == nrFrame++);
+			assert(msg->getMeta("um.pub") == framePub.getUUID());
+			assert(msg->data()[0] == 'a' + (seq % 26) && msg->data()[BUFFER_SIZE - 1] == 'a' + (seq % 26));
+		} else {
+			assert(seq == nrInline++);
+			assert(msg->getMeta("pub") == "inline");
+			assert(msg->getMeta("um.pub") == inlinePub.getUUID());
+			assert(msg->data()[0] == 'A' + (seq % 26) && msg->data()[BUFFER_SIZE - 1] == 'A' + (seq % 26));
+		}
+	}
+	assert(nrFrame == iterations && nrInline == iterations);
+
+	// the frames go back to 0MQ with the messages
+	for (size_t i = 0; i < holdRecv->held.size(); i++)
+		delete holdRecv->held[i];
+	holdRecv->held.clear();
+
+	// the nodes talk tcp, 0MQ is done with the publisher's buffers once they are written
+	for (int i = 0; i < 20 && nrReleased < iterations; i++)
+		Thread::sleepMs(100);
+
+	std::cout << "released " << nrReleased << " of " << iterations << " publisher buffers" << std::endl;
+	assert(nrReleased == iterations);
+
+	subNode.removeSubscriber(sub);
+	pubNode.removePublisher(framePub);
+	pubNode.removePublisher(inlinePub);
+	sub.setReceiver(NULL);
+	delete holdRecv;
+	return true;
+}
+
+class OrderReceiver : public Receiver {
+public:
+	OrderReceiver() : nrReceived(0), inReceive(false), outOfOrder(false) {}
+	void receive(Message* msg) {
+		// a dispatcher must not call us concurrently or out of order
+		if (inReceive || strTo<int>(msg->getMeta("seq")) != nrReceived)
+			outOfOrder = true;
+		inReceive = true;
+		Thread::yield();
+		nrReceived++;
+		inReceive = false;
+	}
+	int nrReceived;
+	bool inReceive;
+	bool outOfOrder;
+};
+
+bool testDispatcher() {
+	int nrSubs = 20;
+	int iterations = 200;
+
+	Node pubNode;
+	Publisher pub("dispatched");
+	pubNode.addPublisher(pub);
+
+	NodeConfig subConfig(0, 0);
+	subConfig.setDispatchThreads(3);
+	Node subNode(&subConfig);
+
+	std::vector<Subscriber> subs;
+	std::vector<OrderReceiver*> receivers;
+	for (int i = 0; i < nrSubs; i++) {
+		receivers.push_back(new OrderReceiver());
+		Subscriber sub("dispatched");
+		sub.setReceiver(receivers.back());
+		subNode.addSubscriber(sub);
+		subs.push_back(sub);
+	}
+
+	// one subscriber opting out keeps its own thread
+	OrderReceiver* ownThreadRecv = new OrderReceiver();
+	SubscriberConfigTCP ownThreadConfig("dispatched");
+	ownThreadConfig.enableDispatcher(false);
+	Subscriber ownThreadSub(&ownThreadConfig);
+	ownThreadSub.setReceiver(ownThreadRecv);
+	subNode.addSubscriber(ownThreadSub);
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+
+	pub.waitForSubscribers(nrSubs + 1);
+	assert(pub.waitForSubscribers(0) == nrSubs + 1);
+
+	for (int j = 0; j < iterations; j++) {
+		Message* msg = new Message();
+		msg->putMeta("seq", toStr(j));
+		pub.send(msg);
+		delete msg;
+	}
+
+	for (int i = 0; i < 20; i++) {
+		bool done = (ownThreadRecv->nrReceived == iterations);
+		for (int j = 0; j < nrSubs; j++)
+			done = done && (receivers[j]->nrReceived == iterations);
+		if (done)
+			break;
+		Thread::sleepMs(500);
+	}
+
+	for (int i = 0; i < nrSubs; i++) {
+		assert(receivers[i]->nrReceived == iterations);
+		assert(!receivers[i]->outOfOrder);
+	}
+	assert(ownThreadRecv->nrReceived == iterations);
+	std::cout << "dispatched " << iterations << " messages to " << nrSubs << " subscribers in order" << std::endl;
+
+	// subscribers leave the dispatcher before their receivers go away
+	for (int i = 0; i < nrSubs; i++) {
+		subNode.removeSubscriber(subs[i]);
+		subs[i].setReceiver(NULL);
+		delete receivers[i];
+	}
+	subNode.removeSubscriber(ownThreadSub);
+	ownThreadSub.setReceiver(NULL);
+	delete ownThreadRecv;
+	return true;
+}
+
+bool testSharedMemoryRing() {
+#ifdef UMUNDO_WITH_SHARED_MEMORY
+	std::string name = SharedMemoryRing::nameFor(UUID::getUUID());
+	SharedPtr<SharedMemoryRing> writer = SharedMemoryRing::create(name, 4096);
+	SharedPtr<SharedMemoryRing> reader = SharedMemoryRing::open(name);
+	assert(writer && reader);
+	assert(reader->getCapacity() == 4096);
+
+	char data[1000];
+	char copy[1000];
+	uint64_t positions[10];
+	for (int i = 0; i < 10; i++) {
+		memset(data, 'a' + i, sizeof(data));
+		assert(writer->write(data, sizeof(data), &positions[i]));
+		assert(positions[i] % 4096 + sizeof(data) + 8 <= 4096); // records do not wrap
+		assert(reader->read(positions[i], copy, sizeof(copy)));
+		assert(memcmp(data, copy, sizeof(data)) == 0);
+	}
+
+	// the oldest records were overwritten, the newest are not written yet
+	assert(!reader->read(positions[0], copy, sizeof(copy)));
+	assert(reader->read(positions[6], copy, sizeof(copy)));
+	assert(!reader->read(positions[9] + 1008, copy, sizeof(copy)));
+
+	// records larger than half the ring do not fit, readers cannot write
+	char large[2100];
+	assert(!writer->write(large, sizeof(large), &positions[0]));
+	assert(!reader->write(data, sizeof(data), &positions[0]));
+
+	// readers keep their mapping when the writer is gone
+	writer.reset();
+	assert(!SharedMemoryRing::open(name));
+	assert(reader->read(positions[9], copy, sizeof(copy)));
+	assert(copy[0] == 'j');
+
+	// large payloads to a subscriber on this host go through the publisher's ring
+	nrReceptions = 0;
+	nrMissing = 0;
+	bytesRecvd = 0;
+
+	Node pubNode;
+	Publisher pub("shm");
+	pubNode.addPublisher(pub);
+
+	Node subNode;
+	TestReceiver* testRecv = new TestReceiver();
+	Subscriber sub("shm");
+	sub.setReceiver(testRecv);
+	subNode.addSubscriber(sub);
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+	pub.waitForSubscribers(1);
+
+	int iterations = 50;
+	std::string payload(64 * 1024, 'x');
+	for (int i = 0; i < iterations; i++) {
+		payload[i] = 'a' + (i % 26);
+		Message* msg = new Message(payload.data(), payload.size());
+		msg->putMeta("md5", md5(msg->data(), msg->size()));
+		msg->putMeta("seq", toStr(i));
+		pub.send(msg);
+		delete msg;
+	}
+
+	for (int i = 0; i < 20 && nrReceptions < iterations; i++)
+		Thread::sleepMs(500);
+
+	std::cout << "received " << nrReceptions << " of " << iterations << " messages via shared memory" << std::endl;
+	assert(nrReceptions == iterations);
+	assert(bytesRecvd == iterations * (int)payload.size());
+	assert(SharedMemoryRing::open(SharedMemoryRing::nameFor(pub.getUUID())));
+
+	subNode.removeSubscriber(sub);
+	sub.setReceiver(NULL);
+	delete testRecv;
+#endif
+	return true;
+}
+
+bool testSubscriberQueue() {
+	SubscriberQueue::Limits limits;
+	limits.maxMsgs = 3;
+	limits.maxBytes = 250;
+	limits.ttlMs = 1000;
+
+	// oldest messages make room for new ones
+	SubscriberQueue queue;
+	assert(queue.push(new Message(std::string(100, 'a').data(), 100), 0, limits) == 0);
+	assert(queue.push(new Message(std::string(100, 'b').data(), 100), 10, limits) == 0);
+	assert(queue.push(new Message(std::string(100, 'c').data(), 100), 20, limits) == 1);
+	assert(queue.size() == 2 && queue.bytes() == 200 && queue.dropped() == 1);
+	assert(queue.push(new Message(std::string(300, 'd').data(), 300), 30, limits) == 1); // larger than the queue
+	assert(queue.push(new Message(std::string(10, 'e').data(), 10), 40, limits) == 0);
+	assert(queue.push(new Message(std::string(10, 'f').data(), 10), 50, limits) == 1);
+	assert(queue.size() == 3 && queue.bytes() == 120 && queue.dropped() == 3);
+
+	// until they expire
+	assert(queue.expire(1019, limits) == 0);
+	assert(queue.expire(1040, limits) == 2);
+	Message* msg = queue.pop();
+	assert(msg->data()[0] == 'f');
+	delete msg;
+	assert(queue.expire(5000, limits) == 0);
+	assert(queue.size() == 0 && queue.bytes() == 0);
+
+	// or the newest are dropped
+	limits.policy = SubscriberQueue::DROP_NEWEST;
+	SubscriberQueue newest;
+	assert(newest.push(new Message(std::string(100, 'a').data(), 100), 0, limits) == 0);
+	assert(newest.push(new Message(std::string(100, 'b').data(), 100), 0, limits) == 0);
+	assert(newest.push(new Message(std::string(100, 'c').data(), 100), 0, limits) == 1);
+	assert(newest.push(new Message(std::string(10, 'd').data(), 10), 0, limits) == 0);
+	assert(newest.push(new Message(std::string(10, 'e').data(), 10), 0, limits) == 1);
+	msg = newest.pop();
+	assert(msg->data()[0] == 'a');
+	delete msg;
+
+	delete newest.pop();
+	assert(newest.size() == 1);
+	return true;
+}
+
+class StateReceiver : public Receiver {
+public:
+	StateReceiver(int delayMs = 0) : delayMs(delayMs) {}
+	void receive(Message* msg) {
+		RScopeLock lock(mutex);
+		assert(msg->getMeta("um.host") == hostId);
+		values.push_back(msg->getMeta("sensor") + "=" + std::string(msg->data(), msg->size()));
+		Thread::sleepMs(delayMs);
+	}
+	size_t nrValues() {
+		RScopeLock lock(mutex);
+		return values.size();
+	}
+	std::vector<std::string> values;
+	RMutex mutex;
+	int delayMs;
+};
+
+bool testLastValueCache() {
+	hostId = Host::getHostId();
+
+	Node pubNode;
+	PublisherConfigTCP pubConfig("state");
+	pubConfig.enableLastValueCache(2, "sensor");
+	Publisher pub(&pubConfig);
+	pubNode.addPublisher(pub);
+
+	// state published before anyone listened
+	for (int i = 0; i < 9; i++) {
+		std::string value = toStr(i);
+		Message* msg = new Message(value.data(), value.size());
+		msg->putMeta("sensor", toStr(i % 3));
+		pub.send(msg);
+		delete msg;
+	}
+
+	// a late joiner gets the last values of the two sensors updated last
+	Node subNode;
+	StateReceiver* lateRecv = new StateReceiver();
+	Subscriber lateSub("state");
+	lateSub.setReceiver(lateRecv);
+	subNode.addSubscriber(lateSub);
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+	pub.waitForSubscribers(1);
+
+	for (int i = 0; i < 20 && lateRecv->nrValues() < 2; i++)
+		Thread::sleepMs(100);
+	Thread::sleepMs(200);
+	assert(lateRecv->values.size() == 2);
+	assert(lateRecv->values[0] == "1=7");
+	assert(lateRecv->values[1] == "2=8");
+
+	// a slow subscriber only gets the latest state
+	StateReceiver* slowRecv = new StateReceiver(100);
+	SubscriberConfigTCP slowConfig("state");
+	slowConfig.enableConflation(true, "sensor");
+	Subscriber slowSub(&slowConfig);
+	slowSub.setReceiver(slowRecv);
+	subNode.addSubscriber(slowSub);
+	pub.waitForSubscribers(2);
+	Thread::sleepMs(500);
+
+	int iterations = 100;
+	for (int i = 0; i < iterations; i++) {
+		std::string value = toStr(i);
+		Message* msg = new Message(value.data(), value.size());
+		msg->putMeta("sensor", "0");
+		pub.send(msg);
+		delete msg;
+	}
+
+	for (int i = 0; i < 20 && lateRecv->nrValues() < (size_t)iterations + 2; i++)
+		Thread::sleepMs(100);
+	Thread::sleepMs(500);
+
+	std::cout << "slow subscriber received " << slowRecv->nrValues() << " of " << iterations << " updates" << std::endl;
+	assert(lateRecv->nrValues() == (size_t)iterations + 2);
+	assert(slowRecv->nrValues() < (size_t)iterations);
+	assert(slowRecv->values.back() == "0=" + toStr(iterations - 1));
+
+	subNode.removeSubscriber(lateSub);
+	subNode.removeSubscriber(slowSub);
+	lateSub.setReceiver(NULL);
+	slowSub.setReceiver(NULL);
+	delete lateRecv;
+	delete slowRecv;
+	return true;
+}
 
 int main(int argc, char** argv, char** envp) {
+	hostId = Host::getHostId();
 	if (!testByteWriting())
 		return EXIT_FAILURE;
+	if (!testCompactHeaders())
+		return EXIT_FAILURE;
+	if (!testMetaFields())
+		return EXIT_FAILURE;
 	if (!testCompression())
 		return EXIT_FAILURE;
 	if (!testMessageTransmission())
 		return EXIT_FAILURE;
+	if (!testZeroCopySend())
+		return EXIT_FAILURE;
+	if (!testZeroCopyReceive())
+		return EXIT_FAILURE;
+	if (!testDispatcher())
+		return EXIT_FAILURE;
+	if (!testSharedMemoryRing())
+		return EXIT_FAILURE;
+	if (!testSubscriberQueue())
+		return EXIT_FAILURE;
+	if (!testLastValueCache())
+		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 }
@@ -2,9 +2,26 @@
 #include "umundo/Message.h"
 #include "umundo/connection/Node.h"
 #include "umundo/discovery/Discovery.h"
+#include "umundo/thread/Thread.h"
+#include <iostream>
 
 using namespace umundo;
 
+static Mutex mutex;
+static std::vector<std::string> payloads;
+static std::vector<uint32_t> timestamps;
+static std::vector<uint16_t> sequenceNumbers;
+
+class BatchReceiver : public Receiver {
+	void receive(Message* msg) {
+		ScopeLock lock(mutex);
+		assert(msg->getMeta("um.version") == "2");
+		payloads.push_back(std::string(msg->data(), msg->size()));
+		timestamps.push_back(strTo<uint32_t>(msg->getMeta("um.timestamp")));
+		sequenceNumbers.push_back(strTo<uint16_t>(msg->getMeta("um.sequenceNumber")));
+	}
+};
+
 bool testInstantiation() {
 	Node node1;
 	Node node2;
@@ -29,10 +46,77 @@ bool testInstantiation() {
 	return true;
 }
 
+/**
+ * A batch goes out with sendmmsg where available, every packet still needs
+ * the header libre would have written for it.
+ */
+bool testBatch() {
+	BatchReceiver* receiver = new BatchReceiver();
+	int iterations = 100;
+
+	Node node1;
+	Node node2;
+
+	PublisherConfigRTP pubConfig("batch");
+	pubConfig.setTimestampIncrement(166);
+	Publisher rtpPub(&pubConfig);
+
+	SubscriberConfigRTP subConfig("batch");
+	Subscriber rtpSub(&subConfig);
+	rtpSub.setReceiver(receiver);
+
+	node1.addSubscriber(rtpSub);
+	node2.addPublisher(rtpPub);
+
+	node1.add(node2);
+	node2.add(node1);
+
+	rtpPub.waitForSubscribers(1);
+	assert(rtpPub.waitForSubscribers(0) == 1);
+
+	std::vector<Message*> batch;
+	for (int i = 0; i < iterations; i++)
+		batch.push_back(new Message(toStr(i).c_str(), toStr(i).size()));
+	rtpPub.sendBatch(batch);
+	for (size_t i = 0; i < batch.size(); i++)
+		delete batch[i];
+
+	for (int i = 0; i < 20; i++) {
+		{
+			ScopeLock lock(mutex);
+			if (payloads.size() >= (size_t)iterations)
+				break;
+		}
+		Thread::sleepMs(100);
+	}
+
+	{
+		ScopeLock lock(mutex);
+		std::cout << "expected " << iterations << " packets, received " << payloads.size() << std::endl;
+		assert(payloads.size() == (size_t)iterations);
+		for (size_t i = 0; i < payloads.size(); i++) {
+			assert(payloads[i] == toStr(i));
+			if (i > 0) {
+				assert(timestamps[i] == timestamps[i - 1] + 166);
+				assert(sequenceNumbers[i] == (uint16_t)(sequenceNumbers[i - 1] + 1));
+			}
+		}
+	}
+
+	node1.removeSubscriber(rtpSub);
+	node2.removePublisher(rtpPub);
+	rtpSub.setReceiver(NULL);
+	delete receiver;
+
+	return true;
+}
+
 int main(int argc, char** argv) {
 	setenv("UMUNDO_LOGLEVEL", "4", 1);
 	if (!testInstantiation())
 		return EXIT_FAILURE;
+	if (!testBatch())
+		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 
 }
\ No newline at end of file
@@ -188,6 +188,165 @@ bool testTimedMonitors() {
 	return true;
 }
 
+bool testBufferPool() {
+	// buffers released in other threads end up in the pool again
+	struct PoolThread : public Thread {
+		std::vector<char*> buffers;
+		void run() {
+			for (size_t i = 0; i < buffers.size(); i++) {
+				assert(buffers[i][0] == (char)i);
+				BufferPool::release(buffers[i]);
+			}
+		}
+	};
+
+	BufferPool::Stats before = BufferPool::getStats();
+
+	for (int round = 0; round < 10; round++) {
+		PoolThread thread;
+		for (size_t i = 0; i < 100; i++) {
+			char* buffer = BufferPool::alloc(1 + i * 100);
+			assert(BufferPool::capacity(buffer) >= 1 + i * 100);
+			memset(buffer, (char)i, 1 + i * 100);
+			thread.buffers.push_back(buffer);
+		}
+		// high-water marks are taken along with the stats
+		if (round == 0)
+			assert(BufferPool::getStats().buffersInUse >= before.buffersInUse + 100);
+		thread.start();
+		thread.join();
+	}
+
+	char* buffer = BufferPool::alloc(100);
+	memset(buffer, 1, 100);
+	buffer = BufferPool::resize(buffer, 10000);
+	assert(BufferPool::capacity(buffer) >= 10000);
+	assert(buffer[99] == 1);
+	BufferPool::release(buffer);
+
+	BufferPool::Stats after = BufferPool::getStats();
+	std::cout << "Buffer pool hit rate " << after.hitRate() << ", high water " << after.highWaterBytes << " bytes" << std::endl;
+	assert(after.buffersInUse == before.buffersInUse);
+	assert(after.hits - before.hits > 500);
+	assert(after.highWaterBuffers >= 100);
+	return true;
+}
+
+bool testStatistics() {
+	// bucket boundaries are within 12.5% of the values they count
+	uint64_t values[] = {0, 1, 7, 8, 9, 15, 16, 100, 1000, 65535, 65536, 1000000, (uint64_t)1 << 39};
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		size_t bucket = Histogram::bucketFor(values[i]);
+		assert(bucket < UMUNDO_HISTOGRAM_BUCKETS);
+		assert(Histogram::bucketMax(bucket) >= values[i]);
+		assert(Histogram::bucketMax(bucket) - values[i] <= values[i] / 8);
+		if (bucket > 0)
+			assert(Histogram::bucketMax(bucket - 1) < values[i]);
+	}
+
+	Histogram histogram;
+	for (uint64_t i = 1; i <= 1000; i++)
+		histogram.record(i);
+	Histogram::Snapshot snapshot = histogram.snapshot();
+	assert(snapshot.count == 1000);
+	assert(snapshot.max == 1000);
+	assert(snapshot.mean() > 500 && snapshot.mean() < 501);
+	assert(snapshot.percentile(50) >= 500 && snapshot.percentile(50) <= 500 + 500 / 8);
+	assert(snapshot.percentile(99) >= 990 && snapshot.percentile(99) <= 1000);
+	assert(snapshot.percentile(100) == 1000);
+
+	// counting from many threads loses nothing
+	class Counter : public Thread {
+	public:
+		Counter(ChannelStats* stats) : _stats(stats) {}
+		void run() {
+			for (size_t i = 0; i < 10000; i++) {
+				_stats->countMessage(i % 100);
+				_stats->countBytes(10);
+			}
+		}
+		ChannelStats* _stats;
+	};
+
+	ChannelStats stats("foo");
+	ChannelStats::Snapshot before = stats.snapshot();
+	std::vector<Counter*> counters;
+	for (size_t i = 0; i < 4; i++) {
+		counters.push_back(new Counter(&stats));
+		counters.back()->start();
+	}
+	for (size_t i = 0; i < counters.size(); i++) {
+		counters[i]->join();
+		delete counters[i];
+	}
+
+	ChannelStats::Snapshot delta = stats.snapshot();
+	delta -= before;
+	std::cout << "Message sizes p50 " << delta.sizes.percentile(50) << ", p99 " << delta.sizes.percentile(99) << std::endl;
+	assert(delta.nrMsgs == 40000);
+	assert(delta.sizeMsgs == 400000);
+	assert(delta.sizes.count == 40000);
+	assert(delta.sizes.max == 99);
+
+	// traced messages with a gap and a late one
+	TraceStats trace;
+	uint64_t seqs[] = {1, 2, 5, 4, 6};
+	for (size_t i = 0; i < sizeof(seqs) / sizeof(seqs[0]); i++)
+		trace.record("pub", seqs[i], 1000, 1100 + 10 * i, 1300 + 100 * i);
+	trace.record("pub", 1, 2000, 0, 1000); // from another host with its clock ahead
+	TraceStats::Snapshot traced = trace.snapshot();
+	assert(traced.nrTraced == 6);
+	assert(traced.nrLost == 2);
+	assert(traced.nrReordered == 2);
+	assert(traced.latency.count == 6);
+	assert(traced.latency.max == 700);
+	assert(traced.toNode.count == 5);
+	assert(traced.fromNode.max == 700 - 140);
+	return true;
+}
+
+bool testSPSCQueue() {
+	SPSCQueue<size_t> queue(1000);
+	assert(queue.capacity() == 1024);
+	size_t value;
+	assert(!queue.pop(value));
+	for (size_t i = 0; i < queue.capacity(); i++)
+		assert(queue.push(i));
+	assert(!queue.push(0));
+	assert(queue.pop(value) && value == 0);
+	assert(queue.push(0));
+	while(queue.pop(value)) {}
+	assert(queue.empty());
+
+	// everything arrives once and in order, with either side being faster
+	class Producer : public Thread {
+	public:
+		Producer(SPSCQueue<size_t>* queue) : _queue(queue) {}
+		void run() {
+			for (size_t i = 1; i <= 1000000; i++) {
+				while(!_queue->push(i))
+					Thread::yield();
+			}
+		}
+		SPSCQueue<size_t>* _queue;
+	};
+
+	Producer producer(&queue);
+	producer.start();
+	size_t expected = 1;
+	while(expected <= 1000000) {
+		if (!queue.pop(value)) {
+			Thread::yield();
+			continue;
+		}
+		assert(value == expected);
+		expected++;
+	}
+	producer.join();
+	assert(queue.empty());
+	return true;
+}
+
 int main(int argc, char** argv) {
 	if(!testRMutex())
 		return EXIT_FAILURE;
@@ -197,5 +356,11 @@ int main(int argc, char** argv) {
 		return EXIT_FAILURE;
 	if(!testTimedMonitors())
 		return EXIT_FAILURE;
+	if(!testBufferPool())
+		return EXIT_FAILURE;
+	if(!testStatistics())
+		return EXIT_FAILURE;
+	if(!testSPSCQueue())
+		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 }
@@ -224,12 +224,84 @@ bool testGeneralStuff() {
 }
 
 
+bool samePublishers(Node* node, Node* remote, std::map<std::string, Publisher>& pubs) {
+	std::map<std::string, NodeStub> peers = node->connectedTo();
+	if (peers.find(remote->getUUID()) == peers.end())
+		return pubs.size() == 0;
+	std::map<std::string, PublisherStub> remotePubs = peers[remote->getUUID()].getPublishers();
+	if (remotePubs.size() != pubs.size())
+		return false;
+	for (std::map<std::string, Publisher>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+		if (remotePubs.find(pubIter->first) == remotePubs.end())
+			return false;
+	}
+	return true;
+}
+
+bool testPublisherDiffs() {
+	// with the changes remembered and with all publishers sent again
+	for (size_t history = 0; history <= 100; history += 100) {
+		NodeConfig config;
+		config.setPublisherHistory(history);
+		Node* node1 = new Node();
+		Node* node2 = new Node(&config);
+
+		node1->add(*node2);
+
+		std::map<std::string, Publisher> pubs;
+		for (int i = 0; i < 20; i++) {
+			Publisher pub("diff.pub" + toStr(i));
+			node2->addPublisher(pub);
+			pubs[pub.getUUID()] = pub;
+		}
+		Thread::sleepMs(100);
+		assert(samePublishers(node1, node2, pubs));
+
+		int iterations = 5;
+		while (iterations--) {
+			// change some publishers while disconnected
+			node1->remove(*node2);
+			Thread::sleepMs(50);
+
+			for (int i = 0; i < 3; i++) {
+				node2->removePublisher(pubs.begin()->second);
+				pubs.erase(pubs.begin());
+			}
+			for (int i = 0; i < 2; i++) {
+				Publisher pub("diff.pub" + toStr(iterations) + "." + toStr(i));
+				node2->addPublisher(pub);
+				pubs[pub.getUUID()] = pub;
+			}
+
+			node1->add(*node2);
+			Thread::sleepMs(100);
+			assert(samePublishers(node1, node2, pubs));
+
+			// and while connected
+			Publisher pub("diff.connected" + toStr(iterations));
+			node2->addPublisher(pub);
+			pubs[pub.getUUID()] = pub;
+			node2->removePublisher(pubs.begin()->second);
+			pubs.erase(pubs.begin());
+
+			Thread::sleepMs(100);
+			assert(samePublishers(node1, node2, pubs));
+		}
+
+		delete node1;
+		delete node2;
+	}
+	return true;
+}
+
 int main(int argc, char** argv) {
 	setenv("UMUNDO_LOGLEVEL", "4", 1);
 	if (!testNodeConnections())
 		return EXIT_FAILURE;
 	if (!testGeneralStuff())
 		return EXIT_FAILURE;
+	if (!testPublisherDiffs())
+		return EXIT_FAILURE;
 	return EXIT_SUCCESS;
 
 }
\ No newline at end of file
@@ -21,8 +21,11 @@
 #include <fstream>
 #include <exception>
 #include <queue>
+#include <deque>
+#include <algorithm>
 #include <cassert>
 #include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
 
 #ifdef WIN32
 #include "XGetopt.h"
@@ -58,6 +61,18 @@ typedef int socklen_t;
 #include <net/if.h>
 #endif
 
+#ifdef UNIX
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+#include "lz4.h"
+#endif
+
 #ifndef SOCKET
 #define SOCKET int
 #endif
@@ -66,33 +81,70 @@ typedef int socklen_t;
 #define TIMEOUT 8
 //ping interval (to keep nat open etc.)
 #define PING_INTERVAL 15
+//highest protocol version we speak, 2 sends binary data frames batched per tcp write
+#define PROTOCOL_VERSION 2
+//tcp connections for data besides the one for control messages, channels are spread over them
+#define DATA_LANES 1
+//senders block while this many bytes of their priority are waiting to be written to a tcp socket
+#define MAX_PENDING (8 * 1024 * 1024)
+//frames of higher priorities overtake the ones pending after this many bytes
+#define MAX_BATCH_SIZE (256 * 1024)
+//batches smaller than this are not worth compressing
+#define MIN_COMPRESS_SIZE 64
+//the highest bit of a batch length marks lz4 compressed batches
+#define BATCH_COMPRESSED 0x80000000U
+//larger frames and batches are not sent, a remote end announcing one is dropped
+#define MAX_FRAME_SIZE (64 * 1024 * 1024)
+//port and duration per message size of the loopback benchmark
+#define BENCH_PORT 42427
+#define BENCH_DURATION_MS 2000
 
 using namespace umundo;
 
 char* domain = NULL;
 bool verbose = false;
+//channels sent ahead of others pending on the same lane, 0 by default
+std::map<std::string, int> channelPriorities;
 
 //some helper functions
 void printUsageAndExit() {
 	printf("umundo-bridge version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
 	printf("Usage:\n");
-	printf("\tumundo-bridge [-d domain] [-v] -c <hostnameOrIPv4>:<port>\n");
-	printf("\tumundo-bridge [-d domain] [-v] -l port\n");
+	printf("\tumundo-bridge [-d domain] [-v] [-p version] [-z] [-n lanes] [-P channel=priority]* -c <hostnameOrIPv4>:<port>\n");
+	printf("\tumundo-bridge [-d domain] [-v] [-p version] [-z] [-n lanes] [-P channel=priority]* -l port\n");
+	printf("\tumundo-bridge [-p version] [-z] [-n lanes] [-l port] -b\n");
 	printf("\n");
 	printf("Options:\n");
 	printf("\t-t                           : run internal tests\n");
+	printf("\t-b                           : measure throughput between two bridges on this host\n");
 	printf("\t-d <domain>                  : join domain\n");
 	printf("\t-v                           : be more verbose\n");
 	printf("\t-l <port>                    : listen on this udp and tcp port\n");
 	printf("\t-c <hostnameOrIPv4>:<port>   : connect to remote end at IPv4:port (via tcp and udp)\n");
+	printf("\t-p <version>                 : highest protocol version to use, 1 for bridges before version 2 (defaults to %d)\n", PROTOCOL_VERSION);
+	printf("\t-z                           : compress the tcp connection with lz4 if the remote end agrees\n");
+	printf("\t-n <lanes>                   : spread channels over this many tcp connections besides the one for control (defaults to %d)\n", DATA_LANES);
+	printf("\t-P <channel>=<priority>      : send channel ahead of those with lower priority on its lane (defaults to 0)\n");
 	printf("\n");
 	printf("Examples:\n");
 	printf("\tumundo-bridge -l 4242\n");
 	printf("\tumundo-bridge -c 130.32.14.22:4242\n");
 	printf("\tumundo-bridge -t\n");
+	printf("\tumundo-bridge -n 4 -P control=1 -c 130.32.14.22:4242\n");
+	printf("\tumundo-bridge -z -b\n");
 	exit(1);
 }
 
+//pick lanes by channel name, the same on every run (FNV-1a)
+uint32_t channelHash(const std::string& channelName) {
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < channelName.size(); i++) {
+		hash ^= (uint8_t)channelName[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
 std::string ipToStr(uint32_t ip) {
 	uint8_t* ip_p = (uint8_t*)&ip;
 	std::string output = toStr((int)ip_p[0])+"."+toStr((int)ip_p[1])+"."+toStr((int)ip_p[2])+"."+toStr((int)ip_p[3]);
@@ -301,6 +353,24 @@ public:
 
 };
 
+//frames in the batches of protocol version 2, all lengths are written with Message::writeCompact
+enum FrameType {
+	FRAME_CONTROL = 0,		//length, serialized BridgeMessage
+	FRAME_CHANNEL = 1,		//channel id, isRTP byte, length, channel name
+	FRAME_DATA = 2			//channel id, length, binary meta fields, length, payload
+};
+
+void appendCompact(std::string& buffer, uint64_t value) {
+	char compact[9];
+	buffer.append(compact, Message::writeCompact(compact, value, sizeof(compact)) - compact);
+}
+
+const char* readCompact(const char* from, const char* end, uint64_t& value) {
+	if (from >= end || (from = Message::readCompact(from, &value, end - from)) == 0 || from > end)
+		throw BridgeMessageException("Frame data truncated");
+	return from;
+}
+
 class MessageQueue {
 private:
 	std::queue<boost::shared_ptr<BridgeMessage> > _queue;
@@ -309,12 +379,10 @@ private:
 
 	MessageQueue() { }
 
-	MessageQueue(MessageQueue& other) : _queue(other._queue), _mutex(other._mutex), _cond(other._cond) { }
-
 	void write(boost::shared_ptr<BridgeMessage> msg) {
 		RScopeLock lock(_mutex);
 		_queue.push(msg);
-		_cond.broadcast();
+		_cond.signal();		//there is only the mainloop reading
 	}
 
 	void write(BridgeMessage& msg) {
@@ -342,172 +410,508 @@ private:
 		return _queue.empty();
 	}
 
-	friend class TCPListener;
-	friend class UDPListener;
+	friend class BridgeLink;
 	friend class ProtocolHandler;
 };
 
-class TCPListener : public Thread {
+//reads and writes the sockets of one lane of a bridge connection from a single thread, waiting with epoll or select
+//tcp packets are prefixed with their length, with protocol version 2 a packet is a batch of frames
+//other threads queued since the last write, highest priority first and optionally lz4 compressed
+class BridgeLink : public Thread {
 private:
-	SOCKET _socket;
-	MessageQueue& _queue;
+	SOCKET _tcpSocket;
+	SOCKET _udpSocket;
+	bool _handleRTP;
+	ProtocolHandler* _handler;
+	bool _batched;
+	bool _compressed;
 	bool _terminated;
+	enum dummy { UDP, TCP };
+
+	//frames of one priority waiting to be written, we only ever take whole frames
+	struct SendQueue {
+		SendQueue() : start(0) { }
+		std::string data;
+		size_t start;
+		std::deque<size_t> frameSizes;
+	};
+
+	//written by other threads, taken highest priority first for the next batch
+	std::map<int, SendQueue> _pending;
+	RMutex _pendingMutex;
+	Monitor _pendingCond;
+	bool _wakeupPending;
+
+	//the batch currently written
+	std::string _batch;
+	std::string _out;
+	size_t _outOffset;
+	bool _outBlocked;
+
+	//buffers reused for every read
+	std::vector<char> _in;
+	size_t _inStart;
+	size_t _inEnd;
+	std::vector<char> _datagram;
+	std::vector<char> _uncompressed;
+
+	//channel ids the remote end assigned, channel and data frames always share a lane
+	std::map<uint64_t, std::pair<bool, std::string> > _remoteChannels;
+
+#ifdef HAVE_EPOLL
+	int _epollFd;
+#endif
+#ifdef UNIX
+	int _wakeupPipe[2];
+#endif
+
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+	//both directions are lz4 streams, the last 64k of each batch are the dictionary for the next one
+	LZ4_stream_t* _lz4Stream;
+	LZ4_streamDecode_t* _lz4StreamDecode;
+	char* _lz4Dict;
+	char* _lz4DictDecode;
+	size_t _lz4DictDecodeSize;
+#endif
 
-	TCPListener(SOCKET socket, MessageQueue& queue) : _socket(socket), _queue(queue), _terminated(false) {
+	BridgeLink(SOCKET tcpSocket, SOCKET udpSocket, bool handleRTP, ProtocolHandler* handler, bool batched, bool compressed) :
+		_tcpSocket(tcpSocket), _udpSocket(udpSocket), _handleRTP(handleRTP), _handler(handler), _batched(batched), _compressed(compressed),
+		_terminated(false), _wakeupPending(false), _outOffset(0), _outBlocked(false), _inStart(0), _inEnd(0) {
+		_in.resize(65536);
+		_datagram.resize(65536);
+
+#ifdef WIN32
+		u_long nonBlocking = 1;
+		ioctlsocket(_tcpSocket, FIONBIO, &nonBlocking);
+#else
+		fcntl(_tcpSocket, F_SETFL, fcntl(_tcpSocket, F_GETFL, 0) | O_NONBLOCK);
+		if (pipe(_wakeupPipe) == -1)
+			throw SocketException("Could not create wakeup pipe");
+		fcntl(_wakeupPipe[0], F_SETFL, fcntl(_wakeupPipe[0], F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+#ifdef HAVE_EPOLL
+		_epollFd = epoll_create(3);
+		if (_epollFd == -1)
+			throw SocketException("Could not create epoll instance");
+		watch(_tcpSocket, EPOLLIN, EPOLL_CTL_ADD);
+		watch(_wakeupPipe[0], EPOLLIN, EPOLL_CTL_ADD);
+		if (_handleRTP)
+			watch(_udpSocket, EPOLLIN, EPOLL_CTL_ADD);
+#endif
+
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+		_lz4Stream = LZ4_createStream();
+		_lz4StreamDecode = LZ4_createStreamDecode();
+		_lz4Dict = (char*)malloc(1 << 16);
+		_lz4DictDecode = (char*)malloc(1 << 16);
+		_lz4DictDecodeSize = 0;
+#else
+		if (_compressed)
+			throw std::runtime_error("Cannot compress the connection without lz4 support");
+#endif
 		start();
 	}
 
-	~TCPListener() {
+	~BridgeLink() {
 		terminate();
+#ifdef HAVE_EPOLL
+		close(_epollFd);
+#endif
+#ifdef UNIX
+		close(_wakeupPipe[0]);
+		close(_wakeupPipe[1]);
+#endif
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+		LZ4_freeStream(_lz4Stream);
+		LZ4_freeStreamDecode(_lz4StreamDecode);
+		free(_lz4Dict);
+		free(_lz4DictDecode);
+#endif
 	}
 
-	void terminate() {
+	//stop writing and wake all threads, does not wait for the link thread
+	void interrupt() {
+		RScopeLock lock(_pendingMutex);
 		_terminated = true;
+		_pendingCond.broadcast();
+		wakeup();
+	}
+
+	void terminate() {
+		interrupt();
 		join();
 	}
 
+	//queue a frame for the next tcp write, blocks while the socket cannot keep up with this priority
+	void write(const char* head, size_t headSize, const char* data = NULL, size_t dataSize = 0, int priority = 0) {
+		if (headSize + dataSize > MAX_FRAME_SIZE) {
+			if (verbose)
+				std::cout << "WARNING: not sending frame of " << headSize + dataSize << " bytes on tcp socket" << std::endl;
+			return;
+		}
+		RScopeLock lock(_pendingMutex);
+		SendQueue& queue = _pending[priority];
+		while(queue.data.size() - queue.start > MAX_PENDING && !_terminated)
+			_pendingCond.wait(_pendingMutex, 100);
+		if (_terminated)
+			return;
+		queue.data.append(head, headSize);
+		if (dataSize > 0)
+			queue.data.append(data, dataSize);
+		queue.frameSizes.push_back(headSize + dataSize);
+		if (!_wakeupPending) {		//the link thread takes everything pending when woken, one wakeup is enough
+			_wakeupPending = true;
+			wakeup();
+		}
+	}
+
+	//udp packets are sent right away, they cannot be coalesced
+	void writeDatagram(const char* head, size_t headSize, const char* data = NULL, size_t dataSize = 0) {
+		std::string packet(head, headSize);
+		if (dataSize > 0)
+			packet.append(data, dataSize);
+		RScopeLock lock(_pendingMutex);
+		if (_terminated)		//the socket might be closed already
+			return;
+		if (send(_udpSocket, packet.data(), packet.length(), 0) != (int)packet.length() && verbose)
+			std::cout << "WARNING: could not send " << packet.length() << " bytes on udp socket: " << strerror(errno) << std::endl;
+	}
+
+	void wakeup() {
+#ifdef UNIX
+		char wake = 0;
+		if (::write(_wakeupPipe[1], &wake, 1) != 1 && verbose)
+			std::cout << "WARNING: could not wake up link thread" << std::endl;
+#endif
+	}
+
+#ifdef HAVE_EPOLL
+	void watch(int fd, uint32_t events, int op) {
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = events;
+		event.data.fd = fd;
+		if (epoll_ctl(_epollFd, op, fd, &event) == -1)
+			throw SocketException("Could not watch socket with epoll");
+	}
+#endif
+
 	void run() {
 		try {
-			char* buffer;
-			uint32_t packetSize;
 			while(!_terminated) {
-				//use select() to timeout every second without data (and then check if _terminated == true)
+				bool tcpReadable = false;
+				bool udpReadable = false;
+				bool woken = false;
+#ifdef HAVE_EPOLL
+				struct epoll_event events[3];
+				int nrEvents = epoll_wait(_epollFd, events, 3, 1000);		//timeout every second without data (and then check if _terminated == true)
+				if (nrEvents == -1 && errno != EINTR)
+					throw SocketException("Could not use epoll_wait() on sockets");
+				for (int i = 0; i < nrEvents; i++) {
+					if (events[i].data.fd == _tcpSocket) {
+						tcpReadable = events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+					} else if (events[i].data.fd == _udpSocket) {
+						udpReadable = true;
+					} else {
+						woken = true;
+					}
+				}
+#else
+				//use select() to timeout without data (and then check if _terminated == true)
 				struct timeval time;
 #ifdef WIN32
 				FD_SET receive;
+				FD_SET writable;
 #else
 				fd_set receive;
+				fd_set writable;
 #endif
 				FD_ZERO(&receive);
-				FD_SET(_socket, &receive);
+				FD_ZERO(&writable);
+				FD_SET(_tcpSocket, &receive);
+				SOCKET maxSocket = _tcpSocket;
+				if (_handleRTP) {
+					FD_SET(_udpSocket, &receive);
+					maxSocket = std::max(maxSocket, _udpSocket);
+				}
+				if (_outBlocked)
+					FD_SET(_tcpSocket, &writable);
+#ifdef UNIX
+				FD_SET(_wakeupPipe[0], &receive);
+				maxSocket = std::max(maxSocket, (SOCKET)_wakeupPipe[0]);
 				time.tv_sec = 1;
 				time.tv_usec = 0;
-				int retval = select(_socket+1, &receive, NULL, NULL, &time);
-				if (retval == EBADF || retval == EINTR || retval == EINVAL || retval == ENOMEM)
-					throw SocketException("Could not use select() on sockets (err = "+toStr(retval)+")");
-				if (FD_ISSET(_socket, &receive)) {
-					packetSize = htonl(0);			//stays zero after recvAll() if connection was closed
-					if (recvAll(_socket, (char*)&packetSize, sizeof(uint32_t), 0)<0)
-						throw SocketException("recv() of packetSize on tcp socket failed");
-					packetSize = ntohl(packetSize);
-					if (packetSize == 0)				//socket read returned 0 --> connection was closed
-						break;
-					buffer = (char*)malloc(packetSize);
-					if (buffer == NULL)
-						throw std::runtime_error("malloc for "+toStr(packetSize)+" bytes failed");
-					if (recvAll(_socket, buffer, packetSize, 0) <= 0) {
-						free(buffer);
-						throw SocketException("recv() of packet on tcp socket failed");
-					} else {
-						boost::shared_ptr<BridgeMessage> msg;
-						try {
-							msg = boost::shared_ptr<BridgeMessage>(new BridgeMessage(buffer, packetSize));
-							msg->set("_source", "TCPListener");
-						} catch(std::exception& e) {
-							free(buffer);
-							throw e;
-						}
-						free(buffer);
-						_queue.write(msg);
-					}
+#else
+				//without a wakeup pipe, poll for pending data
+				time.tv_sec = 0;
+				time.tv_usec = 10000;
+#endif
+				int retval = select(maxSocket+1, &receive, &writable, NULL, &time);
+				if (retval == -1 && errno != EINTR)
+					throw SocketException("Could not use select() on sockets");
+				if (retval > 0) {
+					tcpReadable = FD_ISSET(_tcpSocket, &receive);
+					udpReadable = _handleRTP && FD_ISSET(_udpSocket, &receive);
+#ifdef UNIX
+					woken = FD_ISSET(_wakeupPipe[0], &receive);
+#endif
 				}
+#endif
+#ifdef UNIX
+				if (woken) {
+					char drain[64];
+					while(read(_wakeupPipe[0], drain, sizeof(drain)) > 0);
+				}
+#endif
+				if (_terminated)
+					break;
+				if (tcpReadable && !readTCP())
+					break;		//connection was closed
+				if (udpReadable)
+					readUDP();
+				flush();
 			}
 		} catch(std::exception& e) {
 			if (verbose)
-				std::cout << "Received exception in TCPListener: " << e.what() << std::endl;
+				std::cout << "Received exception in BridgeLink: " << e.what() << std::endl;
 		} catch(...) {
 			if (verbose)
-				std::cout << "Received unknown exception in TCPListener"<< std::endl;
+				std::cout << "Received unknown exception in BridgeLink"<< std::endl;
 		}
 		if (verbose)
-			std::cout << "Terminating TCPListener..."<< std::endl;
+			std::cout << "Terminating BridgeLink..."<< std::endl;
+		{
+			//release blocked writers, nothing will be written anymore
+			RScopeLock lock(_pendingMutex);
+			_terminated = true;
+			_pendingCond.broadcast();
+		}
 		BridgeMessage terminationMessage;
 		terminationMessage.set("type", "internal");
 		terminationMessage.set("cause", "termination");
-		terminationMessage.set("_source", "TCPListener");
-		_queue.write(terminationMessage);
+		terminationMessage.set("_source", "BridgeLink");
+		queue().write(terminationMessage);
 	}
 
-	int recvAll(SOCKET socket, char* buffer, size_t length, int flags) {
-		int retval;
-		size_t originalLength = length;
-		do {
-			retval = recv(socket, buffer, length, 0);
-			if (retval <= 0)
-				return retval;
-			length -= retval;		//calculate remaining data length
-			buffer += retval;		//advance buffer
-		} while(length>0);
-		return originalLength;
+	//read whatever is available and pass on all complete packets
+	bool readTCP() {
+		while(true) {
+			if (_inEnd == _in.size()) {
+				if (_inStart > 0) {		//move the incomplete packet to the front
+					memmove(&_in[0], &_in[_inStart], _inEnd - _inStart);
+					_inEnd -= _inStart;
+					_inStart = 0;
+				} else {
+					_in.resize(_in.size() * 2);
+				}
+			}
+			int retval = recv(_tcpSocket, &_in[_inEnd], _in.size() - _inEnd, 0);
+			if (retval == 0)
+				return false;
+			if (retval < 0) {
+#ifdef WIN32
+				if (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+#endif
+					return true;
+				throw SocketException("recv() on tcp socket failed");
+			}
+			_inEnd += retval;
+
+			while(_inEnd - _inStart >= sizeof(uint32_t)) {
+				uint32_t packetSize;
+				memcpy(&packetSize, &_in[_inStart], sizeof(uint32_t));
+				packetSize = ntohl(packetSize);
+				bool compressed = _batched && (packetSize & BATCH_COMPRESSED);
+				if (_batched)
+					packetSize &= ~BATCH_COMPRESSED;
+				if (packetSize == 0)
+					throw BridgeMessageException("Empty packet on tcp socket");
+				if (packetSize > MAX_FRAME_SIZE)
+					throw BridgeMessageException("Packet on tcp socket too large ("+toStr(packetSize)+" bytes)");
+				if (_inEnd - _inStart < sizeof(uint32_t) + packetSize) {
+					if (sizeof(uint32_t) + packetSize > _in.size())		//grow once for the whole packet
+						_in.resize(sizeof(uint32_t) + packetSize);
+					break;
+				}
+				received(&_in[_inStart + sizeof(uint32_t)], packetSize, compressed);
+				_inStart += sizeof(uint32_t) + packetSize;
+			}
+			if (_inStart == _inEnd)
+				_inStart = _inEnd = 0;
+		}
 	}
 
-	friend class ProtocolHandler;
-};
-
-class UDPListener : public Thread {
-private:
-	SOCKET _socket;
-	MessageQueue& _queue;
-	bool _terminated;
-
-	UDPListener(SOCKET socket, MessageQueue& queue) : _socket(socket), _queue(queue), _terminated(false) {
-		start();
+	void readUDP() {
+		int count = recv(_udpSocket, &_datagram[0], _datagram.size(), 0);
+		if (count == -1) {
+			//the remote end not listening yet or a signal is no reason to give up on the link
+#ifdef WIN32
+			int error = WSAGetLastError();
+			if (error == WSAECONNRESET && verbose)
+				std::cout << "WARNING: udp socket of remote end not reachable" << std::endl;
+			if (error == WSAEWOULDBLOCK || error == WSAECONNRESET || error == WSAEINTR)
+#else
+			if (errno == ECONNREFUSED && verbose)
+				std::cout << "WARNING: udp socket of remote end not reachable" << std::endl;
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNREFUSED)
+#endif
+				return;
+			throw SocketException("recv() on udp socket failed");
+		}
+		handlePacket(&_datagram[0], count, UDP);
 	}
 
-	~UDPListener() {
-		terminate();
+	void received(const char* packet, size_t size, bool compressed) {
+		if (!_compressed) {
+			if (compressed)
+				throw BridgeMessageException("Compressed batch on uncompressed connection");
+			handlePacket(packet, size, TCP);
+			return;
+		}
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+		if (compressed) {
+			if (size < sizeof(uint32_t))
+				throw BridgeMessageException("Compressed batch truncated");
+			uint32_t originalSize;
+			memcpy(&originalSize, packet, sizeof(uint32_t));
+			originalSize = ntohl(originalSize);
+			if (originalSize > MAX_FRAME_SIZE)
+				throw BridgeMessageException("Compressed batch too large ("+toStr(originalSize)+" bytes)");
+			if (_uncompressed.size() < originalSize)
+				_uncompressed.resize(originalSize);
+			LZ4_setStreamDecode(_lz4StreamDecode, _lz4DictDecode, _lz4DictDecodeSize);
+			int decBytes = LZ4_decompress_safe_continue(_lz4StreamDecode, packet + sizeof(uint32_t), &_uncompressed[0], size - sizeof(uint32_t), originalSize);
+			if (decBytes != (int)originalSize)
+				throw BridgeMessageException("Could not decompress batch");
+			packet = &_uncompressed[0];
+			size = originalSize;
+		}
+		//batches sent uncompressed are the dictionary for the next one all the same
+		_lz4DictDecodeSize = size < (1 << 16) ? size : (1 << 16);
+		memcpy(_lz4DictDecode, packet + size - _lz4DictDecodeSize, _lz4DictDecodeSize);
+		handlePacket(packet, size, TCP);
+#endif
 	}
 
-	void terminate() {
-		_terminated = true;
-		join();
-	}
+	//write pending data until the socket would block
+	void flush() {
+		while(true) {
+			if (_outOffset == _out.size()) {
+				{
+					RScopeLock lock(_pendingMutex);
+					_wakeupPending = false;
+					if (!take())
+						break;
+					_pendingCond.broadcast();
+				}
+				encode();
+			}
 
-	void run() {
-		char buffer[65536] = "";
-		try {
-			while(!_terminated) {
-				//use select() to timeout every second without data (and then check if _terminated == true)
-				struct timeval time;
+			int retval = send(_tcpSocket, _out.data() + _outOffset, _out.size() - _outOffset, 0);
+			if (retval < 0) {
 #ifdef WIN32
-				FD_SET receive;
+				if (WSAGetLastError() == WSAEWOULDBLOCK) {
 #else
-				fd_set receive;
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+#endif
+					if (!_outBlocked) {
+						_outBlocked = true;
+#ifdef HAVE_EPOLL
+						watch(_tcpSocket, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
 #endif
-				FD_ZERO(&receive);
-				FD_SET(_socket, &receive);
-				time.tv_sec = 1;
-				time.tv_usec = 0;
-				int retval = select(_socket+1, &receive, NULL, NULL, &time);
-				if (retval == EBADF || retval == EINTR || retval == EINVAL || retval == ENOMEM)
-					throw SocketException("Could not use select() on sockets (err = "+toStr(retval)+")");
-				if (FD_ISSET(_socket, &receive)) {
-					size_t count = recv(_socket, buffer, sizeof(buffer), 0);
-					if (count == -1)
-						throw SocketException("recv() on udp socket failed");
-					else {
-						boost::shared_ptr<BridgeMessage> msg = boost::shared_ptr<BridgeMessage>(new BridgeMessage(buffer, count));
-						msg->set("_source", "UDPListener");
-						_queue.write(msg);
 					}
+					return;
 				}
+				throw SocketException("Could not send data on tcp socket");
 			}
-		} catch(std::exception& e) {
-			if (verbose)
-				std::cout << "Received exception in UDPListener: " << e.what() << std::endl;
-		} catch(...) {
-			if (verbose)
-				std::cout << "Received unknown exception in UDPListener"<< std::endl;
+			_outOffset += retval;
+		}
+		if (_outBlocked) {
+			_outBlocked = false;
+#ifdef HAVE_EPOLL
+			watch(_tcpSocket, EPOLLIN, EPOLL_CTL_MOD);
+#endif
 		}
-		if (verbose)
-			std::cout << "Terminating UDPListener..."<< std::endl;
-		BridgeMessage terminationMessage;
-		terminationMessage.set("type", "internal");
-		terminationMessage.set("cause", "termination");
-		terminationMessage.set("_source", "UDPListener");
-		_queue.write(terminationMessage);
 	}
 
+	//move whole frames into _batch, highest priority first, until MAX_BATCH_SIZE is reached
+	bool take() {
+		_batch.clear();
+		for (std::map<int, SendQueue>::reverse_iterator queueIter = _pending.rbegin(); queueIter != _pending.rend(); queueIter++) {
+			SendQueue& queue = queueIter->second;
+			size_t size = 0;
+			while(!queue.frameSizes.empty() && (_batch.size() + size == 0 || _batch.size() + size + queue.frameSizes.front() <= MAX_BATCH_SIZE)) {
+				size += queue.frameSizes.front();
+				queue.frameSizes.pop_front();
+			}
+			if (size == 0 && queue.frameSizes.empty())
+				continue;		//nothing of this priority
+			if (size == 0)
+				break;		//batch is full
+			if (_batch.empty() && queue.frameSizes.empty() && queue.start == 0) {
+				_batch.swap(queue.data);		//all of it, the queue gets the buffer of the last batch
+				queue.data.clear();
+			} else {
+				_batch.append(queue.data, queue.start, size);
+				queue.start += size;
+				if (queue.frameSizes.empty()) {
+					queue.data.clear();
+					queue.start = 0;
+				} else if (queue.start > queue.data.size() / 2) {
+					queue.data.erase(0, queue.start);
+					queue.start = 0;
+				}
+			}
+		}
+		return !_batch.empty();
+	}
+
+	//turn the data taken from _pending into the next packet
+	void encode() {
+		_out.clear();
+		_outOffset = 0;
+		if (!_batched) {		//version 1 messages are already length prefixed
+			_out.swap(_batch);
+			return;
+		}
+
+		uint32_t header = _batch.size();
+#ifdef BUILD_WITH_COMPRESSION_LZ4
+		if (_compressed) {
+			bool compressed = false;
+			if (_batch.size() >= MIN_COMPRESS_SIZE) {
+				_out.resize(2 * sizeof(uint32_t) + LZ4_compressBound(_batch.size()));
+				int compressedSize = LZ4_compress_fast_continue(_lz4Stream, _batch.data(), &_out[2 * sizeof(uint32_t)], _batch.size(), _out.size() - 2 * sizeof(uint32_t), 1);
+				if (compressedSize > 0 && compressedSize + sizeof(uint32_t) < _batch.size()) {
+					header = htonl((compressedSize + sizeof(uint32_t)) | BATCH_COMPRESSED);
+					uint32_t originalSize = htonl(_batch.size());
+					memcpy(&_out[0], &header, sizeof(uint32_t));
+					memcpy(&_out[sizeof(uint32_t)], &originalSize, sizeof(uint32_t));
+					_out.resize(2 * sizeof(uint32_t) + compressedSize);
+					compressed = true;
+				} else {
+					_out.clear();
+				}
+			}
+			//both ends continue with the end of this batch as dictionary, whether it was compressed or not
+			size_t dictSize = _batch.size() < (1 << 16) ? _batch.size() : (1 << 16);
+			memcpy(_lz4Dict, _batch.data() + _batch.size() - dictSize, dictSize);
+			LZ4_loadDict(_lz4Stream, _lz4Dict, dictSize);
+			if (compressed)
+				return;
+		}
+#endif
+		header = htonl(header);
+		_out.append((char*)&header, sizeof(uint32_t));
+		_out.append(_batch);
+	}
+
+	MessageQueue& queue();
+	void handlePacket(const char* packet, size_t size, dummy source);
+
 	friend class ProtocolHandler;
 };
 
@@ -516,12 +920,13 @@ private:
 	SOCKET _tcpSocket;
 	SOCKET _udpSocket;
 	bool _handleRTP;
+	uint16_t _protocolVersion;
+	std::vector<SOCKET> _dataSockets;
 	bool _shutdownDone;
 	MessageQueue _queue;
-	TCPListener* _tcpListener;
-	UDPListener* _udpListener;
+	//lane 0 carries control messages and rtp data, channels are spread over the others
+	std::vector<BridgeLink*> _links;
 	RMutex _shutdownMutex;
-	RMutex _socketMutex;
 	//our own publishers reproducing remote publishers
 	std::map<bool, std::map<std::string, std::pair<Publisher*, std::map<std::string, Publisher*> > > > _knownPubs;
 	RMutex _knownPubsMutex;
@@ -534,17 +939,28 @@ private:
 	bool _mainloopStarted;
 	RMutex _mainloopStartedMutex;
 	boost::shared_ptr<Node> _innerNode;
+	//channels we send data for (protocol version 2)
+	struct OwnChannel {
+		uint64_t id;
+		size_t lane;
+		int priority;
+	};
+	std::map<std::pair<bool, std::string>, OwnChannel> _channels;
+	RMutex _channelsMutex;
 	enum dummy { UDP, TCP };
 
 public:
-	ProtocolHandler(SOCKET tcpSocket, SOCKET udpSocket, bool handleRTP) : _tcpSocket(tcpSocket), _udpSocket(udpSocket), _handleRTP(handleRTP), _shutdownDone(false), _mainloopStarted(false) {
-		_tcpListener = new TCPListener(_tcpSocket, _queue);
-		if (_handleRTP)
-			_udpListener = new UDPListener(_udpSocket, _queue);
+	ProtocolHandler(SOCKET tcpSocket, SOCKET udpSocket, const std::vector<SOCKET>& dataSockets, bool handleRTP, uint16_t protocolVersion, bool compressed) : _tcpSocket(tcpSocket), _udpSocket(udpSocket), _handleRTP(handleRTP), _protocolVersion(protocolVersion), _dataSockets(dataSockets), _shutdownDone(false), _mainloopStarted(false) {
+		_links.push_back(new BridgeLink(_tcpSocket, _udpSocket, _handleRTP, this, _protocolVersion >= 2, compressed));
+		for (size_t i = 0; i < _dataSockets.size(); i++)
+			_links.push_back(new BridgeLink(_dataSockets[i], -1, false, this, true, compressed));
 	}
 
 	~ProtocolHandler() {
 		shutdown();
+		//senders might still be about to write when shutdown is done, the links ignore them until now
+		for (size_t i = 0; i < _links.size(); i++)
+			delete _links[i];
 		if (verbose)
 			std::cout << "ProtocolHandler successfully destructed..." << std::endl;
 	}
@@ -649,6 +1065,10 @@ public:
 				subsIter++;
 			}
 		}
+		if (_protocolVersion >= 2) {
+			send_dataFrame(channelName, isRTP, umundoMessage);
+			return;
+		}
 		//"serialize" and send umundoMessage
 		BridgeMessage msg;
 		msg.set("type", "data");
@@ -667,6 +1087,55 @@ public:
 		sendMessage(msg, isRTP ? UDP : TCP);
 	}
 
+	//binary data frame preceded by the channel id assignment on first use (and in every udp packet)
+	//only ever called from the thread of the one subscriber receiving the channel, so its frames stay in order
+	void send_dataFrame(const std::string& channelName, bool isRTP, Message* umundoMessage) {
+		if (_shutdownDone)		//only send messages when active
+			return;
+		OwnChannel channel;
+		bool announce = isRTP;		//udp packets might overtake the tcp stream, each carries its channel id
+		{
+			RScopeLock lock(_channelsMutex);
+			std::pair<bool, std::string> key(isRTP, channelName);
+			std::map<std::pair<bool, std::string>, OwnChannel>::iterator channelIter = _channels.find(key);
+			if (channelIter == _channels.end()) {
+				channel.id = _channels.size() + 1;
+				channel.lane = (isRTP || _links.size() == 1 ? 0 : 1 + channelHash(channelName) % (_links.size() - 1));
+				std::map<std::string, int>::iterator priorityIter = channelPriorities.find(channelName);
+				channel.priority = (priorityIter == channelPriorities.end() ? 0 : priorityIter->second);
+				_channels[key] = channel;
+				announce = true;
+				if (verbose)
+					std::cout << "INFO: sending " << (isRTP ? "RTP" : "ZMQ") << " channel '" << channelName << "' on lane " << channel.lane << " with priority " << channel.priority << std::endl;
+			} else {
+				channel = channelIter->second;
+			}
+		}
+
+		std::string head;
+		if (announce) {
+			head += (char)FRAME_CHANNEL;
+			appendCompact(head, channel.id);
+			head += (char)isRTP;
+			appendCompact(head, channelName.size());
+			head += channelName;
+		}
+		head += (char)FRAME_DATA;
+		appendCompact(head, channel.id);
+		size_t metaSize = umundoMessage->getHeaderDataSize(Message::UM_MSG_VERSION_02);
+		appendCompact(head, metaSize);
+		size_t metaOffset = head.size();
+		head.resize(metaOffset + metaSize);
+		if (metaSize > 0 && umundoMessage->writeHeaders(&head[metaOffset], metaSize, Message::UM_MSG_VERSION_02) == 0)
+			throw BridgeMessageException("Could not write meta fields");
+		appendCompact(head, umundoMessage->size());
+		if (isRTP) {
+			_links[0]->writeDatagram(head.data(), head.size(), umundoMessage->data(), umundoMessage->size());
+		} else {
+			_links[channel.lane]->write(head.data(), head.size(), umundoMessage->data(), umundoMessage->size(), channel.priority);
+		}
+	}
+
 	// *** mainloop: read messages from the queue and process them (internal messages here, external messages in own private method) ***
 	void mainloop() {
 		if (!_innerNode)		//only allow when we know our umundo node
@@ -697,7 +1166,8 @@ public:
 				}
 				if (verbose)
 					std::cout << "INFO: sending internal ping message on TCP channel..." << std::endl;
-				sendMessage(msg, TCP);
+				for (size_t lane = 0; lane < _links.size(); lane++)
+					sendMessage(msg, TCP, lane);
 			}
 			if (!msg)
 				continue;
@@ -726,6 +1196,79 @@ public:
 	}
 
 private:
+	/// *** process incoming packets (on the link thread) ***
+	void received(const char* packet, size_t size, dummy source, std::map<uint64_t, std::pair<bool, std::string> >& remoteChannels) {
+		if (_protocolVersion < 2) {
+			boost::shared_ptr<BridgeMessage> msg = boost::shared_ptr<BridgeMessage>(new BridgeMessage(packet, size));
+			msg->set("_source", source == TCP ? "tcp" : "udp");
+			_queue.write(msg);
+			return;
+		}
+
+		const char* end = packet + size;
+		while(packet < end) {
+			uint8_t type;
+			packet = Message::read(packet, &type);
+			uint64_t channelId = 0;
+			uint64_t length = 0;
+			switch(type) {
+			case FRAME_CONTROL: {
+				packet = readCompact(packet, end, length);
+				if (length > (uint64_t)(end - packet))
+					throw BridgeMessageException("Control frame truncated");
+				boost::shared_ptr<BridgeMessage> msg = boost::shared_ptr<BridgeMessage>(new BridgeMessage(packet, length));
+				msg->set("_source", source == TCP ? "tcp" : "udp");
+				_queue.write(msg);		//pubs and subs are added and removed on the mainloop
+				packet += length;
+				break;
+			}
+			case FRAME_CHANNEL: {
+				packet = readCompact(packet, end, channelId);
+				if (packet >= end)
+					throw BridgeMessageException("Channel frame truncated");
+				bool isRTP = *packet++;
+				packet = readCompact(packet, end, length);
+				if (length > (uint64_t)(end - packet))
+					throw BridgeMessageException("Channel frame truncated");
+				remoteChannels[channelId] = std::make_pair(isRTP, std::string(packet, length));
+				packet += length;
+				break;
+			}
+			case FRAME_DATA: {
+				packet = readCompact(packet, end, channelId);
+				packet = readCompact(packet, end, length);
+				if (length > (uint64_t)(end - packet))
+					throw BridgeMessageException("Data frame truncated");
+				const char* meta = packet;
+				size_t metaSize = length;
+				packet = readCompact(packet + metaSize, end, length);
+				if (length > (uint64_t)(end - packet))
+					throw BridgeMessageException("Data frame truncated");
+				std::map<uint64_t, std::pair<bool, std::string> >::iterator channelIter = remoteChannels.find(channelId);
+				if (channelIter == remoteChannels.end())
+					throw BridgeMessageException("Data frame for unknown channel id "+toStr(channelId));
+				receivedData(channelIter->second.first, channelIter->second.second, meta, metaSize, packet, length);
+				packet += length;
+				break;
+			}
+			default:
+				throw BridgeMessageException("Unknown frame type ("+toStr((int)type)+")");
+			}
+		}
+	}
+
+	//data goes to our publisher right away instead of through the mainloop
+	void receivedData(bool isRTP, const std::string& channelName, const char* meta, size_t metaSize, const char* data, size_t size) {
+		RScopeLock lock(_knownPubsMutex);
+		std::map<std::string, std::pair<Publisher*, std::map<std::string, Publisher*> > >::iterator pubIter = _knownPubs[isRTP].find(channelName);
+		if (pubIter == _knownPubs[isRTP].end() || pubIter->second.first == NULL)
+			return;
+		Message umundoMessage(data, size);
+		if (metaSize > 0 && umundoMessage.readHeaders(meta, metaSize, Message::UM_MSG_VERSION_02) == 0)
+			throw BridgeMessageException("Corrupt meta fields in data frame");
+		pubIter->second.first->send(&umundoMessage);
+	}
+
 	/// *** process incoming messages ***
 	bool processMessage(boost::shared_ptr<BridgeMessage> msg) {
 		RScopeLock lock(_shutdownMutex);		//process only when no shutdown in progress
@@ -966,48 +1509,59 @@ private:
 			}
 		}
 
-		//lock "sockets" to prevent sendMessage() calls while closing the sockets
-		{
-			RScopeLock lock(_socketMutex);
-			//terminate all socket listeners
-			_tcpListener->terminate();
-			delete _tcpListener;
-			if (_handleRTP) {
-				_udpListener->terminate();
-				delete _udpListener;
-			}
+		//release senders waiting for any link before we wait for the links
+		for (size_t i = 0; i < _links.size(); i++)
+			_links[i]->interrupt();
+		for (size_t i = 0; i < _links.size(); i++)
+			_links[i]->terminate();
 
-			//close all sockets
+		//close all sockets, the terminated links will not touch them anymore
 #ifdef WIN32
-			closesocket(_tcpSocket);
-			closesocket(_udpSocket);
-			WSACleanup();
+		closesocket(_tcpSocket);
+		closesocket(_udpSocket);
+		for (size_t i = 0; i < _dataSockets.size(); i++)
+			closesocket(_dataSockets[i]);
+		WSACleanup();
 #else
-			close(_tcpSocket);
-			close(_udpSocket);
+		close(_tcpSocket);
+		close(_udpSocket);
+		for (size_t i = 0; i < _dataSockets.size(); i++)
+			close(_dataSockets[i]);
 #endif
-		}
 		_innerNode.reset();
 	}
 
-	void sendMessage(BridgeMessage& msg, dummy channel) {
-		RScopeLock lock(_socketMutex);
+	void sendMessage(BridgeMessage& msg, dummy channel, size_t lane = 0) {
 		if (_shutdownDone)		//only send messages when active
 			return;
 		std::string packet;
-		if (channel == TCP) {
+		std::string message = msg.toString();
+		if (_protocolVersion >= 2) {
+			//control frame in the next batch
+			packet += (char)FRAME_CONTROL;
+			appendCompact(packet, message.length());
+		} else if (channel == TCP) {
 			//prefix message with message length so that our tcp stream could be split into individual messages easyliy at the remote bridge instance
-			std::string message = msg.toString();
 			uint32_t messageSize = htonl(message.length());
 			packet = std::string((char*)&messageSize, sizeof(uint32_t));
-			packet += message;
-		} else
-			packet = msg.toString();
-		if (send(channel == TCP ? _tcpSocket : _udpSocket, packet.c_str(), packet.length(), 0) != packet.length())
-			throw SocketException(std::string("Could not send data on ")+(channel == TCP ? "tcp" : "udp")+" socket");
+		}
+		if (channel == TCP)
+			_links[lane]->write(packet.data(), packet.length(), message.data(), message.length());
+		else
+			_links[lane]->writeDatagram(packet.data(), packet.length(), message.data(), message.length());
 	}
+
+	friend class BridgeLink;
 };
 
+MessageQueue& BridgeLink::queue() {
+	return _handler->_queue;
+}
+
+void BridgeLink::handlePacket(const char* packet, size_t size, dummy source) {
+	_handler->received(packet, size, source == TCP ? ProtocolHandler::TCP : ProtocolHandler::UDP, _remoteChannels);
+}
+
 GlobalReceiver::GlobalReceiver(std::string channelName, bool isRTP, boost::shared_ptr<ProtocolHandler> handler) : _channelName(channelName), _isRTP(isRTP), _handler(handler) { }
 
 void GlobalReceiver::receive(Message* msg) {
@@ -1069,10 +1623,16 @@ private:
 	std::string _connectIP;
 	uint16_t _connectPort;
 	bool _handoffDone;
+	uint16_t _protocolVersion;
+	bool _compressed;
+	uint16_t _lanes;
+	SOCKET _listenSocket;
+	std::vector<SOCKET> _dataSockets;
+	struct sockaddr_in _remoteAddress;
 	enum dummy { UDP, TCP };
 
 public:
-	Connector(uint16_t listenPort) : _listening(true), _connectIP(""), _connectPort(0), _handoffDone(false) {
+	Connector(uint16_t listenPort, uint16_t protocolVersion, bool compressed, uint16_t lanes) : _listening(true), _connectIP(""), _connectPort(0), _handoffDone(false), _protocolVersion(protocolVersion), _compressed(compressed), _lanes(lanes), _listenSocket(-1) {
 		initNetwork();
 
 		struct sockaddr_in addr;
@@ -1089,16 +1649,20 @@ public:
 			throw SocketException("Could not bind tcp socket to specified port: ");
 		if (bind(_udpSocket,(struct sockaddr*)&addr, sizeof(addr)) < 0)
 			throw SocketException("Could not bind udp socket to specified port");
-		if (listen(_tcpSocket, 1) == -1)
+		if (listen(_tcpSocket, 1 + lanes) == -1)
 			throw SocketException("Could not listen on tcp socket");
 	}
 
-	Connector(std::string connectIP, uint16_t connectPort) : _listening(false), _connectIP(connectIP), _connectPort(connectPort) {
+	Connector(std::string connectIP, uint16_t connectPort, uint16_t protocolVersion, bool compressed, uint16_t lanes) : _listening(false), _connectIP(connectIP), _connectPort(connectPort), _handoffDone(false), _protocolVersion(protocolVersion), _compressed(compressed), _lanes(lanes), _listenSocket(-1) {
 		initNetwork();
 	}
 
 	~Connector() {
+		if (_listenSocket != -1)
+			closeSocket(_listenSocket);
 		if (!_handoffDone) {			//dont close our sockets if handoff to ProtocolHandler is already done
+			for (size_t i = 0; i < _dataSockets.size(); i++)
+				closeSocket(_dataSockets[i]);
 #ifdef WIN32
 			closesocket(_tcpSocket);
 			closesocket(_udpSocket);
@@ -1126,12 +1690,9 @@ public:
 				}
 				break;
 			}
-#ifdef WIN32
-			closesocket(_tcpSocket);
-#else
-			close(_tcpSocket);
-#endif
+			_listenSocket = _tcpSocket;		//kept open until the data lanes are connected
 			_tcpSocket = newSocket;
+			memcpy(&_remoteAddress, &remoteAddress, sizeof(remoteAddress));
 
 			if (verbose)
 				std::cout << "Accepted connection from " << ipToStr(remoteAddress.sin_addr.s_addr) << ":" << ntohs(remoteAddress.sin_port) << " on tcp socket, sending serverHello message..." << std::endl;
@@ -1175,6 +1736,7 @@ public:
 				throw SocketException("Could not connect tcp socket");
 			if (connect(_udpSocket, res->ai_addr, res->ai_addrlen) == -1)		//use only the first returned address
 				throw SocketException("Could not connect udp socket");
+			memcpy(&_remoteAddress, res->ai_addr, sizeof(_remoteAddress));
 			freeaddrinfo(res);
 
 			//send "clientHello" on both channels
@@ -1202,15 +1764,96 @@ public:
 				std::cout << "WARNING: udp connection not functional --> only forwarding non-rtp pubs/subs..." << std::endl;
 		}
 
+		//both ends announce what they speak, bridges before version 2 will not understand this and close the connection
+		uint16_t protocolVersion = 1;
+		bool compressed = false;
+		uint16_t lanes = 0;
+		if (_protocolVersion >= 2) {
+			BridgeMessage ownProtocol;
+			ownProtocol.set("type", "protocol");
+			ownProtocol.set("version", _protocolVersion);
+			ownProtocol.set("compression", _compressed ? "lz4" : "none");
+			ownProtocol.set("lanes", _lanes);
+			std::string message = ownProtocol.toString();
+			uint32_t messageSize = htonl(message.length());
+			std::string packet = std::string((char*)&messageSize, sizeof(uint32_t)) + message;
+			if (send(_tcpSocket, packet.c_str(), packet.length(), 0) != (int)packet.length())
+				throw SocketException("Could not send data on tcp socket");
+
+			BridgeMessage remoteProtocol = waitForMessage(TIMEOUT);
+			if (remoteProtocol.get("type") != "protocol")
+				throw BridgeMessageException("Remote end does not negotiate a protocol version, use -p 1 for bridges before version 2");
+			protocolVersion = std::min(_protocolVersion, remoteProtocol.get<uint16_t>("version"));
+			compressed = protocolVersion >= 2 && _compressed && remoteProtocol.get("compression") == "lz4";
+			if (protocolVersion >= 2)
+				lanes = std::min(_lanes, remoteProtocol.get<uint16_t>("lanes"));
+		}
+
+		//one more tcp connection per data lane, the listening end accepts them in the order they were opened
+		for (uint16_t lane = 1; lane <= lanes; lane++) {
+			SOCKET dataSocket;
+			if (_listening) {
+				dataSocket = acceptLane();
+				_dataSockets.push_back(dataSocket);
+				if (waitForString("laneHello", TCP, TIMEOUT, NULL, 0, dataSocket))
+					throw BridgeMessageException("Error while receiving initial 'laneHello' on tcp socket");
+			} else {
+				dataSocket = socket(PF_INET, SOCK_STREAM, 0);
+				_dataSockets.push_back(dataSocket);
+				if (connect(dataSocket, (struct sockaddr*)&_remoteAddress, sizeof(_remoteAddress)) == -1)
+					throw SocketException("Could not connect tcp socket for lane "+toStr(lane));
+				if (send(dataSocket, "laneHello", 9, 0) != 9)
+					throw SocketException("Could not send data on tcp socket");
+			}
+		}
+
 		if (verbose)
-			std::cout << "Connection successfully established, now handing off to ProtocolHandler..." << std::endl;
+			std::cout << "Connection successfully established with protocol version " << protocolVersion << (compressed ? " (lz4)" : "") << " and " << lanes << " data lanes, now handing off to ProtocolHandler..." << std::endl;
 
 		_handoffDone = true;
-		return boost::shared_ptr<ProtocolHandler>(new ProtocolHandler(_tcpSocket, _udpSocket, handleRTP));
+		return boost::shared_ptr<ProtocolHandler>(new ProtocolHandler(_tcpSocket, _udpSocket, _dataSockets, handleRTP, protocolVersion, compressed));
 	}
 
 private:
-	bool waitForString(std::string string, dummy type, uint32_t timeout_s, struct sockaddr* srcAddr, socklen_t* addrlen) {
+	//accept a connection for a data lane from the host we are connected to
+	SOCKET acceptLane() {
+		while(true) {
+			struct timeval time;
+#ifdef WIN32
+			FD_SET receive;
+#else
+			fd_set receive;
+#endif
+			FD_ZERO(&receive);
+			FD_SET(_listenSocket, &receive);
+			time.tv_sec = TIMEOUT;
+			time.tv_usec = 0;
+			if (select(_listenSocket+1, &receive, NULL, NULL, &time) <= 0)
+				throw BridgeMessageException("Timeout while waiting for data lane connections");
+			struct sockaddr_in remoteAddress;
+			socklen_t remoteAddressLength = sizeof(remoteAddress);
+			SOCKET newSocket = accept(_listenSocket, (struct sockaddr*)&remoteAddress, &remoteAddressLength);
+			if (newSocket == -1) {
+				if (errno == EINTR)
+					continue;
+				throw SocketException("Could not accept connection on tcp socket");
+			}
+			if (remoteAddress.sin_addr.s_addr == _remoteAddress.sin_addr.s_addr)
+				return newSocket;
+			std::cout << "WARNING: rejecting connection from " << ipToStr(remoteAddress.sin_addr.s_addr) << " while connecting data lanes" << std::endl;
+			closeSocket(newSocket);
+		}
+	}
+
+	void closeSocket(SOCKET socket) {
+#ifdef WIN32
+		closesocket(socket);
+#else
+		close(socket);
+#endif
+	}
+
+	bool waitForString(std::string string, dummy type, uint32_t timeout_s, struct sockaddr* srcAddr, socklen_t* addrlen, SOCKET laneSocket = -1) {
 		char* buffer;
 		int retval;
 		SOCKET socket;
@@ -1222,7 +1865,9 @@ private:
 #endif
 		FD_ZERO(&receive);
 
-		if (type == TCP)
+		if (laneSocket != -1)
+			socket = laneSocket;
+		else if (type == TCP)
 			socket = _tcpSocket;
 		else
 			socket = _udpSocket;
@@ -1239,7 +1884,7 @@ private:
 				retval = recvAll(socket, buffer, string.length(), 0, srcAddr, addrlen) ? 0 : string.length();
 			else
 				retval = recvfrom(socket, buffer, string.length(), 0, srcAddr, addrlen);
-			if (retval>0 && retval != string.length())
+			if (retval>0 && retval != (int)string.length())
 				throw std::runtime_error(std::string("Could not read on ")+(type == TCP ? "tcp" : "udp")+" socket ("+toStr(retval)+" != "+toStr(string.length())+")");
 			else if (retval <= 0)
 				throw SocketException(std::string("Could not read on ")+(type == TCP ? "tcp" : "udp")+" socket ("+toStr(retval)+")");
@@ -1251,6 +1896,31 @@ private:
 		return true;		//timeout
 	}
 
+	BridgeMessage waitForMessage(uint32_t timeout_s) {
+		struct timeval time;
+#ifdef WIN32
+		FD_SET receive;
+#else
+		fd_set receive;
+#endif
+		FD_ZERO(&receive);
+		FD_SET(_tcpSocket, &receive);
+		time.tv_sec = timeout_s;
+		time.tv_usec = 0;
+		if (select(_tcpSocket+1, &receive, NULL, NULL, &time) <= 0 || !FD_ISSET(_tcpSocket, &receive))
+			throw BridgeMessageException("Timeout while receiving 'protocol' on tcp socket");
+		uint32_t messageSize = 0;
+		if (recvAll(_tcpSocket, (char*)&messageSize, sizeof(uint32_t), 0, NULL, 0))
+			throw SocketException("Could not read on tcp socket");
+		messageSize = ntohl(messageSize);
+		if (messageSize == 0 || messageSize > 65536)
+			throw BridgeMessageException("Unexpected message size on tcp socket ("+toStr(messageSize)+")");
+		std::vector<char> buffer(messageSize);
+		if (recvAll(_tcpSocket, &buffer[0], messageSize, 0, NULL, 0))
+			throw SocketException("Could not read on tcp socket");
+		return BridgeMessage(&buffer[0], messageSize);
+	}
+
 	bool recvAll(SOCKET socket, char* buffer, size_t length, int flags, struct sockaddr* srcAddr, socklen_t* addrlen) {
 		int retval;
 		do {
@@ -1301,23 +1971,183 @@ void test_BridgeMessage() {
 	assert(newMsg.get<bool>("false") == false);
 }
 
+//test compact lengths in frames of protocol version 2
+void test_Frames() {
+	std::string frame;
+	uint64_t values[] = { 0, 253, 254, 65535, 65536, 1ULL << 40 };
+	for (size_t i = 0; i < sizeof(values) / sizeof(uint64_t); i++)
+		appendCompact(frame, values[i]);
+
+	const char* from = frame.data();
+	const char* end = frame.data() + frame.size();
+	for (size_t i = 0; i < sizeof(values) / sizeof(uint64_t); i++) {
+		uint64_t value = 0;
+		from = readCompact(from, end, value);
+		assert(value == values[i]);
+	}
+	assert(from == end);
+
+	bool truncated = false;
+	try {
+		uint64_t value;
+		readCompact(frame.data() + frame.size() - 9, end - 1, value);		//last value needs all 9 bytes
+	} catch(BridgeMessageException& e) {
+		truncated = true;
+	}
+	assert(truncated);
+}
+
 //test internal classes
 void test_All() {
 	std::cout << "Testing BridgeMessage (de-)serialisation..." << std::endl;
 	test_BridgeMessage();
+	std::cout << "Testing frame lengths..." << std::endl;
+	test_Frames();
 	std::cout << "All tests passed successfully..." << std::endl;
 }
 
+//one of the two bridges of the loopback benchmark, accepts the connection and runs the mainloop
+class BenchBridge : public Thread {
+public:
+	Connector* connector;
+	boost::shared_ptr<ProtocolHandler> handler;
+	boost::shared_ptr<Node> innerNode;
+	PubMonitor* monitor;
+
+	BenchBridge() : connector(NULL), monitor(NULL) { }
+
+	void run() {
+		try {
+			if (!handler) {
+				handler = connector->waitForConnection();
+				return;
+			}
+			handler->mainloop();
+		} catch(std::runtime_error& e) {
+			std::cout << "Got runtime_error with message '" << e.what() << "'" << std::endl;
+		}
+	}
+
+	void attach() {
+		innerNode = boost::shared_ptr<Node>(new Node());
+		monitor = new PubMonitor(handler);
+		innerNode->addPublisherMonitor(monitor);
+		handler->setNode(innerNode);
+		start();
+	}
+
+	void detach() {
+		handler->terminate();
+		join();
+		innerNode->clearPublisherMonitors();
+		delete monitor;
+	}
+};
+
+class BenchReceiver : public Receiver {
+public:
+	RMutex mutex;
+	uint64_t msgs;
+	uint64_t bytes;
+	uint64_t first;
+	uint64_t last;
+
+	BenchReceiver() : msgs(0), bytes(0), first(0), last(0) { }
+
+	void receive(Message* msg) {
+		RScopeLock lock(mutex);
+		last = Thread::getTimeStampMs();
+		if (msgs == 0)
+			first = last;
+		msgs++;
+		bytes += msg->size();
+	}
+};
+
+//publish through two bridges connected via loopback and report what arrives
+void bench_Loopback(uint16_t port, uint16_t protocolVersion, bool compressed, uint16_t lanes) {
+	BenchBridge listening;
+	BenchBridge connecting;
+	listening.connector = new Connector(port, protocolVersion, compressed, lanes);
+	connecting.connector = new Connector("127.0.0.1", port, protocolVersion, compressed, lanes);
+	listening.start();
+	try {
+		connecting.handler = connecting.connector->waitForConnection();
+	} catch(std::runtime_error& e) {
+		std::cout << "Got runtime_error with message '" << e.what() << "'" << std::endl;
+	}
+	listening.join();
+	delete listening.connector;
+	delete connecting.connector;
+	if (!listening.handler || !connecting.handler)
+		return;
+	listening.attach();
+	connecting.attach();
+
+	//publisher and subscriber in nodes of their own, each connected to the inner node of one bridge
+	Node pubNode;
+	Node subNode;
+	pubNode.add(*listening.innerNode);
+	listening.innerNode->add(pubNode);
+	subNode.add(*connecting.innerNode);
+	connecting.innerNode->add(subNode);
+
+	BenchReceiver receiver;
+	Publisher pub("umundo.bridge.bench");
+	Subscriber sub("umundo.bridge.bench");
+	sub.setReceiver(&receiver);
+	pubNode.addPublisher(pub);
+	subNode.addSubscriber(sub);
+	if (pub.waitForSubscribers(1, TIMEOUT * 1000) < 1) {
+		std::cout << "Subscription did not arrive through the bridges" << std::endl;
+	} else {
+		std::cout << "Protocol version " << protocolVersion << (compressed ? " with lz4" : "") << (protocolVersion >= 2 ? ", " + toStr(lanes) + " data lanes" : "") << std::endl;
+		size_t sizes[] = { 16, 256, 4096, 65536 };
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+			{
+				RScopeLock lock(receiver.mutex);
+				receiver.msgs = receiver.bytes = 0;
+			}
+			std::string data(sizes[i], 'x');
+			uint64_t sent = 0;
+			uint64_t start = Thread::getTimeStampMs();
+			while(Thread::getTimeStampMs() - start < BENCH_DURATION_MS) {
+				Message msg(data.data(), data.size());
+				msg.putMeta("seq", toStr(sent));
+				pub.send(&msg);
+				sent++;
+			}
+			Thread::sleepMs(1000);		//let the last messages arrive
+
+			RScopeLock lock(receiver.mutex);
+			double seconds = (receiver.last > receiver.first ? receiver.last - receiver.first : 1) / 1000.0;
+			std::cout << std::setw(6) << sizes[i] << " bytes: "
+			          << sent << " sent, " << receiver.msgs << " received, "
+			          << (uint64_t)(receiver.msgs / seconds) << " msgs/s, "
+			          << std::fixed << std::setprecision(2) << (receiver.bytes / seconds / (1024 * 1024)) << " MB/s" << std::endl;
+		}
+	}
+
+	subNode.removeSubscriber(sub);
+	pubNode.removePublisher(pub);
+	connecting.detach();
+	listening.detach();
+}
+
 int main(int argc, char** argv) {
 	int option;
 	int listen = 0;
 	std::string remoteIP = "";
 	uint16_t remotePort = 0;
+	uint16_t protocolVersion = PROTOCOL_VERSION;
+	bool compressed = false;
+	uint16_t lanes = DATA_LANES;
+	bool bench = false;
 	Connector* connector;
 	boost::shared_ptr<ProtocolHandler> handler;
 
 	printf("umundo-bridge version " UMUNDO_VERSION " (" CMAKE_BUILD_TYPE " build)\n");
-	while((option = getopt(argc, argv, "tvd:l:c:")) != -1) {
+	while((option = getopt(argc, argv, "tbzvd:l:c:p:n:P:")) != -1) {
 		switch(option) {
 		case 'd':
 			domain = optarg;
@@ -1338,6 +2168,32 @@ int main(int argc, char** argv) {
 			remotePort = endPoint.getPort();
 			break;
 		}
+		case 'p':
+			protocolVersion = strTo<uint16_t>(optarg);
+			if (protocolVersion < 1 || protocolVersion > PROTOCOL_VERSION)
+				printUsageAndExit();
+			break;
+		case 'z':
+#ifndef BUILD_WITH_COMPRESSION_LZ4
+			std::cout << "WARNING: built without lz4, not compressing the connection" << std::endl;
+			break;
+#endif
+			compressed = true;
+			break;
+		case 'n':
+			lanes = strTo<uint16_t>(optarg);
+			break;
+		case 'P': {
+			std::string channelPriority(optarg);
+			size_t separator = channelPriority.rfind('=');
+			if (separator == std::string::npos || separator == 0)
+				printUsageAndExit();
+			channelPriorities[channelPriority.substr(0, separator)] = strTo<int>(channelPriority.substr(separator + 1));
+			break;
+		}
+		case 'b':
+			bench = true;
+			break;
 		case 't':
 			test_All();
 			return 0;
@@ -1346,6 +2202,10 @@ int main(int argc, char** argv) {
 			break;
 		}
 	}
+	if (bench) {
+		bench_Loopback(listen ? listen : BENCH_PORT, protocolVersion, compressed, lanes);
+		return 0;
+	}
 	if (optind < argc || (listen == 0 && remotePort == 0))
 		printUsageAndExit();
 
@@ -1361,11 +2221,11 @@ int main(int argc, char** argv) {
 			if (listen) {
 				if (verbose)
 					std::cout << "Listening at tcp and udp port " << listen << std::endl;
-				connector = new Connector(listen);
+				connector = new Connector(listen, protocolVersion, compressed, lanes);
 			} else {
 				if (verbose)
 					std::cout << "Connecting to remote bridge instance at " << remoteIP << ":" << remotePort << std::endl;
-				connector = new Connector(remoteIP, remotePort);
+				connector = new Connector(remoteIP, remotePort, protocolVersion, compressed, lanes);
 			}
 			handler = connector->waitForConnection();
 			delete connector;
@@ -0,0 +1,198 @@
+/**
+ *  Copyright (C) 2016  Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ */
+
+#include "umundo/config.h"
+#include "umundo.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+
+#ifdef WIN32
+#include "XGetopt.h"
+#endif
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+#ifdef BUILD_WITH_COMPRESSION_ZSTD
+#include <zdict.h>
+#endif
+
+extern "C" {
+#include "datagen.h"
+}
+
+#define FORMAT_COL std::setw(14) << std::left
+
+using namespace umundo;
+
+size_t mtu = 1280;
+size_t corpusSize = 64 * 1024 * 1024;
+double compressibility = 50;
+int compressionLevel = -1;
+bool compressionWithState = false;
+
+std::string corpus;
+
+void printUsageAndExit() {
+	printf("umundo-compression-bench version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
+	printf("Usage\n");
+	printf("\tumundo-compression-bench [-m N] [-n BYTES] [-c N] [-l N] [-y]\n");
+	printf("\n");
+	printf("Options\n");
+	printf("\t-m <number>         : message size (defaults to 1280)\n");
+	printf("\t-n BYTES            : size of the synthetic corpus (defaults to 64M)\n");
+	printf("\t-c <number>         : compressibility of the corpus in percent as with umundo-throughput -f\n");
+	printf("\t-l <number>         : compression level, codec default if not given\n");
+	printf("\t-y                  : compress with state as with umundo-throughput -y\n");
+	exit(1);
+}
+
+size_t displayToBytes(const std::string& value) {
+	size_t multiply = 1;
+	char suffix = value[value.length() - 1];
+	if (suffix == 'K' || suffix == 'k')
+		multiply = 1024;
+	if (suffix == 'M' || suffix == 'm')
+		multiply = 1024 * 1024;
+	if (suffix == 'G' || suffix == 'g')
+		multiply = 1024 * 1024 * 1024;
+	size_t result = atol((multiply > 1 ? value.substr(0, value.length() - 1).c_str() : value.c_str()));
+	result *= multiply;
+	return result;
+}
+
+double toMBs(size_t bytes, uint64_t ms) {
+	if (ms == 0)
+		ms = 1;
+	return ((double)bytes / (1024 * 1024)) / ((double)ms / 1000);
+}
+
+void benchCodec(const std::string& codec, const std::string& label) {
+	std::vector<std::pair<char*, size_t> > compressed;
+	compressed.reserve(corpus.size() / mtu + 1);
+
+	size_t compressedBytes = 0;
+	void* ctx = (compressionWithState ? Message::createCompression(codec) : NULL);
+
+	uint64_t start = Thread::getTimeStampMs();
+	for (size_t offset = 0; offset < corpus.size(); offset += mtu) {
+		size_t size = (corpus.size() - offset < mtu ? corpus.size() - offset : mtu);
+		Message msg(&corpus[offset], size, Message::WRAP_DATA);
+
+		size_t bounds = msg.getCompressBounds(codec, ctx, Message::PAYLOAD);
+		char* buffer = (char*)malloc(bounds);
+		size_t compressedSize = msg.compress(codec, ctx, buffer, bounds, Message::PAYLOAD, compressionLevel);
+		compressed.push_back(std::make_pair(buffer, compressedSize));
+		compressedBytes += compressedSize;
+	}
+	uint64_t compressMs = Thread::getTimeStampMs() - start;
+	Message::freeCompression(ctx, codec);
+
+	ctx = (compressionWithState ? Message::createCompression(codec) : NULL);
+	bool failed = false;
+
+	start = Thread::getTimeStampMs();
+	size_t offset = 0;
+	for (std::vector<std::pair<char*, size_t> >::iterator msgIter = compressed.begin(); msgIter != compressed.end(); msgIter++) {
+		size_t size = (corpus.size() - offset < mtu ? corpus.size() - offset : mtu);
+		Message msg;
+		if (msg.uncompress(codec, ctx, msgIter->first, msgIter->second, Message::PAYLOAD, size) != size ||
+		        memcmp(msg.data(), &corpus[offset], size) != 0) {
+			failed = true;
+		}
+		offset += size;
+	}
+	uint64_t uncompressMs = Thread::getTimeStampMs() - start;
+	Message::freeCompression(ctx, codec);
+
+	for (std::vector<std::pair<char*, size_t> >::iterator msgIter = compressed.begin(); msgIter != compressed.end(); msgIter++) {
+		free(msgIter->first);
+	}
+
+	std::cout << FORMAT_COL << label;
+	std::cout << FORMAT_COL << std::setprecision(4) << 100 * ((double)compressedBytes / corpus.size());
+	std::cout << FORMAT_COL << std::setprecision(5) << toMBs(corpus.size(), compressMs);
+	std::cout << FORMAT_COL << std::setprecision(5) << toMBs(corpus.size(), uncompressMs);
+	std::cout << (failed ? "FAILED" : "") << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int option;
+	while ((option = getopt(argc, argv, "ym:n:c:l:")) != -1) {
+		switch(option) {
+		case 'y':
+			compressionWithState = true;
+			break;
+		case 'm':
+			mtu = displayToBytes(optarg);
+			break;
+		case 'n':
+			corpusSize = displayToBytes(optarg);
+			break;
+		case 'c':
+			compressibility = strTo<double>(optarg);
+			break;
+		case 'l':
+			compressionLevel = strTo<int>(optarg);
+			break;
+		default:
+			printUsageAndExit();
+			break;
+		}
+	}
+
+	if (mtu == 0 || corpusSize == 0)
+		printUsageAndExit();
+
+	// same synthetic data as umundo-throughput -f size:comp
+	corpus.resize(corpusSize);
+	RDG_genBuffer(&corpus[0], corpusSize, 1 - (compressibility/(double)100), 0.0, 0);
+
+	std::cout << FORMAT_COL << "codec";
+	std::cout << FORMAT_COL << "ratio %";
+	std::cout << FORMAT_COL << "compr MB/s";
+	std::cout << FORMAT_COL << "decompr MB/s";
+	std::cout << std::endl;
+
+	std::vector<std::string> codecs = Message::getCompressionCodecs();
+	for (std::vector<std::string>::iterator codecIter = codecs.begin(); codecIter != codecs.end(); codecIter++) {
+		benchCodec(*codecIter, *codecIter);
+	}
+
+#ifdef BUILD_WITH_COMPRESSION_ZSTD
+	{
+		// train a dictionary on messages from another part of the corpus distribution
+		std::string samples(corpusSize < 16 * 1024 * 1024 ? corpusSize : 16 * 1024 * 1024, 0);
+		RDG_genBuffer(&samples[0], samples.size(), 1 - (compressibility/(double)100), 0.0, 1);
+		std::vector<size_t> sampleSizes(samples.size() / mtu, mtu);
+
+		std::string dict(1 << 16, 0);
+		size_t dictSize = 0;
+		if (sampleSizes.size() > 0)
+			dictSize = ZDICT_trainFromBuffer(&dict[0], dict.size(), samples.data(), &sampleSizes[0], sampleSizes.size());
+		if (sampleSizes.size() == 0 || ZDICT_isError(dictSize)) {
+			std::cout << "Could not train zstd dictionary" << std::endl;
+		} else {
+			Message::setCompressionDictionary("zstd", dict.data(), dictSize);
+			benchCodec("zstd", "zstd+dict");
+		}
+	}
+#endif
+
+	return EXIT_SUCCESS;
+}
@@ -120,6 +120,12 @@ public:
 	std::string channelName;
 	std::string msgsPerSecSent;
 	std::string bytesPerSecSent;
+	std::string msgsPerSecCompressed;
+	std::string msgsPerSecComprSkipped;
+	std::string sizeP50;
+	std::string sizeP99;
+	std::string intervalP50; ///< us between messages
+	std::string intervalP99;
 	std::map<std::string, DebugNode*> availableAtNode;
 	std::map<std::string, DebugNode*> knownByNode;
 	std::map<std::string, DebugSub*> connFromSubs;
@@ -149,6 +155,8 @@ public:
 	std::string bytesPerSecSent;
 	std::string msgsPerSecRcvd;
 	std::string bytesPerSecRcvd;
+	std::string poolHitRate;
+	std::string poolHighWaterBytes;
 	std::map<std::string, DebugNode*> connTo;
 	std::map<std::string, DebugNode*> connFrom;
 	std::map<std::string, DebugSub*> subs;
@@ -280,6 +288,9 @@ void processDebugNode(DebugNode* node) {
 	if (node->bytesPerSecRcvd.size() > 0) {
 		labelSS << "Rcvd: " << bytesToDisplay(strTo<uint64_t>(node->bytesPerSecRcvd)) << "/s in " << node->msgsPerSecRcvd << "msg/s<br />";
 	}
+	if (node->poolHitRate.size() > 0) {
+		labelSS << "Buffers: " << (int)(100 * strTo<double>(node->poolHitRate)) << "% reused, peak " << bytesToDisplay(strTo<uint64_t>(node->poolHighWaterBytes)) << "<br />";
+	}
 	labelSS << ">";
 	dotNodes[node->uuid].attr["label"] = labelSS.str();
 
@@ -410,6 +421,13 @@ void processDebugPub(DebugPub* pub) {
 	if (pub->bytesPerSecSent.size() > 0) {
 		labelSS << "Sent: " << bytesToDisplay(strTo<uint64_t>(pub->bytesPerSecSent)) << " in " << pub->msgsPerSecSent << "msg/s<br />";
 	}
+	if (strTo<double>(pub->msgsPerSecCompressed) > 0 || strTo<double>(pub->msgsPerSecComprSkipped) > 0) {
+		labelSS << "Compressed: " << pub->msgsPerSecCompressed << "msg/s, skipped " << pub->msgsPerSecComprSkipped << "msg/s<br />";
+	}
+	if (strTo<uint64_t>(pub->sizeP99) > 0) {
+		labelSS << "Size p50/p99: " << bytesToDisplay(strTo<uint64_t>(pub->sizeP50)) << " / " << bytesToDisplay(strTo<uint64_t>(pub->sizeP99)) << "<br />";
+		labelSS << "Interval p50/p99: " << pub->intervalP50 << "us / " << pub->intervalP99 << "us<br />";
+	}
 
 	labelSS << ">";
 	dotNodes[pub->uuid].attr["label"] = labelSS.str();
@@ -667,6 +685,8 @@ void populateEntities() {
 		CHECK_AND_ASSIGN("sent:bytes:", currNode->bytesPerSecSent);
 		CHECK_AND_ASSIGN("rcvd:msgs:", currNode->msgsPerSecRcvd);
 		CHECK_AND_ASSIGN("rcvd:bytes:", currNode->bytesPerSecRcvd);
+		CHECK_AND_ASSIGN("pool:hitRate:", currNode->poolHitRate);
+		CHECK_AND_ASSIGN("pool:highWater:bytes:", currNode->poolHighWaterBytes);
 
 		// process publishers
 		key = "pub:";
@@ -691,6 +711,12 @@ void populateEntities() {
 			CHECK_AND_ASSIGN("pub:type:", currPub->type);
 			CHECK_AND_ASSIGN("pub:sent:msgs:", currPub->msgsPerSecSent);
 			CHECK_AND_ASSIGN("pub:sent:bytes:", currPub->bytesPerSecSent);
+			CHECK_AND_ASSIGN("pub:sent:compressed:", currPub->msgsPerSecCompressed);
+			CHECK_AND_ASSIGN("pub:sent:comprSkipped:", currPub->msgsPerSecComprSkipped);
+			CHECK_AND_ASSIGN("pub:sent:size:p50:", currPub->sizeP50);
+			CHECK_AND_ASSIGN("pub:sent:size:p99:", currPub->sizeP99);
+			CHECK_AND_ASSIGN("pub:sent:interval:p50:", currPub->intervalP50);
+			CHECK_AND_ASSIGN("pub:sent:interval:p99:", currPub->intervalP99);
 
 			// remote sub registered at the publisher
 			key = "pub:sub";
@@ -0,0 +1,167 @@
+/**
+ *  Copyright (C) 2016  Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ */
+
+#include "umundo/config.h"
+#include "umundo.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string.h>
+
+#ifdef WIN32
+#include "XGetopt.h"
+#endif
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+#define FORMAT_COL std::setw(12) << std::left
+
+using namespace umundo;
+
+size_t nrSubscribers = 1000;
+size_t nrMessages = 100;
+size_t nrThreads = 0;
+
+void printUsageAndExit() {
+	printf("umundo-dispatch-bench version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
+	printf("Usage\n");
+	printf("\tumundo-dispatch-bench [-s N] [-n N] [-t N]\n");
+	printf("\n");
+	printf("Options\n");
+	printf("\t-s <number>         : subscribers on the receiving node (defaults to 1000)\n");
+	printf("\t-n <number>         : messages every subscriber receives (defaults to 100)\n");
+	printf("\t-t <number>         : dispatcher threads (defaults to one per core)\n");
+	exit(1);
+}
+
+class LatencyReceiver : public Receiver {
+public:
+	LatencyReceiver(Histogram* latencies) : _latencies(latencies) {}
+	void receive(Message* msg) {
+		uint64_t sentAt;
+		if (msg->size() < sizeof(sentAt))
+			return;
+		memcpy(&sentAt, msg->data(), sizeof(sentAt));
+		_latencies->record(Thread::getTimeStampUs() - sentAt);
+	}
+	Histogram* _latencies;
+};
+
+/// value of a field in /proc/self/status, empty where there is none
+std::string procStatus(const std::string& field) {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.substr(0, field.size() + 1) == field + ":") {
+			size_t start = line.find_first_not_of(" \t", field.size() + 1);
+			return (start == std::string::npos ? "" : line.substr(start));
+		}
+	}
+	return "";
+}
+
+void run(const std::string& mode, bool useDispatcher) {
+	Histogram latencies;
+	LatencyReceiver receiver(&latencies);
+
+	Node pubNode;
+	Publisher pub("dispatch.bench");
+	pubNode.addPublisher(pub);
+
+	NodeConfig subConfig(0, 0);
+	if (useDispatcher)
+		subConfig.setDispatchThreads(nrThreads);
+	Node subNode(&subConfig);
+
+	std::list<Subscriber> subs;
+	for (size_t i = 0; i < nrSubscribers; i++) {
+		SubscriberConfigTCP config("dispatch.bench");
+		Subscriber sub(&config);
+		sub.setReceiver(&receiver);
+		subNode.addSubscriber(sub);
+		subs.push_back(sub);
+	}
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+	pub.waitForSubscribers(nrSubscribers);
+
+	std::string threads = procStatus("Threads");
+	std::string memory = procStatus("VmRSS");
+
+	for (size_t i = 0; i < nrMessages; i++) {
+		uint64_t now = Thread::getTimeStampUs();
+		Message msg((const char*)&now, sizeof(now));
+		pub.send(&msg);
+		Thread::sleepMs(10);
+	}
+
+	// wait for stragglers
+	uint64_t expected = nrMessages * nrSubscribers;
+	for (size_t i = 0; i < 100 && latencies.snapshot().count < expected; i++)
+		Thread::sleepMs(50);
+
+	Histogram::Snapshot snapshot = latencies.snapshot();
+	std::cout << FORMAT_COL << mode;
+	std::cout << FORMAT_COL << (threads.size() > 0 ? threads : "n/a");
+	std::cout << FORMAT_COL << (memory.size() > 0 ? memory : "n/a");
+	std::cout << FORMAT_COL << snapshot.count;
+	std::cout << FORMAT_COL << snapshot.percentile(50);
+	std::cout << FORMAT_COL << snapshot.percentile(99);
+	std::cout << FORMAT_COL << snapshot.max;
+	std::cout << std::endl;
+
+	std::list<Subscriber>::iterator subIter = subs.begin();
+	while (subIter != subs.end()) {
+		subNode.removeSubscriber(*subIter);
+		subIter->setReceiver(NULL);
+		subIter++;
+	}
+}
+
+int main(int argc, char** argv) {
+	int option;
+	while ((option = getopt(argc, argv, "s:n:t:")) != -1) {
+		switch(option) {
+		case 's':
+			nrSubscribers = strTo<size_t>(optarg);
+			break;
+		case 'n':
+			nrMessages = strTo<size_t>(optarg);
+			break;
+		case 't':
+			nrThreads = strTo<size_t>(optarg);
+			break;
+		default:
+			printUsageAndExit();
+			break;
+		}
+	}
+
+	if (nrSubscribers == 0 || nrMessages == 0)
+		printUsageAndExit();
+
+	std::cout << FORMAT_COL << "mode" << FORMAT_COL << "threads" << FORMAT_COL << "rss";
+	std::cout << FORMAT_COL << "delivered" << FORMAT_COL << "p50 us" << FORMAT_COL << "p99 us" << FORMAT_COL << "max us";
+	std::cout << std::endl;
+
+	run("thread/sub", false);
+	run("dispatcher", true);
+
+	return EXIT_SUCCESS;
+}
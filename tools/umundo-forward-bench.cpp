@@ -0,0 +1,181 @@
+/**
+ *  Copyright (C) 2016  Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ */
+
+#include "umundo/config.h"
+#include "umundo.h"
+
+#include <iostream>
+#include <iomanip>
+
+#ifdef WIN32
+#include "XGetopt.h"
+#endif
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+#define FORMAT_COL std::setw(14) << std::left
+#define TIMEOUT_MS 30000
+
+using namespace umundo;
+
+size_t maxThreads = 8;
+size_t nrMessages = 100000;
+size_t msgSize = 64;
+
+void printUsageAndExit() {
+	printf("umundo-forward-bench version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
+	printf("Usage\n");
+	printf("\tumundo-forward-bench [-t N] [-n N] [-s N]\n");
+	printf("\n");
+	printf("Options\n");
+	printf("\t-t <number>         : most publishing threads, doubled from 1 (defaults to 8)\n");
+	printf("\t-n <number>         : messages every thread sends (defaults to 100000)\n");
+	printf("\t-s <bytes>          : payload size (defaults to 64)\n");
+	exit(1);
+}
+
+class CountingReceiver : public Receiver {
+public:
+	CountingReceiver() : _received(0) {}
+	void receive(Message* msg) {
+		ScopeLock lock(_mutex);
+		_received++;
+	}
+	size_t received() {
+		ScopeLock lock(_mutex);
+		return _received;
+	}
+	Mutex _mutex;
+	size_t _received;
+};
+
+/// sends as fast as it can with a publisher of its own
+class PublishingThread : public Thread {
+public:
+	PublishingThread(Publisher pub) : _pub(pub) {}
+	void run() {
+		std::string payload(msgSize, 'x');
+		for (size_t i = 0; i < nrMessages; i++) {
+			Message msg(payload.data(), payload.size());
+			_pub.send(&msg);
+		}
+	}
+	Publisher _pub;
+};
+
+/**
+ * Publishers in their own threads on one node send to a subscriber on another.
+ * All of them hand their messages to the thread of the node, with more threads
+ * we would rather see more messages delivered per second than fewer.
+ */
+void run(size_t nrThreads) {
+	CountingReceiver receiver;
+
+	Node pubNode;
+	NodeConfig subConfig(0, 0);
+	Node subNode(&subConfig);
+
+	SubscriberConfigTCP config("forward.bench");
+	Subscriber sub(&config);
+	sub.setReceiver(&receiver);
+	subNode.addSubscriber(sub);
+
+	std::vector<Publisher> pubs;
+	for (size_t i = 0; i < nrThreads; i++) {
+		PublisherConfigTCP pubConfig("forward.bench");
+		pubConfig.setHighWaterMark(nrMessages);
+		Publisher pub(&pubConfig);
+		pubNode.addPublisher(pub);
+		pubs.push_back(pub);
+	}
+
+	subNode.add(pubNode);
+	pubNode.add(subNode);
+	for (size_t i = 0; i < pubs.size(); i++)
+		pubs[i].waitForSubscribers(1);
+
+	std::vector<PublishingThread*> threads;
+	for (size_t i = 0; i < nrThreads; i++)
+		threads.push_back(new PublishingThread(pubs[i]));
+
+	uint64_t start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i]->start();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i]->join();
+	uint64_t sent = Thread::getTimeStampMs();
+
+	// messages above the high-water mark are dropped, wait until nothing arrives anymore
+	size_t expected = nrThreads * nrMessages;
+	size_t received = receiver.received();
+	uint64_t lastArrival = Thread::getTimeStampMs();
+	while (received < expected && Thread::getTimeStampMs() - lastArrival < 500 && Thread::getTimeStampMs() - start < TIMEOUT_MS) {
+		Thread::sleepMs(5);
+		if (receiver.received() != received) {
+			received = receiver.received();
+			lastArrival = Thread::getTimeStampMs();
+		}
+	}
+	uint64_t elapsed = lastArrival - start;
+	if (elapsed == 0)
+		elapsed = 1;
+
+	std::cout << FORMAT_COL << nrThreads;
+	std::cout << FORMAT_COL << (sent - start > 0 ? expected * 1000 / (sent - start) : expected * 1000);
+	std::cout << FORMAT_COL << received;
+	std::cout << FORMAT_COL << received * 1000 / elapsed;
+	std::cout << std::endl;
+
+	for (size_t i = 0; i < threads.size(); i++)
+		delete threads[i];
+	for (size_t i = 0; i < pubs.size(); i++)
+		pubNode.removePublisher(pubs[i]);
+	subNode.removeSubscriber(sub);
+	sub.setReceiver(NULL);
+}
+
+int main(int argc, char** argv) {
+	int option;
+	while ((option = getopt(argc, argv, "t:n:s:")) != -1) {
+		switch(option) {
+		case 't':
+			maxThreads = strTo<size_t>(optarg);
+			break;
+		case 'n':
+			nrMessages = strTo<size_t>(optarg);
+			break;
+		case 's':
+			msgSize = strTo<size_t>(optarg);
+			break;
+		default:
+			printUsageAndExit();
+			break;
+		}
+	}
+
+	if (maxThreads == 0 || nrMessages == 0)
+		printUsageAndExit();
+
+	std::cout << nrMessages << " messages of " << msgSize << " bytes per publishing thread" << std::endl;
+	std::cout << FORMAT_COL << "threads" << FORMAT_COL << "sent msg/s" << FORMAT_COL << "delivered" << FORMAT_COL << "msg/s";
+	std::cout << std::endl;
+
+	for (size_t nrThreads = 1; nrThreads <= maxThreads; nrThreads *= 2)
+		run(nrThreads);
+
+	return EXIT_SUCCESS;
+}
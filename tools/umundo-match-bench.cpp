@@ -0,0 +1,243 @@
+/**
+ *  Copyright (C) 2016  Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ */
+
+#include "umundo/config.h"
+#include "umundo.h"
+#include "umundo/connection/ChannelIndex.h"
+
+#include <iostream>
+#include <iomanip>
+
+#ifdef WIN32
+#include "XGetopt.h"
+#endif
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+#define FORMAT_COL std::setw(14) << std::left
+
+using namespace umundo;
+
+size_t nrNodes = 200;
+size_t nrPubsPerNode = 50;
+size_t nrSubscribers = 100;
+
+void printUsageAndExit() {
+	printf("umundo-match-bench version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
+	printf("Usage\n");
+	printf("\tumundo-match-bench [-n N] [-p N] [-s N]\n");
+	printf("\n");
+	printf("Options\n");
+	printf("\t-n <number>         : simulated remote nodes (defaults to 200)\n");
+	printf("\t-p <number>         : publishers per node (defaults to 50)\n");
+	printf("\t-s <number>         : local subscribers (defaults to 100)\n");
+	exit(1);
+}
+
+/**
+ * Pairs local subscribers with the publishers of remote nodes as they come up,
+ * the way a node does when it learns about them, just without the sockets.
+ */
+class Matcher {
+public:
+	virtual ~Matcher() {}
+	virtual void addNode(NodeStub node) = 0;
+	virtual void addSubscriber(const std::string& channel, const std::string& uuid) = 0;
+	virtual void removeSubscriber(const std::string& channel, const std::string& uuid) = 0;
+
+	size_t pairs;
+
+protected:
+	Matcher() : pairs(0) {}
+	static bool matches(const std::string& subChannel, const PublisherStub& pub) {
+		return pub.getChannelName().compare(0, subChannel.size(), subChannel) == 0;
+	}
+};
+
+/// every subscriber against every publisher of every node, as we used to
+class ScanMatcher : public Matcher {
+public:
+	void addNode(NodeStub node) {
+		_nodes.push_back(node);
+		std::map<std::string, PublisherStub> pubs = node.getPublishers();
+		for (std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+			for (std::map<std::string, std::string>::iterator subIter = _subs.begin(); subIter != _subs.end(); subIter++) {
+				if (matches(subIter->second, pubIter->second))
+					pairs++;
+			}
+		}
+	}
+
+	void addSubscriber(const std::string& channel, const std::string& uuid) {
+		_subs[uuid] = channel;
+		for (std::list<NodeStub>::iterator nodeIter = _nodes.begin(); nodeIter != _nodes.end(); nodeIter++) {
+			std::map<std::string, PublisherStub> pubs = nodeIter->getPublishers();
+			for (std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+				if (matches(channel, pubIter->second))
+					pairs++;
+			}
+		}
+	}
+
+	void removeSubscriber(const std::string& channel, const std::string& uuid) {
+		for (std::list<NodeStub>::iterator nodeIter = _nodes.begin(); nodeIter != _nodes.end(); nodeIter++) {
+			std::map<std::string, PublisherStub> pubs = nodeIter->getPublishers();
+			for (std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+				if (matches(channel, pubIter->second))
+					pairs--;
+			}
+		}
+		_subs.erase(uuid);
+	}
+
+protected:
+	std::list<NodeStub> _nodes;
+	std::map<std::string, std::string> _subs;
+};
+
+/// subscribers and publishers by channel as with ZeroMQNode
+class IndexMatcher : public Matcher {
+public:
+	void addNode(NodeStub node) {
+		std::map<std::string, PublisherStub>& pubs = node.getImpl()->getPublishers();
+		for (std::map<std::string, PublisherStub>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+			_pubs.insert(pubIter->second.getChannelName(), pubIter->first, pubIter->second);
+
+			std::vector<std::string> subs;
+			_subs.findPrefixesOf(pubIter->second.getChannelName(), subs);
+			for (std::vector<std::string>::iterator subIter = subs.begin(); subIter != subs.end(); subIter++) {
+				if (matches(*subIter, pubIter->second))
+					pairs++;
+			}
+		}
+	}
+
+	void addSubscriber(const std::string& channel, const std::string& uuid) {
+		_subs.insert(channel, uuid, channel);
+		std::vector<PublisherStub> pubs;
+		_pubs.findStartingWith(channel, pubs);
+		for (std::vector<PublisherStub>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+			if (matches(channel, *pubIter))
+				pairs++;
+		}
+	}
+
+	void removeSubscriber(const std::string& channel, const std::string& uuid) {
+		std::vector<PublisherStub> pubs;
+		_pubs.findStartingWith(channel, pubs);
+		for (std::vector<PublisherStub>::iterator pubIter = pubs.begin(); pubIter != pubs.end(); pubIter++) {
+			if (matches(channel, *pubIter))
+				pairs--;
+		}
+		_subs.erase(channel, uuid);
+	}
+
+protected:
+	ChannelIndex<std::string> _subs;
+	ChannelIndex<PublisherStub> _pubs;
+};
+
+void run(const std::string& mode, Matcher& matcher, const std::vector<NodeStub>& nodes, const std::vector<std::pair<std::string, std::string> >& subs) {
+	for (size_t i = 0; i < subs.size(); i++)
+		matcher.addSubscriber(subs[i].first, subs[i].second);
+
+	// nodes come up one after the other until every subscriber has all its publishers
+	uint64_t start = Thread::getTimeStampUs();
+	for (size_t i = 0; i < nodes.size(); i++)
+		matcher.addNode(nodes[i]);
+	uint64_t startup = Thread::getTimeStampUs() - start;
+	size_t pairs = matcher.pairs;
+
+	// and all subscribers leave and come back
+	start = Thread::getTimeStampUs();
+	for (size_t i = 0; i < subs.size(); i++)
+		matcher.removeSubscriber(subs[i].first, subs[i].second);
+	for (size_t i = 0; i < subs.size(); i++)
+		matcher.addSubscriber(subs[i].first, subs[i].second);
+	uint64_t churn = Thread::getTimeStampUs() - start;
+
+	std::cout << FORMAT_COL << mode;
+	std::cout << FORMAT_COL << pairs;
+	std::cout << FORMAT_COL << (double)startup / 1000;
+	std::cout << FORMAT_COL << (double)churn / 1000;
+	std::cout << (matcher.pairs == pairs ? "" : " (pairs lost during churn)");
+	std::cout << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int option;
+	while ((option = getopt(argc, argv, "n:p:s:")) != -1) {
+		switch(option) {
+		case 'n':
+			nrNodes = strTo<size_t>(optarg);
+			break;
+		case 'p':
+			nrPubsPerNode = strTo<size_t>(optarg);
+			break;
+		case 's':
+			nrSubscribers = strTo<size_t>(optarg);
+			break;
+		default:
+			printUsageAndExit();
+			break;
+		}
+	}
+
+	if (nrNodes == 0 || nrPubsPerNode == 0)
+		printUsageAndExit();
+
+	// every node publishes its own sensors
+	std::vector<NodeStub> nodes;
+	for (size_t i = 0; i < nrNodes; i++) {
+		NodeStub node(SharedPtr<NodeStubImpl>(new NodeStubImpl()));
+		for (size_t j = 0; j < nrPubsPerNode; j++) {
+			SharedPtr<PublisherStubImpl> pubImpl(new PublisherStubImpl());
+			pubImpl->setChannelName("sensors.node" + toStr(i) + ".sensor" + toStr(j));
+			node.addPublisher(PublisherStub(pubImpl));
+		}
+		nodes.push_back(node);
+	}
+
+	// subscribers for single sensors, all sensors of a node and everything
+	std::vector<std::pair<std::string, std::string> > subs;
+	for (size_t i = 0; i < nrSubscribers; i++) {
+		std::string channel;
+		switch (i % 3) {
+		case 0:
+			channel = "sensors.node" + toStr(i % nrNodes) + ".sensor" + toStr(i % nrPubsPerNode);
+			break;
+		case 1:
+			channel = "sensors.node" + toStr(i % nrNodes) + ".";
+			break;
+		default:
+			channel = (i % 30 == 2 ? "sensors." : "actuators.node" + toStr(i % nrNodes));
+			break;
+		}
+		subs.push_back(std::make_pair(channel, UUID::getUUID()));
+	}
+
+	std::cout << nrNodes << " nodes with " << nrPubsPerNode << " publishers each, " << nrSubscribers << " subscribers" << std::endl;
+	std::cout << FORMAT_COL << "mode" << FORMAT_COL << "pairs" << FORMAT_COL << "startup ms" << FORMAT_COL << "churn ms";
+	std::cout << std::endl;
+
+	ScanMatcher scan;
+	run("scan", scan, nodes, subs);
+	IndexMatcher index;
+	run("index", index, nodes, subs);
+
+	return EXIT_SUCCESS;
+}
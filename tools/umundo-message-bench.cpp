@@ -0,0 +1,127 @@
+/**
+ *  Copyright (C) 2016  Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ */
+
+#include "umundo/config.h"
+#include "umundo.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+
+#ifdef WIN32
+#include "XGetopt.h"
+#endif
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+#define FORMAT_COL std::setw(14) << std::left
+
+using namespace umundo;
+
+size_t iterations = 1000000;
+size_t payloadSize = 100;
+size_t userFields = 2;
+
+void printUsageAndExit() {
+	printf("umundo-message-bench version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
+	printf("Usage\n");
+	printf("\tumundo-message-bench [-n N] [-m N] [-k N]\n");
+	printf("\n");
+	printf("Options\n");
+	printf("\t-n <number>         : messages to encode and decode (defaults to 1000000)\n");
+	printf("\t-m <number>         : payload size (defaults to 100)\n");
+	printf("\t-k <number>         : meta fields besides the um.* ones (defaults to 2)\n");
+	exit(1);
+}
+
+void report(const std::string& label, uint64_t ms) {
+	std::cout << FORMAT_COL << label;
+	std::cout << FORMAT_COL << std::setprecision(4) << ((double)ms * 1000 * 1000) / iterations;
+	std::cout << std::endl;
+}
+
+int main(int argc, char** argv) {
+	int option;
+	while ((option = getopt(argc, argv, "n:m:k:")) != -1) {
+		switch(option) {
+		case 'n':
+			iterations = strTo<size_t>(optarg);
+			break;
+		case 'm':
+			payloadSize = strTo<size_t>(optarg);
+			break;
+		case 'k':
+			userFields = strTo<size_t>(optarg);
+			break;
+		default:
+			printUsageAndExit();
+			break;
+		}
+	}
+
+	if (iterations == 0)
+		printUsageAndExit();
+
+	std::string payload(payloadSize, 'x');
+	std::string pubUUID = UUID::getUUID();
+	std::string procUUID = UUID::getUUID();
+	std::string hostUUID = UUID::getUUID();
+	std::string channel = "bench";
+
+	std::vector<std::string> userKeys;
+	for (size_t i = 0; i < userFields; i++)
+		userKeys.push_back("user.field" + toStr(i));
+
+	std::string encoded;
+	size_t checksum = 0;
+
+	// as the publisher does per message
+	uint64_t start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < iterations; i++) {
+		Message msg(payload.data(), payload.size());
+		for (size_t j = 0; j < userKeys.size(); j++)
+			msg.putMeta(userKeys[j], "value");
+		msg.putMeta("um.pub", pubUUID);
+		msg.putMeta("um.proc", procUUID);
+		msg.putMeta("um.host", hostUUID);
+
+		size_t size = msg.getHeaderDataSize(Message::UM_MSG_VERSION_02);
+		if (encoded.size() < size)
+			encoded.resize(size);
+		msg.writeHeaders(&encoded[0], size, Message::UM_MSG_VERSION_02);
+		checksum += size;
+	}
+	uint64_t encodeMs = Thread::getTimeStampMs() - start;
+
+	// as the subscriber does per message
+	start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < iterations; i++) {
+		Message msg(payload.data(), payload.size());
+		msg.setRawHeaders(encoded.data(), encoded.size(), Message::UM_MSG_VERSION_02, NULL, NULL);
+		msg.putMeta("um.channel", channel);
+		checksum += msg.getMeta("um.pub").size();
+		for (size_t j = 0; j < userKeys.size(); j++)
+			checksum += msg.getMeta(userKeys[j]).size();
+	}
+	uint64_t decodeMs = Thread::getTimeStampMs() - start;
+
+	std::cout << FORMAT_COL << "" << FORMAT_COL << "ns/msg" << std::endl;
+	report("encode", encodeMs);
+	report("decode", decodeMs);
+
+	return (checksum > 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
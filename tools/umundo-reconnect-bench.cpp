@@ -0,0 +1,194 @@
+/**
+ *  Copyright (C) 2016  Stefan Radomski (stefan.radomski@cs.tu-darmstadt.de)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the FreeBSD license as published by the FreeBSD
+ *  project.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ *  You should have received a copy of the FreeBSD license along with this
+ *  program. If not, see <http://www.opensource.org/licenses/bsd-license>.
+ */
+
+#include "umundo/config.h"
+#include "umundo.h"
+
+#include <iostream>
+#include <iomanip>
+
+#ifdef WIN32
+#include "XGetopt.h"
+#endif
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+#define FORMAT_COL std::setw(14) << std::left
+#define TIMEOUT_MS 60000
+
+using namespace umundo;
+
+size_t nrNodes = 50;
+size_t nrPubs = 2000;
+size_t nrChanges = 20;
+size_t nrStorms = 5;
+
+void printUsageAndExit() {
+	printf("umundo-reconnect-bench version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
+	printf("Usage\n");
+	printf("\tumundo-reconnect-bench [-n N] [-p N] [-c N] [-r N]\n");
+	printf("\n");
+	printf("Options\n");
+	printf("\t-n <number>         : nodes reconnecting at once (defaults to 50)\n");
+	printf("\t-p <number>         : publishers of the node they reconnect to (defaults to 2000)\n");
+	printf("\t-c <number>         : publishers replaced while they are gone (defaults to 20)\n");
+	printf("\t-r <number>         : reconnect storms (defaults to 5)\n");
+	exit(1);
+}
+
+/// the publishers a node currently knows of
+class PubCounter : public ResultSet<PublisherStub> {
+public:
+	void added(PublisherStub pub) {
+		RScopeLock lock(_mutex);
+		_pubs.insert(pub.getUUID());
+	}
+	void removed(PublisherStub pub) {
+		RScopeLock lock(_mutex);
+		_pubs.erase(pub.getUUID());
+	}
+	void changed(PublisherStub pub, uint64_t what) {
+	}
+	size_t size() {
+		RScopeLock lock(_mutex);
+		return _pubs.size();
+	}
+
+	RMutex _mutex;
+	std::set<std::string> _pubs;
+};
+
+/// milliseconds until every counter has the given number of publishers or 0 on timeout
+uint64_t waitForPubs(std::vector<PubCounter*>& counters, size_t nrExpected, uint64_t start) {
+	for (;;) {
+		size_t done = 0;
+		for (size_t i = 0; i < counters.size(); i++) {
+			if (counters[i]->size() == nrExpected)
+				done++;
+		}
+		uint64_t now = Thread::getTimeStampMs();
+		if (done == counters.size())
+			return (now - start > 0 ? now - start : 1);
+		if (now - start > TIMEOUT_MS)
+			return 0;
+		Thread::sleepMs(5);
+	}
+}
+
+void printResult(const std::string& mode, const std::string& phase, uint64_t ms) {
+	std::cout << FORMAT_COL << mode << FORMAT_COL << phase;
+	if (ms > 0) {
+		std::cout << FORMAT_COL << ms;
+	} else {
+		std::cout << FORMAT_COL << "timeout";
+	}
+	std::cout << std::endl;
+}
+
+/**
+ * Many nodes connected to one with a lot of publishers lose it at once and come
+ * back while some of its publishers changed. Without any history, every one of
+ * them is sent all the publishers again.
+ */
+void run(const std::string& mode, size_t history) {
+	NodeConfig config;
+	config.setPublisherHistory(history);
+	Node server(&config);
+
+	std::vector<Node> nodes;
+	std::vector<PubCounter*> counters;
+	for (size_t i = 0; i < nrNodes; i++) {
+		Node node;
+		PubCounter* counter = new PubCounter();
+		node.addPublisherMonitor(counter);
+		node.add(server);
+		nodes.push_back(node);
+		counters.push_back(counter);
+	}
+
+	// publishers come up while everyone is connected
+	std::vector<Publisher> pubs;
+	uint64_t start = Thread::getTimeStampMs();
+	for (size_t i = 0; i < nrPubs; i++) {
+		Publisher pub("reconnect.bench." + toStr(i));
+		server.addPublisher(pub);
+		pubs.push_back(pub);
+	}
+	printResult(mode, "announce", waitForPubs(counters, nrPubs, start));
+
+	size_t nextChannel = nrPubs;
+	for (size_t storm = 0; storm < nrStorms; storm++) {
+		for (size_t i = 0; i < nodes.size(); i++)
+			nodes[i].remove(server);
+		waitForPubs(counters, 0, Thread::getTimeStampMs());
+
+		// the node changed a bit while the others were gone
+		for (size_t i = 0; i < nrChanges && i < pubs.size(); i++) {
+			server.removePublisher(pubs[i]);
+			pubs[i] = Publisher("reconnect.bench." + toStr(nextChannel++));
+			server.addPublisher(pubs[i]);
+		}
+
+		start = Thread::getTimeStampMs();
+		for (size_t i = 0; i < nodes.size(); i++)
+			nodes[i].add(server);
+		printResult(mode, "storm " + toStr(storm + 1), waitForPubs(counters, nrPubs, start));
+	}
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		nodes[i].remove(server);
+		nodes[i].clearPublisherMonitors();
+		delete counters[i];
+	}
+	for (size_t i = 0; i < pubs.size(); i++)
+		server.removePublisher(pubs[i]);
+}
+
+int main(int argc, char** argv) {
+	int option;
+	while ((option = getopt(argc, argv, "n:p:c:r:")) != -1) {
+		switch(option) {
+		case 'n':
+			nrNodes = strTo<size_t>(optarg);
+			break;
+		case 'p':
+			nrPubs = strTo<size_t>(optarg);
+			break;
+		case 'c':
+			nrChanges = strTo<size_t>(optarg);
+			break;
+		case 'r':
+			nrStorms = strTo<size_t>(optarg);
+			break;
+		default:
+			printUsageAndExit();
+			break;
+		}
+	}
+
+	if (nrNodes == 0 || nrPubs == 0)
+		printUsageAndExit();
+
+	std::cout << nrNodes << " nodes reconnecting to one with " << nrPubs << " publishers, " << nrChanges << " replaced in between" << std::endl;
+	std::cout << FORMAT_COL << "mode" << FORMAT_COL << "phase" << FORMAT_COL << "ms";
+	std::cout << std::endl;
+
+	run("full", 0);
+	run("diff", nrChanges * 2);
+
+	return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <algorithm>    // std::max
 #include <fstream>      // std::fstream
+#include <ctime>        // clock
 
 #ifdef WIN32
 #include <windows.h>
@@ -69,6 +70,8 @@ size_t waitForSubs = 0;
 size_t packetsWritten = 0;
 PubType type = PUB_TCP;
 bool useZeroCopy = false;
+size_t batchSize = 1;
+clock_t cpuAtLastReport = 0;
 uint64_t bytesTotal = 0;
 uint64_t bytesWritten = 0;
 double intervalFactor = 1;
@@ -82,6 +85,7 @@ std::string streamData;
 std::string compressionType = "";
 int compressionLevel = -1;
 bool compressionWithState = false;
+bool compressionAdaptive = false;
 int compressionRefreshInterval = 0;
 double compressionActualRatio = 100;
 
@@ -188,8 +192,8 @@ class ThroughputReceiver : public Receiver {
 
 		lastSeqNr = currSeqNr;
 
-        compressRatioHead    += (msg->getMeta().find("um.compressRatio.head") != msg->getMeta().end() ? strTo<double>(msg->getMeta("um.compressRatio.head")) : 100);
-        compressRatioPayload += (msg->getMeta().find("um.compressRatio.payload") != msg->getMeta().end() ? strTo<double>(msg->getMeta("um.compressRatio.payload")) : 100);
+        compressRatioHead    += (msg->hasMeta("um.compressRatio.head") ? strTo<double>(msg->getMeta("um.compressRatio.head")) : 100);
+        compressRatioPayload += (msg->hasMeta("um.compressRatio.payload") ? strTo<double>(msg->getMeta("um.compressRatio.payload")) : 100);
         
 //        if (timeStampServerLast == 0)
 //            timeStampServerLast = currServerTimeStamp;
@@ -297,8 +301,8 @@ class ThroughputGreeter : public Greeter {
 void printUsageAndExit() {
 	printf("umundo-throughput version " UMUNDO_VERSION " (" UMUNDO_PLATFORM_ID " " CMAKE_BUILD_TYPE " build)\n");
 	printf("Usage\n");
-	printf("\tumundo-throughput -s|-c [-r BYTES/s] [-l N] [-m N] [-w N] [-d N] [-e N]\n");
-	printf("\t                  [-(x,y) fastlz|miniz|lz4[:level[:refresh]]] [-f (FILE|size:comp)] [-o PREFIX]\n");
+	printf("\tumundo-throughput -s|-c [-r BYTES/s] [-l N] [-m N] [-b N] [-w N] [-d N] [-e N]\n");
+	printf("\t                  [-(x,y) lz4|lz4hc|miniz|zstd[:level[:refresh]] [-a]] [-f (FILE|size:comp)] [-o PREFIX]\n");
 	printf("\n");
 	printf("Options\n");
 	printf("\t-c                  : act as a client\n");
@@ -307,13 +311,15 @@ void printUsageAndExit() {
 	printf("\t-t [rtp|tcp|mcast]  : type of publisher to measure throughput\n");
 	printf("\t-d                  : duration in second to keep server running\n");
 	printf("\t-o PREFIX           : after duration elapsed, write report files\n");
-	printf("\t-z                  : employ zero-copy (experimental)\n");
+	printf("\t-z                  : do not copy payloads from/to 0MQ (tcp only)\n");
 	printf("\t-i                  : report interval in milli-seconds\n");
 	printf("\t-l                  : acceptable packet loss in percent\n");
-    printf("\t-x ALG:LVL          : use compression algorithm (fastlz|miniz|lz4)\n");
+    printf("\t-x ALG:LVL          : use compression algorithm (lz4|lz4hc|miniz|zstd)\n");
     printf("\t-y ALG:LVL:RFRSH    : use compression with state and refresh at intervals given in ms\n");
+	printf("\t-a                  : skip compression for payloads where it does not pay off\n");
     printf("\t-f (FILE|size:comp) : stream data from file or use synthetic data with given compressibility\n");
 	printf("\t-m <number>         : MTU to use on server (defaults to 1280)\n");
+	printf("\t-b <number>         : send messages in batches of given size (e.g. -m 64 -b 64)\n");
 	printf("\t-w <number>         : wait for given number of subscribers\n");
 	printf("\t-e <number>         : after duration elapsed wait for pending reports\n");
 	exit(1);
@@ -393,7 +399,9 @@ void runAsClient() {
 	reporter = Publisher("reports");
 	reporter.setGreeter(&discGreeter);
 
-	Subscriber tcpSub("throughput.tcp");
+	SubscriberConfigTCP tcpConfig("throughput.tcp");
+	tcpConfig.enableZeroCopy(useZeroCopy);
+	Subscriber tcpSub(&tcpConfig);
 	tcpSub.setReceiver(&tpRcvr);
 
 	SubscriberConfigMCast mcastConfig("throughput.mcast");
@@ -447,6 +455,7 @@ void writeReports(std::string scale) {
 	std::cout << FORMAT_COL << "pkts sent";
 	std::cout << FORMAT_COL << "sleep";
 	std::cout << FORMAT_COL << "scale";
+	std::cout << FORMAT_COL << "cpu/GB";
 	switch (type) {
 	case PUB_RTP: {
 		std::cout << FORMAT_COL << "[RTP]";
@@ -470,6 +479,17 @@ void writeReports(std::string scale) {
 	std::cout << FORMAT_COL << timeToDisplay(delay * 1000);
 	std::cout << FORMAT_COL << scale;
 
+	// process cpu time spent per GB sent in this interval
+	clock_t cpuNow = clock();
+	if (bytesWritten > 0) {
+		double cpuSecs = (double)(cpuNow - cpuAtLastReport) / CLOCKS_PER_SEC;
+		double gbWritten = (double)bytesWritten / (double)(1024 * 1024 * 1024);
+		std::cout << FORMAT_COL << timeToDisplay(1000 * 1000 * 1000 * (cpuSecs / gbWritten));
+	} else {
+		std::cout << FORMAT_COL << "N/A";
+	}
+	cpuAtLastReport = cpuNow;
+
 	std::cout << FORMAT_COL << "---";
 	std::cout << std::endl;
 
@@ -545,11 +565,15 @@ void runAsServer() {
 	}
 	case PUB_TCP: {
 		config = new PublisherConfigTCP ("throughput.tcp");
+		((PublisherConfigTCP*)config)->enableZeroCopy(useZeroCopy);
 		break;
 	}
 	}
-	if (compressionType.size() != 0)
+	if (compressionType.size() != 0) {
 		config->enableCompression(compressionType, compressionWithState, compressionLevel, compressionRefreshInterval);
+		if (compressionAdaptive)
+			config->enableAdaptiveCompression();
+	}
 
 	pub = Publisher(config);
 	pub.setGreeter(&tpGreeter);
@@ -621,11 +645,13 @@ void runAsServer() {
 
     uint64_t lastReportAt = Thread::getTimeStampMs();
     size_t streamDataOffset = 0;
+    std::vector<Message*> batch;
+    cpuAtLastReport = clock();
 
 	while(1) {
         
         // fill data from stream data
-        Message* msg = new Message((char*)malloc(mtu), mtu);
+        Message* msg = new Message((char*)malloc(mtu), mtu, Message::ADOPT_DATA);
 
         size_t msgDataOffset = 0;
         while(true) {
@@ -664,7 +690,19 @@ void runAsServer() {
 		}
 
 		// sending with compression will alter msg->size(); not anymore ...
-		pub.send(msg);
+		bool sent = true;
+		if (batchSize > 1) {
+			batch.push_back(msg);
+			sent = (batch.size() >= batchSize);
+			if (sent) {
+				pub.sendBatch(batch);
+				for (std::vector<Message*>::iterator msgIter = batch.begin(); msgIter != batch.end(); msgIter++)
+					delete(*msgIter);
+				batch.clear();
+			}
+		} else {
+			pub.send(msg);
+		}
 
 		// every report interval we are recalculating bandwith
 		if (now - lastReportAt > reportInterval) {
@@ -736,11 +774,12 @@ void runAsServer() {
 			lastReportAt = Thread::getTimeStampMs();
 		}
 
-        delete(msg);
+		if (batchSize <= 1)
+			delete(msg);
 
-		// now we sleep until we have to send another packet
-		if (delay > 50 && fixedBytesPerSecond != (size_t) - 1)
-			Thread::sleepUs(delay);
+		// now we sleep until we have to send another packet or batch
+		if (sent && delay > 50 && fixedBytesPerSecond != (size_t) - 1)
+			Thread::sleepUs(delay * batchSize);
 	}
 
 	pub.setGreeter(NULL);
@@ -749,11 +788,14 @@ void runAsServer() {
 int main(int argc, char** argv) {
 	int option;
     streamFile = argv[0]; // default
-	while ((option = getopt(argc, argv, "zcsm:w:l:r:f:t:i:o:d:x:y:e:")) != -1) {
+	while ((option = getopt(argc, argv, "azcsm:b:w:l:r:f:t:i:o:d:x:y:e:")) != -1) {
 		switch(option) {
 		case 'z':
 			useZeroCopy = true;
 			break;
+		case 'a':
+			compressionAdaptive = true;
+			break;
         case 'y':
                 compressionWithState = true;
                 // fall through
@@ -820,6 +862,9 @@ int main(int argc, char** argv) {
 		case 'm':
 			mtu = displayToBytes(optarg);
 			break;
+		case 'b':
+			batchSize = atoi((const char*)optarg);
+			break;
 		case 'e':
 			waitToConclude = strTo<uint64_t>(optarg);
 			break;